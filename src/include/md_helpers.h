@@ -9,6 +9,8 @@
 #include <random>
 #include <functional>
 #include <map>
+#include <vector>
+#include <cstdint>
 
 #include "dll_defines.h"
 
@@ -20,6 +22,42 @@ MOLDINAM_EXPORT std::istream& operator>>( std::istream&,  Molecule& );
 MOLDINAM_EXPORT std::ostream& operator<<( std::ostream&, const Molecule_Type );
 MOLDINAM_EXPORT std::istream& operator>>( std::istream&,  Molecule_Type& );
 
+// Byte ranges of frames of a trace_write file. Kept in a sidecar file
+// <trace>.idx next to the trace, rebuilt when trace size or modification time changes.
+class MOLDINAM_EXPORT trace_index {
+public:
+    trace_index();
+
+    // loads sidecar if it matches the trace, otherwise builds index and
+    // tries to save sidecar, read-only directories keep index in memory only
+    static trace_index open( std::string trace_path );
+
+    // scans trace once, chunks of chunk_size bytes are scanned in parallel;
+    // frames of unfinished traces are counted up to the last complete one
+    static trace_index build( std::string trace_path, uint64_t chunk_size = 64 << 20 );
+
+    // false if sidecar is missing, corrupted or made for another version of the trace
+    bool load( std::string index_path, uint64_t trace_size, uint64_t trace_mtime );
+    // returns false if sidecar cannot be written
+    bool save( std::string index_path ) const;
+
+    static std::string sidecar_path( std::string trace_path ) { return trace_path + ".idx"; }
+
+    size_t frames() const { return frame_begin.size(); }
+    size_t molecules() const { return molecules_num; }
+
+    // first molecule line of the frame and end of its last line
+    uint64_t begin( size_t frame ) const { return frame_begin.at( frame ); }
+    uint64_t end( size_t frame ) const { return frame_end.at( frame ); }
+
+private:
+    size_t molecules_num;
+    uint64_t file_size;
+    uint64_t file_mtime;
+    std::vector<uint64_t> frame_begin;
+    std::vector<uint64_t> frame_end;
+};
+
 class MOLDINAM_EXPORT trace_read {
 public:
 
@@ -27,6 +65,7 @@ public:
                  // this is temporary solution, must be fixed later   
     trace_read();
     trace_read( std::string filepath );
+    // uses frame index, see trace_index::open()
     void open( std::string filepath );
 
     // reset file to beginning and read initial molecules state
@@ -37,13 +76,19 @@ public:
     // read final state of molecules, reset file to the end
     std::vector<Molecule> final();
 
+    // read frame, next() continues after it
+    std::vector<Molecule> seek( size_t frame );
+
+    size_t frames() const { return total_steps; }
+
     void close();
 
 private:
 
-    size_t read_total_steps();
+    std::vector<Molecule> read_frame( size_t frame );
 
     std::ifstream file;
+    trace_index index;
     size_t molecules_num;
     size_t steps;
     size_t total_steps;
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <platforms/tbb/tbb_platform.hpp>
+#include <platforms/opencl/opencl_helpers.hpp>
+#include <platforms/opencl/kernels.hpp>
+
+// CPU + OpenCL co-execution.
+// Particles are stored on host, target particles of each force pass are
+// split between TBB workers [0, split) and OpenCL device [split, N).
+// Device gets all positions, computed forces are merged into host accel
+// before integration. Split ratio is tuned from measured times of both parts.
+class HybridParticleSystem : public TBBParticleSystem {
+public:
+    HybridParticleSystem();
+    explicit HybridParticleSystem(ParticleSystemConfig conf);
+
+    using TBBParticleSystem::applyLennardJonesInteraction;
+    virtual void applyLennardJonesInteraction();
+
+    // fraction of target particles computed on CPU
+    double cpuRatio() const { return m_cpu_ratio; }
+    void setCpuRatio(double ratio);
+
+    // disable to keep cpu ratio fixed
+    void setAutoTune(bool enable) { m_auto_tune = enable; }
+
+protected:
+    void tune(size_t cpu_num, double cpu_time, size_t device_num, double device_time);
+
+    double m_cpu_ratio;
+    bool m_auto_tune;
+
+    cl::float3vec m_device_pos;
+    cl::float3vec m_device_force;
+    md::float3vec m_force;
+
+    LennardJonesRangeKernel m_kernel;
+};
@@ -26,6 +26,11 @@ public:
     virtual void loadParticles(ParticleIStreamPtr is, size_t num);
     virtual void loadParticles(ParticleIStreamPtr is);
     virtual void storeParticles(ParticleOStreamPtr os);
+    virtual void snapshot(ParticleFrame& frame);
+    virtual Observables observe();
+
+    virtual void saveState(ParticleState& state);
+    virtual void restoreState(const ParticleState& state);
 
     virtual void applyPeriodicConditions();
     virtual void applyVerletIntegration();
@@ -73,8 +78,6 @@ protected:
     float3vec m_pos_prev;
     float3vec m_vel;
     float3vec m_accel;
-
-    LennardJonesConfig m_lj_config;
 };
 
 namespace md {
@@ -4,9 +4,31 @@
 #include <vector>
 #include <sstream>
 
+#include <utils/aligned_allocator.hpp>
+
 namespace md {
     typedef glm::vec3 float3;
-    typedef std::vector<float3> float3vec;
+
+    // float3 padded to 16 bytes, the layout of cl_float3 and OpenCL float3.
+    // Particle arrays of native and OpenCL systems share it, so they are
+    // copied between host and device memory as they are.
+    struct alignas(16) float3a : public float3 {
+        float3a() {}
+        float3a(const float3& v) : float3(v) {}
+        float3a(float x, float y, float z) : float3(x, y, z) {}
+        explicit float3a(float s) : float3(s) {}
+
+        float3a& operator=(const float3& v)
+        {
+            float3::operator=(v);
+            return *this;
+        }
+    };
+
+    static_assert(sizeof(float3a) == 4 * sizeof(float), "float3a is padded to 16 bytes");
+
+    // particle data, page aligned so OpenCL buffers can use it in place
+    typedef std::vector<float3a, aligned_allocator<float3a> > float3vec;
 
     using glm::floor;
     using glm::distance;
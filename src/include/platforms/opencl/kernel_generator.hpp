@@ -0,0 +1,83 @@
+#ifndef __OPENCL_KERNEL_GENERATOR_HPP
+#define __OPENCL_KERNEL_GENERATOR_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <utils/config/particle_system_config.hpp>
+#include <utils/config/opencl_config.hpp>
+#include <utils/config/lennard_jones_config.hpp>
+
+// Structure of a generated kernel. Anything that changes code goes here,
+// numeric constants (LJ constants, dt, area) are passed as build options,
+// so one source serves all runs of the same kind.
+struct KernelSpec {
+    KernelSpec();
+
+    // spec of a step of given system configuration
+    static KernelSpec FromConfig(const ParticleSystemConfig& conf, const OpenCLConfig& ocl_conf);
+
+    // unique name of the variant, e.g. "verlet.lennard_jones.periodic.cutoff.single.energy.s1.tiled"
+    std::string key() const;
+
+    // "verlet" or "euler"
+    std::string integrator;
+    // "lennard_jones"
+    std::string potential;
+    // minimum image distances and wrapped positions
+    bool periodic;
+    bool cutoff;
+    // accumulation type, "single" or "double"
+    std::string precision;
+    // per particle potential energy output
+    bool energy;
+    // number of particle species, pair parameters come from a table if more than one
+    size_t species;
+    // positions staged in local memory tiles, see WG_SIZE and TILE_SIZE options
+    bool tiled;
+};
+
+// Emits fused force + integration kernel `FusedStep` for a KernelSpec.
+// Every variant is generated once per process, built programs are cached
+// by OpenCLProgramCache as usual.
+//
+// Arguments of FusedStep in order:
+//   __global const float3* pos, __global float3* pos_prev (next positions are written here),
+//   __global float3* accel,
+//   __global const float3* vel                      - euler only
+//   __global float* energy                          - energy only
+//   __global const uint* species,
+//   __constant float4* pair_coeffs                  - species > 1 only,
+//                                                     (eps, sigma^6, sigma^12, cutoff^2) per species pair
+//   uint num_particles
+class KernelGenerator {
+public:
+    static KernelGenerator& Instance()
+    {
+        static KernelGenerator self;
+        return self;
+    }
+
+    // cached, throws std::runtime_error for unsupported spec
+    const std::string& source(const KernelSpec& spec);
+
+    // -D constants used by generated source
+    static std::string buildOptions(const KernelSpec& spec, const ParticleSystemConfig& conf,
+                                    const LennardJonesConstants& lj_constants);
+
+    static std::string generate(const KernelSpec& spec);
+
+    // number of generated variants
+    size_t size();
+
+private:
+    KernelGenerator() {}
+    KernelGenerator(const KernelGenerator&);
+    KernelGenerator& operator=(const KernelGenerator&);
+
+    std::mutex m_mutex;
+    std::map<std::string, std::string> m_sources;
+};
+
+#endif // __OPENCL_KERNEL_GENERATOR_HPP
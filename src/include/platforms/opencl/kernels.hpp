@@ -1,23 +1,68 @@
 #ifndef __OPENCL_KERNELS_HPP
 #define __OPENCL_KERNELS_HPP
 
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <stdexcept>
+#include <vector>
+
+#include <platforms/opencl/opencl_helpers.hpp>
+#include <platforms/opencl/kernel_generator.hpp>
+#include <utils/config/particle_system_config.hpp>
+#include <utils/config/lennard_jones_config.hpp>
+#include <utils/observables.hpp>
 
 class OpenCLParticleSystem;
+class OpenCLDevice;
 
 class OpenCLKernel {
 public:
+    virtual ~OpenCLKernel() {}
+
     virtual void execute() = 0;
 
     virtual std::string get_source() { return m_source; }
 
+    // run on given device instead of the one from OpenCLDispatcher
+    void set_device(std::shared_ptr<OpenCLDevice> device);
+
 protected:
+    // Program comes from OpenCLProgramCache, kernel objects are reused
+    // until build options change, so args can be set for every enqueue
+    cl::Kernel& get_kernel(const char* name, const std::string& build_options = "");
+    cl::CommandQueue& get_queue();
+    const cl::Device& get_device();
+
+    // for kernels with source known only at enqueue, built kernels are dropped on change
+    void set_source(const std::string& source);
+
     std::string m_source;
+
+private:
+    std::shared_ptr<OpenCLDevice> device();
+
+    std::shared_ptr<OpenCLDevice> m_device;
+    std::map<std::string, cl::Kernel> m_kernels;
+    std::string m_kernel_options;
 };
 
+// -D options with LJ constants, cutoff and periodic area, used by all LJ kernels
+std::string lennardJonesBuildOptions(const ParticleSystemConfig& conf, const LennardJonesConstants& lj_constants);
+
+// -DPERIODIC and area size if periodic, empty otherwise,
+// non-periodic kernels are built without any wrapping code
+std::string periodicBuildOptions(const ParticleSystemConfig& conf);
+
+// OpenCL AREA and minimumImage(d) for kernels built with
+// periodicBuildOptions(), prepended to kernel sources
+extern const char* periodic_kernel_source;
+
 class OpenCLParticleSystemKernel : public OpenCLKernel {
 public:
+    OpenCLParticleSystemKernel() : m_sys(NULL) {}
+
     void set_system(OpenCLParticleSystem* sys) { m_sys = sys; }
 protected:
     OpenCLParticleSystem* m_sys;
@@ -29,33 +74,219 @@ public:
     virtual void execute();
 };
 
+// enqueue() functions below are non-blocking and take buffers explicitly,
+// so the same kernel can run on ping-ponged buffers.
+// execute() runs on system buffers and waits for completion.
+//
+// With periodic boundaries new positions are wrapped into [0, area_size) and
+// forces use minimum image distances. As in NativeParticleSystem, the previous
+// position of a wrapped particle is shifted by the same offset, so pos - pos_prev
+// is the real displacement and device state can be continued on any platform.
+
 class VerletIntegrationKernel : public OpenCLParticleSystemKernel {
 public:
     VerletIntegrationKernel();
     virtual void execute();
+
+    // new positions are written to pos_prev, caller swaps buffers
+    cl::Event enqueue(cl::Buffer& pos, cl::Buffer& pos_prev, cl::Buffer& accel,
+                      const std::vector<cl::Event>* wait_list = NULL);
+
+    // no particle system required, periodic boundaries are taken from set_config()
+    cl::Event enqueue(cl::Buffer& pos, cl::Buffer& pos_prev, cl::Buffer& accel, size_t size, float dt,
+                      const std::vector<cl::Event>* wait_list = NULL);
+    void set_config(const ParticleSystemConfig& conf);
+
+private:
+    std::string m_build_options;
 };
 
 class EulerIntegrationKernel : public OpenCLParticleSystemKernel {
 public:
     EulerIntegrationKernel();
     virtual void execute();
+
+    // new positions are written to pos_prev, caller swaps buffers
+    cl::Event enqueue(cl::Buffer& pos, cl::Buffer& pos_prev, cl::Buffer& vel, cl::Buffer& accel,
+                      const std::vector<cl::Event>* wait_list = NULL);
+
+    // no particle system required, periodic boundaries are taken from set_config()
+    cl::Event enqueue(cl::Buffer& pos, cl::Buffer& pos_prev, cl::Buffer& vel, cl::Buffer& accel,
+                      size_t size, float dt, const std::vector<cl::Event>* wait_list = NULL);
+    void set_config(const ParticleSystemConfig& conf);
+
+private:
+    std::string m_build_options;
+};
+
+// Cutoff LJ forces on a uniform grid of cells not smaller than cutoff radius.
+// Every stage runs on device, host only enqueues:
+//   CellCount   - cell of every particle and number of particles per cell
+//   ScanBlocks  - cell start = exclusive prefix sum of counts (multi-level scan)
+//   CellScatter - counting sort by cell: sorted positions and original indices
+//   CellForces  - every particle interacts with particles of adjacent cells,
+//                 result goes to accel of original particle index
+// Particles outside of [0, area_size) are clamped to boundary cells.
+// With periodic boundaries adjacent cells wrap around the grid, dimensions
+// of less than 3 cells are searched whole.
+class CellListLennardJonesKernel : public OpenCLParticleSystemKernel {
+public:
+    CellListLennardJonesKernel();
+    virtual void execute();
+
+    cl::Event enqueue(cl::Buffer& pos, cl::Buffer& accel, const std::vector<cl::Event>* wait_list = NULL);
+
+    // grid of the last enqueue
+    cl_int4 grid() const { return m_grid; }
+
+private:
+    void setup_grid(float cutoff, size_t num_particles);
+    void resize(size_t num_particles, size_t num_cells);
+    cl::Event enqueue_scan(cl::Buffer& data, size_t size, size_t level, const std::string& build_options,
+                           const std::vector<cl::Event>* wait_list);
+
+    cl_int4 m_grid;
+    cl_float4 m_inv_cell_size;
+    size_t m_scan_wg;
+
+    size_t m_num_particles;
+    size_t m_num_cells;
+    cl::Buffer m_cell_of;
+    cl::Buffer m_sorted_pos;
+    cl::Buffer m_sorted_index;
+    cl::Buffer m_cell_count;
+    cl::Buffer m_cell_start;
+    cl::Buffer m_cell_fill;
+    std::vector<cl::Buffer> m_scan_sums;
 };
 
+// Overwrites accel with forces from all other particles.
+// With cutoff enabled cell list pipeline is used unless disabled in OpenCLConfig.
 class LennardJonesInteractionKernel : public OpenCLParticleSystemKernel {
 public:
     LennardJonesInteractionKernel();
     virtual void execute();
+
+    cl::Event enqueue(cl::Buffer& pos, cl::Buffer& accel, const std::vector<cl::Event>* wait_list = NULL);
+
+private:
+    CellListLennardJonesKernel m_cell_list;
+};
+
+// Force and integration of one step in a single kernel generated from KernelSpec,
+// forces never leave registers between the passes. Spec follows the system config
+// unless set explicitly.
+class FusedStepKernel : public OpenCLParticleSystemKernel {
+public:
+    FusedStepKernel();
+
+    // one step on system buffers, swaps pos and pos_prev, blocking
+    virtual void execute();
+
+    void set_spec(const KernelSpec& spec);
+    KernelSpec spec() const;
+
+    // required for spec with more than one species: species index of every particle
+    // and species x species table of float4 (eps, sigma^6, sigma^12, cutoff^2)
+    void set_species(cl::Buffer& species, cl::Buffer& pair_coeffs);
+    // required for spec with energy output, float per particle
+    void set_energy(cl::Buffer& energy);
+
+    // new positions are written to pos_prev, caller swaps buffers,
+    // euler variant reads system velocities; periodic specs wrap both
+    // buffers in a second kernel, the returned event is the last one
+    cl::Event enqueue(cl::Buffer& pos, cl::Buffer& pos_prev, cl::Buffer& accel,
+                      const std::vector<cl::Event>* wait_list = NULL);
+
+private:
+    KernelSpec m_spec;
+    bool m_spec_set;
+
+    cl::Buffer m_species;
+    cl::Buffer m_pair_coeffs;
+    cl::Buffer m_energy;
 };
 
+// Runs Euler step and `iterations` LJ + Verlet steps.
+// All steps are enqueued with event dependencies on ping-ponged
+// pos/pos_prev buffers, host waits only for the last step.
+// LJ + Verlet run as FusedStepKernel if OpenCLConfig fused_kernels is set
+// and cell list pipeline is not used.
 class IterateLJVerlet : public OpenCLParticleSystemKernel
 {
 public:
+    // Called after step `iteration` is enqueued, `pos` and `pos_prev` hold positions of
+    // that step once `step` completes. Commands enqueued to `queue` run before the next step.
+    typedef std::function<void(size_t iteration, cl::CommandQueue& queue, cl::Buffer& pos,
+                               cl::Buffer& pos_prev, const cl::Event& step)> ChunkFn;
+
     IterateLJVerlet();
     virtual void execute();
     void set_iterations(size_t iterations_num) { m_iterations = iterations_num; }
 
+    // fn is called for every iteration multiple of interval
+    void set_chunks(size_t interval, ChunkFn fn);
+
 private:
     size_t m_iterations;
+    size_t m_chunk_interval;
+    ChunkFn m_chunk_fn;
+};
+
+// Observables computed on device: per particle terms of kinetic and potential
+// energy, momentum and virial, then work-group tree reduction to partial sums
+// and a final single work-group pass, so only two float4 values are read back.
+class ObservablesKernel : public OpenCLParticleSystemKernel {
+public:
+    ObservablesKernel();
+
+    // system state, blocking
+    virtual void execute();
+    const Observables& result() const { return m_result; }
+
+    // blocking, queue must belong to the kernel device
+    Observables compute(cl::CommandQueue& queue, cl::Buffer& pos, cl::Buffer& pos_prev, size_t num_particles,
+                        const std::vector<cl::Event>* wait_list = NULL);
+
+private:
+    void resize(size_t num_particles);
+    cl::Event enqueue_reduce(cl::CommandQueue& queue, cl::Buffer& terms, size_t size, size_t sum_index,
+                             const std::string& build_options, const std::vector<cl::Event>* wait_list);
+
+    size_t m_reduce_wg;
+    size_t m_num_particles;
+
+    // per particle (vel, kinetic) and (potential, virial, 0, 0)
+    cl::Buffer m_motion;
+    cl::Buffer m_pair_terms;
+    cl::Buffer m_partial;
+    // two totals, same layout as per particle terms
+    cl::Buffer m_sums;
+
+    Observables m_result;
+};
+
+// Computes forces for target particles [offset, offset + count) from all
+// num_particles particles, force[i] is written for target offset + i.
+// Used when targets are split between devices.
+class LennardJonesRangeKernel : public OpenCLKernel {
+public:
+    LennardJonesRangeKernel();
+
+    void set_args(cl::Buffer& pos, cl::Buffer& force, size_t num_particles, size_t offset, size_t count);
+    void set_constants(const ParticleSystemConfig& conf, const LennardJonesConstants& lj_constants);
+
+    // non-blocking
+    cl::Event enqueue(const std::vector<cl::Event>* wait_list = NULL);
+    virtual void execute();
+
+private:
+    std::string m_build_options;
+    cl::Buffer m_pos;
+    cl::Buffer m_force;
+    size_t m_num_particles;
+    size_t m_offset;
+    size_t m_count;
 };
 
 #endif // __OPENCL_KERNELS_HPP
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <platforms/native/native_platform.hpp>
+#include <platforms/opencl/opencl_helpers.hpp>
+#include <platforms/opencl/opencl_device.hpp>
+#include <platforms/opencl/kernels.hpp>
+#include <utils/config/opencl_config.hpp>
+
+// Runs iterations on several OpenCL devices or sub-devices of one platform,
+// see OpenCLConfig device_* and sub_devices entries.
+// Particles are split into contiguous partitions proportional to compute units,
+// each device integrates its own partition and computes its forces from all positions.
+// After every step own positions are gathered on host and written to all devices.
+// Host state is synchronized only when iteration callbacks are set and after the run.
+class OpenCLMultiDeviceParticleSystem : public NativeParticleSystem {
+public:
+    OpenCLMultiDeviceParticleSystem();
+    explicit OpenCLMultiDeviceParticleSystem(ParticleSystemConfig conf);
+
+    // Global OpenCLConfig is used by default, devices are selected again
+    void setOpenCLConfig(const OpenCLConfig& conf);
+    const OpenCLConfig& openCLConfig() const { return m_opencl_config; }
+
+    virtual void iterate(size_t iterations);
+
+    // selected devices, available before first iterate()
+    size_t devicesNum();
+
+protected:
+    struct Partition {
+        std::shared_ptr<OpenCLDevice> device;
+        size_t compute_units;
+        size_t offset;
+        size_t count;
+
+        // positions of all particles, forces are computed from them
+        cl::Buffer pos_all;
+
+        // own particles only
+        cl::Buffer pos;
+        cl::Buffer pos_prev;
+        cl::Buffer vel;
+        cl::Buffer accel;
+
+        LennardJonesRangeKernel lennard_jones;
+        VerletIntegrationKernel verlet;
+        EulerIntegrationKernel euler;
+    };
+
+    void selectDevices();
+    void createPartitions();
+
+    // own positions of every device to m_staging, blocking,
+    // reads wait for wait_list as m_staging may still be written to devices
+    void gatherPositions(const std::vector<cl::Event>* wait_list = NULL);
+    // m_staging to pos_all of every device, returns write events
+    std::vector<cl::Event> scatterPositions();
+    // all own buffers to host m_pos, m_pos_prev, m_accel
+    void readState();
+
+    OpenCLConfig m_opencl_config;
+
+    cl::Context m_context;
+    std::vector<cl::Device> m_devices;
+    std::vector<Partition> m_parts;
+
+    std::vector<cl_float3> m_staging;
+};
@@ -2,6 +2,8 @@
 #define __OPENCL_DEVICE_HPP
 
 #include "platforms/opencl/opencl_helpers.hpp"
+#include "platforms/opencl/program_cache.hpp"
+#include "platforms/opencl/profiler.hpp"
 #include <unordered_set>
 
 class OpenCLDevice {
@@ -12,17 +14,50 @@ public:
         cl_int err = CL_SUCCESS;
         m_context = OpenCLManager::Instance().getContext().context();
         m_devices = m_context.getInfo<CL_CONTEXT_DEVICES>();
-        m_queue = cl::CommandQueue(m_context, m_devices[0], 0, &err);
+        m_queue = cl::CommandQueue(m_context, m_devices[0], OpenCLProfiler::Instance().queueProperties(), &err);
+    }
+
+    // device of a shared context, e.g. one of multiple devices or sub-devices
+    OpenCLDevice(const cl::Context& context, const cl::Device& device)
+        : m_context(context)
+        , m_devices(1, device)
+        , m_queue(context, device, OpenCLProfiler::Instance().queueProperties())
+    {
     }
 
     cl::CommandQueue& get_queue() { return m_queue; }
+    const cl::Device& get_device() const { return m_devices[0]; }
 
+    // Programs are cached, see OpenCLProgramCache
     cl::Program CreateProgram(std::string source, const char* build_options = NULL)
+    {
+        std::string options = build_options ? build_options : "";
+        return OpenCLProgramCache::Instance().getProgram(m_context, m_devices, source, options, [&]() {
+            return BuildProgram(source, build_options);
+        });
+    }
+
+    cl::Program CreateProgram(std::vector<std::string> sources, const char* build_options = NULL)
+    {
+        std::string joined;
+        for (const std::string& source : sources) {
+            joined += source;
+            joined += '\0';
+        }
+
+        std::string options = build_options ? build_options : "";
+        return OpenCLProgramCache::Instance().getProgram(m_context, m_devices, joined, options, [&]() {
+            return BuildProgram(sources, build_options);
+        });
+    }
+
+protected:
+    cl::Program BuildProgram(const std::string& source, const char* build_options)
     {
         cl::Program::Sources src(1, std::make_pair(source.c_str(), source.length()));
         cl::Program program(m_context, src);
         try {
-            program.build(build_options);
+            program.build(m_devices, build_options);
         } catch (cl::Error& err) {
             std::cout << "program build failed:\n" << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_devices[0]);
             std::cout << std::endl;
@@ -32,13 +67,13 @@ public:
         return program;
     }
 
-    cl::Program CreateProgram(std::vector<std::string> sources, const char* build_options = NULL)
+    cl::Program BuildProgram(const std::vector<std::string>& sources, const char* build_options)
     {
         std::vector<cl::Program> programs;
         cl::Program linked_program;
 
         try {
-            for (std::string source : sources) {
+            for (const std::string& source : sources) {
                 cl::Program::Sources src(1, std::make_pair(source.c_str(), source.length()));
                 programs.emplace_back(m_context, src);
                 programs.back().compile(build_options);
@@ -63,7 +98,12 @@ public:
 
         cl_int error = CL_SUCCESS;
 
-        linked_program = ::clLinkProgram(m_context(), 0, NULL, NULL, compiled_progs.size(),
+        std::vector<cl_device_id> device_ids;
+        for (cl::Device& device : m_devices) {
+            device_ids.push_back(device());
+        }
+
+        linked_program = ::clLinkProgram(m_context(), device_ids.size(), &device_ids[0], NULL, compiled_progs.size(),
                                          &compiled_progs[0], NULL, NULL, &error);
 
         if (error != CL_SUCCESS) {
@@ -73,8 +113,6 @@ public:
         return linked_program;
     }
 
-
-protected:
     cl::Context m_context;
     std::vector<cl::Device> m_devices;
     cl::CommandQueue m_queue;
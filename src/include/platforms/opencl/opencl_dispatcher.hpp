@@ -16,17 +16,17 @@ public:
         return self;
     }
 
+    // Device is selected by OpenCLConfig (see OpenCLContext),
+    // kernels of multi-device systems set their device explicitly
     template<class Kernel>
     DevicePtr getDeviceFor(Kernel& kernel)
     {
-        // TODO Device selection based on heuristic
         return m_device;
     }
 
 private:
     OpenCLDispatcher()
     {
-        // TODO Device selection
         m_device = std::make_shared<OpenCLDevice>(CL_DEVICE_TYPE_ALL);
     }
 
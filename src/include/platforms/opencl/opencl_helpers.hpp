@@ -1,21 +1,35 @@
 #ifndef __OPENCL_HELPERS_HPP
 #define __OPENCL_HELPERS_HPP
 
+#include <algorithm>
+#include <iterator>
 #include <memory>
+#include <vector>
 
 #define __CL_ENABLE_EXCEPTIONS
 #include <opencl.hpp>
 
 #include <platforms/native/types.hpp>
+#include <platforms/opencl/profiler.hpp>
+#include <utils/config/opencl_config.hpp>
 #include <iostream>
 
 class OpenCLContext {
 public:
-    OpenCLContext() : m_context(CL_DEVICE_TYPE_ALL)
-    {
-        // TODO: device selection
-        // TODO: multiple contexts
-    }
+    // device is selected by global OpenCLConfig
+    OpenCLContext();
+    explicit OpenCLContext(const OpenCLConfig& conf);
+
+    // Devices of all platforms matching device_type and device_vendor,
+    // throws std::runtime_error if there are none
+    static std::vector<cl::Device> FindDevices(const OpenCLConfig& conf);
+
+    // FindDevices()[device_index]
+    static cl::Device SelectDevice(const OpenCLConfig& conf);
+
+    // Devices for multi-device execution: device_count devices from device_index,
+    // split into sub-devices if configured
+    static std::vector<cl::Device> SelectDevices(const OpenCLConfig& conf);
 
     template <class T>
     T GetKernel() const
@@ -28,7 +42,13 @@ public:
         return m_context;
     }
 
+    const cl::Device& device() const
+    {
+        return m_device;
+    }
+
 protected:
+    cl::Device m_device;
     cl::Context m_context;
 };
 
@@ -54,7 +74,9 @@ public:
     cl::CommandQueue default_queue;
 
 private:
-    OpenCLManager() : default_queue(default_context.context())
+    OpenCLManager()
+        : default_queue(default_context.context(), default_context.device(),
+                        OpenCLProfiler::Instance().queueProperties())
     {
     }
 };
@@ -72,7 +94,7 @@ namespace cl {
 
     template <>
     struct cl_type_traits<cl_float3> {
-        typedef md::float3 native_type;
+        typedef md::float3a native_type;
         typedef cl_float3 cl_type;
     };
 
@@ -81,6 +103,11 @@ namespace cl {
         typedef cl_float3 cl_type;
     };
 
+    template <>
+    struct cl_type_traits<md::float3a> {
+        typedef cl_float3 cl_type;
+    };
+
     template <typename T>
     using cl_native_type_t = typename cl_type_traits<T>::native_type;
 
@@ -93,131 +120,65 @@ namespace cl {
     template <typename T, typename CLType>
     T convert_to(const CLType& rhs);
 
-    /**
-    * Blocking copy operation between iterators and a buffer.
-    * Performs conversions to apropriate type before copy using cl_type_traits.
-    * Host to Device.
-    * Uses specified queue.
-    */
-    template< typename IteratorType >
-    inline cl_int conv_copy( const CommandQueue &queue, IteratorType startIterator, IteratorType endIterator, cl::Buffer &buffer )
-    {
-        typedef typename std::iterator_traits<IteratorType>::value_type iter_data_type;
-        typedef cl_type_t<iter_data_type> data_type;
-
-        cl_int error;
-
-        ::size_t length = endIterator-startIterator;
-        ::size_t byteLength = length*sizeof(data_type);
-
-        data_type* pointer = 
-            static_cast<data_type*>(queue.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_WRITE, 0, byteLength, 0, 0, &error));
-        // if exceptions enabled, enqueueMapBuffer will throw
-        if( error != CL_SUCCESS ) {
-            return error;
-        }
-
-        // perform copy with convertion
-        data_type* dest = pointer;
-        while (startIterator != endIterator) {
-            *dest++ = convert_to_cl(*startIterator++);
-        }
-
-        Event endEvent;
-        error = queue.enqueueUnmapMemObject(buffer, pointer, 0, &endEvent);
-        // if exceptions enabled, enqueueUnmapMemObject will throw
-        if( error != CL_SUCCESS ) { 
-            return error;
-        }
-        endEvent.wait();
-        return CL_SUCCESS;
-    }
+    // Flags of raw cl::Buffers (multi-device partitions, frame staging, observables sums):
+    // they are allocated in host accessible memory, so mapping them on CPU runtimes and
+    // integrated devices does not copy data. cl::vector always uses CL_MEM_USE_HOST_PTR.
+    static const cl_mem_flags default_mem_flags = CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR;
 
     /**
-    * Blocking copy operation between iterators and a buffer.
-    * Performs conversions to apropriate type before copy using cl_type_traits.
-    * Device to Host.
-    * Uses specified queue.
+    * Buffer of T over page aligned host memory of native elements with the same
+    * layout (md::float3vec for cl_float3). The buffer is created with
+    * CL_MEM_USE_HOST_PTR in place of host pointer flags of mem_flags, map()
+    * returns that memory, so CPU runtimes and integrated devices never copy it.
+    * Host memory is released together with the buffer.
     */
-    template< typename IteratorType >
-    inline cl_int conv_copy( const CommandQueue &queue, cl::Buffer &buffer, IteratorType startIterator, IteratorType endIterator)
-    {
-        typedef typename std::iterator_traits<IteratorType>::value_type iter_data_type;
-        typedef cl_type_t<iter_data_type> data_type;
-
-        cl_int error;
-
-        ::size_t length = endIterator-startIterator;
-        ::size_t byteLength = length*sizeof(data_type);
-
-        data_type* pointer = 
-            static_cast<data_type*>(queue.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_WRITE, 0, byteLength, 0, 0, &error));
-        // if exceptions enabled, enqueueMapBuffer will throw
-        if( error != CL_SUCCESS ) {
-            return error;
-        }
-
-        // perform copy with convertion
-        data_type* dest = pointer;
-        while (startIterator != endIterator) {
-            *startIterator++ = convert_to<iter_data_type>(*dest++);
-        }
-
-        Event endEvent;
-        error = queue.enqueueUnmapMemObject(buffer, pointer, 0, &endEvent);
-        // if exceptions enabled, enqueueUnmapMemObject will throw
-        if( error != CL_SUCCESS ) { 
-            return error;
-        }
-        endEvent.wait();
-        return CL_SUCCESS;
-    }
-
-
-    // TODO: implement cl::vector
     template <typename T>
     class vector{
     public:
         using value_type = T;
         using native_value_type = cl_native_type_t<T>;
+        using store_type = std::vector<native_value_type, md::aligned_allocator<native_value_type> >;
         static const ::size_t default_size = 256;
 
-        vector(::size_t size = default_size, cl_mem_flags mem_flags = CL_MEM_READ_WRITE) :
+        static_assert(sizeof(native_value_type) == sizeof(value_type), "Host memory has the layout of buffer");
+
+        vector(::size_t size = default_size, cl_mem_flags mem_flags = default_mem_flags) :
             m_size(size),
-            m_queue(OpenCLManager::Instance().getQueue()),
-            m_buffer(OpenCLManager::Instance().getContext().context(),
-                     mem_flags, sizeof(value_type) * m_size)
+            m_buffer(create(OpenCLManager::Instance().getContext().context(), store_type(size), mem_flags)),
+            m_queue(OpenCLManager::Instance().getQueue())
         {
         }
 
         // TODO: need to create or use existing CommandQueue to init m_queue
         // See todo below
-        vector(cl::Context context, ::size_t size = default_size, cl_mem_flags mem_flags = CL_MEM_READ_WRITE) :
+        vector(cl::Context context, ::size_t size = default_size, cl_mem_flags mem_flags = default_mem_flags) :
             m_size(size),
-            m_buffer(context, mem_flags, sizeof(value_type) * m_size)
+            m_buffer(create(context, store_type(size), mem_flags))
         {
         }
 
-        // TODO: cl::copy will use default queue and it may not match for given context
-        // we should either create new queue or use OpenCLContext wrapper
-        //
-        // NOTE: this may throw -34: invalid context
+        // values are placed in host memory before the buffer is created, no copy to device
         template <class IteratorTy>
-        vector(cl::Context context, IteratorTy begin, IteratorTy end, cl_mem_flags mem_flags = CL_MEM_READ_WRITE) :
+        vector(cl::Context context, IteratorTy begin, IteratorTy end, cl_mem_flags mem_flags = default_mem_flags) :
             m_size(std::distance(begin, end)),
-            m_buffer(context, mem_flags, sizeof(value_type) * m_size)
+            m_buffer(create(context, store_type(begin, end), mem_flags))
         {
-            cl::copy(begin, end, m_buffer);
         }
 
         template <class IteratorTy>
-        vector(IteratorTy begin, IteratorTy end, cl_mem_flags mem_flags = CL_MEM_READ_WRITE) :
+        vector(IteratorTy begin, IteratorTy end, cl_mem_flags mem_flags = default_mem_flags) :
             m_size(std::distance(begin, end)),
-            m_queue(OpenCLManager::Instance().getQueue()),
-            m_buffer(OpenCLManager::Instance().getContext().context(),
-                     mem_flags, sizeof(value_type) * m_size)
+            m_buffer(create(OpenCLManager::Instance().getContext().context(), store_type(begin, end), mem_flags)),
+            m_queue(OpenCLManager::Instance().getQueue())
+        {
+        }
+
+        // takes over memory of native particle data, values are not copied
+        explicit vector(store_type&& values, cl_mem_flags mem_flags = default_mem_flags) :
+            m_size(values.size()),
+            m_buffer(create(OpenCLManager::Instance().getContext().context(), std::move(values), mem_flags)),
+            m_queue(OpenCLManager::Instance().getQueue())
         {
-            cl::conv_copy(m_queue, begin, end, m_buffer);
         }
 
         ~vector()
@@ -227,33 +188,117 @@ namespace cl {
         inline ::size_t size() const { return m_size; }
         inline cl::Buffer& buffer() { return m_buffer; }
 
-        md::float3vec to_native()
+        // Copies native values into buffer, buffer is reallocated only if size differs
+        template <class IteratorTy>
+        void assign(IteratorTy begin, IteratorTy end)
         {
-            md::float3vec result(m_size);
-            cl::conv_copy(m_queue, m_buffer, result.begin(), result.end());
+            ::size_t size = std::distance(begin, end);
+            if (size != m_size) {
+                *this = vector(begin, end);
+                return;
+            }
+
+            native_value_type* pointer = map(CL_MAP_WRITE_INVALIDATE_REGION);
+            std::copy(begin, end, pointer);
+            unmap(pointer);
+        }
+
+        store_type to_native()
+        {
+            store_type result;
+            to_native(result);
             return result;
         }
 
-        value_type* map()
+        // reuses result storage, no allocation if capacity is enough
+        void to_native(store_type& result)
+        {
+            const native_value_type* pointer = map(CL_MAP_READ);
+            result.assign(pointer, pointer + m_size);
+            unmap(const_cast<native_value_type*>(pointer));
+        }
+
+        // Host memory of the buffer, valid until unmap().
+        // CL_MAP_READ if host only reads, CL_MAP_WRITE_INVALIDATE_REGION if host overwrites everything
+        native_value_type* map(cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE)
         {
             ::size_t size = sizeof(value_type) * m_size;
-            value_type* pointer = 
-                static_cast<value_type*>(m_queue.enqueueMapBuffer(m_buffer, CL_TRUE, CL_MAP_WRITE, 0, size, 0, 0, nullptr));
+            Event event;
+            native_value_type* pointer = static_cast<native_value_type*>(
+                m_queue.enqueueMapBuffer(m_buffer, CL_TRUE, flags, 0, size, 0, &event, nullptr));
+            OpenCLProfiler::Instance().record("map:vector", event);
             return pointer;
         }
 
-        void unmap(value_type* ptr)
+        void unmap(native_value_type* ptr)
         {
             Event end;
             m_queue.enqueueUnmapMemObject(m_buffer, ptr, 0, &end);
             end.wait();
+            OpenCLProfiler::Instance().record("unmap:vector", end);
         }
+
     protected:
+        // buffer over host memory holding values, owned by the buffer from now on
+        static cl::Buffer create(const cl::Context& context, store_type&& values, cl_mem_flags mem_flags)
+        {
+            std::unique_ptr<store_type> host(new store_type(std::move(values)));
+            mem_flags = (mem_flags & ~(CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR)) | CL_MEM_USE_HOST_PTR;
+
+            cl::Buffer buffer(context, mem_flags, sizeof(value_type) * host->size(), host->data());
+            buffer.setDestructorCallback(&vector::release, host.get());
+            host.release();
+            return buffer;
+        }
+
+        static void CL_CALLBACK release(cl_mem, void* host)
+        {
+            delete static_cast<store_type*>(host);
+        }
+
         ::size_t m_size;
         cl::Buffer m_buffer;
         cl::CommandQueue m_queue;
     };
 
+    /**
+    * Host access to vector elements, buffer stays mapped while mapping is alive.
+    * Unmaps on destruction, including stack unwinding.
+    */
+    template <typename T>
+    class mapping {
+    public:
+        typedef typename vector<T>::native_value_type value_type;
+
+        mapping(vector<T>& vec, cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE) :
+            m_vec(vec),
+            m_ptr(vec.map(flags))
+        {
+        }
+
+        ~mapping()
+        {
+            try {
+                m_vec.unmap(m_ptr);
+            } catch (...) {
+                // destructor must not throw, buffer is released with vector anyway
+            }
+        }
+
+        value_type& operator[](::size_t i) { return m_ptr[i]; }
+        const value_type& operator[](::size_t i) const { return m_ptr[i]; }
+
+        value_type* data() { return m_ptr; }
+        ::size_t size() const { return m_vec.size(); }
+
+    private:
+        mapping(const mapping&);
+        mapping& operator=(const mapping&);
+
+        vector<T>& m_vec;
+        value_type* m_ptr;
+    };
+
     using float3vec = cl::vector<cl_float3>;
 }
 
@@ -4,6 +4,7 @@
 #include <platforms/platform.hpp>
 #include <platforms/opencl/opencl_helpers.hpp>
 #include <platforms/opencl/kernels.hpp>
+#include <utils/config/opencl_config.hpp>
 
 #include <platforms/native/native_platform.hpp>
     
@@ -14,24 +15,82 @@ public:
 
     NativeParticleSystem convertToNative();
     void fromNative(const NativeParticleSystem& native);
+    // buffers take over particle data of native, which is left empty
+    void fromNative(NativeParticleSystem&& native);
     
     virtual void applyVerletIntegration();
     virtual void applyEulerIntegration();
 
     virtual void applyLennardJonesInteraction();
 
+    // Without callbacks all iterations run in one go. With callbacks device runs
+    // chunks of iterationCbInterval() iterations, state of every chunk end is copied
+    // to staging buffers and read back on a second queue while the next chunk runs.
+    // During callbacks snapshot() and storeParticles() return that state from
+    // mapped staging memory.
     virtual void iterate(size_t iterations);
 
     virtual void loadParticles(ParticleIStreamPtr is, size_t num);
     virtual void loadParticles(ParticleIStreamPtr is);
     virtual void storeParticles(ParticleOStreamPtr os);
+    virtual void snapshot(ParticleFrame& frame);
+
+    // during callbacks of chunked iterate() pos_prev is read from staging buffer
+    virtual void saveState(ParticleState& state);
+    virtual void restoreState(const ParticleState& state);
+
+    // reduced on device, during callbacks of chunked iterate() on chunk end state
+    virtual Observables observe();
 
     cl::float3vec& pos() { return m_pos; }
     cl::float3vec& pos_prev() { return m_pos_prev; }
     cl::float3vec& vel() { return m_vel; }
     cl::float3vec& accel() { return m_accel; }
 
+    // Global OpenCLConfig is used by default
+    void setOpenCLConfig(const OpenCLConfig& conf) { m_opencl_config = conf; }
+    const OpenCLConfig& openCLConfig() const { return m_opencl_config; }
+
 protected:
+    // Copy of chunk end state in host accessible buffers, double buffered.
+    // Buffers are mapped for reading on readback queue after the copy, callbacks
+    // use the mapped memory. Unmaps are enqueued when the slot is copied to again.
+    struct FrameStaging {
+        FrameStaging() : iteration(0), pos_mapped(NULL), vel_mapped(NULL), accel_mapped(NULL), pending(false) {}
+
+        cl::Buffer pos;
+        cl::Buffer vel;
+        cl::Buffer accel;
+        // not mapped, used by observe()
+        cl::Buffer pos_prev;
+        size_t iteration;
+
+        std::vector<cl::Event> mapped;
+        md::float3a* pos_mapped;
+        md::float3a* vel_mapped;
+        md::float3a* accel_mapped;
+        // callbacks are not invoked yet
+        bool pending;
+    };
+
+    void enqueueFrameCopy(size_t iteration, cl::CommandQueue& queue, cl::Buffer& pos, cl::Buffer& pos_prev,
+                          const cl::Event& step);
+    // waits for staging readback and invokes callbacks with it
+    void completeFrame(FrameStaging& staging);
+    // enqueues unmap of mapped staging buffers, appends their events to unmapped
+    void unmapFrame(FrameStaging& staging, std::vector<cl::Event>& unmapped);
+
+    OpenCLConfig m_opencl_config;
+
+    FrameStaging m_staging[2];
+    size_t m_staging_index;
+    cl::CommandQueue m_readback_queue;
+
+    // chunk end state seen by callbacks, NULL outside of them
+    FrameStaging* m_active_staging;
+
+    ObservablesKernel m_observables;
+
     cl::float3vec m_pos;
     cl::float3vec m_pos_prev;
     cl::float3vec m_vel;
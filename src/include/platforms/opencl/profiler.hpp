@@ -0,0 +1,104 @@
+#ifndef __OPENCL_PROFILER_HPP
+#define __OPENCL_PROFILER_HPP
+
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// included by opencl_helpers.hpp, so it includes OpenCL itself
+#define __CL_ENABLE_EXCEPTIONS
+#include <opencl.hpp>
+
+// Device time of kernels and transfers from OpenCL event profiling.
+// Disabled by default, queues are created with CL_QUEUE_PROFILING_ENABLE
+// only when profiler is enabled before they are created (see queueProperties()).
+// Recorded events are read lazily, so recording does not stall the pipeline.
+//
+// Commands are aggregated by name: kernel function name for kernels,
+// "<command>:<what>" for transfers, e.g. "copy:frame_staging".
+class OpenCLProfiler {
+public:
+    // device timestamps of one command, nanoseconds
+    struct Record {
+        std::string name;
+        // queue of the command, timeline lane
+        size_t queue;
+        cl_ulong queued;
+        cl_ulong submit;
+        cl_ulong start;
+        cl_ulong end;
+    };
+
+    struct Stats {
+        Stats() : count(0), total_ns(0), min_ns(0), max_ns(0), wait_ns(0) {}
+
+        size_t count;
+        // execution time, end - start
+        cl_ulong total_ns;
+        cl_ulong min_ns;
+        cl_ulong max_ns;
+        // time between enqueue and start, includes waiting for dependencies
+        cl_ulong wait_ns;
+    };
+
+    static OpenCLProfiler& Instance()
+    {
+        static OpenCLProfiler self;
+        return self;
+    }
+
+    void setEnabled(bool enabled);
+    bool enabled() const;
+    // keep every record for writeTimeline(), otherwise only aggregated stats are kept
+    void setTimeline(bool timeline);
+
+    cl_command_queue_properties queueProperties() const;
+
+    // no-op if disabled, events of queues without profiling are skipped
+    void record(const std::string& name, const cl::Event& event);
+    void record(const cl::Kernel& kernel, const cl::Event& event);
+
+    // waits for recorded commands and aggregates them
+    void collect();
+    void reset();
+
+    std::map<std::string, Stats> stats();
+    std::vector<Record> timeline();
+
+    // collect() must be called before writing
+    void writeJson(std::ostream& os);
+    void writeCsv(std::ostream& os);
+    // Chrome trace event format (chrome://tracing, Perfetto), one lane per queue
+    void writeTimeline(std::ostream& os);
+
+    // stats to <base>.json and <base>.csv, timeline to timeline_file if not empty,
+    // throws std::runtime_error if a file cannot be written
+    void save(const std::string& base, const std::string& timeline_file);
+
+private:
+    struct Pending {
+        std::string name;
+        cl::Event event;
+    };
+
+    OpenCLProfiler() : m_enabled(false), m_timeline(false), m_skipped(0) {}
+    OpenCLProfiler(const OpenCLProfiler&);
+    OpenCLProfiler& operator=(const OpenCLProfiler&);
+
+    // requires m_mutex to be held, completed commands only unless wait is set
+    void collectLocked(bool wait);
+
+    mutable std::mutex m_mutex;
+    bool m_enabled;
+    bool m_timeline;
+
+    std::vector<Pending> m_pending;
+    std::map<std::string, Stats> m_stats;
+    std::vector<Record> m_records;
+    std::map<cl_command_queue, size_t> m_queues;
+    size_t m_skipped;
+};
+
+#endif /* __OPENCL_PROFILER_HPP */
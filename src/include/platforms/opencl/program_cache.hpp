@@ -0,0 +1,64 @@
+#ifndef __OPENCL_PROGRAM_CACHE_HPP
+#define __OPENCL_PROGRAM_CACHE_HPP
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "platforms/opencl/opencl_helpers.hpp"
+
+// Built programs keyed by devices (name, vendor, device and driver versions),
+// source and build options.
+// Programs are kept in memory for the process lifetime, if cache directory
+// is set, CL_PROGRAM_BINARIES are also stored there and loaded on next start,
+// so warm start does not invoke the compiler.
+class OpenCLProgramCache {
+public:
+    typedef std::function<cl::Program()> BuildFn;
+
+    struct Stats {
+        Stats() : memory_hits(0), disk_hits(0), builds(0) {}
+
+        size_t memory_hits;
+        size_t disk_hits;
+        size_t builds;
+    };
+
+    static OpenCLProgramCache& Instance()
+    {
+        static OpenCLProgramCache self;
+        return self;
+    }
+
+    // empty dir disables on-disk cache
+    void setCacheDir(std::string dir);
+    std::string cacheDir() const;
+
+    // build is called on cache miss, it must build program for all devices
+    cl::Program getProgram(const cl::Context& context, const std::vector<cl::Device>& devices,
+                           const std::string& source, const std::string& build_options, BuildFn build);
+
+    // drops in-memory programs, on-disk cache is kept
+    void clearMemory();
+
+    Stats stats() const;
+
+private:
+    OpenCLProgramCache() {}
+    OpenCLProgramCache(const OpenCLProgramCache&);
+    OpenCLProgramCache& operator=(const OpenCLProgramCache&);
+
+    std::string filePath(const std::string& key) const;
+    bool load(const std::string& key, const cl::Context& context, const std::vector<cl::Device>& devices,
+              const std::string& build_options, cl::Program& program);
+    void store(const std::string& key, const cl::Program& program, size_t num_devices);
+
+    mutable std::mutex m_mutex;
+    std::string m_cache_dir;
+    std::map<std::pair<cl_context, std::string>, cl::Program> m_programs;
+    Stats m_stats;
+};
+
+#endif /* __OPENCL_PROGRAM_CACHE_HPP */
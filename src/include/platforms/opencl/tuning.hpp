@@ -0,0 +1,90 @@
+#ifndef __OPENCL_TUNING_HPP
+#define __OPENCL_TUNING_HPP
+
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "platforms/opencl/opencl_helpers.hpp"
+
+class OpenCLParticleSystem;
+
+// Launch parameters of a single kernel, 0 means kernel default
+struct KernelTuning {
+    KernelTuning() : work_group_size(0), tile_size(0), unroll(0) {}
+
+    size_t work_group_size;
+    size_t tile_size;
+    size_t unroll;
+};
+
+std::ostream& operator<<(std::ostream& os, const KernelTuning& tuning);
+
+// Best known kernel parameters for every device.
+// Each device has its own profile file in profile directory, named after
+// device name and driver version. Profiles are loaded on first use,
+// so kernels pick up tuned parameters automatically.
+//
+// File format, one kernel per line:
+//   <kernel name> work_group_size <n> tile_size <n> unroll <n>
+class OpenCLTuningProfiles {
+public:
+    static OpenCLTuningProfiles& Instance()
+    {
+        static OpenCLTuningProfiles self;
+        return self;
+    }
+
+    // empty dir disables profile files, loaded profiles are dropped
+    void setProfileDir(std::string dir);
+    std::string profileDir() const;
+
+    std::string profilePath(const cl::Device& device) const;
+
+    bool find(const cl::Device& device, const std::string& kernel, KernelTuning& tuning);
+    void set(const cl::Device& device, const std::string& kernel, const KernelTuning& tuning);
+    void erase(const cl::Device& device, const std::string& kernel);
+
+    // throws std::runtime_error if profile cannot be written
+    void save(const cl::Device& device);
+
+private:
+    typedef std::map<std::string, KernelTuning> Profile;
+
+    OpenCLTuningProfiles() {}
+    OpenCLTuningProfiles(const OpenCLTuningProfiles&);
+    OpenCLTuningProfiles& operator=(const OpenCLTuningProfiles&);
+
+    // both require m_mutex to be held
+    std::string pathFor(const cl::Device& device) const;
+    Profile& profile(const cl::Device& device);
+
+    mutable std::mutex m_mutex;
+    std::string m_profile_dir;
+    std::map<std::string, Profile> m_profiles;
+};
+
+// Benchmarks LJ kernel parameters on particles of the given system
+// and stores the fastest ones in the device profile.
+// Only kernels used by the system configuration are tuned:
+// CellForces for cutoff runs with cell list, otherwise the configured
+// all-pairs variant (tiled: work-group, tile size and unroll factor;
+// simple: work-group size).
+class OpenCLAutotuner {
+public:
+    explicit OpenCLAutotuner(OpenCLParticleSystem& sys, size_t repeats = 3);
+
+    // profile is saved if profile directory is set
+    void run(std::ostream& log);
+
+private:
+    void tune(const std::string& kernel, const std::vector<KernelTuning>& candidates, std::ostream& log);
+    double benchmark();
+
+    OpenCLParticleSystem& m_sys;
+    size_t m_repeats;
+};
+
+#endif /* __OPENCL_TUNING_HPP */
@@ -1,16 +1,37 @@
 #ifndef __PLATFORM_H
 #define __PLATFORM_H
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
 
 #include <utils/config/particle_system_config.hpp>
+#include <utils/config/lennard_jones_config.hpp>
+#include <utils/config/config_manager.hpp>
 #include <platforms/native/types.hpp>
 #include <utils/stream.hpp>
+#include <utils/frame.hpp>
+#include <utils/observables.hpp>
 
 using namespace md;
 
+// Held by objects which register callbacks bound to themselves (collectors,
+// writers), their callbacks stay registered while the owner lives.
+// Copies are owners of their own.
+class IterationCbOwner {
+public:
+    IterationCbOwner() : m_token(std::make_shared<char>(0)) {}
+    IterationCbOwner(const IterationCbOwner&) : m_token(std::make_shared<char>(0)) {}
+    IterationCbOwner& operator=(const IterationCbOwner&) { return *this; }
+
+    std::weak_ptr<void> token() const { return m_token; }
+
+private:
+    std::shared_ptr<char> m_token;
+};
+
 enum class IntegrationAlg {
     Verlet,
     Euler
@@ -23,13 +44,24 @@ enum class PotentialAlg {
 class ParticleSystem {
 public:
     ParticleSystem()
+        : m_lj_config(ConfigManager::Instance().getLennardJonesConfig())
+        , m_iter_cb_interval(1)
+        , m_iteration(0)
+        , m_has_pos_prev(false)
     {
     }
 
-    explicit ParticleSystem(ParticleSystemConfig conf) : m_config(conf)
+    explicit ParticleSystem(ParticleSystemConfig conf)
+        : m_config(conf)
+        , m_lj_config(ConfigManager::Instance().getLennardJonesConfig())
+        , m_iter_cb_interval(1)
+        , m_iteration(0)
+        , m_has_pos_prev(false)
     {
     }
 
+    virtual ~ParticleSystem() {}
+
     virtual void applyVerletIntegration() = 0;
     virtual void applyEulerIntegration() = 0;
 
@@ -37,34 +69,133 @@ public:
     virtual void loadParticles(ParticleIStreamPtr is) = 0;
     virtual void storeParticles(ParticleOStreamPtr os) = 0;
 
+    // Copy current state to host frame, used to offload I/O from the simulation loop
+    virtual void snapshot(ParticleFrame& frame) = 0;
+
+    // Energies, temperature, momentum and virial of current state, iteration is not set
+    virtual Observables observe() = 0;
+
+    // Full state for checkpoints, iteration is not set.
+    // During callbacks of chunked iterate() it is the state seen by callbacks.
+    virtual void saveState(ParticleState& state) = 0;
+    // Continues a run from saved state: iterations are numbered from state.iteration
+    // and the next iterate() does not start with Euler step
+    virtual void restoreState(const ParticleState& state) = 0;
+
+    // First iteration starts with Euler step which computes pos_prev from vel,
+    // unless the system continues previous iterate() or restored state.
+    // Callbacks get iteration numbers counted from the first iterate() call.
     virtual void iterate(size_t iterations) = 0;
 
+    // iterations completed, including those before restoreState()
+    size_t iteration() const { return m_iteration; }
+    // pos_prev holds positions of the previous Verlet step
+    bool hasPosPrev() const { return m_has_pos_prev; }
+
     void setIntegrationAlg(IntegrationAlg alg) { m_integration_alg = alg; }
     void setPotentialAlg(PotentialAlg alg) { m_potential_alg = alg; }
 
     const ParticleSystemConfig& config() const { return m_config; }
 
+    // Global LennardJonesConfig is used by default, override it
+    // when several systems with different constants live in one process
+    void setLennardJonesConfig(const LennardJonesConfig& conf) { m_lj_config = conf; }
+    const LennardJonesConfig& lennardJonesConfig() const { return m_lj_config; }
+
     typedef std::function<void(ParticleSystem*, size_t)> IterationCb;
-    virtual void registerOnIterationCb(IterationCb cb)
+
+    // cb needs only iterations multiple of interval, platforms which have to
+    // synchronize device state for callbacks may skip other iterations
+    virtual void registerOnIterationCb(IterationCb cb, size_t interval = 1)
     {
-        m_on_iter_cb.push_back(cb);
+        addIterationCb(cb, interval, std::weak_ptr<void>(), false);
     }
 
+    // cb is dropped once owner is destroyed, objects register callbacks
+    // bound to themselves this way and may die before the system
+    void registerOnIterationCb(IterationCb cb, size_t interval, const IterationCbOwner& owner)
+    {
+        addIterationCb(cb, interval, owner.token(), true);
+    }
+
+    // greatest interval which satisfies all callbacks
+    size_t iterationCbInterval() const { return m_iter_cb_interval; }
+
+    // iteration is counted from the start of current iterate()
     virtual void invokeOnIteration(size_t iteration)
     {
-        for(auto& cb : m_on_iter_cb) {
-            cb(this, iteration);
+        dropDetachedCbs();
+        for(auto& entry : m_on_iter_cb) {
+            entry.cb(this, m_iteration + iteration);
         }
     }
 
 protected:
     ParticleSystemConfig m_config;
+    LennardJonesConfig m_lj_config;
 
     // TODO: add to config?
     IntegrationAlg m_integration_alg;
     PotentialAlg m_potential_alg;
 
-    std::vector<IterationCb> m_on_iter_cb;
+    // true if any callback is registered, callbacks of destroyed owners are dropped
+    bool hasIterationCbs()
+    {
+        dropDetachedCbs();
+        return !m_on_iter_cb.empty();
+    }
+
+    struct IterationCbEntry {
+        IterationCb cb;
+        size_t interval;
+        std::weak_ptr<void> owner;
+        bool owned;
+    };
+
+    std::vector<IterationCbEntry> m_on_iter_cb;
+    size_t m_iter_cb_interval;
+
+    // updated by iterate() implementations when they finish
+    size_t m_iteration;
+    bool m_has_pos_prev;
+
+private:
+    void addIterationCb(IterationCb cb, size_t interval, std::weak_ptr<void> owner, bool owned)
+    {
+        IterationCbEntry entry = { cb, std::max<size_t>(interval, 1), owner, owned };
+        m_on_iter_cb.push_back(entry);
+        updateIterationCbInterval();
+    }
+
+    void dropDetachedCbs()
+    {
+        auto detached = std::remove_if(m_on_iter_cb.begin(), m_on_iter_cb.end(), [](const IterationCbEntry& entry) {
+            return entry.owned && entry.owner.expired();
+        });
+        if (detached != m_on_iter_cb.end()) {
+            m_on_iter_cb.erase(detached, m_on_iter_cb.end());
+            updateIterationCbInterval();
+        }
+    }
+
+    void updateIterationCbInterval()
+    {
+        m_iter_cb_interval = 1;
+        for (size_t i = 0; i < m_on_iter_cb.size(); i++) {
+            size_t interval = m_on_iter_cb[i].interval;
+            m_iter_cb_interval = (i == 0) ? interval : gcd(m_iter_cb_interval, interval);
+        }
+    }
+
+    static size_t gcd(size_t a, size_t b)
+    {
+        while (b != 0) {
+            size_t r = a % b;
+            a = b;
+            b = r;
+        }
+        return a;
+    }
 };
 
 #endif // __PLATFORM_H
@@ -8,4 +8,8 @@ public:
     TBBParticleSystem();
     explicit TBBParticleSystem(ParticleSystemConfig conf);
     virtual void applyLennardJonesInteraction();
+
+protected:
+    // Interaction for target particles [first, last) with all other particles
+    void applyLennardJonesInteraction(size_t first, size_t last);
 };
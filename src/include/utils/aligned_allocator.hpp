@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace md {
+
+// Allocates storage at Alignment bytes with size rounded up to 64 bytes.
+// OpenCL runtimes use such host memory with CL_MEM_USE_HOST_PTR without copying it
+// (page alignment and cache line size is the strictest known requirement).
+template <typename T, size_t Alignment = 4096>
+class aligned_allocator {
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    static const size_t alignment = Alignment;
+
+    template <typename U>
+    struct rebind {
+        typedef aligned_allocator<U, Alignment> other;
+    };
+
+    aligned_allocator() {}
+
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Alignment>&) {}
+
+    pointer address(reference value) const { return &value; }
+    const_pointer address(const_reference value) const { return &value; }
+
+    pointer allocate(size_type n, const void* = 0)
+    {
+        if (n == 0) {
+            return nullptr;
+        }
+        if (n > max_size()) {
+            throw std::bad_alloc();
+        }
+
+        size_t size = (n * sizeof(T) + 63) / 64 * 64;
+        void* ptr = nullptr;
+#ifdef _WIN32
+        ptr = _aligned_malloc(size, Alignment);
+#else
+        if (posix_memalign(&ptr, Alignment, size) != 0) {
+            ptr = nullptr;
+        }
+#endif
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<pointer>(ptr);
+    }
+
+    void deallocate(pointer ptr, size_type)
+    {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    size_type max_size() const { return (size_t(-1) - 63) / sizeof(T); }
+
+    template <typename U, typename... Args>
+    void construct(U* ptr, Args&&... args)
+    {
+        ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    void destroy(U* ptr)
+    {
+        ptr->~U();
+    }
+};
+
+template <typename T, typename U, size_t Alignment>
+bool operator==(const aligned_allocator<T, Alignment>&, const aligned_allocator<U, Alignment>&)
+{
+    return true;
+}
+
+template <typename T, typename U, size_t Alignment>
+bool operator!=(const aligned_allocator<T, Alignment>&, const aligned_allocator<U, Alignment>&)
+{
+    return false;
+}
+
+} // namespace md
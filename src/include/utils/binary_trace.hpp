@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Binary trace layout, native byte order (little endian on supported platforms):
+//
+//   BinaryTraceHeader                       64 bytes
+//   frames[0 .. frames - 1]                 frameSize() bytes each
+//     uint64_t iteration
+//     float[particles * 3] per stored field, in order pos, vel, accel
+//   BinaryTraceIndexEntry[frames]           at index_offset
+//
+// Frames of quantized traces (codec binary_trace_quantized) have variable size:
+//     BinaryTraceFrameHeader
+//     per stored field: uint64_t size, field encoded by TraceFrameCodec
+//
+// Header is written before the first frame and rewritten with frame count and
+// index offset when the trace is closed. Trace of an interrupted run has
+// index_offset == 0, its complete frames are found by scanning the file.
+
+const char binary_trace_magic[8] = { 'M', 'D', 'T', 'R', 'A', 'C', 'E', '\0' };
+const uint32_t binary_trace_version = 1;
+
+const uint32_t binary_trace_raw = 0;
+const uint32_t binary_trace_quantized = 1;
+
+const uint32_t binary_trace_keyframe = 0x01;
+
+// same bits as StreamIgnore
+const uint32_t binary_trace_pos = 0x01;
+const uint32_t binary_trace_vel = 0x02;
+const uint32_t binary_trace_accel = 0x04;
+
+struct BinaryTraceHeader {
+    // header of an empty trace
+    static BinaryTraceHeader Make(uint32_t fields, uint64_t particles, const float area[3])
+    {
+        BinaryTraceHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, binary_trace_magic, sizeof(header.magic));
+        header.version = binary_trace_version;
+        header.fields = fields;
+        header.particles = particles;
+        header.precision = sizeof(float);
+        std::memcpy(header.area, area, sizeof(header.area));
+        return header;
+    }
+
+    bool valid() const
+    {
+        return std::memcmp(magic, binary_trace_magic, sizeof(magic)) == 0 && version == binary_trace_version &&
+               precision == sizeof(float) && codec <= binary_trace_quantized &&
+               (fields & ~(binary_trace_pos | binary_trace_vel | binary_trace_accel)) == 0;
+    }
+
+    bool has(uint32_t field) const { return (fields & field) != 0; }
+
+    uint32_t fieldCount() const { return has(binary_trace_pos) + has(binary_trace_vel) + has(binary_trace_accel); }
+
+    // position of a field in frame data, field must be stored
+    uint64_t fieldOffset(uint32_t field) const
+    {
+        uint64_t preceding = 0;
+        for (uint32_t f = binary_trace_pos; f < field; f <<= 1) {
+            preceding += has(f);
+        }
+        return sizeof(uint64_t) + preceding * particles * 3 * precision;
+    }
+
+    // raw frames only
+    uint64_t frameSize() const { return sizeof(uint64_t) + fieldCount() * particles * 3 * precision; }
+
+    uint64_t frameOffset(uint64_t frame) const { return sizeof(BinaryTraceHeader) + frame * frameSize(); }
+
+    char magic[8];
+    uint32_t version;
+    // mask of binary_trace_pos, binary_trace_vel, binary_trace_accel
+    uint32_t fields;
+    uint64_t particles;
+    // bytes per value
+    uint32_t precision;
+    // binary_trace_raw or binary_trace_quantized
+    uint32_t codec;
+    // simulation area size, zero if unknown
+    float area[3];
+    // absolute precision of quantized values
+    float quantum;
+    uint64_t frames;
+    uint64_t index_offset;
+};
+
+struct BinaryTraceFrameHeader {
+    uint64_t iteration;
+    // binary_trace_keyframe if fields are not encoded relative to the previous frame
+    uint32_t flags;
+    uint32_t reserved;
+    // bytes of the frame after this header
+    uint64_t size;
+};
+
+struct BinaryTraceIndexEntry {
+    uint64_t iteration;
+    uint64_t offset;
+};
+
+static_assert(sizeof(BinaryTraceHeader) == 64, "Binary trace header layout");
+static_assert(sizeof(BinaryTraceFrameHeader) == 24, "Binary trace frame header layout");
+static_assert(sizeof(BinaryTraceIndexEntry) == 16, "Binary trace index layout");
+static_assert(std::is_pod<BinaryTraceHeader>::value, "Binary trace header is written as raw bytes");
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Thread-safe FIFO queue with limited capacity.
+// Once closed, push fails and pop drains remaining items.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : m_capacity(capacity), m_closed(false)
+    {
+    }
+
+    // blocks while queue is full, returns false if queue is closed
+    bool push(T value)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(lock, [this]() { return m_closed || m_queue.size() < m_capacity; });
+        if (m_closed) {
+            return false;
+        }
+
+        m_queue.push_back(std::move(value));
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    // returns false if queue is full or closed
+    bool tryPush(T value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_closed || m_queue.size() >= m_capacity) {
+            return false;
+        }
+
+        m_queue.push_back(std::move(value));
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    // blocks while queue is empty, returns false if queue is closed and empty
+    bool pop(T& value)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_empty.wait(lock, [this]() { return m_closed || !m_queue.empty(); });
+        if (m_queue.empty()) {
+            return false;
+        }
+
+        value = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_not_full.notify_one();
+        return true;
+    }
+
+    // returns false if queue is empty
+    bool tryPop(T& value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.empty()) {
+            return false;
+        }
+
+        value = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queue.size();
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+private:
+    BoundedQueue(const BoundedQueue&);
+    BoundedQueue& operator=(const BoundedQueue&);
+
+    size_t m_capacity;
+    bool m_closed;
+    std::deque<T> m_queue;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <platforms/platform.hpp>
+#include <utils/config/checkpoint_config.hpp>
+#include <utils/frame.hpp>
+
+class CheckpointError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Checkpoint layout, native byte order:
+//
+//   CheckpointHeader                        48 bytes
+//   char[config_size]                       config text the run was started with
+//   float[particles * 3] per field, in order pos, pos_prev, vel, accel
+//
+// checksum is FNV-1a of everything after the header.
+const char checkpoint_magic[8] = { 'M', 'D', 'C', 'H', 'K', 'P', 'T', '\0' };
+const uint32_t checkpoint_version = 2;
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    // bytes per value
+    uint32_t precision;
+    uint64_t iteration;
+    uint64_t particles;
+    uint64_t config_size;
+    uint64_t checksum;
+};
+
+static_assert(sizeof(CheckpointHeader) == 48, "Checkpoint header layout");
+
+// Everything needed to continue a run exactly where it stopped.
+// Random generator is only used by the particle generator, its init_seed is in config.
+struct Checkpoint {
+    ParticleState state;
+    // config files text, loaded before configs given on restart
+    std::string config;
+
+    // Written to a temporary file which then replaces filename,
+    // interrupted write keeps the previous checkpoint. Throws CheckpointError.
+    void save(const std::string& filename) const;
+    // throws CheckpointError if file is missing, truncated or corrupted
+    static Checkpoint load(const std::string& filename);
+};
+
+// Writes checkpoint every iterations_threshold iterations.
+// In async mode the simulation thread only copies full state, the file is
+// written by background thread. Next checkpoint waits for the previous write.
+class CheckpointWriter {
+public:
+    CheckpointWriter();
+    explicit CheckpointWriter(CheckpointConfig conf);
+
+    // waits for pending write
+    ~CheckpointWriter();
+
+    // stored in every checkpoint, see Checkpoint::config
+    void setConfigText(const std::string& config) { m_checkpoint.config = config; }
+
+    // attach after restoreState(), thresholds are counted from system iteration;
+    // callback is dropped when the writer is destroyed, par_sys may outlive it
+    void attach(ParticleSystem& par_sys);
+    void onIteration(ParticleSystem* pSys, size_t iteration);
+
+    // checkpoint of current state outside of callbacks, e.g. at the end of the run
+    void write(ParticleSystem& par_sys);
+
+    // blocks until pending checkpoint is written, rethrows write error
+    void flush();
+
+    size_t checkpointsWritten() const { return m_written; }
+
+private:
+    void init();
+    // state is filled, checkpoint.state.iteration is set
+    void submit();
+    void writerLoop();
+
+    size_t m_last_iteration;
+    CheckpointConfig m_conf;
+
+    // filled by simulation thread while nothing is pending
+    Checkpoint m_checkpoint;
+
+    std::thread m_writer;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_pending;
+    bool m_stop;
+    std::exception_ptr m_writer_error;
+    std::atomic<size_t> m_written;
+
+    // keeps callbacks of attach() registered
+    IterationCbOwner m_cb_owner;
+};
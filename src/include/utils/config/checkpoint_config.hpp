@@ -0,0 +1,32 @@
+#pragma once
+
+#include <utils/config/config.hpp>
+
+class CheckpointConfig : public IConfig {
+public:
+    CheckpointConfig()
+    {
+        m_config_name = "CheckpointConfig";
+        loadDefault();
+    }
+
+    virtual void loadDefault()
+    {
+        enabled = ConfigEntry<bool>(false, "enabled");
+        filename = ConfigEntry<std::string>("checkpoint.bin", "filename");
+        iterations_threshold = ConfigEntry<size_t>(1000, "iterations_threshold");
+        async = ConfigEntry<bool>(true, "async");
+
+        m_strEntryMap[enabled.name()] = &enabled;
+        m_strEntryMap[filename.name()] = &filename;
+        m_strEntryMap[iterations_threshold.name()] = &iterations_threshold;
+        m_strEntryMap[async.name()] = &async;
+    }
+
+    ConfigEntry<bool> enabled;
+    // every checkpoint replaces the previous one
+    ConfigEntry<std::string> filename;
+    ConfigEntry<size_t> iterations_threshold;
+    // write file on background thread
+    ConfigEntry<bool> async;
+};
@@ -74,10 +74,32 @@ private:
 
 class IConfig {
 public:
+    IConfig()
+    {
+    }
+
+    // Entries map points to members of the source object, so it is not
+    // copied: copies must be reloaded (loadFromStream) before using setEntry
+    IConfig(const IConfig& rhs) : m_config_name(rhs.m_config_name)
+    {
+    }
+
+    IConfig& operator=(const IConfig& rhs)
+    {
+        m_config_name = rhs.m_config_name;
+        return *this;
+    }
+
+    virtual ~IConfig() {}
+
     virtual void loadDefault() = 0;
     virtual void loadFromStream(std::istream& is);
     virtual std::string name() { return m_config_name; }
 
+    // Override single entry, value uses the same syntax as in config file
+    virtual void setEntry(std::string entry_name, std::string value);
+    virtual bool hasEntry(std::string entry_name) const { return m_strEntryMap.count(entry_name) != 0; }
+
 protected:
     virtual void onLoad()
     {
@@ -3,6 +3,13 @@
 #include <utils/config/particle_system_config.hpp>
 #include <utils/config/lennard_jones_config.hpp>
 #include <utils/config/trace_config.hpp>
+#include <utils/config/opencl_config.hpp>
+#include <utils/config/observables_config.hpp>
+#include <utils/config/checkpoint_config.hpp>
+#include <utils/config/frame_ring_config.hpp>
+#include <utils/config/trace_selection_config.hpp>
+
+#include <vector>
 
 class ConfigManager {
 public:
@@ -17,17 +24,44 @@ public:
         m_strConfMap[m_part_system_config.name()] = &m_part_system_config;
         m_strConfMap[m_lennard_jones_config.name()] = &m_lennard_jones_config;
         m_strConfMap[m_trace_config.name()] = &m_trace_config;
+        m_strConfMap[m_opencl_config.name()] = &m_opencl_config;
+        m_strConfMap[m_observables_config.name()] = &m_observables_config;
+        m_strConfMap[m_checkpoint_config.name()] = &m_checkpoint_config;
+        m_strConfMap[m_frame_ring_config.name()] = &m_frame_ring_config;
     }
 
     ParticleSystemConfig getParticleSystemConfig() { return m_part_system_config; }
     LennardJonesConfig getLennardJonesConfig() { return m_lennard_jones_config; }
     TraceConfig getTraceConfig() { return m_trace_config; }
+    OpenCLConfig getOpenCLConfig() { return m_opencl_config; }
+    ObservablesConfig getObservablesConfig() { return m_observables_config; }
+    CheckpointConfig getCheckpointConfig() { return m_checkpoint_config; }
+    FrameRingConfig getFrameRingConfig() { return m_frame_ring_config; }
+    // in order of sections, one per selection label
+    std::vector<TraceSelectionConfig> getTraceSelectionConfigs() { return m_trace_selection_configs; }
 
     void loadFromFile(std::string filename);
+    void loadFromStream(std::istream& is);
+
+    // entry is either "ConfigName.entry_name" or just "entry_name",
+    // the latter only if a single config has such entry, ConfigError otherwise
+    void setEntry(std::string entry, std::string value);
 
 private:
+    void loadTraceSelection(std::istream& is);
+
+    // Configs are registered by pointer, copy is not allowed
+    ConfigManager(const ConfigManager&);
+    ConfigManager& operator=(const ConfigManager&);
+
     std::map<std::string, IConfig*> m_strConfMap;
     ParticleSystemConfig m_part_system_config;
     LennardJonesConfig m_lennard_jones_config;
     TraceConfig m_trace_config;
+    OpenCLConfig m_opencl_config;
+    ObservablesConfig m_observables_config;
+    CheckpointConfig m_checkpoint_config;
+    FrameRingConfig m_frame_ring_config;
+    // repeated sections, not reachable by setEntry
+    std::vector<TraceSelectionConfig> m_trace_selection_configs;
 };
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <utils/config/config.hpp>
+
+class FrameRingConfig : public IConfig {
+public:
+    FrameRingConfig()
+    {
+        m_config_name = "FrameRingConfig";
+        loadDefault();
+    }
+
+    virtual void loadDefault()
+    {
+        enabled = ConfigEntry<bool>(false, "enabled");
+        shm_name = ConfigEntry<std::string>("/moldynam_frames", "shm_name");
+        slots = ConfigEntry<size_t>(4, "slots");
+        iterations_threshold = ConfigEntry<size_t>(0, "iterations_threshold");
+        pos = ConfigEntry<bool>(true, "pos");
+        vel = ConfigEntry<bool>(false, "vel");
+        accel = ConfigEntry<bool>(false, "accel");
+
+        m_strEntryMap[enabled.name()] = &enabled;
+        m_strEntryMap[shm_name.name()] = &shm_name;
+        m_strEntryMap[slots.name()] = &slots;
+        m_strEntryMap[iterations_threshold.name()] = &iterations_threshold;
+        m_strEntryMap[pos.name()] = &pos;
+        m_strEntryMap[vel.name()] = &vel;
+        m_strEntryMap[accel.name()] = &accel;
+    }
+
+    virtual void onLoad()
+    {
+        if (slots < 2) {
+            throw ConfigError("Frame ring needs at least 2 slots");
+        }
+
+        if (!pos && !vel && !accel) {
+            throw ConfigError("Frame ring stores no fields");
+        }
+    }
+
+    ConfigEntry<bool> enabled;
+    // POSIX shared memory object, "/name"
+    ConfigEntry<std::string> shm_name;
+    // frames kept in the ring, readers copy the newest one
+    ConfigEntry<size_t> slots;
+    ConfigEntry<size_t> iterations_threshold;
+
+    // published fields
+    ConfigEntry<bool> pos;
+    ConfigEntry<bool> vel;
+    ConfigEntry<bool> accel;
+};
@@ -104,7 +104,7 @@ public:
         temp_lj_constants.set_eps(m_eps);
     }
 
-    LennardJonesConstants getConstants()
+    LennardJonesConstants getConstants() const
     {
         return temp_lj_constants;
     }
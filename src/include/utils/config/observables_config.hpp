@@ -0,0 +1,29 @@
+#pragma once
+
+#include <utils/config/config.hpp>
+
+class ObservablesConfig : public IConfig {
+public:
+    ObservablesConfig()
+    {
+        m_config_name = "ObservablesConfig";
+        loadDefault();
+    }
+
+    virtual void loadDefault()
+    {
+        enabled = ConfigEntry<bool>(false, "enabled");
+        filename = ConfigEntry<std::string>("observables.csv", "filename");
+        iterations_threshold = ConfigEntry<size_t>(0, "iterations_threshold");
+
+        m_strEntryMap[enabled.name()] = &enabled;
+        m_strEntryMap[filename.name()] = &filename;
+        m_strEntryMap[iterations_threshold.name()] = &iterations_threshold;
+    }
+
+    ConfigEntry<bool> enabled;
+    // csv: iteration,kinetic_energy,potential_energy,total_energy,temperature,
+    //      momentum_x,momentum_y,momentum_z,virial
+    ConfigEntry<std::string> filename;
+    ConfigEntry<size_t> iterations_threshold;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <utils/config/config.hpp>
+
+class OpenCLConfig : public IConfig {
+public:
+    OpenCLConfig()
+    {
+        m_config_name = "OpenCLConfig";
+        loadDefault();
+    }
+
+    virtual void loadDefault()
+    {
+        device_type = ConfigEntry<std::string>("all", "device_type");
+        device_vendor = ConfigEntry<std::string>("", "device_vendor");
+        device_index = ConfigEntry<size_t>(0, "device_index");
+        device_count = ConfigEntry<size_t>(0, "device_count");
+        sub_devices = ConfigEntry<std::string>("none", "sub_devices");
+        sub_device_units = ConfigEntry<size_t>(1, "sub_device_units");
+        program_cache_dir = ConfigEntry<std::string>("", "program_cache_dir");
+        lj_kernel = ConfigEntry<std::string>("tiled", "lj_kernel");
+        work_group_size = ConfigEntry<size_t>(64, "work_group_size");
+        tile_size = ConfigEntry<size_t>(0, "tile_size");
+        unroll = ConfigEntry<size_t>(1, "unroll");
+        cell_list = ConfigEntry<bool>(true, "cell_list");
+        tuning_profile_dir = ConfigEntry<std::string>("", "tuning_profile_dir");
+        fused_kernels = ConfigEntry<bool>(true, "fused_kernels");
+        precision = ConfigEntry<std::string>("single", "precision");
+        profiling = ConfigEntry<bool>(false, "profiling");
+        profile_file = ConfigEntry<std::string>("opencl_profile", "profile_file");
+        profile_timeline = ConfigEntry<std::string>("", "profile_timeline");
+
+        m_strEntryMap[device_type.name()] = &device_type;
+        m_strEntryMap[device_vendor.name()] = &device_vendor;
+        m_strEntryMap[device_index.name()] = &device_index;
+        m_strEntryMap[device_count.name()] = &device_count;
+        m_strEntryMap[sub_devices.name()] = &sub_devices;
+        m_strEntryMap[sub_device_units.name()] = &sub_device_units;
+        m_strEntryMap[program_cache_dir.name()] = &program_cache_dir;
+        m_strEntryMap[lj_kernel.name()] = &lj_kernel;
+        m_strEntryMap[work_group_size.name()] = &work_group_size;
+        m_strEntryMap[tile_size.name()] = &tile_size;
+        m_strEntryMap[unroll.name()] = &unroll;
+        m_strEntryMap[cell_list.name()] = &cell_list;
+        m_strEntryMap[tuning_profile_dir.name()] = &tuning_profile_dir;
+        m_strEntryMap[fused_kernels.name()] = &fused_kernels;
+        m_strEntryMap[precision.name()] = &precision;
+        m_strEntryMap[profiling.name()] = &profiling;
+        m_strEntryMap[profile_file.name()] = &profile_file;
+        m_strEntryMap[profile_timeline.name()] = &profile_timeline;
+    }
+
+    virtual void onLoad()
+    {
+        const std::string& type = device_type.value();
+        if (type != "all" && type != "default" && type != "cpu" && type != "gpu" && type != "accelerator") {
+            throw ConfigError("Unsupported OpenCL device type: " + type);
+        }
+
+        if (sub_devices.value() != "none" && sub_devices.value() != "equally" && sub_devices.value() != "numa") {
+            throw ConfigError("Unsupported OpenCL sub-devices partition: " + sub_devices.value());
+        }
+
+        if (sub_device_units.value() == 0) {
+            throw ConfigError("OpenCL sub_device_units must be positive");
+        }
+
+        if (lj_kernel.value() != "tiled" && lj_kernel.value() != "simple") {
+            throw ConfigError("Unsupported OpenCL LJ kernel: " + lj_kernel.value());
+        }
+
+        if (work_group_size.value() == 0) {
+            throw ConfigError("OpenCL work_group_size must be positive");
+        }
+
+        if (tile_size.value() % work_group_size.value() != 0) {
+            throw ConfigError("OpenCL tile_size must be a multiple of work_group_size");
+        }
+
+        if (precision.value() != "single" && precision.value() != "double") {
+            throw ConfigError("Unsupported OpenCL precision: " + precision.value());
+        }
+    }
+
+    // Device selection: devices of all platforms matching type ("all", "default",
+    // "cpu", "gpu", "accelerator") and vendor (case-insensitive substring, empty
+    // matches any) are enumerated, device_index picks one of them
+    ConfigEntry<std::string> device_type;
+    ConfigEntry<std::string> device_vendor;
+    ConfigEntry<size_t> device_index;
+
+    // Multi-device platform uses device_count devices starting from device_index
+    // (0 means all remaining), devices must belong to one OpenCL platform.
+    // Every device may be split into sub-devices: "none", "equally" (by
+    // sub_device_units compute units) or "numa" (by NUMA affinity domain)
+    ConfigEntry<size_t> device_count;
+    ConfigEntry<std::string> sub_devices;
+    ConfigEntry<size_t> sub_device_units;
+
+    // directory for compiled program binaries, empty disables on-disk cache
+    ConfigEntry<std::string> program_cache_dir;
+
+    // "tiled" stages positions in local memory, "simple" reads global memory
+    ConfigEntry<std::string> lj_kernel;
+    // passed to tiled kernel as -DWG_SIZE, clamped to device limit
+    ConfigEntry<size_t> work_group_size;
+    // positions per local memory tile (-DTILE_SIZE), 0 means work_group_size
+    ConfigEntry<size_t> tile_size;
+    // interactions per inner loop iteration of tiled kernel (-DUNROLL)
+    ConfigEntry<size_t> unroll;
+    // use cell list pipeline for cutoff runs, otherwise all pairs are visited
+    ConfigEntry<bool> cell_list;
+
+    // per-device kernel profiles written by autotuner, loaded automatically,
+    // tuned values override work_group_size, tile_size and unroll
+    ConfigEntry<std::string> tuning_profile_dir;
+
+    // run force and integration as one generated kernel per step, see KernelGenerator,
+    // not used by cell list pipeline
+    ConfigEntry<bool> fused_kernels;
+    // accumulation type of generated kernels: "single" or "double" (requires cl_khr_fp64)
+    ConfigEntry<std::string> precision;
+
+    // device time of every kernel and transfer, see OpenCLProfiler,
+    // per command stats go to <profile_file>.json and <profile_file>.csv
+    ConfigEntry<bool> profiling;
+    ConfigEntry<std::string> profile_file;
+    // Chrome trace event file of all commands, none if empty
+    ConfigEntry<std::string> profile_timeline;
+};
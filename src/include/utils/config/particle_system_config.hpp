@@ -23,6 +23,10 @@ public:
         particles_num = ConfigEntry<size_t>(0, "particles_num");
         init_file = ConfigEntry<std::string>("", "init_file");
         init_file_binary = ConfigEntry<bool>(false, "init_file_binary");
+        init_generator = ConfigEntry<std::string>("", "init_generator");
+        init_seed = ConfigEntry<size_t>(1, "init_seed");
+        init_min_distance = ConfigEntry<float>(0, "init_min_distance");
+        init_temperature = ConfigEntry<float>(0, "init_temperature");
         result_file = ConfigEntry<std::string>("", "result_file");
         result_file_binary = ConfigEntry<bool>(false, "result_file_binary");
 
@@ -33,10 +37,35 @@ public:
         m_strEntryMap[particles_num.name()] = &particles_num;
         m_strEntryMap[init_file.name()] = &init_file;
         m_strEntryMap[init_file_binary.name()] = &init_file_binary;
+        m_strEntryMap[init_generator.name()] = &init_generator;
+        m_strEntryMap[init_seed.name()] = &init_seed;
+        m_strEntryMap[init_min_distance.name()] = &init_min_distance;
+        m_strEntryMap[init_temperature.name()] = &init_temperature;
         m_strEntryMap[result_file.name()] = &result_file;
         m_strEntryMap[result_file_binary.name()] = &result_file_binary;
     }
 
+    virtual void onLoad()
+    {
+        md::float3 area = area_size;
+        if (periodic && (area.x <= 0 || area.y <= 0 || area.z <= 0)) {
+            throw ConfigError("Periodic boundaries require positive area_size");
+        }
+
+        std::string generator = init_generator;
+        if (generator != "") {
+            if (generator != "uniform" && generator != "fcc" && generator != "bcc") {
+                throw ConfigError("init_generator must be one of uniform, fcc, bcc");
+            }
+            if (area.x <= 0 || area.y <= 0 || area.z <= 0) {
+                throw ConfigError("Generated particles require positive area_size");
+            }
+            if (init_min_distance < 0 || init_temperature < 0) {
+                throw ConfigError("init_min_distance and init_temperature must not be negative");
+            }
+        }
+    }
+
     // made all config variables public to avoid function number explosion
     ConfigEntry<bool> periodic;
     ConfigEntry<bool> use_cutoff;
@@ -45,6 +74,13 @@ public:
     ConfigEntry<size_t> particles_num;
     ConfigEntry<std::string> init_file;
     ConfigEntry<bool> init_file_binary;
+    // generates particles in process instead of reading init_file:
+    // "uniform", "fcc" or "bcc", see ParticleGenerator
+    ConfigEntry<std::string> init_generator;
+    ConfigEntry<size_t> init_seed;
+    // uniform generator only
+    ConfigEntry<float> init_min_distance;
+    ConfigEntry<float> init_temperature;
     ConfigEntry<std::string> result_file;
     ConfigEntry<bool> result_file_binary;
 };
@@ -16,18 +16,52 @@ public:
         filename = ConfigEntry<std::string>("", "filename");
         binary_file = ConfigEntry<bool>(false, "binary_file");
         value_threshold = ConfigEntry<float>(0, "value_threshold");
+        keyframe_interval = ConfigEntry<size_t>(100, "keyframe_interval");
         iterations_threshold = ConfigEntry<size_t>(0, "iterations_threshold");
+        async = ConfigEntry<bool>(true, "async");
+        frames_pool = ConfigEntry<size_t>(4, "frames_pool");
+        backpressure = ConfigEntry<std::string>("block", "backpressure");
 
         m_strEntryMap[enabled.name()] = &enabled;
         m_strEntryMap[filename.name()] = &filename;
         m_strEntryMap[binary_file.name()] = &binary_file;
         m_strEntryMap[value_threshold.name()] = &value_threshold;
+        m_strEntryMap[keyframe_interval.name()] = &keyframe_interval;
         m_strEntryMap[iterations_threshold.name()] = &iterations_threshold;
+        m_strEntryMap[async.name()] = &async;
+        m_strEntryMap[frames_pool.name()] = &frames_pool;
+        m_strEntryMap[backpressure.name()] = &backpressure;
+    }
+
+    virtual void onLoad()
+    {
+        if (backpressure.value() != "block" && backpressure.value() != "drop") {
+            throw ConfigError("Unsupported trace backpressure policy: " + backpressure.value());
+        }
+
+        if (value_threshold < 0) {
+            throw ConfigError("Trace value_threshold must not be negative");
+        }
+
+        if (keyframe_interval == 0) {
+            throw ConfigError("Trace keyframe_interval must be positive");
+        }
     }
 
     ConfigEntry<bool> enabled;
     ConfigEntry<std::string> filename;
     ConfigEntry<bool> binary_file;
+    // absolute precision of binary trace values, 0 stores exact floats,
+    // otherwise values are quantized and compressed
     ConfigEntry<float> value_threshold;
+    // frames between keyframes of compressed trace, limits cost of seeking
+    ConfigEntry<size_t> keyframe_interval;
     ConfigEntry<size_t> iterations_threshold;
+
+    // write frames on background thread
+    ConfigEntry<bool> async;
+    // number of preallocated frames, limits async queue length
+    ConfigEntry<size_t> frames_pool;
+    // what to do when all frames are queued: "block" simulation or "drop" frame
+    ConfigEntry<std::string> backpressure;
 };
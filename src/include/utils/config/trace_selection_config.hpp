@@ -0,0 +1,110 @@
+#pragma once
+
+#include <utils/config/config.hpp>
+#include <platforms/native/types.hpp>
+
+// Subset of particles traced into its own file, see TraceSelection.
+// Config files may contain several [TraceSelectionConfig] sections, a section
+// replaces an earlier one with the same label.
+class TraceSelectionConfig : public IConfig {
+public:
+    TraceSelectionConfig()
+    {
+        m_config_name = "TraceSelectionConfig";
+        loadDefault();
+    }
+
+    virtual void loadDefault()
+    {
+        label = ConfigEntry<std::string>("", "label");
+        filename = ConfigEntry<std::string>("", "filename");
+        binary_file = ConfigEntry<bool>(false, "binary_file");
+        iterations_threshold = ConfigEntry<size_t>(0, "iterations_threshold");
+        pos = ConfigEntry<bool>(true, "pos");
+        vel = ConfigEntry<bool>(true, "vel");
+        accel = ConfigEntry<bool>(true, "accel");
+        id_begin = ConfigEntry<size_t>(0, "id_begin");
+        id_end = ConfigEntry<size_t>(0, "id_end");
+        id_stride = ConfigEntry<size_t>(1, "id_stride");
+        region = ConfigEntry<std::string>("", "region");
+        box_min = ConfigEntry<md::float3>(md::float3(0), "box_min");
+        box_max = ConfigEntry<md::float3>(md::float3(0), "box_max");
+        sphere_center = ConfigEntry<md::float3>(md::float3(0), "sphere_center");
+        sphere_radius = ConfigEntry<float>(0, "sphere_radius");
+
+        m_strEntryMap[label.name()] = &label;
+        m_strEntryMap[filename.name()] = &filename;
+        m_strEntryMap[binary_file.name()] = &binary_file;
+        m_strEntryMap[iterations_threshold.name()] = &iterations_threshold;
+        m_strEntryMap[pos.name()] = &pos;
+        m_strEntryMap[vel.name()] = &vel;
+        m_strEntryMap[accel.name()] = &accel;
+        m_strEntryMap[id_begin.name()] = &id_begin;
+        m_strEntryMap[id_end.name()] = &id_end;
+        m_strEntryMap[id_stride.name()] = &id_stride;
+        m_strEntryMap[region.name()] = &region;
+        m_strEntryMap[box_min.name()] = &box_min;
+        m_strEntryMap[box_max.name()] = &box_max;
+        m_strEntryMap[sphere_center.name()] = &sphere_center;
+        m_strEntryMap[sphere_radius.name()] = &sphere_radius;
+    }
+
+    virtual void onLoad()
+    {
+        if (filename.value() == "") {
+            throw ConfigError("Trace selection " + label.value() + " requires filename");
+        }
+
+        if (!pos && !vel && !accel) {
+            throw ConfigError("Trace selection " + label.value() + " stores no fields");
+        }
+
+        if (id_stride == 0 || (id_end != 0 && id_end <= id_begin)) {
+            throw ConfigError("Trace selection " + label.value() + " has empty id range");
+        }
+
+        std::string shape = region;
+        md::float3 lo = box_min;
+        md::float3 hi = box_max;
+        if (shape == "box") {
+            if (lo.x >= hi.x || lo.y >= hi.y || lo.z >= hi.z) {
+                throw ConfigError("Trace selection " + label.value() + " requires box_min below box_max");
+            }
+        } else if (shape == "sphere") {
+            if (sphere_radius <= 0) {
+                throw ConfigError("Trace selection " + label.value() + " requires positive sphere_radius");
+            }
+        } else if (shape != "") {
+            throw ConfigError("Unsupported trace selection region: " + shape);
+        }
+
+        // binary traces have the same particle count in every frame
+        if (shape != "" && binary_file) {
+            throw ConfigError("Trace selection " + label.value() + " with region requires text file");
+        }
+    }
+
+    ConfigEntry<std::string> label;
+    ConfigEntry<std::string> filename;
+    ConfigEntry<bool> binary_file;
+    ConfigEntry<size_t> iterations_threshold;
+
+    // stored fields
+    ConfigEntry<bool> pos;
+    ConfigEntry<bool> vel;
+    ConfigEntry<bool> accel;
+
+    // particles id_begin, id_begin + id_stride, ... before id_end,
+    // id_end 0 includes the last particle
+    ConfigEntry<size_t> id_begin;
+    ConfigEntry<size_t> id_end;
+    ConfigEntry<size_t> id_stride;
+
+    // "" for all particles of the id range, "box" or "sphere" for those of them
+    // inside the region at the traced iteration
+    ConfigEntry<std::string> region;
+    ConfigEntry<md::float3> box_min;
+    ConfigEntry<md::float3> box_max;
+    ConfigEntry<md::float3> sphere_center;
+    ConfigEntry<float> sphere_radius;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <platforms/native/types.hpp>
+
+namespace md {
+
+// Host copy of particle system state taken at some iteration.
+// Vectors keep their capacity, so a reused frame does not allocate.
+struct ParticleFrame {
+    ParticleFrame() : iteration(0)
+    {
+    }
+
+    size_t size() const { return pos.size(); }
+
+    size_t iteration;
+    float3vec pos;
+    float3vec vel;
+    float3vec accel;
+    // particle indices of a frame with part of the particles, empty if it has all of them
+    std::vector<size_t> ids;
+};
+
+// Full state of a particle system, a run continued from it gives the same
+// results as an uninterrupted one. iteration is the number of completed iterations.
+struct ParticleState : public ParticleFrame {
+    float3vec pos_prev;
+};
+
+} // namespace md
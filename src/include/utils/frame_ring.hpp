@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <platforms/platform.hpp>
+#include <utils/binary_trace.hpp>
+#include <utils/config/frame_ring_config.hpp>
+#include <utils/frame.hpp>
+#include <utils/stream.hpp>
+
+class FrameRingError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Ring of frames in POSIX shared memory, native byte order:
+//
+//   FrameRingHeader                         64 bytes
+//   slots[0 .. slots - 1]                   slot_size bytes each
+//     FrameRingSlot                         64 bytes
+//     float[capacity * 4] per stored field, in order pos, vel, accel,
+//     x, y, z and padding of each particle as in md::float3vec
+//
+// Frame n (counted from 0) is written to slot n % slots. The slot sequence is
+// 2n + 1 while the frame is written and 2n + 2 when it is complete, then header
+// published becomes n + 1. Readers copy the newest frame and retry if the slot
+// sequence changed meanwhile (seqlock), so the writer never waits for them.
+const char frame_ring_magic[8] = { 'M', 'D', 'F', 'R', 'I', 'N', 'G', '\0' };
+const uint32_t frame_ring_version = 1;
+
+struct FrameRingHeader {
+    char magic[8];
+    uint32_t version;
+    // mask of binary_trace_pos, binary_trace_vel, binary_trace_accel
+    uint32_t fields;
+    // particles per slot
+    uint64_t capacity;
+    uint64_t slots;
+    uint64_t slot_size;
+    float area[3];
+    uint32_t reserved;
+    // frames completely written so far
+    std::atomic<uint64_t> published;
+};
+
+struct FrameRingSlot {
+    std::atomic<uint64_t> sequence;
+    uint64_t iteration;
+    uint64_t particles;
+    uint64_t reserved[5];
+};
+
+static_assert(sizeof(FrameRingHeader) == 64, "Frame ring header layout");
+static_assert(sizeof(FrameRingSlot) == 64, "Frame ring slot layout");
+
+// Creates the ring and publishes frames into it. A ring of the same name left
+// by another run is replaced, its readers have to attach again.
+// Available on POSIX systems, throws FrameRingError elsewhere.
+class FrameRingWriter {
+public:
+    FrameRingWriter(const std::string& name, size_t slots, size_t capacity, uint32_t fields, md::float3 area);
+    // removes the name, attached readers keep their mapping
+    ~FrameRingWriter();
+
+    // fields missing in frame are published as zeros,
+    // throws FrameRingError if frame has more particles than capacity
+    void publish(const ParticleFrame& frame);
+
+    size_t published() const { return m_next; }
+
+private:
+    FrameRingWriter(const FrameRingWriter&);
+    FrameRingWriter& operator=(const FrameRingWriter&);
+
+    std::string m_name;
+    char* m_data;
+    size_t m_size;
+    FrameRingHeader* m_header;
+    uint64_t m_next;
+};
+
+// Read-only view of a ring created by FrameRingWriter.
+class FrameRingReader {
+public:
+    // throws FrameRingError if the ring does not exist or is not initialized yet
+    explicit FrameRingReader(const std::string& name);
+    ~FrameRingReader();
+
+    size_t capacity() const { return m_header->capacity; }
+    uint32_t fields() const { return m_header->fields; }
+    md::float3 area() const { return md::float3(m_header->area[0], m_header->area[1], m_header->area[2]); }
+    size_t published() const { return m_header->published.load(std::memory_order_acquire); }
+
+    // Copies the newest complete frame, fields not in the ring are cleared.
+    // False if nothing newer than the previously read frame was published.
+    bool readLatest(ParticleFrame& frame);
+
+private:
+    FrameRingReader(const FrameRingReader&);
+    FrameRingReader& operator=(const FrameRingReader&);
+
+    std::string m_name;
+    const char* m_data;
+    size_t m_size;
+    const FrameRingHeader* m_header;
+    uint64_t m_last_read;
+};
+
+// Publishes particle system state every iterations_threshold iterations.
+// The ring is created at the first frame, its capacity is the particle count.
+class FrameRingPublisher {
+public:
+    FrameRingPublisher();
+    explicit FrameRingPublisher(FrameRingConfig conf);
+
+    // callback is dropped when the publisher is destroyed, par_sys may outlive it
+    void attach(ParticleSystem& par_sys);
+    void onIteration(ParticleSystem* pSys, size_t iteration);
+
+    size_t published() const { return m_writer ? m_writer->published() : 0; }
+
+private:
+    size_t m_last_iteration;
+    FrameRingConfig m_conf;
+    md::float3 m_area;
+
+    ParticleFrame m_frame;
+    std::unique_ptr<FrameRingWriter> m_writer;
+
+    // keeps callbacks of attach() registered
+    IterationCbOwner m_cb_owner;
+};
+
+// Live frames of a ring: every ReadFrame() returns the newest published frame,
+// or the previous one again if nothing new was published. Fields missing in
+// the ring are left untouched. Never reaches the end.
+class FrameRingIStream : public ParticleIStream {
+public:
+    FrameRingIStream();
+    explicit FrameRingIStream(std::string name);
+
+    virtual void open(std::string name);
+    virtual bool good();
+
+    // particles of consecutive frames
+    virtual void Read(md::float3& pos, md::float3& vel, md::float3& accel);
+    virtual void Read(cl_float3& pos, cl_float3& vel, cl_float3& accel);
+
+    virtual void ReadFrame(md::float3a* pos, md::float3a* vel, md::float3a* accel, size_t num);
+    virtual void ReadFrame(cl_float3* pos, cl_float3* vel, cl_float3* accel, size_t num);
+
+private:
+    // particles [first, first + num) of m_frame
+    template <class T>
+    void copyParticles(T* pos, T* vel, T* accel, size_t first, size_t num);
+
+    // particles of m_frame
+    size_t frameParticles() const;
+
+    std::unique_ptr<FrameRingReader> m_reader;
+    ParticleFrame m_frame;
+    size_t m_particle;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include <platforms/native/types.hpp>
+#include <utils/binary_trace.hpp>
+
+class MappedTraceError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Random access reader of uncompressed binary traces (see binary_trace.hpp).
+// The whole file is mapped read-only, frames are views into the mapping,
+// so nothing is copied and only touched pages are read from disk.
+// Views are valid while the MappedTrace is alive.
+//
+// Available on POSIX systems, throws MappedTraceError elsewhere.
+class MappedTrace {
+public:
+    // arrays of one frame, nullptr for fields not stored in the trace
+    class Frame {
+    public:
+        Frame() : m_iteration(0), m_size(0), m_pos(nullptr), m_vel(nullptr), m_accel(nullptr) {}
+        Frame(size_t iteration, size_t size, const md::float3* pos, const md::float3* vel, const md::float3* accel)
+            : m_iteration(iteration), m_size(size), m_pos(pos), m_vel(vel), m_accel(accel)
+        {
+        }
+
+        size_t iteration() const { return m_iteration; }
+        size_t size() const { return m_size; }
+
+        const md::float3* pos() const { return m_pos; }
+        const md::float3* vel() const { return m_vel; }
+        const md::float3* accel() const { return m_accel; }
+
+    private:
+        size_t m_iteration;
+        size_t m_size;
+        const md::float3* m_pos;
+        const md::float3* m_vel;
+        const md::float3* m_accel;
+    };
+
+    // frames first, first + stride, ... before last, pages of the next
+    // read_ahead frames are requested from the kernel while iterating
+    class Range {
+    public:
+        class iterator : public std::iterator<std::input_iterator_tag, Frame> {
+        public:
+            iterator(const Range* range, size_t frame) : m_range(range), m_frame(frame) {}
+
+            Frame operator*() const { return m_range->m_trace->frame(m_frame); }
+            iterator& operator++();
+            bool operator==(const iterator& other) const { return m_frame == other.m_frame; }
+            bool operator!=(const iterator& other) const { return m_frame != other.m_frame; }
+
+            size_t index() const { return m_frame; }
+
+        private:
+            const Range* m_range;
+            size_t m_frame;
+        };
+
+        Range(const MappedTrace* trace, size_t first, size_t last, size_t stride, size_t read_ahead);
+
+        iterator begin() const;
+        iterator end() const { return iterator(this, m_end); }
+        size_t size() const { return (m_end - m_first) / m_stride; }
+
+    private:
+        const MappedTrace* m_trace;
+        size_t m_first;
+        // first frame after the range that is reached with stride
+        size_t m_end;
+        size_t m_stride;
+        size_t m_read_ahead;
+    };
+
+    // throws MappedTraceError if file cannot be mapped, is not a binary trace or is compressed
+    explicit MappedTrace(const std::string& filename);
+    ~MappedTrace();
+
+    const BinaryTraceHeader& header() const { return m_header; }
+    size_t frames() const { return m_frames; }
+    size_t particles() const { return m_header.particles; }
+    md::float3 area() const { return md::float3(m_header.area[0], m_header.area[1], m_header.area[2]); }
+
+    // O(1), throws std::out_of_range
+    Frame frame(size_t index) const;
+
+    Range range(size_t first, size_t last, size_t stride = 1, size_t read_ahead = 4) const;
+    Range all() const { return range(0, m_frames); }
+
+    // access pattern hints for the mapping (madvise)
+    void adviseSequential() const;
+    void adviseRandom() const;
+    // start reading frames [first, first + count) in background
+    void willNeed(size_t first, size_t count) const;
+    // pages of frames [first, first + count) may be dropped from memory
+    void dontNeed(size_t first, size_t count) const;
+
+private:
+    MappedTrace(const MappedTrace&);
+    MappedTrace& operator=(const MappedTrace&);
+
+    void advise(size_t first, size_t count, int advice) const;
+
+    std::string m_filename;
+    const char* m_data;
+    size_t m_size;
+
+    BinaryTraceHeader m_header;
+    size_t m_frames;
+    // nullptr if trace has no index
+    const BinaryTraceIndexEntry* m_index;
+};
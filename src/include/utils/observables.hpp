@@ -0,0 +1,40 @@
+#pragma once
+
+#include <platforms/native/types.hpp>
+
+#include <cstddef>
+
+namespace md {
+
+// Macroscopic quantities of particle system at some iteration.
+// Particles have unit mass, velocities are taken from the last Verlet step:
+// v = (pos - pos_prev) / dt, temperature is in units of eps / k_B.
+struct Observables {
+    Observables()
+        : iteration(0)
+        , kinetic_energy(0)
+        , potential_energy(0)
+        , temperature(0)
+        , momentum(0, 0, 0)
+        , virial(0)
+    {
+    }
+
+    double totalEnergy() const { return kinetic_energy + potential_energy; }
+
+    // 3 degrees of freedom per particle
+    static double temperatureOf(double kinetic_energy, size_t particles_num)
+    {
+        return particles_num ? 2 * kinetic_energy / (3.0 * particles_num) : 0;
+    }
+
+    size_t iteration;
+    double kinetic_energy;
+    double potential_energy;
+    double temperature;
+    float3 momentum;
+    // sum of r_ij * f_ij over particle pairs
+    double virial;
+};
+
+} // namespace md
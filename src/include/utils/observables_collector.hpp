@@ -0,0 +1,37 @@
+#pragma once
+
+#include <fstream>
+#include <stdexcept>
+
+#include <platforms/platform.hpp>
+#include <utils/config/observables_config.hpp>
+#include <utils/observables.hpp>
+
+class ObservablesError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Writes ParticleSystem::observe() every iterations_threshold iterations as csv rows.
+// Only a few scalars are taken from the system, device platforms reduce on device.
+class ObservablesCollector {
+public:
+    ObservablesCollector();
+    explicit ObservablesCollector(ObservablesConfig conf);
+
+    // callback is dropped when the collector is destroyed, par_sys may outlive it
+    void attach(ParticleSystem& par_sys);
+    void onIteration(ParticleSystem* pSys, size_t iteration);
+
+    static void writeHeader(std::ostream& os);
+    static void writeRow(std::ostream& os, const Observables& obs);
+
+private:
+    void init();
+
+    size_t m_last_iteration;
+    ObservablesConfig m_conf;
+    std::ofstream m_os;
+
+    // keeps callbacks of attach() registered
+    IterationCbOwner m_cb_owner;
+};
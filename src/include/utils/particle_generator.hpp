@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <platforms/native/types.hpp>
+#include <utils/config/particle_system_config.hpp>
+#include <utils/stream.hpp>
+
+class GeneratorError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Counter based random numbers: value number `counter` of stream `stream` is a
+// SplitMix64 hash of the seed, stream and counter. Values do not depend on the
+// order they are taken in, so parallel loops give the same numbers as sequential ones.
+class CounterRng {
+public:
+    explicit CounterRng(uint64_t seed) : m_key(mix(seed)) {}
+
+    uint64_t bits(uint64_t stream, uint64_t counter) const
+    {
+        return mix(mix(m_key + stream * golden) + (counter + 1) * golden);
+    }
+
+    // [0, 1), 53 bits
+    double uniform(uint64_t stream, uint64_t counter) const
+    {
+        return (bits(stream, counter) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // standard normal distribution, Box-Muller of counters 2 * counter and 2 * counter + 1
+    double normal(uint64_t stream, uint64_t counter) const;
+
+private:
+    static const uint64_t golden = 0x9e3779b97f4a7c15ull;
+
+    static uint64_t mix(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t m_key;
+};
+
+// Initial state of particles_num particles in area_size, selected by init_generator:
+//   uniform  - uniform random positions, at least init_min_distance apart; spheres of
+//              that diameter may fill about a fifth of the area, denser systems
+//              start from a lattice
+//   fcc, bcc - first particles_num sites of the smallest cubic lattice of m^3 cells
+//              that holds them, cells are stretched to the area
+// Velocities follow Maxwell-Boltzmann distribution of init_temperature (unit mass,
+// temperature in units of epsilon / k_B) without center of mass drift.
+// Same init_seed gives the same particles regardless of thread count.
+class ParticleGenerator {
+public:
+    explicit ParticleGenerator(const ParticleSystemConfig& conf);
+
+    // throws GeneratorError if particles do not fit with init_min_distance
+    void generate(float3vec& pos, float3vec& vel) const;
+
+    void positions(float3vec& pos) const;
+    void velocities(float3vec& vel) const;
+
+    // names accepted by init_generator, "" is not a generator
+    static bool isGenerator(const std::string& name);
+
+private:
+    void uniformPositions(float3vec& pos) const;
+    void separatedPositions(float3vec& pos) const;
+    void latticePositions(float3vec& pos, const md::float3* basis, size_t basis_size) const;
+
+    std::string m_generator;
+    size_t m_num;
+    md::float3 m_area;
+    bool m_periodic;
+    float m_min_distance;
+    float m_temperature;
+    CounterRng m_rng;
+};
+
+// Generated particles read as an init file, see ParticleGenerator.
+// Particles are generated at the first read.
+class GeneratorIStream : public ParticleIStream {
+public:
+    explicit GeneratorIStream(const ParticleSystemConfig& conf);
+
+    // nothing to open, particles come from the config
+    virtual void open(std::string /*filename*/) {}
+    virtual bool good();
+
+    virtual void Read(md::float3& pos, md::float3& vel, md::float3& accel);
+    virtual void Read(cl_float3& pos, cl_float3& vel, cl_float3& accel);
+
+    virtual void ReadFrame(md::float3a* pos, md::float3a* vel, md::float3a* accel, size_t num);
+    virtual void ReadFrame(cl_float3* pos, cl_float3* vel, cl_float3* accel, size_t num);
+
+private:
+    template <class T>
+    void readParticles(T* pos, T* vel, T* accel, size_t num);
+
+    ParticleGenerator m_generator;
+    bool m_generated;
+    float3vec m_pos;
+    float3vec m_vel;
+    size_t m_next;
+};
@@ -2,10 +2,15 @@
 
 #include <sstream>
 #include <memory>
+#include <vector>
 
 #include <platforms/native/types.hpp>
 #include <utils/config/trace_config.hpp>
 #include <utils/config/particle_system_config.hpp>
+#include <utils/binary_trace.hpp>
+#include <utils/trace_codec.hpp>
+
+class TextFile;
 #include <CL/cl.h>
 
 enum class StreamIgnore : unsigned char {
@@ -54,24 +59,82 @@ public:
 
     virtual void Write(md::float3 pos, md::float3 vel, md::float3 accel) = 0;
     virtual void Write(cl_float3 pos, cl_float3 vel, cl_float3 accel) = 0;
+
+    // num particles at once, arrays of ignored fields may be nullptr;
+    // default implementation calls Write() for every particle
+    virtual void WriteFrame(const md::float3a* pos, const md::float3a* vel, const md::float3a* accel, size_t num);
+    virtual void WriteFrame(const cl_float3* pos, const cl_float3* vel, const cl_float3* accel, size_t num);
+
+    // end of a trace frame, framed formats collect particles until then
+    virtual void endFrame(size_t /*iteration*/) {}
+    // simulation area, stored by formats with header
+    virtual void setArea(md::float3 /*area_size*/) {}
 };
 
 using ParticleOStreamPtr = std::shared_ptr<ParticleOStream>;
 
+// Binary trace writer, see binary_trace.hpp for the layout.
+// Particles are collected in memory and written per field in one call at
+// endFrame(). Particles left without endFrame() form the last frame, so a
+// single storeParticles() call gives a one frame file.
+// Particle count and fields are taken from the first frame.
+// With setQuantization() frames are compressed by TraceFrameCodec.
 class ByteOStream : public ParticleOStream {
 public:
     ByteOStream();
     ByteOStream(std::string filename);
     ByteOStream(std::ostream& os);
 
+    // closes the trace
+    virtual ~ByteOStream();
+
     virtual void open(std::string filename);
     virtual bool good();
 
     virtual void Write(md::float3 pos, md::float3 vel, md::float3 accel);
     virtual void Write(cl_float3 pos, cl_float3 vel, cl_float3 accel);
 
+    virtual void WriteFrame(const md::float3a* pos, const md::float3a* vel, const md::float3a* accel, size_t num);
+    virtual void WriteFrame(const cl_float3* pos, const cl_float3* vel, const cl_float3* accel, size_t num);
+
+    // throws std::runtime_error if frame particle count differs from the first frame
+    virtual void endFrame(size_t iteration);
+    virtual void setArea(md::float3 area_size);
+
+    // lossy compression with given absolute precision, every keyframe_interval-th
+    // frame is encoded independently of previous ones; before the first frame only
+    void setQuantization(float quantum, size_t keyframe_interval);
+
+    // writes pending particles, frame index and final header
+    void close();
+
 protected:
+    template <class T>
+    void appendFrame(const T* pos, const T* vel, const T* accel, size_t num);
+
+    void writeHeader();
+    void writeRawFrame(uint64_t iteration);
+    void writeQuantizedFrame(uint64_t iteration);
+
     std::shared_ptr<std::ostream> m_stream_ptr;
+
+    BinaryTraceHeader m_header;
+    bool m_header_written;
+    bool m_closed;
+    // bytes written so far
+    uint64_t m_offset;
+    std::vector<BinaryTraceIndexEntry> m_index;
+
+    size_t m_keyframe_interval;
+    bool m_force_keyframe;
+    // per field: pos, vel, accel
+    std::vector<std::unique_ptr<TraceFrameCodec> > m_codecs;
+    std::vector<uint8_t> m_encoded;
+
+    // current frame, xyz per particle
+    std::vector<float> m_pos;
+    std::vector<float> m_vel;
+    std::vector<float> m_accel;
 };
 
 class TextOStream : public ParticleOStream {
@@ -86,8 +149,19 @@ public:
     virtual void Write(md::float3 pos, md::float3 vel, md::float3 accel);
     virtual void Write(cl_float3 pos, cl_float3 vel, cl_float3 accel);
 
+    // formats the frame in memory, in parallel blocks, and writes it at once
+    virtual void WriteFrame(const md::float3a* pos, const md::float3a* vel, const md::float3a* accel, size_t num);
+    virtual void WriteFrame(const cl_float3* pos, const cl_float3* vel, const cl_float3* accel, size_t num);
+
 protected:
+    template <class T>
+    void writeParticles(const T* pos, const T* vel, const T* accel, size_t num);
+
     std::shared_ptr<std::ostream> m_stream_ptr;
+    // stream formatted frame, used only with non-default float format flags
+    std::ostringstream m_buffer;
+    // frame formatted in parallel blocks
+    std::vector<std::string> m_chunks;
 };
 
 
@@ -98,10 +172,21 @@ public:
 
     virtual void Read(md::float3& pos, md::float3& vel, md::float3& accel) = 0;
     virtual void Read(cl_float3& pos, cl_float3& vel, cl_float3& accel) = 0;
+
+    // num particles at once, arrays of ignored fields may be nullptr;
+    // default implementation calls Read() for every particle
+    virtual void ReadFrame(md::float3a* pos, md::float3a* vel, md::float3a* accel, size_t num);
+    virtual void ReadFrame(cl_float3* pos, cl_float3* vel, cl_float3* accel, size_t num);
 };
 
 using ParticleIStreamPtr = std::shared_ptr<ParticleIStream>;
 
+// Binary trace reader, see binary_trace.hpp for the layout.
+// Read() returns particles of consecutive frames, a whole frame is read at once.
+// Fields missing in the trace are left untouched. After the last frame good()
+// turns false and Read() does not change its arguments.
+// Quantized frames are decoded from the preceding keyframe when needed.
+// Throws std::runtime_error if the stream is not a binary trace.
 class ByteIStream : public ParticleIStream {
 public:
     ByteIStream();
@@ -114,10 +199,54 @@ public:
     virtual void Read(md::float3& pos, md::float3& vel, md::float3& accel);
     virtual void Read(cl_float3& pos, cl_float3& vel, cl_float3& accel);
 
+    // copies whole field arrays of a frame, may span several frames
+    virtual void ReadFrame(md::float3a* pos, md::float3a* vel, md::float3a* accel, size_t num);
+    virtual void ReadFrame(cl_float3* pos, cl_float3* vel, cl_float3* accel, size_t num);
+
+    const BinaryTraceHeader& header() const { return m_header; }
+    size_t frames() const { return m_frames; }
+    size_t particles() const { return m_header.particles; }
+    md::float3 area() const { return md::float3(m_header.area[0], m_header.area[1], m_header.area[2]); }
+
+    // iteration the frame was taken at
+    size_t iteration(size_t frame);
+    // next Read() starts at the first particle of the frame, O(1)
+    void seekFrame(size_t frame);
+
 protected:
+    template <class T>
+    void readParticles(T* pos, T* vel, T* accel, size_t num);
+
+    void readHeader();
+    // indexes complete frames of a trace without index
+    void scanFrames();
+    void readFrame(size_t frame);
+    void decodeFrame(size_t frame);
+    // loads next frame if current one is consumed, false at the end of trace
+    bool nextParticle();
+    // values of current particle, nullptr if field is not stored or ignored
+    const float* value(uint32_t field, StreamIgnore ignore);
+
     std::shared_ptr<std::istream> m_stream_ptr;
+
+    BinaryTraceHeader m_header;
+    size_t m_frames;
+    std::vector<BinaryTraceIndexEntry> m_index;
+
+    size_t m_next_frame;
+    size_t m_particle;
+    bool m_eof;
+    std::vector<float> m_frame;
+
+    // per field: pos, vel, accel
+    std::vector<std::unique_ptr<TraceFrameCodec> > m_codecs;
+    std::vector<uint8_t> m_encoded;
+    // frame whose values are in m_frame and codecs
+    size_t m_decoded_frame;
 };
 
+// Files opened by name are mapped and parsed without iostreams, frames with
+// one particle per line in parallel. Other streams use iostream operators.
 class TextIStream : public ParticleIStream {
 public:
     TextIStream();
@@ -130,8 +259,21 @@ public:
     virtual void Read(md::float3& pos, md::float3& vel, md::float3& accel);
     virtual void Read(cl_float3& pos, cl_float3& vel, cl_float3& accel);
 
+    virtual void ReadFrame(md::float3a* pos, md::float3a* vel, md::float3a* accel, size_t num);
+    virtual void ReadFrame(cl_float3* pos, cl_float3* vel, cl_float3* accel, size_t num);
+
 protected:
+    template <class T>
+    void readParticles(T* pos, T* vel, T* accel, size_t num);
+
+    // stream given by user
     std::shared_ptr<std::istream> m_stream_ptr;
+
+    // file opened by name is parsed from memory
+    std::shared_ptr<TextFile> m_file;
+    const char* m_pos;
+    bool m_file_good;
+    std::vector<const char*> m_lines;
 };
 
 class StringStream : public TextOStream {
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+
+class SweepError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Values of a single config entry to iterate over.
+// Spec syntax:
+//   entry=begin:end:step  - inclusive numeric range
+//   entry=v1,v2,v3        - explicit list of values
+//   entry=value           - single value
+struct SweepRange {
+    std::string entry;
+    std::vector<std::string> values;
+
+    static SweepRange parse(std::string spec);
+};
+
+// Config entry overrides for a single run: (entry, value) pairs
+typedef std::vector<std::pair<std::string, std::string> > SweepPoint;
+
+class Sweep {
+public:
+    void addRange(const SweepRange& range);
+    const std::vector<SweepRange>& ranges() const { return m_ranges; }
+
+    // cartesian product of all ranges, last range changes fastest
+    std::vector<SweepPoint> points() const;
+
+private:
+    std::vector<SweepRange> m_ranges;
+};
+
+// Runs sweep points on a shared pool of workers.
+// Each run gets cores_per_run cores, number of concurrent runs is
+// total_cores / cores_per_run, so the machine is never oversubscribed.
+class SweepScheduler {
+public:
+    // run function must not use more than `cores` threads
+    typedef std::function<void(size_t run, const SweepPoint& point, size_t cores)> RunFn;
+
+    // total_cores == 0 means all hardware threads
+    explicit SweepScheduler(size_t cores_per_run, size_t total_cores = 0);
+
+    size_t workers() const { return m_workers; }
+    size_t coresPerRun() const { return m_cores_per_run; }
+
+    // Rows are written to csv as soon as runs finish:
+    // run,<entry1>,<entry2>,...,seconds,status
+    void run(const Sweep& sweep, RunFn fn, std::ostream& csv);
+
+private:
+    size_t m_cores_per_run;
+    size_t m_workers;
+};
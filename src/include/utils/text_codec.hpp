@@ -0,0 +1,227 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Header only: used by moldynam_utils streams and by the legacy moldynam library,
+// which do not link each other.
+
+// Read-only contents of a whole file, memory mapped on POSIX systems and read
+// at once elsewhere. Contents are not NUL terminated.
+class TextFile {
+public:
+    explicit TextFile(const std::string& filename)
+        : m_data(nullptr)
+        , m_size(0)
+        , m_mapped(false)
+        , m_open(false)
+    {
+#ifndef _WIN32
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        m_open = true;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                m_data = static_cast<const char*>(data);
+                m_size = st.st_size;
+                m_mapped = true;
+                // parsed once from start to end
+                madvise(data, m_size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+
+        if (m_mapped) {
+            return;
+        }
+#endif
+        std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+        if (!ifs.is_open()) {
+            return;
+        }
+
+        m_open = true;
+        m_buffer.resize(static_cast<size_t>(ifs.tellg()));
+        ifs.seekg(0);
+        ifs.read(m_buffer.data(), m_buffer.size());
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+
+    ~TextFile()
+    {
+#ifndef _WIN32
+        if (m_mapped) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+#endif
+    }
+
+    bool is_open() const { return m_open; }
+
+    const char* begin() const { return m_data; }
+    const char* end() const { return m_data + m_size; }
+    size_t size() const { return m_size; }
+
+private:
+    TextFile(const TextFile&);
+    TextFile& operator=(const TextFile&);
+
+    const char* m_data;
+    size_t m_size;
+    bool m_mapped;
+    bool m_open;
+    std::vector<char> m_buffer;
+};
+
+// Whitespace separated numbers without iostreams. Conversions are done by
+// strtof/strtod and snprintf, "C" locale is expected as for iostreams.
+class TextCodec {
+public:
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f'; }
+
+    // next token of [pos, end) into token, skips any whitespace before it
+    static bool nextToken(const char*& pos, const char* end, std::string& token)
+    {
+        while (pos < end && isSpace(*pos)) {
+            pos++;
+        }
+
+        const char* start = pos;
+        while (pos < end && !isSpace(*pos)) {
+            pos++;
+        }
+
+        token.assign(start, pos);
+        return start != pos;
+    }
+
+    // next number of [pos, end), skips any whitespace before it, false if there
+    // are no more tokens or token is not a number
+    template <class T>
+    static bool parseNext(const char*& pos, const char* end, T& value)
+    {
+        while (pos < end && isSpace(*pos)) {
+            pos++;
+        }
+        return parseToken(pos, end, value);
+    }
+
+    // exactly count numbers on the line [pos, line_end), false if the line
+    // contains anything else; line_end is the '\n' or end of text
+    template <class T>
+    static bool parseLine(const char* pos, const char* line_end, T* values, size_t count)
+    {
+        for (size_t i = 0; i < count; i++) {
+            while (pos < line_end && isSpace(*pos)) {
+                pos++;
+            }
+            if (!parseToken(pos, line_end, values[i])) {
+                return false;
+            }
+        }
+
+        while (pos < line_end && isSpace(*pos)) {
+            pos++;
+        }
+        return pos == line_end;
+    }
+
+    // starts of next `lines` lines beginning at pos, followed by the start of the line
+    // after them; returns number of lines found, it is less at the end of text
+    static size_t findLines(const char* pos, const char* end, size_t lines, std::vector<const char*>& starts)
+    {
+        starts.clear();
+        starts.reserve(lines + 1);
+        starts.push_back(pos);
+        while (starts.size() <= lines && pos < end) {
+            const char* eol = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+            pos = eol ? eol + 1 : end;
+            starts.push_back(pos);
+        }
+        return starts.size() - 1;
+    }
+
+    // end of a line found by findLines(), without '\n'
+    static const char* lineEnd(const char* line_start, const char* next_line_start)
+    {
+        return (next_line_start > line_start && next_line_start[-1] == '\n') ? next_line_start - 1 : next_line_start;
+    }
+
+    // same text as iostream default floating point format with given precision
+    static void appendNumber(std::string& out, double value, int precision)
+    {
+        char buf[32];
+        int len = std::snprintf(buf, sizeof(buf), "%.*g", precision, value);
+        out.append(buf, len);
+    }
+
+private:
+    // token is copied, text is not NUL terminated
+    static bool copyToken(const char*& pos, const char* end, char* buf, size_t buf_size)
+    {
+        const char* start = pos;
+        while (pos < end && !isSpace(*pos)) {
+            pos++;
+        }
+
+        size_t len = pos - start;
+        if (len == 0 || len >= buf_size) {
+            return false;
+        }
+
+        std::memcpy(buf, start, len);
+        buf[len] = '\0';
+        return true;
+    }
+
+    static bool parseToken(const char*& pos, const char* end, float& value)
+    {
+        char buf[64];
+        char* parsed = nullptr;
+        if (!copyToken(pos, end, buf, sizeof(buf))) {
+            return false;
+        }
+        value = std::strtof(buf, &parsed);
+        return *parsed == '\0';
+    }
+
+    static bool parseToken(const char*& pos, const char* end, double& value)
+    {
+        char buf[64];
+        char* parsed = nullptr;
+        if (!copyToken(pos, end, buf, sizeof(buf))) {
+            return false;
+        }
+        value = std::strtod(buf, &parsed);
+        return *parsed == '\0';
+    }
+
+    static bool parseToken(const char*& pos, const char* end, long& value)
+    {
+        char buf[64];
+        char* parsed = nullptr;
+        if (!copyToken(pos, end, buf, sizeof(buf))) {
+            return false;
+        }
+        value = std::strtol(buf, &parsed, 10);
+        return *parsed == '\0';
+    }
+};
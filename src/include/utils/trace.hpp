@@ -1,12 +1,23 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <vector>
 #include <platforms/platform.hpp>
 #include <utils/config/config.hpp>
 #include <utils/config/config_manager.hpp>
 #include <utils/config/trace_config.hpp>
+#include <utils/bounded_queue.hpp>
+#include <utils/frame.hpp>
 #include <utils/stream.hpp>
+#include <utils/trace_selection.hpp>
 
 using namespace md;
 
@@ -17,20 +28,67 @@ class TraceError : public std::runtime_error {
 class TraceConfig;
 class ParticleSystem;
 
+// Stores particle system state every iterations_threshold iterations.
+// In async mode the simulation thread only copies state into one of
+// preallocated frames, formatting and disk I/O are done by writer thread.
+//
+// Collector of a selection filters the state on the simulation thread, only
+// selected particles are queued. Frames of a spatial selection have varying
+// particle count, a line "iteration count id..." per frame is written to
+// filename + ".ids".
 class TraceCollector {
 public:
-    TraceCollector() : m_last_iteration(0), m_os(nullptr)
-    {
-        m_trace_conf = ConfigManager::Instance().getTraceConfig();
-        m_os = StreamFactory::Instance()->MakeTraceOStream(m_trace_conf);
-    }
+    TraceCollector();
+    explicit TraceCollector(TraceConfig conf);
+    // conf gives sink settings not covered by the selection, see TraceSelection::traceConfig()
+    TraceCollector(TraceConfig conf, const TraceSelectionConfig& selection);
 
+    // writes all queued frames
+    ~TraceCollector();
+
+    // callback is dropped when the collector is destroyed, par_sys may outlive it
     void attach(ParticleSystem& par_sys);
     void onInteration(ParticleSystem* pSys, size_t iteration);
 
+    // blocks until all queued frames are written
+    void flush();
+
+    // frames skipped due to "drop" backpressure policy
+    size_t droppedFrames() const { return m_dropped_frames; }
+
 private:
+    void init();
+    void writerLoop();
+    void writeFrame(const ParticleFrame& frame);
+    void rethrowWriterError();
+
+    // frame of the iteration, filtered by selection
+    void takeFrame(ParticleSystem* pSys, size_t iteration, ParticleFrame& frame);
+
     size_t m_last_iteration;
     TraceConfig m_trace_conf;
 
+    TraceSelection m_selection;
+    // whole state before selection, used on simulation thread
+    ParticleFrame m_snapshot;
+    ParticleFrame m_selected;
+    std::ofstream m_ids_os;
+
     ParticleOStreamPtr m_os;
+
+    std::vector<std::unique_ptr<ParticleFrame> > m_frames;
+    std::unique_ptr<BoundedQueue<ParticleFrame*> > m_free_frames;
+    std::unique_ptr<BoundedQueue<ParticleFrame*> > m_queued_frames;
+
+    std::thread m_writer;
+    std::exception_ptr m_writer_error;
+
+    std::mutex m_pending_mutex;
+    std::condition_variable m_pending_cv;
+    size_t m_pending_frames;
+
+    std::atomic<size_t> m_dropped_frames;
+
+    // keeps callbacks of attach() registered
+    IterationCbOwner m_cb_owner;
 };
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+class TraceCodecError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Lossy codec of one field of binary trace frames.
+//
+// Values are quantized to integers of `quantum` absolute precision,
+// so decoded values differ from original ones by at most quantum / 2.
+// Quantized values are encoded as difference to the previous frame
+// (to zero for keyframes), zigzag mapped, split into byte planes and run
+// length encoded. Motion between frames is small compared to positions,
+// so high byte planes are mostly zero runs.
+//
+// Values are processed in independent blocks in parallel (OpenMP).
+// Encoded field:
+//   uint32_t block_count, uint32_t block_values, uint32_t size[block_count], blocks
+//
+// Codec keeps the previous frame, frames must be decoded in the order they
+// were encoded, starting from a keyframe.
+class TraceFrameCodec {
+public:
+    TraceFrameCodec(float quantum, size_t values, size_t block_values = 3 * 4096);
+
+    // returns true if frame is encoded as keyframe, the first frame and frames
+    // after an error always are; throws TraceCodecError if a value does not
+    // fit quantized range
+    bool encode(const float* values, bool keyframe, std::vector<uint8_t>& out);
+    // throws TraceCodecError for corrupted input or missing keyframe
+    void decode(const uint8_t* data, size_t size, bool keyframe, float* values);
+
+    float quantum() const { return m_quantum; }
+    size_t values() const { return m_reference.size(); }
+
+private:
+    size_t blockCount() const { return (m_reference.size() + m_block_values - 1) / m_block_values; }
+
+    float m_quantum;
+    size_t m_block_values;
+    bool m_has_reference;
+
+    // quantized values of previous frame
+    std::vector<int32_t> m_reference;
+    // per block scratch, capacity is reused
+    std::vector<std::vector<uint8_t> > m_blocks;
+};
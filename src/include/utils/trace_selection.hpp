@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include <platforms/native/types.hpp>
+#include <utils/config/trace_config.hpp>
+#include <utils/config/trace_selection_config.hpp>
+#include <utils/frame.hpp>
+#include <utils/stream.hpp>
+
+// Particles and fields of a frame chosen by TraceSelectionConfig.
+// Candidates of the id range are tested against the region with a branch-free
+// loop over blocks of particles, selected ones are then gathered in parallel.
+class TraceSelection {
+public:
+    // every particle and field
+    TraceSelection();
+    explicit TraceSelection(const TraceSelectionConfig& conf);
+
+    // selects every particle and field, frames can be traced as they are
+    bool all() const;
+    // particle count may change from frame to frame
+    bool spatial() const { return m_region != region_none; }
+
+    StreamIgnore ignoreFlags() const;
+
+    // sphere uses minimum image distance in periodic area
+    void setArea(md::float3 area_size, bool periodic);
+
+    // out gets iteration, ids and selected fields of frame particles, other fields are cleared
+    void apply(const ParticleFrame& frame, ParticleFrame& out);
+
+    // trace config of the selection sink, other settings come from base
+    static TraceConfig traceConfig(const TraceSelectionConfig& conf, TraceConfig base);
+
+private:
+    enum Region { region_none, region_box, region_sphere };
+
+    void selectIds(const ParticleFrame& frame, std::vector<size_t>& ids);
+
+    size_t m_id_begin;
+    size_t m_id_end;
+    size_t m_id_stride;
+    StreamIgnore m_ignore_flags;
+
+    Region m_region;
+    md::float3 m_box_min;
+    md::float3 m_box_max;
+    md::float3 m_sphere_center;
+    float m_sphere_radius;
+
+    md::float3 m_area;
+    bool m_periodic;
+
+    // per candidate: 1 if inside the region
+    std::vector<unsigned char> m_mask;
+    // selected particles before each block of candidates
+    std::vector<size_t> m_block_offsets;
+};
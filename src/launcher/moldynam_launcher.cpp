@@ -1,21 +1,39 @@
 #include <boost/program_options.hpp>
 #include <boost/throw_exception.hpp>
+#include <algorithm>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
+#include <iterator>
 #include <memory>
 
+#include <omp.h>
+
 #include <utils/trace.hpp>
+#include <utils/checkpoint.hpp>
+#include <utils/frame_ring.hpp>
+#include <utils/observables_collector.hpp>
+#include <utils/sweep.hpp>
 #include <utils/config/config_manager.hpp>
 #include <platforms/platform.hpp>
 #include <platforms/native/native_platform.hpp>
 #include <platforms/opencl/opencl_platform.hpp>
+#include <platforms/opencl/multi_device_platform.hpp>
+#include <platforms/opencl/program_cache.hpp>
+#include <platforms/opencl/profiler.hpp>
+#include <platforms/opencl/tuning.hpp>
 #include <platforms/tbb/tbb_platform.hpp>
+#include <platforms/hybrid/hybrid_platform.hpp>
 
 
 namespace po = boost::program_options;
 
-void moldynam(std::vector<std::string> configs, std::string platform, size_t iterations, std::string output);
+void moldynam(std::vector<std::string> configs, std::string platform, size_t iterations, std::string output,
+              bool autotune, std::string restart, bool overwrite);
+void moldynam_sweep(std::vector<std::string> configs, std::string platform, size_t iterations, std::string output,
+                    std::vector<std::string> ranges, size_t cores_per_run, std::string sweep_result);
 
 int main(int argc, char** argv)
 {
@@ -24,15 +42,33 @@ int main(int argc, char** argv)
         std::vector<std::string> config_files;
         std::string output_file;
         std::string platform;
+        std::vector<std::string> sweep_ranges;
+        size_t cores_per_run = 1;
+        std::string sweep_result;
+        bool autotune = false;
+        std::string restart_file;
+        bool overwrite = false;
 
         // named arguments
         po::options_description desc("Allowed options");
         desc.add_options()
             ("help", "produce help message")
             ("iterations", po::value<int>(&iterations)->required(), "number of iterations")
-            ("config,c", po::value<std::vector<std::string> >(&config_files)->required()->multitoken(), "path to particle system config")
+            ("config,c", po::value<std::vector<std::string> >(&config_files)->multitoken(),
+             "path to particle system config, required unless restarting")
             ("output,o", po::value<std::string>(&output_file), "path to result data file")
-            ("platform,p", po::value<std::string>(&platform)->default_value("native"), "platform usage: native, opencl, tbb")
+            ("platform,p", po::value<std::string>(&platform)->default_value("native"), "platform usage: native, opencl, opencl_multi, tbb, hybrid")
+            ("sweep", po::value<std::vector<std::string> >(&sweep_ranges)->multitoken(),
+             "run parameter sweep over config entries: entry=begin:end:step or entry=v1,v2,...; "
+             "entries of several configs need the ConfigName.entry form")
+            ("cores-per-run", po::value<size_t>(&cores_per_run)->default_value(1), "number of cores used by each sweep run")
+            ("sweep-result", po::value<std::string>(&sweep_result)->default_value("sweep.csv"), "path to aggregated sweep results")
+            ("autotune", po::bool_switch(&autotune), "tune OpenCL kernels before run, see OpenCLConfig.tuning_profile_dir")
+            ("restart", po::value<std::string>(&restart_file),
+             "continue run from checkpoint, see CheckpointConfig; configs given with it override saved ones "
+             "and iterations is the total number of iterations of the run")
+            ("overwrite", po::bool_switch(&overwrite),
+             "restart even if trace or observables files exist, they are written from the checkpoint iteration")
         ;
 
         // positional arguments
@@ -51,10 +87,23 @@ int main(int argc, char** argv)
 
         po::notify(vm);
 
-        if (platform != "native" && platform != "opencl" && platform != "tbb") {
+        if (platform != "native" && platform != "opencl" && platform != "opencl_multi" &&
+            platform != "tbb" && platform != "hybrid") {
             throw po::error("invalid value for platform: " + platform);
         }
 
+        if (config_files.empty() && restart_file.empty()) {
+            throw po::error("the option '--config' is required but missing");
+        }
+
+        if (!restart_file.empty() && !sweep_ranges.empty()) {
+            throw po::error("restart is not supported for sweep");
+        }
+
+        if (autotune && (platform != "opencl" || !sweep_ranges.empty())) {
+            throw po::error("autotune is supported only for single opencl run");
+        }
+
         std::cout << "Selected platform: " << platform << std::endl;
         std::cout << "Iterations: " << iterations << std::endl;
         std::cout << "Output: " << ((output_file == "") ? "none" : output_file) << std::endl;
@@ -63,8 +112,16 @@ int main(int argc, char** argv)
             std::cout << conf << " ";
         }
         std::cout << std::endl;
+        if (!restart_file.empty()) {
+            std::cout << "Restart: " << restart_file << std::endl;
+        }
 
-        moldynam(config_files, platform, iterations, output_file);
+        if (sweep_ranges.empty()) {
+            moldynam(config_files, platform, iterations, output_file, autotune, restart_file, overwrite);
+        } else {
+            moldynam_sweep(config_files, platform, iterations, output_file,
+                           sweep_ranges, cores_per_run, sweep_result);
+        }
 
     } catch (boost::program_options::error& po_error) {
         std::cerr << po_error.what() << std::endl;
@@ -74,31 +131,180 @@ int main(int argc, char** argv)
     }
 }
 
-void moldynam(std::vector<std::string> configs, std::string platform, size_t iterations, std::string output)
+std::unique_ptr<ParticleSystem> make_particle_system(std::string platform, ParticleSystemConfig psys_conf)
 {
-    ConfigManager& conf_man = ConfigManager::Instance();
-    for (auto& conf : configs) {
-        conf_man.loadFromFile(conf);
-    }
-
-    ParticleSystemConfig psys_conf = conf_man.getParticleSystemConfig();
-
     std::unique_ptr<ParticleSystem> psys;
     if (platform == "native") {
         psys.reset(new NativeParticleSystem(psys_conf));
     } else if (platform == "opencl") {
         psys.reset(new OpenCLParticleSystem(psys_conf));
+    } else if (platform == "opencl_multi") {
+        psys.reset(new OpenCLMultiDeviceParticleSystem(psys_conf));
     } else if (platform == "tbb") {
         psys.reset(new TBBParticleSystem(psys_conf));
+    } else if (platform == "hybrid") {
+        psys.reset(new HybridParticleSystem(psys_conf));
     }
 
     psys->setIntegrationAlg(IntegrationAlg::Verlet);
     psys->setPotentialAlg(PotentialAlg::LennardJones);
 
+    return psys;
+}
+
+// before any OpenCL queue is created
+void setup_opencl_profiler(const OpenCLConfig& conf)
+{
+    OpenCLProfiler& profiler = OpenCLProfiler::Instance();
+    profiler.setEnabled(conf.profiling);
+    profiler.setTimeline(conf.profile_timeline.value() != "");
+}
+
+void save_opencl_profile(const OpenCLConfig& conf)
+{
+    if (!conf.profiling) {
+        return;
+    }
+
+    OpenCLProfiler::Instance().save(conf.profile_file, conf.profile_timeline);
+    std::cout << "OpenCL profile: " << conf.profile_file.value() << ".json" << std::endl;
+}
+
+// OpenCL entries the shared context, program cache, tuning profiles and profiler
+// are set up from, a sweep run can not change them
+bool is_shared_opencl_entry(std::string entry)
+{
+    static const char* shared[] = { "device_type", "device_vendor", "device_index", "device_count",
+                                    "sub_devices", "sub_device_units", "program_cache_dir",
+                                    "tuning_profile_dir", "profiling", "profile_file", "profile_timeline" };
+
+    size_t dot = entry.find('.');
+    if (dot != std::string::npos) {
+        if (entry.substr(0, dot) != OpenCLConfig().name()) {
+            return false;
+        }
+        entry = entry.substr(dot + 1);
+    }
+
+    return std::find(std::begin(shared), std::end(shared), entry) != std::end(shared);
+}
+
+// trace and observables files of enabled collectors, collectors truncate them when opened
+std::vector<std::string> collector_files(ConfigManager& conf_man)
+{
+    std::vector<std::string> files;
+
+    TraceConfig trace_conf = conf_man.getTraceConfig();
+    if (trace_conf.enabled) {
+        files.push_back(trace_conf.filename.value());
+    }
+    for (auto& selection : conf_man.getTraceSelectionConfigs()) {
+        files.push_back(selection.filename.value());
+        files.push_back(selection.filename.value() + ".ids");
+    }
+
+    ObservablesConfig observables_conf = conf_man.getObservablesConfig();
+    if (observables_conf.enabled) {
+        files.push_back(observables_conf.filename.value());
+    }
+
+    return files;
+}
+
+std::string read_config(std::string filename)
+{
+    std::ifstream ifs(filename);
+    if (ifs.fail()) {
+        throw std::runtime_error("Unable to open config: " + filename);
+    }
+
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+void moldynam(std::vector<std::string> configs, std::string platform, size_t iterations, std::string output,
+              bool autotune, std::string restart, bool overwrite)
+{
+    ConfigManager& conf_man = ConfigManager::Instance();
+
+    // text of all configs in load order goes to checkpoints
+    std::string config_text;
+    Checkpoint checkpoint;
+    if (restart != "") {
+        checkpoint = Checkpoint::load(restart);
+        config_text = checkpoint.config;
+
+        std::istringstream iss(config_text);
+        conf_man.loadFromStream(iss);
+    }
+
+    for (auto& conf : configs) {
+        std::string contents = read_config(conf);
+        if (!contents.empty() && contents[contents.size() - 1] != '\n') {
+            contents += '\n';
+        }
+
+        std::istringstream iss(contents);
+        conf_man.loadFromStream(iss);
+        config_text += contents;
+    }
+
+    ParticleSystemConfig psys_conf = conf_man.getParticleSystemConfig();
+    if (restart != "") {
+        // particles come from checkpoint
+        psys_conf.init_file = "";
+        psys_conf.init_generator = "";
+        psys_conf.particles_num = checkpoint.state.size();
+
+        size_t done = checkpoint.state.iteration;
+        std::cout << "Restarted at iteration: " << done << std::endl;
+        iterations = (iterations > done) ? iterations - done : 0;
+
+        // files hold iterations before the checkpoint, restart would replace them
+        for (auto& file : collector_files(conf_man)) {
+            if (!overwrite && std::ifstream(file).good()) {
+                throw std::runtime_error("Restart would overwrite " + file + ", move it or use --overwrite");
+            }
+        }
+    }
+
+    OpenCLProgramCache::Instance().setCacheDir(conf_man.getOpenCLConfig().program_cache_dir);
+    OpenCLTuningProfiles::Instance().setProfileDir(conf_man.getOpenCLConfig().tuning_profile_dir);
+    setup_opencl_profiler(conf_man.getOpenCLConfig());
+
+    std::unique_ptr<ParticleSystem> psys = make_particle_system(platform, psys_conf);
+    psys->setLennardJonesConfig(conf_man.getLennardJonesConfig());
+    if (restart != "") {
+        psys->restoreState(checkpoint.state);
+    }
+
+    if (autotune) {
+        OpenCLAutotuner(dynamic_cast<OpenCLParticleSystem&>(*psys)).run(std::cout);
+    }
+
     // disabled by default, use config to enable and setup
     TraceCollector trace;
     trace.attach(*psys);
 
+    // each selection traces its part of particles into its own file
+    std::vector<std::unique_ptr<TraceCollector> > selections;
+    for (auto& selection : conf_man.getTraceSelectionConfigs()) {
+        selections.emplace_back(new TraceCollector(conf_man.getTraceConfig(), selection));
+        selections.back()->attach(*psys);
+    }
+
+    ObservablesCollector observables;
+    observables.attach(*psys);
+
+    // disabled by default, live frames for the visualizer and other processes
+    FrameRingPublisher live;
+    live.attach(*psys);
+
+    // disabled by default, periodic and final checkpoints
+    CheckpointWriter checkpoints;
+    checkpoints.setConfigText(config_text);
+    checkpoints.attach(*psys);
 
     if (output != "") {
         psys_conf.result_file = output;
@@ -108,4 +314,116 @@ void moldynam(std::vector<std::string> configs, std::string platform, size_t ite
     psys->iterate(iterations);
 
     psys->storeParticles(result);
+    checkpoints.write(*psys);
+
+    save_opencl_profile(conf_man.getOpenCLConfig());
+}
+
+void moldynam_sweep(std::vector<std::string> configs, std::string platform, size_t iterations, std::string output,
+                    std::vector<std::string> ranges, size_t cores_per_run, std::string sweep_result)
+{
+    // read configs once, every run parses them from memory
+    std::vector<std::string> config_contents;
+    for (auto& conf : configs) {
+        config_contents.push_back(read_config(conf));
+    }
+
+    // OpenCL context (device selection), program cache, tuning profiles and profiler
+    // are shared by all runs. The context is created from the global config, so base
+    // configs are loaded into it before the first run.
+    ConfigManager& base_conf_man = ConfigManager::Instance();
+    for (auto& contents : config_contents) {
+        std::istringstream iss(contents);
+        base_conf_man.loadFromStream(iss);
+    }
+    OpenCLConfig base_opencl_conf = base_conf_man.getOpenCLConfig();
+    OpenCLProgramCache::Instance().setCacheDir(base_opencl_conf.program_cache_dir);
+    OpenCLTuningProfiles::Instance().setProfileDir(base_opencl_conf.tuning_profile_dir);
+    setup_opencl_profiler(base_opencl_conf);
+
+    // unknown and ambiguous entries fail here, before any run starts
+    Sweep sweep;
+    ConfigManager entries_check;
+    for (auto& range : ranges) {
+        SweepRange parsed = SweepRange::parse(range);
+        entries_check.setEntry(parsed.entry, parsed.values.front());
+        if (is_shared_opencl_entry(parsed.entry)) {
+            throw ConfigError("OpenCL setup is shared by all sweep runs, " + parsed.entry +
+                              " can only be set in config files");
+        }
+        sweep.addRange(parsed);
+    }
+
+    std::ofstream csv(sweep_result);
+    if (csv.fail()) {
+        throw std::runtime_error("Unable to open sweep result file: " + sweep_result);
+    }
+
+    SweepScheduler scheduler(cores_per_run);
+    std::cout << "Sweep runs: " << sweep.points().size() << ", concurrent runs: " << scheduler.workers()
+              << ", cores per run: " << scheduler.coresPerRun() << std::endl;
+
+    scheduler.run(sweep, [&](size_t run, const SweepPoint& point, size_t cores) {
+        ConfigManager conf_man;
+        for (auto& contents : config_contents) {
+            std::istringstream iss(contents);
+            conf_man.loadFromStream(iss);
+        }
+
+        for (auto& entry : point) {
+            conf_man.setEntry(entry.first, entry.second);
+        }
+
+        std::string suffix = "." + std::to_string(run);
+
+        ParticleSystemConfig psys_conf = conf_man.getParticleSystemConfig();
+        TraceConfig trace_conf = conf_man.getTraceConfig();
+        if (trace_conf.filename.value() != "") {
+            trace_conf.filename = trace_conf.filename.value() + suffix;
+        }
+
+        ObservablesConfig observables_conf = conf_man.getObservablesConfig();
+        observables_conf.filename = observables_conf.filename.value() + suffix;
+
+        // native platform uses OpenMP, tbb platform uses TBB, limit both
+        omp_set_num_threads(static_cast<int>(cores));
+        tbb::task_arena arena(static_cast<int>(cores));
+
+        arena.execute([&]() {
+            std::unique_ptr<ParticleSystem> psys = make_particle_system(platform, psys_conf);
+            psys->setLennardJonesConfig(conf_man.getLennardJonesConfig());
+
+            if (OpenCLParticleSystem* cl_sys = dynamic_cast<OpenCLParticleSystem*>(psys.get())) {
+                cl_sys->setOpenCLConfig(conf_man.getOpenCLConfig());
+            } else if (OpenCLMultiDeviceParticleSystem* multi_sys =
+                           dynamic_cast<OpenCLMultiDeviceParticleSystem*>(psys.get())) {
+                multi_sys->setOpenCLConfig(conf_man.getOpenCLConfig());
+            }
+
+            TraceCollector trace(trace_conf);
+            trace.attach(*psys);
+
+            std::vector<std::unique_ptr<TraceCollector> > selections;
+            for (auto& selection : conf_man.getTraceSelectionConfigs()) {
+                selection.filename = selection.filename.value() + suffix;
+                selections.emplace_back(new TraceCollector(trace_conf, selection));
+                selections.back()->attach(*psys);
+            }
+
+            ObservablesCollector observables(observables_conf);
+            observables.attach(*psys);
+
+            psys->iterate(iterations);
+
+            if (output != "") {
+                psys_conf.result_file = output + suffix;
+                psys->storeParticles(StreamFactory::Instance()->MakeResultOStream(psys_conf));
+            }
+        });
+    }, csv);
+
+    std::cout << "Sweep results: " << sweep_result << std::endl;
+
+    // aggregated over all runs
+    save_opencl_profile(base_opencl_conf);
 }
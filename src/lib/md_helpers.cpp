@@ -1,29 +1,119 @@
 #include <md_helpers.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <regex>
 #include <sstream>
+#include <sys/stat.h>
+
+#include <utils/text_codec.hpp>
+
+// molecules below this are not worth parallel parsing or formatting
+static const int parallel_molecules = 1024;
+static const size_t format_block = 4096;
+
+static bool parseMoleculeType(const std::string& str_type, Molecule_Type& type)
+{
+    if (str_type == "H") {
+        type = Molecule_Type::H;
+    } else if (str_type == "O") {
+        type = Molecule_Type::O;
+    } else if (str_type == "NO_TYPE") {
+        type = Molecule_Type::NO_TYPE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// same values as operator>>(Molecule&), false if text ends or a value is not a number
+static bool parseMolecule(const char*& pos, const char* end, Molecule& mol)
+{
+    std::string str_type;
+    TextCodec::nextToken(pos, end, str_type);
+    if (!parseMoleculeType(str_type, mol.type)) {
+        throw std::runtime_error("Unsupported molecule type: " + str_type);
+    }
+
+    double* values[9] = { &mol.pos.x,   &mol.pos.y,   &mol.pos.z,   &mol.speed.x, &mol.speed.y,
+                          &mol.speed.z, &mol.accel.x, &mol.accel.y, &mol.accel.z };
+    for (size_t i = 0; i < 9; i++) {
+        if (!TextCodec::parseNext(pos, end, *values[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// one molecule per line as written by write_molecules_to_file()
+static bool parseMoleculeLine(const char* pos, const char* line_end, Molecule& mol)
+{
+    std::string str_type;
+    TextCodec::nextToken(pos, line_end, str_type);
+    if (!parseMoleculeType(str_type, mol.type)) {
+        return false;
+    }
+
+    double values[9];
+    if (!TextCodec::parseLine(pos, line_end, values, 9)) {
+        return false;
+    }
+
+    mol.pos = double3(values[0], values[1], values[2]);
+    mol.speed = double3(values[3], values[4], values[5]);
+    mol.accel = double3(values[6], values[7], values[8]);
+    return true;
+}
+
+// one molecule per line in parallel, otherwise any layout of whitespace separated values
+static void parseMolecules(const char* pos, const char* end, std::vector<Molecule>& molecules)
+{
+    std::vector<const char*> lines;
+    bool lines_parsed = TextCodec::findLines(pos, end, molecules.size(), lines) == molecules.size();
+    if (lines_parsed) {
+        int count = static_cast<int>(molecules.size());
+
+        #pragma omp parallel for schedule(static) reduction(&&:lines_parsed) if (count >= parallel_molecules)
+        for (int i = 0; i < count; i++) {
+            const char* line_end = TextCodec::lineEnd(lines[i], lines[i + 1]);
+            lines_parsed = parseMoleculeLine(lines[i], line_end, molecules[i]) && lines_parsed;
+        }
+    }
+
+    if (lines_parsed) {
+        return;
+    }
+
+    for (size_t i = 0; i < molecules.size(); i++) {
+        if (!parseMolecule(pos, end, molecules[i])) {
+            break;
+        }
+    }
+}
 
 std::vector<Molecule> read_molecules_from_file(std::string filepath)
 {
-    std::ifstream file(filepath.c_str(), std::ifstream::in);
+    TextFile file(filepath);
 
     if (!file.is_open()) {
         throw std::runtime_error(
             "Error while opening file " + filepath + " for reading! Check if it exist and have correct permissions.");
     }
 
-    std::string line;
+    const char* pos = file.begin();
+    const char* end = file.end();
 
-    int lines_num = 0;
-    file >> lines_num;
+    long lines_num = 0;
+    if (!TextCodec::parseNext(pos, end, lines_num) || lines_num < 0) {
+        lines_num = 0;
+    }
 
-    std::vector<Molecule> molecules;
-    molecules.reserve(lines_num);
+    // rest of the count line
+    pos = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    pos = pos ? pos + 1 : end;
 
-    for (int i = 0; i < lines_num; i++) {
-        Molecule mol;
-        file >> mol;
-        molecules.push_back(mol);
-    }
+    std::vector<Molecule> molecules(lines_num);
+    parseMolecules(pos, end, molecules);
 
     return molecules;
 }
@@ -40,8 +130,31 @@ void write_molecules_to_file(std::vector<Molecule>& molecules,
 
     file << molecules.size() << std::endl;
 
-    for (unsigned int i = 0; i < molecules.size(); i++) {
-        file << molecules[i] << std::endl;
+    // same text as operator<<(Molecule), formatted in parallel blocks
+    const int precision = std::numeric_limits<double>::digits10;
+    int blocks = static_cast<int>((molecules.size() + format_block - 1) / format_block);
+    std::vector<std::string> chunks(blocks);
+
+    #pragma omp parallel for schedule(static) if (molecules.size() >= parallel_molecules)
+    for (int b = 0; b < blocks; b++) {
+        std::string& out = chunks[b];
+        size_t last = std::min(molecules.size(), (b + 1) * format_block);
+        for (size_t i = b * format_block; i < last; i++) {
+            const Molecule& mol = molecules[i];
+            out += mol.type == Molecule_Type::O ? "O" : "H";
+
+            const double values[9] = { mol.pos.x,   mol.pos.y,   mol.pos.z,   mol.speed.x, mol.speed.y,
+                                       mol.speed.z, mol.accel.x, mol.accel.y, mol.accel.z };
+            for (size_t k = 0; k < 9; k++) {
+                out += ' ';
+                TextCodec::appendNumber(out, values[k], precision);
+            }
+            out += '\n';
+        }
+    }
+
+    for (int b = 0; b < blocks; b++) {
+        file.write(chunks[b].data(), chunks[b].size());
     }
 }
 
@@ -68,15 +181,222 @@ std::istream& operator>>(std::istream& is, Molecule& molecule)
     return is;
 }
 
+// Sidecar layout, native byte order: header, uint64_t frame_begin[frames], uint64_t frame_end[frames]
+struct TraceIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t trace_size;
+    uint64_t trace_mtime;
+    uint64_t molecules;
+    uint64_t frames;
+};
+
+static_assert(sizeof(TraceIndexHeader) == 48, "Trace index header layout");
+
+static const char trace_index_magic[8] = { 'M', 'D', 'T', 'R', 'I', 'D', 'X', '\0' };
+static const uint32_t trace_index_version = 1;
+
+static bool traceFileStat(const std::string& path, uint64_t& size, uint64_t& mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+trace_index::trace_index()
+{
+    molecules_num = 0;
+    file_size = 0;
+    file_mtime = 0;
+}
+
+trace_index trace_index::open(std::string trace_path)
+{
+    uint64_t size = 0;
+    uint64_t mtime = 0;
+    if (!traceFileStat(trace_path, size, mtime)) {
+        throw std::runtime_error(
+            "Error while opening file " + trace_path + " for reading! Check if it exist and have correct permissions.");
+    }
+
+    trace_index index;
+    if (index.load(sidecar_path(trace_path), size, mtime)) {
+        return index;
+    }
+
+    index = build(trace_path);
+    index.save(sidecar_path(trace_path));
+    return index;
+}
+
+trace_index trace_index::build(std::string trace_path, uint64_t chunk_size)
+{
+    trace_index index;
+    if (!traceFileStat(trace_path, index.file_size, index.file_mtime)) {
+        throw std::runtime_error(
+            "Error while opening file " + trace_path + " for reading! Check if it exist and have correct permissions.");
+    }
+
+    TextFile file(trace_path);
+    if (!file.is_open()) {
+        throw std::runtime_error(
+            "Error while opening file " + trace_path + " for reading! Check if it exist and have correct permissions.");
+    }
+
+    const char* data = file.begin();
+    const char* pos = data;
+    long molecules = 0;
+    if (!TextCodec::parseNext(pos, file.end(), molecules) || molecules < 0) {
+        throw std::runtime_error("Molecules number not found in trace file " + trace_path);
+    }
+
+    index.molecules_num = molecules;
+    if (molecules == 0) {
+        return index;
+    }
+
+    uint64_t size = file.size();
+    chunk_size = std::max<uint64_t>(chunk_size, 1);
+    int chunks = static_cast<int>((size + chunk_size - 1) / chunk_size);
+
+    // lines ended before every chunk
+    std::vector<uint64_t> chunk_lines(chunks + 1, 0);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < chunks; c++) {
+        const char* p = data + c * chunk_size;
+        const char* chunk_end = data + std::min(size, (c + 1) * chunk_size);
+        uint64_t lines = 0;
+        while ((p = static_cast<const char*>(std::memchr(p, '\n', chunk_end - p))) != nullptr) {
+            lines++;
+            p++;
+        }
+        chunk_lines[c + 1] = lines;
+    }
+
+    for (int c = 0; c < chunks; c++) {
+        chunk_lines[c + 1] += chunk_lines[c];
+    }
+
+    // line 0 is molecules number, frame k takes lines [1 + k * period, (k + 1) * period)
+    // and is followed by an empty line. A frame is complete once that line is
+    // written, which also keeps the "total steps" line out of one molecule traces.
+    uint64_t period = molecules + 1;
+    std::vector<std::vector<uint64_t> > begins(chunks);
+    std::vector<std::vector<uint64_t> > ends(chunks);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < chunks; c++) {
+        const char* p = data + c * chunk_size;
+        const char* chunk_end = data + std::min(size, (c + 1) * chunk_size);
+        uint64_t line = chunk_lines[c];
+        while ((p = static_cast<const char*>(std::memchr(p, '\n', chunk_end - p))) != nullptr) {
+            p++;
+            if (line % period == 0) {
+                begins[c].push_back(p - data);
+            }
+            if ((line + 1) % period == 0 && p < data + size && (*p == '\n' || *p == '\r')) {
+                ends[c].push_back(p - data);
+            }
+            line++;
+        }
+    }
+
+    for (int c = 0; c < chunks; c++) {
+        index.frame_begin.insert(index.frame_begin.end(), begins[c].begin(), begins[c].end());
+        index.frame_end.insert(index.frame_end.end(), ends[c].begin(), ends[c].end());
+    }
+
+    // complete frames only
+    index.frame_begin.resize(index.frame_end.size());
+    return index;
+}
+
+bool trace_index::load(std::string index_path, uint64_t trace_size, uint64_t trace_mtime)
+{
+    std::ifstream is(index_path.c_str(), std::ios::in | std::ios::binary);
+    if (!is.is_open()) {
+        return false;
+    }
+
+    TraceIndexHeader header;
+    is.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!is.good() || std::memcmp(header.magic, trace_index_magic, sizeof(header.magic)) != 0 ||
+        header.version != trace_index_version || header.trace_size != trace_size ||
+        header.trace_mtime != trace_mtime || header.frames > trace_size) {
+        return false;
+    }
+
+    std::vector<uint64_t> begins(header.frames);
+    std::vector<uint64_t> ends(header.frames);
+    if (header.frames != 0) {
+        is.read(reinterpret_cast<char*>(&begins[0]), sizeof(uint64_t) * begins.size());
+        is.read(reinterpret_cast<char*>(&ends[0]), sizeof(uint64_t) * ends.size());
+    }
+
+    if (!is.good()) {
+        return false;
+    }
+
+    for (size_t k = 0; k < begins.size(); k++) {
+        if (begins[k] > ends[k] || ends[k] > trace_size) {
+            return false;
+        }
+    }
+
+    molecules_num = header.molecules;
+    file_size = trace_size;
+    file_mtime = trace_mtime;
+    frame_begin.swap(begins);
+    frame_end.swap(ends);
+    return true;
+}
+
+bool trace_index::save(std::string index_path) const
+{
+    TraceIndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, trace_index_magic, sizeof(header.magic));
+    header.version = trace_index_version;
+    header.trace_size = file_size;
+    header.trace_mtime = file_mtime;
+    header.molecules = molecules_num;
+    header.frames = frame_begin.size();
+
+    std::ofstream os(index_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!os.is_open()) {
+        return false;
+    }
+
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!frame_begin.empty()) {
+        os.write(reinterpret_cast<const char*>(&frame_begin[0]), sizeof(uint64_t) * frame_begin.size());
+        os.write(reinterpret_cast<const char*>(&frame_end[0]), sizeof(uint64_t) * frame_end.size());
+    }
+
+    os.flush();
+    return os.good();
+}
+
 trace_read::trace_read()
 {
     molecules_num = 0;
+    steps = 0;
+    total_steps = 0;
     active = false;
 }
 
 trace_read::trace_read(std::string filepath)
 {
     molecules_num = 0;
+    steps = 0;
+    total_steps = 0;
     this->open(filepath);
 }
 
@@ -93,129 +413,91 @@ void trace_read::open(std::string filepath)
         file.close();
     }
 
-    file.open(filepath.c_str(), std::ifstream::in);
+    file.open(filepath.c_str(), std::ifstream::in | std::ifstream::binary);
     if (!file.is_open()) {
         throw std::runtime_error(
             "Error while opening file " + filepath + " for reading! Check if it exist and have correct permissions.");
     }
 
+    index = trace_index::open(filepath);
+
     active = true;
-    file >> molecules_num;
-    total_steps = read_total_steps();
+    molecules_num = index.molecules();
+    total_steps = index.frames();
+    steps = 0;
 }
 
-size_t trace_read::read_total_steps()
+std::vector<Molecule> trace_read::read_frame(size_t frame)
 {
     if (!file.is_open()) {
         throw std::logic_error(
-            std::string("Cannot read file which was not opened"));
+            std::string("Cannot read file which is not opened at ") + std::string(__FILE__) + ":" + std::to_string(__LINE__));
     }
 
-    size_t initial_pos = file.tellg();
+    uint64_t begin = index.begin(frame);
+    std::string text(static_cast<size_t>(index.end(frame) - begin), '\0');
 
-    file.seekg(0, file.end);
-    size_t length = file.tellg();
-
-    for (int i = length - 2; i > 0; i--) {
-        file.seekg(i);
-        char c = file.get();
-        if (c == '\r' || c == '\n') { // new line?
-            break;
-        }
+    file.clear();
+    file.seekg(begin);
+    if (!text.empty()) {
+        file.read(&text[0], text.size());
     }
 
-    std::string total_steps_str;
-    std::getline(file, total_steps_str);
-
-    std::string substr = "total steps = ";
-    size_t substr_pos = total_steps_str.find(substr);
-    if (substr_pos != std::string::npos) {
-        total_steps_str = total_steps_str.substr(substr_pos + substr.length());
-    } else {
-        throw std::runtime_error("Total steps number not found in trace file");
+    if (!file.good()) {
+        throw std::runtime_error("Unable to read frame " + std::to_string(frame) + " of trace file");
     }
 
-    file.seekg(initial_pos);
-    return std::stoi(total_steps_str);
+    std::vector<Molecule> molecules(molecules_num);
+    parseMolecules(text.data(), text.data() + text.size(), molecules);
+    return molecules;
 }
 
 std::vector<Molecule> trace_read::initial()
 {
-
-    file.seekg(0, file.beg);
-    file >> molecules_num;
-
-    std::vector<Molecule> molecules(molecules_num);
-
-    for (size_t i = 0; i < molecules_num; i++) {
-        file >> molecules[i];
-    }
-
-    steps++;
-
-    return molecules;
+    steps = 0;
+    return next();
 }
 
 std::vector<Molecule> trace_read::next()
 {
-    if (!file.is_open()) {
-        throw std::logic_error(
-            std::string("Cannot read file which is not opened at ") + std::string(__FILE__) + ":" + std::to_string(__LINE__));
-    }
-
-    if (static_cast<size_t>(file.tellg()) == file.beg) {
-        return this->initial();
-    }
-
     if (total_steps == steps) {
         std::cout << "trace_read reached end of the file" << std::endl;
         active = false;
         return std::vector<Molecule>();
-    } else {
-        std::vector<Molecule> molecules(molecules_num);
-
-        for (size_t i = 0; i < molecules_num; i++) {
-            file >> molecules[i];
-        }
-        steps++;
+    }
 
-        if (total_steps == steps) {
-            std::cout << "trace_read reached end of the file" << std::endl;
-            active = false;
-        }
+    std::vector<Molecule> molecules = read_frame(steps);
+    steps++;
 
-        return molecules;
+    if (total_steps == steps) {
+        std::cout << "trace_read reached end of the file" << std::endl;
+        active = false;
     }
+
+    return molecules;
 }
 
 std::vector<Molecule> trace_read::final()
 {
-    if (!file.is_open()) {
-        throw std::logic_error(
-            std::string("Cannot read file which is not opened at ") + std::string(__FILE__) + ":" + std::to_string(__LINE__));
-    }
-
-    file.seekg(file.end);
-    size_t length = file.tellg();
-
-    size_t lines_end_num = 0; // counting lines from the end of the file
-    // once we reach the beginning of last group -- read it
-
-    /* total steps + empty line*/
-    for (int i = length - 2; i > 0 && lines_end_num < molecules_num + 2; i--) {
-        file.seekg(i);
-        char c = file.get();
-        if (c == '\r' || c == '\n') { // new line?
-            lines_end_num++;
-        }
+    if (total_steps == 0) {
+        return std::vector<Molecule>();
     }
 
-    std::vector<Molecule> molecules(molecules_num);
+    std::vector<Molecule> molecules = read_frame(total_steps - 1);
+    steps = total_steps;
+    return molecules;
+}
 
-    for (size_t i = 0; i < molecules_num; i++) {
-        file >> molecules[i];
+std::vector<Molecule> trace_read::seek(size_t frame)
+{
+    if (frame >= total_steps) {
+        throw std::out_of_range("Trace has " + std::to_string(total_steps) + " frames, frame " +
+                                std::to_string(frame) + " requested");
     }
 
+    std::vector<Molecule> molecules = read_frame(frame);
+    steps = frame + 1;
+    active = steps != total_steps;
     return molecules;
 }
 
@@ -0,0 +1,105 @@
+#include <platforms/hybrid/hybrid_platform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+
+// keep at least this share on each side, otherwise it cannot be measured
+static const double min_ratio = 0.01;
+static const double max_ratio = 1 - min_ratio;
+
+// weight of the last measurement, smooths noise in step times
+static const double tune_weight = 0.5;
+
+HybridParticleSystem::HybridParticleSystem() : m_cpu_ratio(0.5), m_auto_tune(true), m_device_pos(1), m_device_force(1)
+{
+}
+
+HybridParticleSystem::HybridParticleSystem(ParticleSystemConfig conf)
+    : TBBParticleSystem(conf)
+    , m_cpu_ratio(0.5)
+    , m_auto_tune(true)
+    , m_device_pos(1)
+    , m_device_force(1)
+{
+}
+
+void HybridParticleSystem::setCpuRatio(double ratio)
+{
+    m_cpu_ratio = std::min(std::max(ratio, 0.0), 1.0);
+}
+
+void HybridParticleSystem::applyLennardJonesInteraction()
+{
+    typedef std::chrono::steady_clock clock;
+
+    size_t num = m_pos.size();
+    size_t split = static_cast<size_t>(m_cpu_ratio * num + 0.5);
+    split = std::min(split, num);
+    size_t device_num = num - split;
+
+    std::future<double> device_part;
+    if (device_num > 0) {
+        if (m_device_pos.size() != num) {
+            m_device_pos = cl::float3vec(num);
+        }
+
+        if (m_device_force.size() != device_num) {
+            m_device_force = cl::float3vec(device_num);
+        }
+
+        m_kernel.set_constants(m_config, m_lj_config.getConstants());
+
+        device_part = std::async(std::launch::async, [this, num, split, device_num]() {
+            clock::time_point start = clock::now();
+
+            // same element layout on both sides, positions are copied as they are
+            m_device_pos.assign(m_pos.begin(), m_pos.end());
+
+            m_kernel.set_args(m_device_pos.buffer(), m_device_force.buffer(), num, split, device_num);
+            m_kernel.execute();
+
+            m_device_force.to_native(m_force);
+
+            std::chrono::duration<double> elapsed = clock::now() - start;
+            return elapsed.count();
+        });
+    }
+
+    clock::time_point cpu_start = clock::now();
+    if (split > 0) {
+        applyLennardJonesInteraction(0, split);
+    }
+    std::chrono::duration<double> cpu_time = clock::now() - cpu_start;
+
+    if (device_num == 0) {
+        return;
+    }
+
+    double device_time = device_part.get();
+
+    for (size_t i = 0; i < device_num; i++) {
+        m_accel[split + i] = m_force[i];
+    }
+
+    if (m_auto_tune) {
+        tune(split, cpu_time.count(), device_num, device_time);
+    }
+}
+
+void HybridParticleSystem::tune(size_t cpu_num, double cpu_time, size_t device_num, double device_time)
+{
+    if (cpu_num == 0 || device_num == 0 || cpu_time <= 0 || device_time <= 0) {
+        m_cpu_ratio = std::min(std::max(m_cpu_ratio, min_ratio), max_ratio);
+        return;
+    }
+
+    // every target particle costs the same (interacts with all particles),
+    // so balanced split is proportional to throughput of each side
+    double cpu_rate = cpu_num / cpu_time;
+    double device_rate = device_num / device_time;
+    double balanced = cpu_rate / (cpu_rate + device_rate);
+
+    m_cpu_ratio = (1 - tune_weight) * m_cpu_ratio + tune_weight * balanced;
+    m_cpu_ratio = std::min(std::max(m_cpu_ratio, min_ratio), max_ratio);
+}
@@ -8,7 +8,8 @@ NativeParticleSystem::NativeParticleSystem(ParticleSystemConfig conf) : Particle
 {
     size_t particles_num = m_config.particles_num;
     std::string init_file = m_config.init_file;
-    if (init_file != "") {
+    std::string init_generator = m_config.init_generator;
+    if (init_file != "" || init_generator != "") {
         if (particles_num == 0) {
             throw std::runtime_error("particles_num is not defined in config file!");
         }
@@ -21,10 +22,11 @@ NativeParticleSystem::NativeParticleSystem(ParticleSystemConfig conf) : Particle
 void NativeParticleSystem::loadParticles(float3vec&& pos, float3vec&& pos_prev,
                                          float3vec&& vel,float3vec&& accel)
 {
-    m_pos = pos;
-    m_pos_prev = pos_prev;
-    m_vel = vel;
-    m_accel = accel;
+    m_pos = std::move(pos);
+    m_pos_prev = std::move(pos_prev);
+    m_vel = std::move(vel);
+    m_accel = std::move(accel);
+    m_has_pos_prev = false;
 }
 
 void NativeParticleSystem::loadParticles(ParticleIStreamPtr is, size_t num)
@@ -33,10 +35,9 @@ void NativeParticleSystem::loadParticles(ParticleIStreamPtr is, size_t num)
     m_pos_prev.resize(num);
     m_vel.resize(num);
     m_accel.resize(num);
+    m_has_pos_prev = false;
 
-    for (size_t i = 0; i < num; i++) {
-        is->Read(m_pos[i], m_vel[i], m_accel[i]);
-    }
+    is->ReadFrame(m_pos.data(), m_vel.data(), m_accel.data(), num);
 }
 
 void NativeParticleSystem::loadParticles(ParticleIStreamPtr is)
@@ -46,9 +47,32 @@ void NativeParticleSystem::loadParticles(ParticleIStreamPtr is)
 
 void NativeParticleSystem::storeParticles(ParticleOStreamPtr os)
 {
-    for (size_t i = 0; i < m_pos.size(); i++) {
-        os->Write(m_pos[i], m_vel[i], m_accel[i]);
-    }
+    os->WriteFrame(m_pos.data(), m_vel.data(), m_accel.data(), m_pos.size());
+}
+
+void NativeParticleSystem::snapshot(ParticleFrame& frame)
+{
+    frame.pos = m_pos;
+    frame.vel = m_vel;
+    frame.accel = m_accel;
+}
+
+void NativeParticleSystem::saveState(ParticleState& state)
+{
+    state.pos = m_pos;
+    state.pos_prev = m_pos_prev;
+    state.vel = m_vel;
+    state.accel = m_accel;
+}
+
+void NativeParticleSystem::restoreState(const ParticleState& state)
+{
+    m_pos = state.pos;
+    m_pos_prev = state.pos_prev;
+    m_vel = state.vel;
+    m_accel = state.accel;
+    m_iteration = state.iteration;
+    m_has_pos_prev = true;
 }
 
 void NativeParticleSystem::applyPeriodicConditions()
@@ -85,7 +109,7 @@ void NativeParticleSystem::applyEulerIntegration()
 
     std::swap(m_pos, m_pos_prev);
 
-    bool periodic = false;
+    bool periodic = m_config.periodic;
     if (periodic) {
         applyPeriodicConditions();
     }
@@ -93,15 +117,19 @@ void NativeParticleSystem::applyEulerIntegration()
 
 void NativeParticleSystem::applyLennardJonesInteraction()
 {
-    bool periodic = false;
+    bool periodic = m_config.periodic;
     if (periodic) {
         periodicLennardJonesInteraction();
+        return;
     }
 
     auto lj_constants = m_lj_config.getConstants();
 
     #pragma omp parallel for 
     for (int i = 0; i < (int)m_pos.size(); i++) {
+        // forces are recomputed every pass, previous step must not leak in
+        m_accel[i] = float3(0, 0, 0);
+
         for (int j = 0; j < i; j++) {
             singleLennardJonesInteraction(m_pos[i], m_pos[j], m_accel[i], lj_constants);
         }
@@ -113,9 +141,84 @@ void NativeParticleSystem::applyLennardJonesInteraction()
 
 }
 
+Observables NativeParticleSystem::observe()
+{
+    float dt = m_config.dt;
+    float dt_inv = dt > 0 ? 1 / dt : 0;
+    auto lj_constants = m_lj_config.getConstants();
+    bool use_cutoff = m_config.use_cutoff;
+    float cutoff_sqr = 2.5f * 2.5f * lj_constants.get_sigma_pow_2<float>();
+    bool periodic = m_config.periodic;
+    float3 area_size = m_config.area_size;
+
+    double kinetic = 0;
+    double potential = 0;
+    double virial = 0;
+    double px = 0, py = 0, pz = 0;
+
+    int num = (int)m_pos.size();
+
+    #pragma omp parallel for reduction(+:kinetic,potential,virial,px,py,pz) schedule(dynamic, 16)
+    for (int i = 0; i < num; i++) {
+        float3 vel = (m_pos[i] - m_pos_prev[i]) * dt_inv;
+        kinetic += 0.5 * glm::dot(vel, vel);
+        px += vel.x;
+        py += vel.y;
+        pz += vel.z;
+
+        for (int j = i + 1; j < num; j++) {
+            float3 d = m_pos[i] - m_pos[j];
+            if (periodic) {
+                d -= area_size * glm::round(d / area_size);
+            }
+
+            float r_sqr = glm::dot(d, d);
+            if (use_cutoff && r_sqr > cutoff_sqr) {
+                continue;
+            }
+
+            float force_scalar = 0;
+            float pair_potential = 0;
+            computeLennardJonesForcePotential(r_sqr, lj_constants, force_scalar, pair_potential);
+
+            potential += pair_potential;
+            // r_ij * f_ij, force vector is direction * force_scalar
+            virial += sqrtf(r_sqr) * force_scalar;
+        }
+    }
+
+    Observables obs;
+    obs.kinetic_energy = kinetic;
+    obs.potential_energy = potential;
+    obs.temperature = Observables::temperatureOf(kinetic, m_pos.size());
+    obs.momentum = float3(px, py, pz);
+    obs.virial = virial;
+    return obs;
+}
+
+// Minimum image convention: every particle interacts with the nearest
+// periodic image of each other particle
 void NativeParticleSystem::periodicLennardJonesInteraction()
 {
+    auto lj_constants = m_lj_config.getConstants();
+    float3 area_size = m_config.area_size;
+
+    #pragma omp parallel for
+    for (int i = 0; i < (int)m_pos.size(); i++) {
+        m_accel[i] = float3(0, 0, 0);
+
+        for (int j = 0; j < (int)m_pos.size(); j++) {
+            if (j == i) {
+                continue;
+            }
+
+            float3 d = m_pos[i] - m_pos[j];
+            d -= area_size * glm::round(d / area_size);
 
+            // nearest image is the other particle placed at target - d
+            singleLennardJonesInteraction(m_pos[i], m_pos[i] - d, m_accel[i], lj_constants);
+        }
+    }
 }
 
 // Changes only target particle, other particle is not affected
@@ -227,7 +330,10 @@ void NativeParticleSystem::iterate(size_t iterations)
 {
     bool periodic = m_config.periodic;
 
-    applyEulerIntegration(); // to compute pos_prev
+    if (!m_has_pos_prev) {
+        applyEulerIntegration(); // to compute pos_prev
+        m_has_pos_prev = true;
+    }
 
     for (size_t i = 0; i < iterations; ++i) {
         applyLennardJonesInteraction();
@@ -239,4 +345,6 @@ void NativeParticleSystem::iterate(size_t iterations)
 
         invokeOnIteration(i);
     }
+
+    m_iteration += iterations;
 }
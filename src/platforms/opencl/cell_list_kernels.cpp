@@ -0,0 +1,393 @@
+#include <algorithm>
+#include <sstream>
+
+#include <platforms/opencl/opencl_platform.hpp>
+#include <platforms/opencl/opencl_dispatcher.hpp>
+#include <platforms/opencl/kernels.hpp>
+#include <platforms/opencl/tuning.hpp>
+#include <platforms/opencl/profiler.hpp>
+
+// work-items per scan work-group, every work-group scans twice as many elements
+static const size_t default_scan_wg = 128;
+
+CellListLennardJonesKernel::CellListLennardJonesKernel()
+    : m_scan_wg(0)
+    , m_num_particles(0)
+    , m_num_cells(0)
+{
+    m_grid.s[0] = m_grid.s[1] = m_grid.s[2] = 1;
+    m_grid.s[3] = 0;
+    m_inv_cell_size.s[0] = m_inv_cell_size.s[1] = m_inv_cell_size.s[2] = m_inv_cell_size.s[3] = 0;
+
+    m_source = std::string(periodic_kernel_source) + R"(
+    int3 cellCoord(float3 p, float4 inv_cell_size, int4 grid)
+    {
+        int3 c = convert_int3_sat_rtn(p * inv_cell_size.xyz);
+        return clamp(c, (int3)(0), grid.xyz - 1);
+    }
+
+    uint cellIndex(int3 c, int4 grid)
+    {
+        return (c.z * grid.y + c.y) * grid.x + c.x;
+    }
+
+    __kernel void CellCount(__global const float3* pos, __global uint* cell_of, __global uint* cell_count,
+                            uint num_particles, float4 inv_cell_size, int4 grid)
+    {
+        uint gid = get_global_id(0);
+        if (gid >= num_particles) {
+            return;
+        }
+
+        uint cell = cellIndex(cellCoord(pos[gid], inv_cell_size, grid), grid);
+        cell_of[gid] = cell;
+        atomic_inc(&cell_count[cell]);
+    }
+
+    // Exclusive in-place scan of 2 * SCAN_WG elements per work-group,
+    // total of every block goes to block_sums
+    __kernel __attribute__((reqd_work_group_size(SCAN_WG, 1, 1)))
+    void ScanBlocks(__global uint* data, __global uint* block_sums, uint size)
+    {
+        __local uint temp[2 * SCAN_WG];
+
+        uint lid = get_local_id(0);
+        uint block = get_group_id(0);
+        uint base = block * 2 * SCAN_WG;
+
+        uint ai = lid;
+        uint bi = lid + SCAN_WG;
+        temp[ai] = base + ai < size ? data[base + ai] : 0;
+        temp[bi] = base + bi < size ? data[base + bi] : 0;
+
+        uint offset = 1;
+        for (uint d = SCAN_WG; d > 0; d >>= 1) {
+            barrier(CLK_LOCAL_MEM_FENCE);
+            if (lid < d) {
+                uint a = offset * (2 * lid + 1) - 1;
+                uint b = offset * (2 * lid + 2) - 1;
+                temp[b] += temp[a];
+            }
+            offset <<= 1;
+        }
+
+        if (lid == 0) {
+            block_sums[block] = temp[2 * SCAN_WG - 1];
+            temp[2 * SCAN_WG - 1] = 0;
+        }
+
+        for (uint d = 1; d <= SCAN_WG; d <<= 1) {
+            offset >>= 1;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            if (lid < d) {
+                uint a = offset * (2 * lid + 1) - 1;
+                uint b = offset * (2 * lid + 2) - 1;
+                uint t = temp[a];
+                temp[a] = temp[b];
+                temp[b] += t;
+            }
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (base + ai < size) {
+            data[base + ai] = temp[ai];
+        }
+        if (base + bi < size) {
+            data[base + bi] = temp[bi];
+        }
+    }
+
+    __kernel void AddBlockOffsets(__global uint* data, __global const uint* block_sums, uint size)
+    {
+        uint gid = get_global_id(0);
+        if (gid < size) {
+            data[gid] += block_sums[gid / (2 * SCAN_WG)];
+        }
+    }
+
+    __kernel void CellScatter(__global const float3* pos, __global const uint* cell_of,
+                              __global const uint* cell_start, __global uint* cell_fill,
+                              __global float3* sorted_pos, __global uint* sorted_index, uint num_particles)
+    {
+        uint gid = get_global_id(0);
+        if (gid >= num_particles) {
+            return;
+        }
+
+        uint cell = cell_of[gid];
+        uint slot = cell_start[cell] + atomic_inc(&cell_fill[cell]);
+        sorted_pos[slot] = pos[gid];
+        sorted_index[slot] = gid;
+    }
+
+    __kernel void CellForces(__global const float3* sorted_pos, __global const uint* sorted_index,
+                             __global const uint* cell_start, __global const uint* cell_count,
+                             __global float3* force, uint num_particles, float4 inv_cell_size, int4 grid)
+    {
+        uint p = get_global_id(0);
+        if (p >= num_particles) {
+            return;
+        }
+
+        float3 target_pos = sorted_pos[p];
+        int3 c = cellCoord(target_pos, inv_cell_size, grid);
+    #ifdef PERIODIC
+        // adjacent cells wrap around, dimensions of less than 3 cells are searched whole
+        // so no cell is visited twice
+        int3 small = grid.xyz < 3;
+        int3 lo = select(c - 1, (int3)(0), small);
+        int3 hi = select(c + 1, grid.xyz - 1, small);
+    #else
+        int3 lo = max(c - 1, (int3)(0));
+        int3 hi = min(c + 1, grid.xyz - 1);
+    #endif
+
+        float3 sum = (float3)(0.0f);
+
+        for (int z = lo.z; z <= hi.z; ++z) {
+            for (int y = lo.y; y <= hi.y; ++y) {
+                for (int x = lo.x; x <= hi.x; ++x) {
+    #ifdef PERIODIC
+                    uint cell = cellIndex(((int3)(x, y, z) + grid.xyz) % grid.xyz, grid);
+    #else
+                    uint cell = cellIndex((int3)(x, y, z), grid);
+    #endif
+                    uint start = cell_start[cell];
+                    uint end = start + cell_count[cell];
+
+                    for (uint j = start; j < end; ++j) {
+                        float3 d = target_pos - sorted_pos[j];
+    #ifdef PERIODIC
+                        d = minimumImage(d);
+    #endif
+                        float r_sqr = dot(d, d);
+
+                        if (j == p || r_sqr > cutoff_sqr) {
+                            continue;
+                        }
+
+                        float r_inv = rsqrt(r_sqr);
+                        float ri_sqr = r_inv * r_inv;
+                        float ri6 = ri_sqr * ri_sqr * ri_sqr;
+                        float force_scalar = 48 * eps * ri6 * ri_sqr * (sigma_pow_12 * ri6 - sigma_pow_6 / 2);
+
+                        sum += d * (r_inv * force_scalar);
+                    }
+                }
+            }
+        }
+
+        force[sorted_index[p]] = sum;
+    }
+    )";
+}
+
+void CellListLennardJonesKernel::setup_grid(float cutoff, size_t num_particles)
+{
+    md::float3 area = m_sys->config().area_size;
+
+    size_t dims[3];
+    for (int i = 0; i < 3; i++) {
+        // cell is never smaller than cutoff, so neighbours are in adjacent cells
+        dims[i] = (area[i] > 0 && cutoff > 0) ? std::max<size_t>(static_cast<size_t>(area[i] / cutoff), 1) : 1;
+    }
+
+    // more cells than particles only costs memory and scan time
+    size_t max_cells = std::max<size_t>(num_particles, 1);
+    while (dims[0] * dims[1] * dims[2] > max_cells) {
+        size_t* largest = std::max_element(dims, dims + 3);
+        *largest = (*largest + 1) / 2;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        m_grid.s[i] = static_cast<cl_int>(dims[i]);
+        m_inv_cell_size.s[i] = area[i] > 0 ? dims[i] / area[i] : 0;
+    }
+}
+
+void CellListLennardJonesKernel::resize(size_t num_particles, size_t num_cells)
+{
+    if (m_scan_wg == 0) {
+        size_t max_wg = get_device().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+
+        // scan requires power of two work-group
+        m_scan_wg = 1;
+        while (m_scan_wg * 2 <= std::min(default_scan_wg, max_wg)) {
+            m_scan_wg *= 2;
+        }
+    }
+
+    const cl::Context& context = OpenCLManager::Instance().getContext().context();
+
+    if (num_particles != m_num_particles) {
+        m_cell_of = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * num_particles);
+        m_sorted_pos = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float3) * num_particles);
+        m_sorted_index = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * num_particles);
+        m_num_particles = num_particles;
+    }
+
+    if (num_cells != m_num_cells) {
+        m_cell_count = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * num_cells);
+        m_cell_start = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * num_cells);
+        m_cell_fill = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * num_cells);
+
+        // block sums for every scan level until a single block remains
+        m_scan_sums.clear();
+        size_t block_elements = 2 * m_scan_wg;
+        for (size_t size = num_cells; ; ) {
+            size_t blocks = (size + block_elements - 1) / block_elements;
+            m_scan_sums.push_back(cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * blocks));
+            if (blocks == 1) {
+                break;
+            }
+            size = blocks;
+        }
+
+        m_num_cells = num_cells;
+    }
+}
+
+cl::Event CellListLennardJonesKernel::enqueue_scan(cl::Buffer& data, size_t size, size_t level,
+                                                   const std::string& build_options,
+                                                   const std::vector<cl::Event>* wait_list)
+{
+    size_t block_elements = 2 * m_scan_wg;
+    size_t blocks = (size + block_elements - 1) / block_elements;
+    cl::Buffer& block_sums = m_scan_sums[level];
+
+    cl::Kernel& scan = get_kernel("ScanBlocks", build_options);
+    scan.setArg(0, data());
+    scan.setArg(1, block_sums());
+    scan.setArg(2, (cl_uint) size);
+
+    std::vector<cl::Event> deps(1);
+    get_queue().enqueueNDRangeKernel(scan, cl::NDRange(0), cl::NDRange(blocks * m_scan_wg),
+                                     cl::NDRange(m_scan_wg), wait_list, &deps[0]);
+    OpenCLProfiler::Instance().record(scan, deps[0]);
+
+    if (blocks == 1) {
+        return deps[0];
+    }
+
+    deps[0] = enqueue_scan(block_sums, blocks, level + 1, build_options, &deps);
+
+    cl::Kernel& add = get_kernel("AddBlockOffsets", build_options);
+    add.setArg(0, data());
+    add.setArg(1, block_sums());
+    add.setArg(2, (cl_uint) size);
+
+    cl::Event event;
+    get_queue().enqueueNDRangeKernel(add, cl::NDRange(0), cl::NDRange(blocks * block_elements),
+                                     cl::NDRange(), &deps, &event);
+    OpenCLProfiler::Instance().record(add, event);
+    return event;
+}
+
+cl::Event CellListLennardJonesKernel::enqueue(cl::Buffer& pos, cl::Buffer& accel,
+                                              const std::vector<cl::Event>* wait_list)
+{
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to CellListLennardJonesKernel");
+    }
+
+    cl::CommandQueue& queue = get_queue();
+    size_t num = m_sys->pos().size();
+    if (num == 0) {
+        cl::Event event;
+        queue.enqueueMarkerWithWaitList(wait_list, &event);
+        return event;
+    }
+
+    LennardJonesConstants lj_constants = m_sys->lennardJonesConfig().getConstants();
+    float cutoff = 2.5f * lj_constants.get_sigma<float>();
+
+    setup_grid(cutoff, num);
+    size_t num_cells = size_t(m_grid.s[0]) * m_grid.s[1] * m_grid.s[2];
+    resize(num, num_cells);
+
+    // cell list kernels always check cutoff
+    ParticleSystemConfig conf = m_sys->config();
+    conf.use_cutoff = true;
+
+    std::stringstream ss;
+    ss << lennardJonesBuildOptions(conf, lj_constants) << " -DSCAN_WG=" << m_scan_wg;
+    std::string build_options = ss.str();
+
+    cl_uint num_particles = num;
+    std::vector<cl::Event> deps(1);
+
+    // 1. clear per-cell counters
+    std::vector<cl::Event> cleared(2);
+    queue.enqueueFillBuffer(m_cell_count, cl_uint(0), 0, sizeof(cl_uint) * num_cells, wait_list, &cleared[0]);
+    queue.enqueueFillBuffer(m_cell_fill, cl_uint(0), 0, sizeof(cl_uint) * num_cells, wait_list, &cleared[1]);
+
+    OpenCLProfiler& profiler = OpenCLProfiler::Instance();
+    profiler.record("fill:cell_counters", cleared[0]);
+    profiler.record("fill:cell_counters", cleared[1]);
+
+    // 2. cell of every particle and cell histogram
+    cl::Kernel& count = get_kernel("CellCount", build_options);
+    count.setArg(0, pos());
+    count.setArg(1, m_cell_of());
+    count.setArg(2, m_cell_count());
+    count.setArg(3, num_particles);
+    count.setArg(4, m_inv_cell_size);
+    count.setArg(5, m_grid);
+    queue.enqueueNDRangeKernel(count, cl::NDRange(0), cl::NDRange(num), cl::NDRange(), &cleared, &deps[0]);
+    profiler.record(count, deps[0]);
+
+    // 3. cell start = exclusive scan of counts
+    queue.enqueueCopyBuffer(m_cell_count, m_cell_start, 0, 0, sizeof(cl_uint) * num_cells, &deps, &deps[0]);
+    profiler.record("copy:cell_start", deps[0]);
+    deps[0] = enqueue_scan(m_cell_start, num_cells, 0, build_options, &deps);
+
+    // 4. counting sort of positions by cell
+    cl::Kernel& scatter = get_kernel("CellScatter", build_options);
+    scatter.setArg(0, pos());
+    scatter.setArg(1, m_cell_of());
+    scatter.setArg(2, m_cell_start());
+    scatter.setArg(3, m_cell_fill());
+    scatter.setArg(4, m_sorted_pos());
+    scatter.setArg(5, m_sorted_index());
+    scatter.setArg(6, num_particles);
+    queue.enqueueNDRangeKernel(scatter, cl::NDRange(0), cl::NDRange(num), cl::NDRange(), &deps, &deps[0]);
+    profiler.record(scatter, deps[0]);
+
+    // 5. forces from adjacent cells, written in original order
+    cl::Kernel& forces = get_kernel("CellForces", build_options);
+    forces.setArg(0, m_sorted_pos());
+    forces.setArg(1, m_sorted_index());
+    forces.setArg(2, m_cell_start());
+    forces.setArg(3, m_cell_count());
+    forces.setArg(4, accel());
+    forces.setArg(5, num_particles);
+    forces.setArg(6, m_inv_cell_size);
+    forces.setArg(7, m_grid);
+
+    KernelTuning tuning;
+    OpenCLTuningProfiles::Instance().find(get_device(), "CellForces", tuning);
+
+    size_t work_group_size = std::min<size_t>(tuning.work_group_size,
+                                              get_device().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+
+    cl::NDRange global(num);
+    cl::NDRange local;
+    if (work_group_size) {
+        global = cl::NDRange((num + work_group_size - 1) / work_group_size * work_group_size);
+        local = cl::NDRange(work_group_size);
+    }
+
+    cl::Event event;
+    queue.enqueueNDRangeKernel(forces, cl::NDRange(0), global, local, &deps, &event);
+    profiler.record(forces, event);
+    return event;
+}
+
+void CellListLennardJonesKernel::execute()
+{
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to CellListLennardJonesKernel");
+    }
+
+    enqueue(m_sys->pos().buffer(), m_sys->accel().buffer()).wait();
+}
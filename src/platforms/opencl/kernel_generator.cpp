@@ -0,0 +1,337 @@
+#include <platforms/opencl/kernel_generator.hpp>
+#include <platforms/opencl/kernels.hpp>
+
+#include <sstream>
+#include <stdexcept>
+
+KernelSpec::KernelSpec()
+    : integrator("verlet")
+    , potential("lennard_jones")
+    , periodic(false)
+    , cutoff(false)
+    , precision("single")
+    , energy(false)
+    , species(1)
+    , tiled(false)
+{
+}
+
+KernelSpec KernelSpec::FromConfig(const ParticleSystemConfig& conf, const OpenCLConfig& ocl_conf)
+{
+    KernelSpec spec;
+    spec.periodic = conf.periodic;
+    spec.cutoff = conf.use_cutoff;
+    spec.precision = ocl_conf.precision;
+    spec.tiled = ocl_conf.lj_kernel.value() == "tiled";
+    return spec;
+}
+
+std::string KernelSpec::key() const
+{
+    std::stringstream ss;
+    ss << integrator << "." << potential;
+    ss << (periodic ? ".periodic" : "") << (cutoff ? ".cutoff" : "");
+    ss << "." << precision << (energy ? ".energy" : "");
+    ss << ".s" << species << (tiled ? ".tiled" : "");
+    return ss.str();
+}
+
+static void validate(const KernelSpec& spec)
+{
+    if (spec.integrator != "verlet" && spec.integrator != "euler") {
+        throw std::runtime_error("Unsupported generated kernel integrator: " + spec.integrator);
+    }
+
+    if (spec.potential != "lennard_jones") {
+        throw std::runtime_error("Unsupported generated kernel potential: " + spec.potential);
+    }
+
+    if (spec.precision != "single" && spec.precision != "double") {
+        throw std::runtime_error("Unsupported generated kernel precision: " + spec.precision);
+    }
+
+    if (spec.species == 0) {
+        throw std::runtime_error("Generated kernel requires at least one species");
+    }
+}
+
+// pair force of the potential, cutoff and self interaction are masked, not branched
+static void emitPairForce(std::stringstream& src, const KernelSpec& spec)
+{
+    bool multi = spec.species > 1;
+
+    src << "inline real3 pairForce(float3 d, bool self";
+    src << (multi ? ", float4 coeffs" : "");
+    src << (spec.energy ? ", real* potential" : "");
+    src << ")\n{\n";
+
+    if (spec.periodic) {
+        src << "    d -= AREA * round(d / AREA);\n";
+    }
+
+    src << "    real3 dr = TO_REAL3(d);\n"
+           "    real r_sqr = self ? (real) 1 : dot(dr, dr);\n"
+           "    real ri_sqr = 1 / r_sqr;\n"
+           "    real ri6 = ri_sqr * ri_sqr * ri_sqr;\n"
+           "    real force_scalar = 48 * PAIR_EPS * ri6 * ri_sqr * (PAIR_SIGMA_12 * ri6 - PAIR_SIGMA_6 / 2);\n";
+
+    if (spec.cutoff) {
+        src << "    bool active = !self && r_sqr <= PAIR_CUTOFF_SQR;\n";
+    } else {
+        src << "    bool active = !self;\n";
+    }
+
+    src << "    force_scalar = active ? force_scalar : (real) 0;\n";
+
+    if (spec.energy) {
+        src << "    real pair_potential = 4 * PAIR_EPS * ri6 * (ri6 * PAIR_SIGMA_12 - PAIR_SIGMA_6);\n"
+               "    *potential += active ? pair_potential : (real) 0;\n";
+    }
+
+    src << "    return dr * (sqrt(ri_sqr) * force_scalar);\n"
+           "}\n\n";
+}
+
+static void emitSignature(std::stringstream& src, const KernelSpec& spec)
+{
+    if (spec.tiled) {
+        src << "__kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))\n";
+    } else {
+        src << "__kernel\n";
+    }
+
+    src << "void FusedStep(__global const float3* pos, __global float3* pos_prev, __global float3* accel";
+    if (spec.integrator == "euler") {
+        src << ",\n               __global const float3* vel";
+    }
+    if (spec.energy) {
+        src << ",\n               __global float* energy";
+    }
+    if (spec.species > 1) {
+        src << ",\n               __global const uint* species, __constant float4* pair_coeffs";
+    }
+    src << ",\n               uint num_particles)\n{\n";
+}
+
+// arguments of pairForce() after position difference and self flag
+static std::string pairArgs(const KernelSpec& spec, const std::string& other_species)
+{
+    std::string args;
+    if (spec.species > 1) {
+        args += ", pair_coeffs[target_species * SPECIES + " + other_species + "]";
+    }
+    if (spec.energy) {
+        args += ", &potential";
+    }
+    return args;
+}
+
+static void emitIntegration(std::stringstream& src, const KernelSpec& spec)
+{
+    src << "    float3 a = convert_float3(sum);\n"
+           "    accel[gid] = a;\n";
+
+    if (spec.energy) {
+        src << "    // every pair is visited from both particles\n"
+               "    energy[gid] = (float) (potential / 2);\n";
+    }
+
+    if (spec.integrator == "verlet") {
+        src << "    float3 next = 2 * target_pos - pos_prev[gid] + a * (DT * DT);\n";
+    } else {
+        src << "    float3 next = target_pos + vel[gid] * DT + a * (DT * DT);\n";
+    }
+
+    src << "    pos_prev[gid] = next;\n"
+           "}\n";
+}
+
+// Other work items still read pos of this step, so FusedStep leaves positions
+// unwrapped and this pass runs on the swapped buffers afterwards. Both positions
+// of a particle move by the same offset, as in NativeParticleSystem.
+static void emitPeriodicWrap(std::stringstream& src)
+{
+    src << "\n__kernel\n"
+           "void PeriodicWrap(__global float3* pos, __global float3* pos_prev, uint num_particles)\n"
+           "{\n"
+           "    uint gid = get_global_id(0);\n"
+           "    if (gid >= num_particles) {\n"
+           "        return;\n"
+           "    }\n\n"
+           "    float3 shift = AREA * floor(pos[gid] / AREA);\n"
+           "    pos[gid] -= shift;\n"
+           "    pos_prev[gid] -= shift;\n"
+           "}\n";
+}
+
+static void emitSimpleBody(std::stringstream& src, const KernelSpec& spec)
+{
+    src << "    uint gid = get_global_id(0);\n"
+           "    if (gid >= num_particles) {\n"
+           "        return;\n"
+           "    }\n\n"
+           "    float3 target_pos = pos[gid];\n";
+    if (spec.species > 1) {
+        src << "    uint target_species = species[gid];\n";
+    }
+    src << "    real3 sum = (real3)(0);\n";
+    if (spec.energy) {
+        src << "    real potential = 0;\n";
+    }
+
+    src << "\n    for (uint j = 0; j < num_particles; ++j) {\n"
+           "        sum += pairForce(target_pos - pos[j], j == gid" << pairArgs(spec, "species[j]") << ");\n"
+           "    }\n\n";
+}
+
+// same scheme as LennardJonesInteractionTiled
+static void emitTiledBody(std::stringstream& src, const KernelSpec& spec)
+{
+    src << "    __local float3 tile[TILE_SIZE];\n";
+    if (spec.species > 1) {
+        src << "    __local uint tile_species[TILE_SIZE];\n";
+    }
+
+    src << "\n    uint gid = get_global_id(0);\n"
+           "    uint lid = get_local_id(0);\n"
+           "    bool active = gid < num_particles;\n"
+           "    uint target = active ? gid : 0;\n\n"
+           "    float3 target_pos = pos[target];\n";
+    if (spec.species > 1) {
+        src << "    uint target_species = species[target];\n";
+    }
+    src << "    real3 sum = (real3)(0);\n";
+    if (spec.energy) {
+        src << "    real potential = 0;\n";
+    }
+
+    src << "\n    for (uint tile_start = 0; tile_start < num_particles; tile_start += TILE_SIZE) {\n"
+           "        for (uint k = lid; k < TILE_SIZE; k += WG_SIZE) {\n"
+           "            uint idx = tile_start + k;\n"
+           "            tile[k] = idx < num_particles ? pos[idx] : (float3)(0.0f);\n";
+    if (spec.species > 1) {
+        src << "            tile_species[k] = idx < num_particles ? species[idx] : 0;\n";
+    }
+    src << "        }\n\n"
+           "        barrier(CLK_LOCAL_MEM_FENCE);\n\n"
+           "        uint tile_len = min((uint) TILE_SIZE, num_particles - tile_start);\n"
+           "        uint k = 0;\n"
+           "        for (; k + UNROLL <= tile_len; k += UNROLL) {\n"
+           "            #pragma unroll\n"
+           "            for (uint u = 0; u < UNROLL; ++u) {\n"
+           "                sum += pairForce(target_pos - tile[k + u], tile_start + k + u == target"
+        << pairArgs(spec, "tile_species[k + u]") << ");\n"
+           "            }\n"
+           "        }\n\n"
+           "        for (; k < tile_len; ++k) {\n"
+           "            sum += pairForce(target_pos - tile[k], tile_start + k == target"
+        << pairArgs(spec, "tile_species[k]") << ");\n"
+           "        }\n\n"
+           "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+           "    }\n\n"
+           "    if (!active) {\n"
+           "        return;\n"
+           "    }\n\n";
+}
+
+std::string KernelGenerator::generate(const KernelSpec& spec)
+{
+    validate(spec);
+
+    std::stringstream src;
+    src << "// generated: " << spec.key() << "\n\n";
+
+    if (spec.precision == "double") {
+        src << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
+               "typedef double real;\n"
+               "typedef double3 real3;\n"
+               "#define TO_REAL3(v) convert_double3(v)\n\n";
+    } else {
+        src << "typedef float real;\n"
+               "typedef float3 real3;\n"
+               "#define TO_REAL3(v) (v)\n\n";
+    }
+
+    // build options are double literals, float vectors do not mix with them
+    src << "#define DT ((float) dt)\n\n";
+
+    if (spec.periodic) {
+        src << "#define AREA ((float3)(area_x, area_y, area_z))\n\n";
+    }
+
+    if (spec.species > 1) {
+        src << "#define SPECIES " << spec.species << "\n"
+               "#define PAIR_EPS coeffs.x\n"
+               "#define PAIR_SIGMA_6 coeffs.y\n"
+               "#define PAIR_SIGMA_12 coeffs.z\n"
+               "#define PAIR_CUTOFF_SQR coeffs.w\n\n";
+    } else {
+        src << "#define PAIR_EPS eps\n"
+               "#define PAIR_SIGMA_6 sigma_pow_6\n"
+               "#define PAIR_SIGMA_12 sigma_pow_12\n"
+               "#define PAIR_CUTOFF_SQR cutoff_sqr\n\n";
+    }
+
+    if (spec.tiled) {
+        src << "#ifndef UNROLL\n"
+               "#define UNROLL 1\n"
+               "#endif\n\n";
+    }
+
+    emitPairForce(src, spec);
+    emitSignature(src, spec);
+
+    if (spec.tiled) {
+        emitTiledBody(src, spec);
+    } else {
+        emitSimpleBody(src, spec);
+    }
+
+    emitIntegration(src, spec);
+
+    if (spec.periodic) {
+        emitPeriodicWrap(src);
+    }
+
+    return src.str();
+}
+
+const std::string& KernelGenerator::source(const KernelSpec& spec)
+{
+    std::string key = spec.key();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_sources.find(key);
+    if (found != m_sources.end()) {
+        return found->second;
+    }
+
+    return m_sources[key] = generate(spec);
+}
+
+size_t KernelGenerator::size()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_sources.size();
+}
+
+std::string KernelGenerator::buildOptions(const KernelSpec& spec, const ParticleSystemConfig& conf,
+                                          const LennardJonesConstants& lj_constants)
+{
+    std::stringstream ss;
+    ss << lennardJonesBuildOptions(conf, lj_constants);
+
+    ss.precision(9);
+    ss << " -Ddt=" << static_cast<float>(conf.dt);
+
+    if (spec.cutoff && !conf.use_cutoff) {
+        ss << " -Dcutoff_sqr=" << 2.5f * 2.5f * lj_constants.get_sigma_pow_2<float>();
+    }
+
+    if (spec.periodic && !conf.periodic) {
+        md::float3 area = conf.area_size;
+        ss << " -Darea_x=" << area.x << " -Darea_y=" << area.y << " -Darea_z=" << area.z;
+    }
+
+    return ss.str();
+}
@@ -1,11 +1,60 @@
+#include <algorithm>
 #include <sstream>
 
 #include <platforms/opencl/opencl_platform.hpp>
 #include <platforms/opencl/opencl_dispatcher.hpp>
 #include <platforms/opencl/kernels.hpp>
+#include <platforms/opencl/tuning.hpp>
+#include <platforms/opencl/profiler.hpp>
 
 #include <utils/config/config_manager.hpp>
 
+void OpenCLKernel::set_device(std::shared_ptr<OpenCLDevice> device)
+{
+    m_device = device;
+    m_kernels.clear();
+}
+
+std::shared_ptr<OpenCLDevice> OpenCLKernel::device()
+{
+    return m_device ? m_device : OpenCLDispatcher::Instance().getDeviceFor(*this);
+}
+
+cl::Kernel& OpenCLKernel::get_kernel(const char* name, const std::string& build_options)
+{
+    if (m_kernel_options != build_options) {
+        m_kernels.clear();
+        m_kernel_options = build_options;
+    }
+
+    auto found = m_kernels.find(name);
+    if (found != m_kernels.end()) {
+        return found->second;
+    }
+
+    cl::Program program = device()->CreateProgram(m_source, build_options.c_str());
+
+    return m_kernels[name] = cl::Kernel(program, name);
+}
+
+void OpenCLKernel::set_source(const std::string& source)
+{
+    if (m_source != source) {
+        m_source = source;
+        m_kernels.clear();
+    }
+}
+
+cl::CommandQueue& OpenCLKernel::get_queue()
+{
+    return device()->get_queue();
+}
+
+const cl::Device& OpenCLKernel::get_device()
+{
+    return device()->get_device();
+}
+
 HelloWorldKernel::HelloWorldKernel()
 {
     m_source = R"(__kernel void print() { printf("hello world!\n");})";
@@ -13,276 +62,640 @@ HelloWorldKernel::HelloWorldKernel()
 
 void HelloWorldKernel::execute()
 {
-    // TODO Implement common solution like cl::KernelFunctor from newest cl.hpp
-    // with arguments binding to avoid copy/paste this init stuff
-
-    OpenCLDispatcher::DevicePtr device =  OpenCLDispatcher::Instance().getDeviceFor(*this);
-
-    cl::Program program = device->CreateProgram(m_source);
-    cl::Kernel kernel(program, "print");
+    cl::Kernel& kernel = get_kernel("print");
 
     cl::Event event;
-    device->get_queue().enqueueNDRangeKernel(kernel, cl::NDRange(0),
-                                            cl::NDRange(4,4), cl::NDRange(2,2), NULL, &event);
+    get_queue().enqueueNDRangeKernel(kernel, cl::NDRange(0),
+                                     cl::NDRange(4,4), cl::NDRange(2,2), NULL, &event);
 
     event.wait();
 }
 
 
+const char* periodic_kernel_source = R"(
+    #ifdef PERIODIC
+    #define AREA ((float3)(area_x, area_y, area_z))
+
+    inline float3 minimumImage(float3 d)
+    {
+        return d - AREA * round(d / AREA);
+    }
+    #endif
+)";
+
+std::string periodicBuildOptions(const ParticleSystemConfig& conf)
+{
+    if (!conf.periodic) {
+        return "";
+    }
+
+    md::float3 area = conf.area_size;
+
+    std::stringstream ss;
+    ss.precision(9);
+    ss << " -DPERIODIC -Darea_x=" << area.x << " -Darea_y=" << area.y << " -Darea_z=" << area.z;
+    return ss.str();
+}
+
 VerletIntegrationKernel::VerletIntegrationKernel()
 {
-    m_source = R"(
+    m_source = std::string(periodic_kernel_source) + R"(
         __kernel void VerletIntegration(__global float3* pos, __global float3* pos_prev,
-                                        __global float3* accel, float dt)
+                                        __global const float3* accel, float dt)
         {
             int gid = get_global_id(0);
-            pos_prev[gid] = 2 * pos[gid] - pos_prev[gid] + accel[gid] * dt * dt;
+            float3 next = 2 * pos[gid] - pos_prev[gid] + accel[gid] * dt * dt;
+    #ifdef PERIODIC
+            // both positions move by the wrap offset, as in NativeParticleSystem
+            float3 shift = AREA * floor(next / AREA);
+            pos[gid] -= shift;
+            next -= shift;
+    #endif
+            pos_prev[gid] = next;
             // swap pos_prev and pos required after execution!
         }
     )";
 }
 
-void VerletIntegrationKernel::execute()
+cl::Event VerletIntegrationKernel::enqueue(cl::Buffer& pos, cl::Buffer& pos_prev, cl::Buffer& accel,
+                                           const std::vector<cl::Event>* wait_list)
 {
     if (!m_sys) {
         throw std::runtime_error("No particle system set to VerletIntegrationKernel");
     }
 
-    OpenCLDispatcher::DevicePtr device =  OpenCLDispatcher::Instance().getDeviceFor(*this);
+    set_config(m_sys->config());
+    return enqueue(pos, pos_prev, accel, m_sys->pos().size(), m_sys->config().dt, wait_list);
+}
 
-    cl::Program program = device->CreateProgram(m_source);
-    cl::Kernel kernel(program, "VerletIntegration");
+cl::Event VerletIntegrationKernel::enqueue(cl::Buffer& pos, cl::Buffer& pos_prev, cl::Buffer& accel,
+                                           size_t size, float dt, const std::vector<cl::Event>* wait_list)
+{
+    cl::Kernel& kernel = get_kernel("VerletIntegration", m_build_options);
 
-    kernel.setArg(0, m_sys->pos().buffer()());
-    kernel.setArg(1, m_sys->pos_prev().buffer()());
-    kernel.setArg(2, m_sys->accel().buffer()());
+    kernel.setArg(0, pos());
+    kernel.setArg(1, pos_prev());
+    kernel.setArg(2, accel());
+    kernel.setArg(3, (cl_float) dt);
 
-    cl_float dt = (float) m_sys->config().dt;
-    kernel.setArg(3, dt);
+    cl::Event event;
+    get_queue().enqueueNDRangeKernel(kernel, cl::NDRange(0),
+                                     cl::NDRange(size), cl::NDRange(), wait_list, &event);
+    OpenCLProfiler::Instance().record(kernel, event);
+    return event;
+}
 
-    size_t size = m_sys->pos().size();
+void VerletIntegrationKernel::set_config(const ParticleSystemConfig& conf)
+{
+    m_build_options = periodicBuildOptions(conf);
+}
 
-    cl::Event event;
-    device->get_queue().enqueueNDRangeKernel(kernel, cl::NDRange(0),
-                                            cl::NDRange(size), cl::NDRange(), NULL, &event);
-    event.wait();
+void VerletIntegrationKernel::execute()
+{
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to VerletIntegrationKernel");
+    }
+
+    enqueue(m_sys->pos().buffer(), m_sys->pos_prev().buffer(), m_sys->accel().buffer()).wait();
 }
 
 EulerIntegrationKernel::EulerIntegrationKernel()
 {
-    m_source = R"(
+    m_source = std::string(periodic_kernel_source) + R"(
         __kernel void EulerIntegration(__global float3* pos, __global float3* pos_prev,
-                                       __global float3* vel, __global float3* accel, float dt)
+                                       __global const float3* vel, __global const float3* accel, float dt)
         {
             int gid = get_global_id(0);
-            pos_prev[gid] = pos[gid] + vel[gid] * dt + accel[gid] * dt * dt;
+            float3 next = pos[gid] + vel[gid] * dt + accel[gid] * dt * dt;
+    #ifdef PERIODIC
+            // both positions move by the wrap offset, as in NativeParticleSystem
+            float3 shift = AREA * floor(next / AREA);
+            pos[gid] -= shift;
+            next -= shift;
+    #endif
+            pos_prev[gid] = next;
             // swap pos_prev and pos required after execution!
         }
     )";
 }
 
-void EulerIntegrationKernel::execute()
+cl::Event EulerIntegrationKernel::enqueue(cl::Buffer& pos, cl::Buffer& pos_prev, cl::Buffer& vel,
+                                          cl::Buffer& accel, const std::vector<cl::Event>* wait_list)
 {
     if (!m_sys) {
         throw std::runtime_error("No particle system set to EulerIntegrationKernel");
     }
 
-    OpenCLDispatcher::DevicePtr device =  OpenCLDispatcher::Instance().getDeviceFor(*this);
-
-    cl::Program program = device->CreateProgram(m_source);
-    cl::Kernel kernel(program, "EulerIntegration");
-
-    kernel.setArg(0, m_sys->pos().buffer()());
-    kernel.setArg(1, m_sys->pos_prev().buffer()());
-    kernel.setArg(2, m_sys->vel().buffer()());
-    kernel.setArg(3, m_sys->accel().buffer()());
+    set_config(m_sys->config());
+    return enqueue(pos, pos_prev, vel, accel, m_sys->pos().size(), m_sys->config().dt, wait_list);
+}
 
-    cl_float dt = (float) m_sys->config().dt;
-    kernel.setArg(4, dt);
+cl::Event EulerIntegrationKernel::enqueue(cl::Buffer& pos, cl::Buffer& pos_prev, cl::Buffer& vel,
+                                          cl::Buffer& accel, size_t size, float dt,
+                                          const std::vector<cl::Event>* wait_list)
+{
+    cl::Kernel& kernel = get_kernel("EulerIntegration", m_build_options);
 
-    size_t size = m_sys->pos().size();
+    kernel.setArg(0, pos());
+    kernel.setArg(1, pos_prev());
+    kernel.setArg(2, vel());
+    kernel.setArg(3, accel());
+    kernel.setArg(4, (cl_float) dt);
 
     cl::Event event;
-    device->get_queue().enqueueNDRangeKernel(kernel, cl::NDRange(0),
-                                            cl::NDRange(size), cl::NDRange(), NULL, &event);
-    event.wait();
+    get_queue().enqueueNDRangeKernel(kernel, cl::NDRange(0),
+                                     cl::NDRange(size), cl::NDRange(), wait_list, &event);
+    OpenCLProfiler::Instance().record(kernel, event);
+    return event;
 }
 
-LennardJonesInteractionKernel::LennardJonesInteractionKernel()
+void EulerIntegrationKernel::set_config(const ParticleSystemConfig& conf)
 {
-    m_source = R"(
-    inline float computeLennardJonesForce(float r)
-    {
-        float ri = 1 / r;
-        float ri3 = ri * ri * ri;
-        float ri6 = ri3 * ri3;
-
-        // eps and sigma passed as defines
+    m_build_options = periodicBuildOptions(conf);
+}
 
-        float force = 48 * eps * ri6 * ri * ri * (sigma_pow_12 * ri6 - sigma_pow_6 / 2);
-        return force;
+void EulerIntegrationKernel::execute()
+{
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to EulerIntegrationKernel");
     }
 
-    inline float computeLennardJonesPotential(float r)
+    enqueue(m_sys->pos().buffer(), m_sys->pos_prev().buffer(),
+            m_sys->vel().buffer(), m_sys->accel().buffer()).wait();
+}
+
+// Shared by LennardJonesInteractionKernel (offset 0, all particles)
+// and LennardJonesRangeKernel.
+// Forces of every target are summed in registers and written once,
+// so no work-item reads memory written by another one during the pass.
+static const char* lennard_jones_source = R"(
+    __kernel void LennardJonesInteraction(__global const float3* pos, __global float3* force,
+                                          uint num_particles, uint offset, uint count)
     {
-        float ri = 1 / r;
-        float ri3 = ri * ri * ri;
-        float ri6 = ri3 * ri3;
+        if (get_global_id(0) >= count) {
+            return;
+        }
+
+        uint target = offset + get_global_id(0);
+        float3 target_pos = pos[target];
+        float3 sum = (float3)(0.0f);
+
+        for (uint i = 0; i < num_particles; ++i) {
+            if (i == target) {
+                continue;
+            }
+
+            float3 d = target_pos - pos[i];
+    #ifdef PERIODIC
+            d = minimumImage(d);
+    #endif
+            float r_sqr = dot(d, d);
+
+    #ifdef USE_CUTOFF
+            if (r_sqr > cutoff_sqr) {
+                continue;
+            }
+    #endif
+
+            // same formula as NativeParticleSystem::computeLennardJonesForcePotential,
+            // eps and sigma passed as defines
+            float ri_sqr = 1 / r_sqr;
+            float ri6 = ri_sqr * ri_sqr * ri_sqr;
+            float force_scalar = 48 * eps * ri6 * ri_sqr * (sigma_pow_12 * ri6 - sigma_pow_6 / 2);
+
+            sum += d / sqrt(r_sqr) * force_scalar;
+        }
 
-        // eps and sigma passed as defines
-        float potential = 4 * eps * ri6 * (ri6 * sigma_pow_12 - sigma_pow_6);
-        return potential;
+        force[get_global_id(0)] = sum;
     }
 
-    float3 computeTargetAccel(float3 target_pos, float3 other_pos)
+    #ifndef WG_SIZE
+    #define WG_SIZE 64
+    #endif
+
+    #ifndef TILE_SIZE
+    #define TILE_SIZE WG_SIZE
+    #endif
+
+    #ifndef UNROLL
+    #define UNROLL 1
+    #endif
+
+    inline float3 tiledPairForce(float3 d, bool self)
     {
-        float r = distance(target_pos, other_pos);
+    #ifdef PERIODIC
+        d = minimumImage(d);
+    #endif
+        float r_sqr = dot(d, d);
 
-        float force = computeLennardJonesForce(r);
-        float potential = computeLennardJonesPotential(r);
+        // d is zero for the target itself, any finite r_sqr keeps its term zero
+        r_sqr = self ? 1.0f : r_sqr;
 
-        float3 force_direction = (target_pos - other_pos) / r;
-        float3 force_vec = force_direction * force;
+        float r_inv = rsqrt(r_sqr);
+        float ri_sqr = r_inv * r_inv;
+        float ri6 = ri_sqr * ri_sqr * ri_sqr;
+        float force_scalar = 48 * eps * ri6 * ri_sqr * (sigma_pow_12 * ri6 - sigma_pow_6 / 2);
 
-        return force_vec;
+    #ifdef USE_CUTOFF
+        force_scalar = r_sqr > cutoff_sqr ? 0.0f : force_scalar;
+    #endif
+
+        return d * (r_inv * force_scalar);
     }
 
-    __kernel void LennardJonesInteraction(__global float3* pos, __global float3* pos_prev,
-                                        __global float3* vel, __global float3* accel, uint num_particles)
+    // Work-group stages TILE_SIZE positions in local memory, then every
+    // work-item interacts its target with the whole tile.
+    // Global size is rounded up to WG_SIZE, extra work-items only help loading.
+    __kernel __attribute__((reqd_work_group_size(WG_SIZE, 1, 1)))
+    void LennardJonesInteractionTiled(__global const float3* pos, __global float3* force,
+                                      uint num_particles, uint offset, uint count)
     {
-        int gid = get_global_id(0);
+        __local float3 tile[TILE_SIZE];
+
+        uint gid = get_global_id(0);
+        uint lid = get_local_id(0);
+        bool active = gid < count;
+
+        uint target = active ? offset + gid : offset;
+        float3 target_pos = pos[target];
+        float3 sum = (float3)(0.0f);
 
-        for (size_t i = 0; i < gid; ++i) {
-            accel[gid] += computeTargetAccel(pos[gid], pos[i]);
+        for (uint tile_start = 0; tile_start < num_particles; tile_start += TILE_SIZE) {
+            for (uint k = lid; k < TILE_SIZE; k += WG_SIZE) {
+                uint idx = tile_start + k;
+                tile[k] = idx < num_particles ? pos[idx] : (float3)(0.0f);
+            }
+
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            uint tile_len = min((uint) TILE_SIZE, num_particles - tile_start);
+            uint k = 0;
+
+            // UNROLL interactions per iteration, constant inner loop is unrolled by compiler
+            for (; k + UNROLL <= tile_len; k += UNROLL) {
+                #pragma unroll
+                for (uint u = 0; u < UNROLL; ++u) {
+                    sum += tiledPairForce(target_pos - tile[k + u], tile_start + k + u == target);
+                }
+            }
+
+            for (; k < tile_len; ++k) {
+                sum += tiledPairForce(target_pos - tile[k], tile_start + k == target);
+            }
+
+            barrier(CLK_LOCAL_MEM_FENCE);
         }
 
-        for (size_t i = gid + 1; i < num_particles; ++i) {
-            accel[gid] += computeTargetAccel(pos[gid], pos[i]);
+        if (active) {
+            force[gid] = sum;
         }
     }
+)";
 
-    )";
+std::string lennardJonesBuildOptions(const ParticleSystemConfig& conf, const LennardJonesConstants& lj_constants)
+{
+    std::stringstream ss;
+    // enough digits to pass float constants exactly
+    ss.precision(9);
+    ss << " -Deps=" << lj_constants.get_eps<float>();
+    ss << " -Dsigma_pow_6=" << lj_constants.get_sigma_pow_6<float>();
+    ss << " -Dsigma_pow_12=" << lj_constants.get_sigma_pow_12<float>();
+
+    if (conf.use_cutoff) {
+        ss << " -DUSE_CUTOFF";
+        ss << " -Dcutoff_sqr=" << 2.5f * 2.5f * lj_constants.get_sigma_pow_2<float>();
+    }
+
+    ss << periodicBuildOptions(conf);
+
+    return ss.str();
 }
 
-void LennardJonesInteractionKernel::execute()
+// Work-group size of an all-pairs kernel, tiled kernels get WG_SIZE, TILE_SIZE
+// and UNROLL appended to build_options. Tuned device profile wins over config.
+static size_t tiledLaunchOptions(const cl::Device& device, const OpenCLConfig& ocl_conf, const char* kernel_name,
+                                 bool tiled, std::string& build_options)
 {
-    if (!m_sys) {
-        throw std::runtime_error("No particle system set to EulerIntegrationKernel");
+    KernelTuning tuning;
+    if (!OpenCLTuningProfiles::Instance().find(device, kernel_name, tuning) && tiled) {
+        tuning.work_group_size = ocl_conf.work_group_size;
+        tuning.tile_size = ocl_conf.tile_size;
+        tuning.unroll = ocl_conf.unroll;
     }
 
-    OpenCLDispatcher::DevicePtr device =  OpenCLDispatcher::Instance().getDeviceFor(*this);
+    size_t max_work_group_size = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    size_t work_group_size = std::min(tuning.work_group_size, max_work_group_size);
 
-    LennardJonesConfig lj_config = ConfigManager::Instance().getLennardJonesConfig();
-    LennardJonesConstants lj_constants = lj_config.getConstants();
+    if (tiled) {
+        work_group_size = work_group_size ? work_group_size : std::min<size_t>(64, max_work_group_size);
 
-    std::stringstream ss;
-    ss << " -Deps=" << lj_constants.get_eps<float>();
-    ss << " -Dsigma=" << lj_constants.get_sigma<float>();
-    ss << " -Dsigma_pow_6=" << lj_constants.get_sigma_pow_6<float>();
-    ss << " -Dsigma_pow_12=" << lj_constants.get_sigma_pow_12<float>();
+        // tile must stay a multiple of work-group size after clamping
+        size_t tile_size = tuning.tile_size;
+        tile_size = tile_size ? tile_size : work_group_size;
+        tile_size = std::max(tile_size / work_group_size, size_t(1)) * work_group_size;
 
-    if (m_sys->config().use_cutoff) {
-        ss << " -DUSE_CUTOFF";
+        std::stringstream ss;
+        ss << " -DWG_SIZE=" << work_group_size << " -DTILE_SIZE=" << tile_size
+           << " -DUNROLL=" << std::max<size_t>(tuning.unroll, 1);
+        build_options += ss.str();
+    }
+
+    return work_group_size;
+}
+
+// kernels check bounds, global size is rounded up to work-group
+static void enqueueRounded(cl::CommandQueue& queue, cl::Kernel& kernel, size_t size, size_t work_group_size,
+                           const std::vector<cl::Event>* wait_list, cl::Event* event)
+{
+    cl::NDRange global(size);
+    cl::NDRange local;
+    if (work_group_size) {
+        global = cl::NDRange((size + work_group_size - 1) / work_group_size * work_group_size);
+        local = cl::NDRange(work_group_size);
+    }
+
+    queue.enqueueNDRangeKernel(kernel, cl::NDRange(0), global, local, wait_list, event);
+    OpenCLProfiler::Instance().record(kernel, *event);
+}
+
+LennardJonesInteractionKernel::LennardJonesInteractionKernel()
+{
+    m_source = std::string(periodic_kernel_source) + lennard_jones_source;
+}
+
+cl::Event LennardJonesInteractionKernel::enqueue(cl::Buffer& pos, cl::Buffer& accel,
+                                                 const std::vector<cl::Event>* wait_list)
+{
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to LennardJonesInteractionKernel");
+    }
+
+    if (m_sys->config().use_cutoff && m_sys->openCLConfig().cell_list) {
+        m_cell_list.set_system(m_sys);
+        return m_cell_list.enqueue(pos, accel, wait_list);
     }
 
-    cl::Program program = device->CreateProgram(m_source, ss.str().c_str());
-    cl::Kernel kernel(program, "LennardJonesInteraction");
+    LennardJonesConstants lj_constants = m_sys->lennardJonesConfig().getConstants();
+    std::string build_options = lennardJonesBuildOptions(m_sys->config(), lj_constants);
+
+    const OpenCLConfig& ocl_conf = m_sys->openCLConfig();
+    bool tiled = ocl_conf.lj_kernel.value() == "tiled";
+    const char* kernel_name = tiled ? "LennardJonesInteractionTiled" : "LennardJonesInteraction";
 
-    kernel.setArg(0, m_sys->pos().buffer()());
-    kernel.setArg(1, m_sys->pos_prev().buffer()());
-    kernel.setArg(2, m_sys->vel().buffer()());
-    kernel.setArg(3, m_sys->accel().buffer()());
+    size_t work_group_size = tiledLaunchOptions(get_device(), ocl_conf, kernel_name, tiled, build_options);
+
+    cl::Kernel& kernel = get_kernel(kernel_name, build_options);
 
     cl_uint size = m_sys->pos().size();
 
+    kernel.setArg(0, pos());
+    kernel.setArg(1, accel());
+    kernel.setArg(2, size);
+    kernel.setArg(3, (cl_uint) 0);
     kernel.setArg(4, size);
 
-
     cl::Event event;
-    device->get_queue().enqueueNDRangeKernel(kernel, cl::NDRange(0),
-                                            cl::NDRange(size), cl::NDRange(), NULL, &event);
-    event.wait();
+    enqueueRounded(get_queue(), kernel, size, work_group_size, wait_list, &event);
+    return event;
 }
 
-IterateLJVerlet::IterateLJVerlet()
+void LennardJonesInteractionKernel::execute()
 {
-    m_source = R"(
-    void LennardJonesInteraction(__global float3* pos, __global float3* pos_prev,
-                                 __global float3* vel, __global float3* accel, uint num_particles);
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to LennardJonesInteractionKernel");
+    }
 
-    void VerletIntegration(__global float3* pos, __global float3* pos_prev,
-                           __global float3* accel, float dt);
+    enqueue(m_sys->pos().buffer(), m_sys->accel().buffer()).wait();
+}
 
-    void EulerIntegration(__global float3* pos, __global float3* pos_prev,
-                          __global float3* vel, __global float3* accel, float dt);
+LennardJonesRangeKernel::LennardJonesRangeKernel() : m_num_particles(0), m_offset(0), m_count(0)
+{
+    m_source = std::string(periodic_kernel_source) + lennard_jones_source;
+}
 
-    __kernel void IterateLJVerlet(__global float3* pos, __global float3* pos_prev,
-                             __global float3* vel, __global float3* accel, 
-                             uint num_particles, float dt)
-    {
-        EulerIntegration(pos, pos_prev, vel, accel, dt);
-        for (size_t i = 0; i < ITERATIONS_LJVerlet; ++i) {
-            LennardJonesInteraction(pos, pos_prev, vel, accel, num_particles);
-            VerletIntegration(pos, pos_prev, accel, dt);
+void LennardJonesRangeKernel::set_constants(const ParticleSystemConfig& conf, const LennardJonesConstants& lj_constants)
+{
+    m_build_options = lennardJonesBuildOptions(conf, lj_constants);
+}
 
-            barrier(CLK_GLOBAL_MEM_FENCE);
+void LennardJonesRangeKernel::set_args(cl::Buffer& pos, cl::Buffer& force, size_t num_particles,
+                                       size_t offset, size_t count)
+{
+    m_pos = pos;
+    m_force = force;
+    m_num_particles = num_particles;
+    m_offset = offset;
+    m_count = count;
+}
 
-            __global float3* tmp = pos;
-            pos = pos_prev;
-            pos_prev = tmp;
-        }
+cl::Event LennardJonesRangeKernel::enqueue(const std::vector<cl::Event>* wait_list)
+{
+    if (m_count == 0) {
+        throw std::runtime_error("No arguments set to LennardJonesRangeKernel");
     }
-)";
+
+    cl::Kernel& kernel = get_kernel("LennardJonesInteraction", m_build_options);
+
+    kernel.setArg(0, m_pos());
+    kernel.setArg(1, m_force());
+    kernel.setArg(2, (cl_uint) m_num_particles);
+    kernel.setArg(3, (cl_uint) m_offset);
+    kernel.setArg(4, (cl_uint) m_count);
+
+    cl::Event event;
+    get_queue().enqueueNDRangeKernel(kernel, cl::NDRange(0),
+                                     cl::NDRange(m_count), cl::NDRange(), wait_list, &event);
+    get_queue().flush();
+    OpenCLProfiler::Instance().record(kernel, event);
+    return event;
 }
 
-void IterateLJVerlet::execute()
+void LennardJonesRangeKernel::execute()
 {
-    if (!m_sys) {
-        throw std::runtime_error("No particle system set to EulerIntegrationKernel");
-    }
+    enqueue().wait();
+}
 
+FusedStepKernel::FusedStepKernel() : m_spec_set(false)
+{
+}
 
-    OpenCLContext ctx = OpenCLManager::Instance().getContext();
+void FusedStepKernel::set_spec(const KernelSpec& spec)
+{
+    m_spec = spec;
+    m_spec_set = true;
+}
 
-    std::string lj_src = ctx.GetKernel<LennardJonesInteractionKernel>().get_source();
-    std::string verlet_src = ctx.GetKernel<VerletIntegrationKernel>().get_source();
-    std::string euler_src = ctx.GetKernel<EulerIntegrationKernel>().get_source();
+KernelSpec FusedStepKernel::spec() const
+{
+    if (m_spec_set || !m_sys) {
+        return m_spec;
+    }
 
-    std::vector<std::string> sources { m_source, lj_src, verlet_src, euler_src };
+    return KernelSpec::FromConfig(m_sys->config(), m_sys->openCLConfig());
+}
 
-    OpenCLDispatcher::DevicePtr device =  OpenCLDispatcher::Instance().getDeviceFor(*this);
+void FusedStepKernel::set_species(cl::Buffer& species, cl::Buffer& pair_coeffs)
+{
+    m_species = species;
+    m_pair_coeffs = pair_coeffs;
+}
 
-    LennardJonesConfig lj_config = ConfigManager::Instance().getLennardJonesConfig();
-    LennardJonesConstants lj_constants = lj_config.getConstants();
+void FusedStepKernel::set_energy(cl::Buffer& energy)
+{
+    m_energy = energy;
+}
 
-    std::stringstream ss;
-    ss << " -Deps=" << lj_constants.get_eps<float>();
-    ss << " -Dsigma=" << lj_constants.get_sigma<float>();
-    ss << " -Dsigma_pow_6=" << lj_constants.get_sigma_pow_6<float>();
-    ss << " -Dsigma_pow_12=" << lj_constants.get_sigma_pow_12<float>();
-    ss << " -DITERATIONS_LJVerlet=" << m_iterations;
+cl::Event FusedStepKernel::enqueue(cl::Buffer& pos, cl::Buffer& pos_prev, cl::Buffer& accel,
+                                   const std::vector<cl::Event>* wait_list)
+{
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to FusedStepKernel");
+    }
 
-    if (m_sys->config().use_cutoff) {
-        ss << " -DUSE_CUTOFF";
+    KernelSpec spec = this->spec();
+    if (spec.energy && !m_energy()) {
+        throw std::runtime_error("No energy buffer set to FusedStepKernel");
     }
+    if (spec.species > 1 && (!m_species() || !m_pair_coeffs())) {
+        throw std::runtime_error("No species buffers set to FusedStepKernel");
+    }
+
+    set_source(KernelGenerator::Instance().source(spec));
+
+    LennardJonesConstants lj_constants = m_sys->lennardJonesConfig().getConstants();
+    std::string build_options = KernelGenerator::buildOptions(spec, m_sys->config(), lj_constants);
 
-    cl::Program program = device->CreateProgram(sources, ss.str().c_str());
-    cl::Kernel kernel(program, "IterateLJVerlet");
+    // tile scheme is the one of LennardJonesInteractionTiled, so are its tuned profiles
+    const char* tuning_name = spec.tiled ? "LennardJonesInteractionTiled" : "LennardJonesInteraction";
+    size_t work_group_size = tiledLaunchOptions(get_device(), m_sys->openCLConfig(), tuning_name,
+                                                spec.tiled, build_options);
 
-    kernel.setArg(0, m_sys->pos().buffer()());
-    kernel.setArg(1, m_sys->pos_prev().buffer()());
-    kernel.setArg(2, m_sys->vel().buffer()());
-    kernel.setArg(3, m_sys->accel().buffer()());
+    cl::Kernel& kernel = get_kernel("FusedStep", build_options);
 
     cl_uint size = m_sys->pos().size();
-    kernel.setArg(4, size);
 
-    cl_float dt = (float) m_sys->config().dt;
-    kernel.setArg(5, dt);
+    cl_uint arg = 0;
+    kernel.setArg(arg++, pos());
+    kernel.setArg(arg++, pos_prev());
+    kernel.setArg(arg++, accel());
+    if (spec.integrator == "euler") {
+        kernel.setArg(arg++, m_sys->vel().buffer()());
+    }
+    if (spec.energy) {
+        kernel.setArg(arg++, m_energy());
+    }
+    if (spec.species > 1) {
+        kernel.setArg(arg++, m_species());
+        kernel.setArg(arg++, m_pair_coeffs());
+    }
+    kernel.setArg(arg++, size);
 
     cl::Event event;
-    device->get_queue().enqueueNDRangeKernel(kernel, cl::NDRange(0),
-                                            cl::NDRange(size), cl::NDRange(), NULL, &event);
-    event.wait();
-    
+    enqueueRounded(get_queue(), kernel, size, work_group_size, wait_list, &event);
+    if (!spec.periodic) {
+        return event;
+    }
+
+    // new positions are in pos_prev until the caller swaps buffers
+    cl::Kernel& wrap = get_kernel("PeriodicWrap", build_options);
+    wrap.setArg(0, pos_prev());
+    wrap.setArg(1, pos());
+    wrap.setArg(2, size);
+
+    std::vector<cl::Event> step(1, event);
+    cl::Event wrapped;
+    enqueueRounded(get_queue(), wrap, size, 0, &step, &wrapped);
+    return wrapped;
+}
+
+void FusedStepKernel::execute()
+{
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to FusedStepKernel");
+    }
+
+    enqueue(m_sys->pos().buffer(), m_sys->pos_prev().buffer(), m_sys->accel().buffer()).wait();
+    std::swap(m_sys->pos(), m_sys->pos_prev());
+}
+
+// Host waits for the step enqueued this many iterations ago,
+// bounds the number of commands in flight for long runs
+static const size_t max_steps_in_flight = 64;
+
+IterateLJVerlet::IterateLJVerlet() : m_iterations(0), m_chunk_interval(0)
+{
+}
+
+void IterateLJVerlet::set_chunks(size_t interval, ChunkFn fn)
+{
+    m_chunk_interval = std::max<size_t>(interval, 1);
+    m_chunk_fn = fn;
+}
+
+void IterateLJVerlet::execute()
+{
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to IterateLJVerlet");
+    }
+
+    EulerIntegrationKernel euler;
+    VerletIntegrationKernel verlet;
+    LennardJonesInteractionKernel lennard_jones;
+    FusedStepKernel fused;
+
+    euler.set_system(m_sys);
+    verlet.set_system(m_sys);
+    lennard_jones.set_system(m_sys);
+    fused.set_system(m_sys);
+
+    const OpenCLConfig& ocl_conf = m_sys->openCLConfig();
+    bool use_fused = ocl_conf.fused_kernels && !(m_sys->config().use_cutoff && ocl_conf.cell_list);
+
+    cl::Buffer pos = m_sys->pos().buffer();
+    cl::Buffer pos_prev = m_sys->pos_prev().buffer();
+    cl::Buffer& vel = m_sys->vel().buffer();
+    cl::Buffer& accel = m_sys->accel().buffer();
+
+    // every step depends on the previous one only
+    std::vector<cl::Event> last_step(1);
+    size_t swaps = 0;
+    if (!m_sys->hasPosPrev()) {
+        last_step[0] = euler.enqueue(pos, pos_prev, vel, accel);
+        std::swap(pos, pos_prev);
+        swaps++;
+    } else {
+        // continued run, marker takes the place of Euler step
+        get_queue().enqueueMarkerWithWaitList(NULL, &last_step[0]);
+    }
+
+    cl::Event window_start = last_step[0];
+    for (size_t i = 0; i < m_iterations; ++i) {
+        if (use_fused) {
+            last_step[0] = fused.enqueue(pos, pos_prev, accel, &last_step);
+        } else {
+            last_step[0] = lennard_jones.enqueue(pos, accel, &last_step);
+            last_step[0] = verlet.enqueue(pos, pos_prev, accel, &last_step);
+        }
+        std::swap(pos, pos_prev);
+        swaps++;
+
+        // callbacks compare iterations counted from the start of the run
+        if (m_chunk_fn && (m_sys->iteration() + i) % m_chunk_interval == 0) {
+            get_queue().flush();
+            m_chunk_fn(i, get_queue(), pos, pos_prev, last_step[0]);
+        }
+
+        if ((i + 1) % max_steps_in_flight == 0) {
+            get_queue().flush();
+            window_start.wait();
+            window_start = last_step[0];
+        }
+    }
+
+    last_step[0].wait();
+
+    // Euler step and each Verlet step swapped buffers once
+    if (swaps % 2 == 1) {
+        std::swap(m_sys->pos(), m_sys->pos_prev());
+    }
 }
@@ -0,0 +1,192 @@
+#include <platforms/opencl/multi_device_platform.hpp>
+#include <platforms/opencl/profiler.hpp>
+#include <utils/config/config_manager.hpp>
+
+#include <algorithm>
+
+OpenCLMultiDeviceParticleSystem::OpenCLMultiDeviceParticleSystem()
+    : m_opencl_config(ConfigManager::Instance().getOpenCLConfig())
+{
+}
+
+OpenCLMultiDeviceParticleSystem::OpenCLMultiDeviceParticleSystem(ParticleSystemConfig conf)
+    : NativeParticleSystem(conf)
+    , m_opencl_config(ConfigManager::Instance().getOpenCLConfig())
+{
+}
+
+void OpenCLMultiDeviceParticleSystem::setOpenCLConfig(const OpenCLConfig& conf)
+{
+    m_opencl_config = conf;
+    m_devices.clear();
+    m_parts.clear();
+}
+
+size_t OpenCLMultiDeviceParticleSystem::devicesNum()
+{
+    selectDevices();
+    return m_devices.size();
+}
+
+void OpenCLMultiDeviceParticleSystem::selectDevices()
+{
+    if (!m_devices.empty()) {
+        return;
+    }
+
+    m_devices = OpenCLContext::SelectDevices(m_opencl_config);
+    m_context = cl::Context(m_devices);
+}
+
+void OpenCLMultiDeviceParticleSystem::createPartitions()
+{
+    selectDevices();
+
+    size_t num = m_pos.size();
+    if (!m_parts.empty() && m_parts.back().offset + m_parts.back().count == num) {
+        return;
+    }
+
+    m_parts.clear();
+    m_parts.resize(m_devices.size());
+
+    size_t total_units = 0;
+    for (size_t d = 0; d < m_devices.size(); d++) {
+        Partition& part = m_parts[d];
+        part.device = std::make_shared<OpenCLDevice>(m_context, m_devices[d]);
+        part.compute_units = std::max<size_t>(m_devices[d].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>(), 1);
+        total_units += part.compute_units;
+    }
+
+    // boundaries are rounded from cumulative units, so partitions cover all particles
+    size_t units = 0;
+    for (Partition& part : m_parts) {
+        part.offset = num * units / total_units;
+        units += part.compute_units;
+        part.count = num * units / total_units - part.offset;
+    }
+
+    // devices without particles are not used
+    m_parts.erase(std::remove_if(m_parts.begin(), m_parts.end(), [](const Partition& part) {
+        return part.count == 0;
+    }), m_parts.end());
+
+    for (Partition& part : m_parts) {
+        part.pos_all = cl::Buffer(m_context, cl::default_mem_flags, sizeof(cl_float3) * num);
+        part.pos = cl::Buffer(m_context, cl::default_mem_flags, sizeof(cl_float3) * part.count);
+        part.pos_prev = cl::Buffer(m_context, cl::default_mem_flags, sizeof(cl_float3) * part.count);
+        part.vel = cl::Buffer(m_context, cl::default_mem_flags, sizeof(cl_float3) * part.count);
+        part.accel = cl::Buffer(m_context, cl::default_mem_flags, sizeof(cl_float3) * part.count);
+
+        part.lennard_jones.set_device(part.device);
+        part.verlet.set_device(part.device);
+        part.euler.set_device(part.device);
+
+        part.lennard_jones.set_args(part.pos_all, part.accel, num, part.offset, part.count);
+    }
+}
+
+void OpenCLMultiDeviceParticleSystem::gatherPositions(const std::vector<cl::Event>* wait_list)
+{
+    std::vector<cl::Event> reads(m_parts.size());
+    for (size_t d = 0; d < m_parts.size(); d++) {
+        Partition& part = m_parts[d];
+        part.device->get_queue().enqueueReadBuffer(part.pos, CL_FALSE, 0, sizeof(cl_float3) * part.count,
+                                                   &m_staging[part.offset], wait_list, &reads[d]);
+        part.device->get_queue().flush();
+        OpenCLProfiler::Instance().record("read:gather_positions", reads[d]);
+    }
+
+    cl::WaitForEvents(reads);
+}
+
+std::vector<cl::Event> OpenCLMultiDeviceParticleSystem::scatterPositions()
+{
+    std::vector<cl::Event> writes(m_parts.size());
+    for (size_t d = 0; d < m_parts.size(); d++) {
+        Partition& part = m_parts[d];
+        part.device->get_queue().enqueueWriteBuffer(part.pos_all, CL_FALSE, 0, sizeof(cl_float3) * m_staging.size(),
+                                                    &m_staging[0], NULL, &writes[d]);
+        part.device->get_queue().flush();
+        OpenCLProfiler::Instance().record("write:scatter_positions", writes[d]);
+    }
+
+    return writes;
+}
+
+void OpenCLMultiDeviceParticleSystem::readState()
+{
+    // native particle data has the layout of device buffers
+    for (Partition& part : m_parts) {
+        cl::CommandQueue& queue = part.device->get_queue();
+        ::size_t size = sizeof(cl_float3) * part.count;
+        queue.enqueueReadBuffer(part.pos, CL_TRUE, 0, size, &m_pos[part.offset]);
+        queue.enqueueReadBuffer(part.pos_prev, CL_TRUE, 0, size, &m_pos_prev[part.offset]);
+        queue.enqueueReadBuffer(part.accel, CL_TRUE, 0, size, &m_accel[part.offset]);
+    }
+}
+
+void OpenCLMultiDeviceParticleSystem::iterate(size_t iterations)
+{
+    size_t num = m_pos.size();
+    if (num == 0) {
+        return;
+    }
+
+    createPartitions();
+
+    m_staging.resize(num);
+    float dt = m_config.dt;
+    LennardJonesConstants lj_constants = m_lj_config.getConstants();
+
+    // own state of every device, Euler step computes first positions
+    // unless pos_prev is known
+    for (Partition& part : m_parts) {
+        cl::CommandQueue& queue = part.device->get_queue();
+        ::size_t size = sizeof(cl_float3) * part.count;
+
+        queue.enqueueWriteBuffer(part.pos, CL_TRUE, 0, size, &m_pos[part.offset]);
+        queue.enqueueWriteBuffer(part.vel, CL_TRUE, 0, size, &m_vel[part.offset]);
+        queue.enqueueWriteBuffer(part.accel, CL_TRUE, 0, size, &m_accel[part.offset]);
+
+        part.lennard_jones.set_constants(m_config, lj_constants);
+        part.verlet.set_config(m_config);
+        part.euler.set_config(m_config);
+
+        if (m_has_pos_prev) {
+            queue.enqueueWriteBuffer(part.pos_prev, CL_TRUE, 0, size, &m_pos_prev[part.offset]);
+            continue;
+        }
+
+        part.euler.enqueue(part.pos, part.pos_prev, part.vel, part.accel, part.count, dt);
+        std::swap(part.pos, part.pos_prev);
+    }
+
+    m_has_pos_prev = true;
+    gatherPositions();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        std::vector<cl::Event> writes = scatterPositions();
+
+        for (size_t d = 0; d < m_parts.size(); d++) {
+            Partition& part = m_parts[d];
+
+            std::vector<cl::Event> wait_list(1, writes[d]);
+            wait_list[0] = part.lennard_jones.enqueue(&wait_list);
+            part.verlet.enqueue(part.pos, part.pos_prev, part.accel, part.count, dt, &wait_list);
+            std::swap(part.pos, part.pos_prev);
+        }
+
+        // in-order queues, reads wait for Verlet steps of own device,
+        // positions of this step must be written to all devices before staging is reused
+        gatherPositions(&writes);
+
+        if (hasIterationCbs()) {
+            readState();
+            invokeOnIteration(i);
+        }
+    }
+
+    readState();
+    m_iteration += iterations;
+}
@@ -0,0 +1,202 @@
+#include <algorithm>
+
+#include <platforms/opencl/opencl_platform.hpp>
+#include <platforms/opencl/kernels.hpp>
+#include <platforms/opencl/profiler.hpp>
+
+// work-items per reduction work-group
+static const size_t default_reduce_wg = 256;
+
+ObservablesKernel::ObservablesKernel()
+    : m_reduce_wg(0)
+    , m_num_particles(0)
+{
+    m_source = std::string(periodic_kernel_source) + R"(
+    // every pair is visited from both particles, so pair terms are halved
+    __kernel void ParticleObservables(__global const float3* pos, __global const float3* pos_prev,
+                                      __global float4* motion, __global float4* pair_terms,
+                                      uint num_particles, float dt_inv)
+    {
+        uint gid = get_global_id(0);
+        if (gid >= num_particles) {
+            return;
+        }
+
+        float3 target_pos = pos[gid];
+        float3 step = target_pos - pos_prev[gid];
+    #ifdef PERIODIC
+        step = minimumImage(step);
+    #endif
+        float3 vel = step * dt_inv;
+        motion[gid] = (float4)(vel, 0.5f * dot(vel, vel));
+
+        float potential = 0.0f;
+        float virial = 0.0f;
+        for (uint i = 0; i < num_particles; ++i) {
+            if (i == gid) {
+                continue;
+            }
+
+            float3 d = target_pos - pos[i];
+    #ifdef PERIODIC
+            d = minimumImage(d);
+    #endif
+            float r_sqr = dot(d, d);
+
+    #ifdef USE_CUTOFF
+            if (r_sqr > cutoff_sqr) {
+                continue;
+            }
+    #endif
+
+            // same formulas as NativeParticleSystem::computeLennardJonesForcePotential
+            float ri_sqr = 1 / r_sqr;
+            float ri6 = ri_sqr * ri_sqr * ri_sqr;
+            float force_scalar = 48 * eps * ri6 * ri_sqr * (sigma_pow_12 * ri6 - sigma_pow_6 / 2);
+
+            potential += 4 * eps * ri6 * (ri6 * sigma_pow_12 - sigma_pow_6);
+            virial += sqrt(r_sqr) * force_scalar;
+        }
+
+        pair_terms[gid] = (float4)(0.5f * potential, 0.5f * virial, 0.0f, 0.0f);
+    }
+
+    // Every work-item accumulates a grid-strided slice, then work-group
+    // reduces in local memory, group sum goes to out[out_offset + group]
+    __kernel __attribute__((reqd_work_group_size(REDUCE_WG, 1, 1)))
+    void ReduceSum(__global const float4* in, __global float4* out, uint size, uint out_offset)
+    {
+        __local float4 scratch[REDUCE_WG];
+
+        uint lid = get_local_id(0);
+        float4 sum = (float4)(0.0f);
+        for (uint i = get_global_id(0); i < size; i += get_global_size(0)) {
+            sum += in[i];
+        }
+
+        scratch[lid] = sum;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (uint stride = REDUCE_WG / 2; stride > 0; stride >>= 1) {
+            if (lid < stride) {
+                scratch[lid] += scratch[lid + stride];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        if (lid == 0) {
+            out[out_offset + get_group_id(0)] = scratch[0];
+        }
+    }
+    )";
+}
+
+void ObservablesKernel::resize(size_t num_particles)
+{
+    if (m_reduce_wg == 0) {
+        size_t max_wg = get_device().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+        // tree reduction requires power of two work-group
+        m_reduce_wg = 1;
+        while (m_reduce_wg * 2 <= std::min(default_reduce_wg, max_wg)) {
+            m_reduce_wg *= 2;
+        }
+    }
+
+    if (num_particles == m_num_particles) {
+        return;
+    }
+
+    const cl::Context& context = OpenCLManager::Instance().getContext().context();
+    m_motion = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * num_particles);
+    m_pair_terms = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * num_particles);
+    // first pass has at most m_reduce_wg groups
+    m_partial = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * m_reduce_wg);
+    m_sums = cl::Buffer(context, cl::default_mem_flags, sizeof(cl_float4) * 2);
+    m_num_particles = num_particles;
+}
+
+cl::Event ObservablesKernel::enqueue_reduce(cl::CommandQueue& queue, cl::Buffer& terms, size_t size,
+                                            size_t sum_index, const std::string& build_options,
+                                            const std::vector<cl::Event>* wait_list)
+{
+    cl::Kernel& reduce = get_kernel("ReduceSum", build_options);
+
+    size_t groups = std::min((size + m_reduce_wg - 1) / m_reduce_wg, m_reduce_wg);
+
+    std::vector<cl::Event> deps(1);
+    reduce.setArg(0, terms());
+    reduce.setArg(1, m_partial());
+    reduce.setArg(2, (cl_uint) size);
+    reduce.setArg(3, (cl_uint) 0);
+    queue.enqueueNDRangeKernel(reduce, cl::NDRange(0), cl::NDRange(groups * m_reduce_wg),
+                               cl::NDRange(m_reduce_wg), wait_list, &deps[0]);
+    OpenCLProfiler::Instance().record(reduce, deps[0]);
+
+    // final pass over partial sums, args are captured at enqueue
+    cl::Event event;
+    reduce.setArg(0, m_partial());
+    reduce.setArg(1, m_sums());
+    reduce.setArg(2, (cl_uint) groups);
+    reduce.setArg(3, (cl_uint) sum_index);
+    queue.enqueueNDRangeKernel(reduce, cl::NDRange(0), cl::NDRange(m_reduce_wg),
+                               cl::NDRange(m_reduce_wg), &deps, &event);
+    OpenCLProfiler::Instance().record(reduce, event);
+    return event;
+}
+
+Observables ObservablesKernel::compute(cl::CommandQueue& queue, cl::Buffer& pos, cl::Buffer& pos_prev,
+                                       size_t num_particles, const std::vector<cl::Event>* wait_list)
+{
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to ObservablesKernel");
+    }
+
+    Observables obs;
+    if (num_particles == 0) {
+        return obs;
+    }
+
+    resize(num_particles);
+
+    std::string build_options = lennardJonesBuildOptions(m_sys->config(), m_sys->lennardJonesConfig().getConstants());
+    build_options += " -DREDUCE_WG=" + std::to_string(m_reduce_wg);
+
+    float dt = m_sys->config().dt;
+    cl::Kernel& terms = get_kernel("ParticleObservables", build_options);
+    terms.setArg(0, pos());
+    terms.setArg(1, pos_prev());
+    terms.setArg(2, m_motion());
+    terms.setArg(3, m_pair_terms());
+    terms.setArg(4, (cl_uint) num_particles);
+    terms.setArg(5, dt > 0 ? 1 / dt : 0.0f);
+
+    std::vector<cl::Event> deps(1);
+    queue.enqueueNDRangeKernel(terms, cl::NDRange(0), cl::NDRange(num_particles), cl::NDRange(),
+                               wait_list, &deps[0]);
+    OpenCLProfiler::Instance().record(terms, deps[0]);
+
+    // both reductions share partial sums buffer, in-order queue serializes them
+    enqueue_reduce(queue, m_motion, num_particles, 0, build_options, &deps);
+    enqueue_reduce(queue, m_pair_terms, num_particles, 1, build_options, NULL);
+
+    cl_float4 sums[2];
+    cl::Event read;
+    queue.enqueueReadBuffer(m_sums, CL_TRUE, 0, sizeof(sums), sums, NULL, &read);
+    OpenCLProfiler::Instance().record("read:observables", read);
+
+    obs.momentum = md::float3(sums[0].s[0], sums[0].s[1], sums[0].s[2]);
+    obs.kinetic_energy = sums[0].s[3];
+    obs.potential_energy = sums[1].s[0];
+    obs.virial = sums[1].s[1];
+    obs.temperature = Observables::temperatureOf(obs.kinetic_energy, num_particles);
+    return obs;
+}
+
+void ObservablesKernel::execute()
+{
+    if (!m_sys) {
+        throw std::runtime_error("No particle system set to ObservablesKernel");
+    }
+
+    m_result = compute(get_queue(), m_sys->pos().buffer(), m_sys->pos_prev().buffer(), m_sys->pos().size());
+}
@@ -1,5 +1,135 @@
 #include <platforms/opencl/opencl_helpers.hpp>
 #include <platforms/native/types.hpp>
+#include <utils/config/config_manager.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+OpenCLContext::OpenCLContext()
+    : m_device(SelectDevice(ConfigManager::Instance().getOpenCLConfig()))
+    , m_context(m_device)
+{
+}
+
+OpenCLContext::OpenCLContext(const OpenCLConfig& conf)
+    : m_device(SelectDevice(conf))
+    , m_context(m_device)
+{
+}
+
+static std::string toLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::tolower(c); });
+    return str;
+}
+
+static cl_device_type deviceType(const std::string& type)
+{
+    if (type == "cpu") {
+        return CL_DEVICE_TYPE_CPU;
+    } else if (type == "gpu") {
+        return CL_DEVICE_TYPE_GPU;
+    } else if (type == "accelerator") {
+        return CL_DEVICE_TYPE_ACCELERATOR;
+    } else if (type == "default") {
+        return CL_DEVICE_TYPE_DEFAULT;
+    }
+
+    return CL_DEVICE_TYPE_ALL;
+}
+
+std::vector<cl::Device> OpenCLContext::FindDevices(const OpenCLConfig& conf)
+{
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+
+    cl_device_type type = deviceType(conf.device_type);
+    std::string vendor = toLower(conf.device_vendor);
+
+    std::vector<cl::Device> result;
+    for (cl::Platform& platform : platforms) {
+        std::vector<cl::Device> devices;
+        try {
+            platform.getDevices(type, &devices);
+        } catch (cl::Error&) {
+            // CL_DEVICE_NOT_FOUND, platform has no devices of this type
+            continue;
+        }
+
+        for (cl::Device& device : devices) {
+            if (vendor.empty() || toLower(device.getInfo<CL_DEVICE_VENDOR>()).find(vendor) != std::string::npos) {
+                result.push_back(device);
+            }
+        }
+    }
+
+    if (result.empty()) {
+        throw std::runtime_error("No OpenCL devices of type " + conf.device_type.value() +
+                                 " and vendor '" + conf.device_vendor.value() + "'");
+    }
+
+    return result;
+}
+
+cl::Device OpenCLContext::SelectDevice(const OpenCLConfig& conf)
+{
+    std::vector<cl::Device> devices = FindDevices(conf);
+
+    size_t index = conf.device_index;
+    if (index >= devices.size()) {
+        throw std::runtime_error("OpenCL device_index " + std::to_string(index) + " is out of range, " +
+                                 std::to_string(devices.size()) + " devices found");
+    }
+
+    return devices[index];
+}
+
+std::vector<cl::Device> OpenCLContext::SelectDevices(const OpenCLConfig& conf)
+{
+    std::vector<cl::Device> devices = FindDevices(conf);
+
+    size_t first = conf.device_index;
+    if (first >= devices.size()) {
+        throw std::runtime_error("OpenCL device_index " + std::to_string(first) + " is out of range, " +
+                                 std::to_string(devices.size()) + " devices found");
+    }
+
+    size_t count = conf.device_count;
+    size_t last = count ? std::min(first + count, devices.size()) : devices.size();
+    devices = std::vector<cl::Device>(devices.begin() + first, devices.begin() + last);
+
+    // one context is shared by all devices
+    cl_platform_id platform = devices[0].getInfo<CL_DEVICE_PLATFORM>();
+    for (cl::Device& device : devices) {
+        if (device.getInfo<CL_DEVICE_PLATFORM>() != platform) {
+            throw std::runtime_error("Selected OpenCL devices belong to different platforms");
+        }
+    }
+
+    if (conf.sub_devices.value() == "none") {
+        return devices;
+    }
+
+    std::vector<cl::Device> sub_devices;
+    for (cl::Device& device : devices) {
+        std::vector<cl_device_partition_property> props;
+        if (conf.sub_devices.value() == "equally") {
+            props.push_back(CL_DEVICE_PARTITION_EQUALLY);
+            props.push_back(static_cast<cl_device_partition_property>(conf.sub_device_units));
+        } else {
+            props.push_back(CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN);
+            props.push_back(CL_DEVICE_AFFINITY_DOMAIN_NUMA);
+        }
+        props.push_back(0);
+
+        std::vector<cl::Device> parts;
+        device.createSubDevices(&props[0], &parts);
+        sub_devices.insert(sub_devices.end(), parts.begin(), parts.end());
+    }
+
+    return sub_devices;
+}
 
 namespace cl {
     
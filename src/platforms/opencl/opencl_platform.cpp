@@ -1,14 +1,23 @@
 #include <platforms/opencl/opencl_platform.hpp>
+#include <platforms/opencl/profiler.hpp>
 
 OpenCLParticleSystem::OpenCLParticleSystem()
+    : m_opencl_config(ConfigManager::Instance().getOpenCLConfig())
+    , m_staging_index(0)
+    , m_active_staging(NULL)
 {
 }
 
-OpenCLParticleSystem::OpenCLParticleSystem(ParticleSystemConfig conf) : ParticleSystem(conf)
+OpenCLParticleSystem::OpenCLParticleSystem(ParticleSystemConfig conf)
+    : ParticleSystem(conf)
+    , m_opencl_config(ConfigManager::Instance().getOpenCLConfig())
+    , m_staging_index(0)
+    , m_active_staging(NULL)
 {
     size_t particles_num = m_config.particles_num;
     std::string init_file = m_config.init_file;
-    if (init_file != "") {
+    std::string init_generator = m_config.init_generator;
+    if (init_file != "" || init_generator != "") {
         if (particles_num == 0) {
             throw std::runtime_error("particles_num is not defined in config file!");
         }
@@ -31,10 +40,23 @@ NativeParticleSystem OpenCLParticleSystem::convertToNative()
 void OpenCLParticleSystem::fromNative(const NativeParticleSystem& native)
 {
     m_config = native.config();
-    m_pos = cl::float3vec(native.pos().begin(), native.pos().end());
-    m_pos_prev = cl::float3vec(native.pos_prev().begin(), native.pos_prev().end());
-    m_vel = cl::float3vec(native.vel().begin(), native.vel().end());
-    m_accel = cl::float3vec(native.accel().begin(), native.accel().end());
+    m_pos.assign(native.pos().begin(), native.pos().end());
+    m_pos_prev.assign(native.pos_prev().begin(), native.pos_prev().end());
+    m_vel.assign(native.vel().begin(), native.vel().end());
+    m_accel.assign(native.accel().begin(), native.accel().end());
+    m_iteration = native.iteration();
+    m_has_pos_prev = native.hasPosPrev();
+}
+
+void OpenCLParticleSystem::fromNative(NativeParticleSystem&& native)
+{
+    m_config = native.config();
+    m_pos = cl::float3vec(std::move(native.pos()));
+    m_pos_prev = cl::float3vec(std::move(native.pos_prev()));
+    m_vel = cl::float3vec(std::move(native.vel()));
+    m_accel = cl::float3vec(std::move(native.accel()));
+    m_iteration = native.iteration();
+    m_has_pos_prev = native.hasPosPrev();
 }
 
 void OpenCLParticleSystem::applyVerletIntegration()
@@ -81,38 +103,19 @@ void OpenCLParticleSystem::loadParticles(ParticleIStreamPtr is, size_t num)
     cl::float3vec vel(num);
     cl::float3vec accel(num);
 
+    {
+        cl::mapping<cl_float3> pos_mapped(pos, CL_MAP_WRITE_INVALIDATE_REGION);
+        cl::mapping<cl_float3> vel_mapped(vel, CL_MAP_WRITE_INVALIDATE_REGION);
+        cl::mapping<cl_float3> accel_mapped(accel, CL_MAP_WRITE_INVALIDATE_REGION);
 
-    cl::float3vec::value_type* pos_mapped = nullptr;
-    cl::float3vec::value_type* vel_mapped = nullptr;
-    cl::float3vec::value_type* accel_mapped = nullptr;
-
-    try {
-        using namespace cl;
-        pos_mapped = pos.map();
-        vel_mapped = vel.map();
-        accel_mapped = accel.map();
-
-        for (::size_t i = 0; i < m_pos.size(); i++) {
-            is->Read(pos_mapped[i], vel_mapped[i], accel_mapped[i]);
-        }
-    } catch (...) {
-        if (accel_mapped) {
-            accel.unmap(accel_mapped);
-        }
-        if (vel_mapped) {
-            vel.unmap(vel_mapped);
-        }
-        if (pos_mapped) {
-            pos.unmap(pos_mapped);
-        }
-
-        throw;
+        is->ReadFrame(pos_mapped.data(), vel_mapped.data(), accel_mapped.data(), num);
     }
 
     m_pos = std::move(pos);
     m_pos_prev = std::move(pos_prev);
     m_vel = std::move(vel);
     m_accel = std::move(accel);
+    m_has_pos_prev = false;
 }
 
 void OpenCLParticleSystem::loadParticles(ParticleIStreamPtr is)
@@ -122,32 +125,160 @@ void OpenCLParticleSystem::loadParticles(ParticleIStreamPtr is)
 
 void OpenCLParticleSystem::storeParticles(ParticleOStreamPtr os)
 {
-    cl::float3vec::value_type* pos_mapped = nullptr;
-    cl::float3vec::value_type* vel_mapped = nullptr;
-    cl::float3vec::value_type* accel_mapped = nullptr;
+    if (m_active_staging) {
+        const FrameStaging& staging = *m_active_staging;
+        os->WriteFrame(staging.pos_mapped, staging.vel_mapped, staging.accel_mapped, m_pos.size());
+        return;
+    }
 
-    try {
-        using namespace cl;
-        pos_mapped = m_pos.map();
-        vel_mapped = m_vel.map();
-        accel_mapped = m_accel.map();
+    cl::mapping<cl_float3> pos_mapped(m_pos, CL_MAP_READ);
+    cl::mapping<cl_float3> vel_mapped(m_vel, CL_MAP_READ);
+    cl::mapping<cl_float3> accel_mapped(m_accel, CL_MAP_READ);
 
-        for (::size_t i = 0; i < m_pos.size(); i++) {
-            os->Write(pos_mapped[i], vel_mapped[i], accel_mapped[i]);
-        }
-    } catch (...) {
-        if (accel_mapped) {
-            m_accel.unmap(accel_mapped);
-        }
-        if (vel_mapped) {
-            m_vel.unmap(vel_mapped);
-        }
-        if (pos_mapped) {
-            m_pos.unmap(pos_mapped);
-        }
+    os->WriteFrame(pos_mapped.data(), vel_mapped.data(), accel_mapped.data(), m_pos.size());
+}
+
+void OpenCLParticleSystem::snapshot(ParticleFrame& frame)
+{
+    if (m_active_staging) {
+        const FrameStaging& staging = *m_active_staging;
+        size_t num = m_pos.size();
+        frame.pos.assign(staging.pos_mapped, staging.pos_mapped + num);
+        frame.vel.assign(staging.vel_mapped, staging.vel_mapped + num);
+        frame.accel.assign(staging.accel_mapped, staging.accel_mapped + num);
+        return;
+    }
+
+    m_pos.to_native(frame.pos);
+    m_vel.to_native(frame.vel);
+    m_accel.to_native(frame.accel);
+}
+
+void OpenCLParticleSystem::saveState(ParticleState& state)
+{
+    snapshot(state);
+
+    if (!m_active_staging) {
+        m_pos_prev.to_native(state.pos_prev);
+        return;
+    }
+
+    // staging copies are complete, maps waited for them
+    size_t num = m_pos.size();
+    state.pos_prev.resize(num);
+    if (num != 0) {
+        m_readback_queue.enqueueReadBuffer(m_active_staging->pos_prev, CL_TRUE, 0, sizeof(cl_float3) * num,
+                                           state.pos_prev.data());
+    }
+}
+
+void OpenCLParticleSystem::restoreState(const ParticleState& state)
+{
+    m_pos.assign(state.pos.begin(), state.pos.end());
+    m_pos_prev.assign(state.pos_prev.begin(), state.pos_prev.end());
+    m_vel.assign(state.vel.begin(), state.vel.end());
+    m_accel.assign(state.accel.begin(), state.accel.end());
+    m_iteration = state.iteration;
+    m_has_pos_prev = true;
+}
+
+Observables OpenCLParticleSystem::observe()
+{
+    m_observables.set_system(this);
 
+    if (m_active_staging) {
+        // readback queue runs next to the chunk computed on the main queue,
+        // staging maps waited for all staging copies, kernels may read mapped buffers
+        return m_observables.compute(m_readback_queue, m_active_staging->pos, m_active_staging->pos_prev,
+                                     m_pos.size());
+    }
+
+    m_observables.execute();
+    return m_observables.result();
+}
+
+void OpenCLParticleSystem::enqueueFrameCopy(size_t iteration, cl::CommandQueue& queue, cl::Buffer& pos,
+                                            cl::Buffer& pos_prev, const cl::Event& step)
+{
+    FrameStaging& staging = m_staging[m_staging_index];
+    if (staging.pending) {
+        completeFrame(staging);
+    }
+
+    // callbacks are done with the previous frame of this slot,
+    // copies wait for its unmap on device instead of host
+    std::vector<cl::Event> wait_list(1, step);
+    unmapFrame(staging, wait_list);
+
+    ::size_t size = sizeof(cl_float3) * m_pos.size();
+    std::vector<cl::Event> copied(4);
+    queue.enqueueCopyBuffer(pos, staging.pos, 0, 0, size, &wait_list, &copied[0]);
+    queue.enqueueCopyBuffer(m_vel.buffer(), staging.vel, 0, 0, size, &wait_list, &copied[1]);
+    queue.enqueueCopyBuffer(m_accel.buffer(), staging.accel, 0, 0, size, &wait_list, &copied[2]);
+    queue.enqueueCopyBuffer(pos_prev, staging.pos_prev, 0, 0, size, &wait_list, &copied[3]);
+    queue.flush();
+
+    OpenCLProfiler& profiler = OpenCLProfiler::Instance();
+    for (cl::Event& event : copied) {
+        profiler.record("copy:frame_staging", event);
+    }
+
+    staging.mapped.resize(3);
+    staging.pos_mapped = static_cast<md::float3a*>(
+        m_readback_queue.enqueueMapBuffer(staging.pos, CL_FALSE, CL_MAP_READ, 0, size, &copied, &staging.mapped[0]));
+    staging.vel_mapped = static_cast<md::float3a*>(
+        m_readback_queue.enqueueMapBuffer(staging.vel, CL_FALSE, CL_MAP_READ, 0, size, &copied, &staging.mapped[1]));
+    staging.accel_mapped = static_cast<md::float3a*>(
+        m_readback_queue.enqueueMapBuffer(staging.accel, CL_FALSE, CL_MAP_READ, 0, size, &copied, &staging.mapped[2]));
+    m_readback_queue.flush();
+
+    for (cl::Event& event : staging.mapped) {
+        profiler.record("map:frame_staging", event);
+    }
+
+    staging.iteration = iteration;
+    staging.pending = true;
+
+    // previous frame is handled on host while device runs this chunk
+    m_staging_index ^= 1;
+    FrameStaging& previous = m_staging[m_staging_index];
+    if (previous.pending) {
+        completeFrame(previous);
+    }
+}
+
+void OpenCLParticleSystem::completeFrame(FrameStaging& staging)
+{
+    cl::WaitForEvents(staging.mapped);
+    staging.pending = false;
+
+    // buffers stay mapped until the slot is copied to again
+    m_active_staging = &staging;
+    try {
+        invokeOnIteration(staging.iteration);
+    } catch (...) {
+        m_active_staging = NULL;
         throw;
     }
+    m_active_staging = NULL;
+}
+
+void OpenCLParticleSystem::unmapFrame(FrameStaging& staging, std::vector<cl::Event>& unmapped)
+{
+    if (!staging.pos_mapped) {
+        return;
+    }
+
+    size_t first = unmapped.size();
+    unmapped.resize(first + 3);
+    m_readback_queue.enqueueUnmapMemObject(staging.pos, staging.pos_mapped, NULL, &unmapped[first]);
+    m_readback_queue.enqueueUnmapMemObject(staging.vel, staging.vel_mapped, NULL, &unmapped[first + 1]);
+    m_readback_queue.enqueueUnmapMemObject(staging.accel, staging.accel_mapped, NULL, &unmapped[first + 2]);
+    m_readback_queue.flush();
+
+    staging.pos_mapped = NULL;
+    staging.vel_mapped = NULL;
+    staging.accel_mapped = NULL;
 }
 
 void OpenCLParticleSystem::iterate(size_t iterations)
@@ -156,6 +287,50 @@ void OpenCLParticleSystem::iterate(size_t iterations)
 
     kernel.set_system(this);
     kernel.set_iterations(iterations);
+
+    if (hasIterationCbs()) {
+        // staging of a run stopped by a throwing callback may still be mapped
+        std::vector<cl::Event> unmapped;
+        for (FrameStaging& staging : m_staging) {
+            unmapFrame(staging, unmapped);
+        }
+        cl::WaitForEvents(unmapped);
+
+        const OpenCLContext& context = OpenCLManager::Instance().getContext();
+        m_readback_queue = cl::CommandQueue(context.context(), context.device(),
+                                            OpenCLProfiler::Instance().queueProperties());
+
+        ::size_t size = sizeof(cl_float3) * m_pos.size();
+        for (FrameStaging& staging : m_staging) {
+            staging = FrameStaging();
+            staging.pos = cl::Buffer(context.context(), cl::default_mem_flags, size);
+            staging.vel = cl::Buffer(context.context(), cl::default_mem_flags, size);
+            staging.accel = cl::Buffer(context.context(), cl::default_mem_flags, size);
+            staging.pos_prev = cl::Buffer(context.context(), CL_MEM_READ_WRITE, size);
+        }
+        m_staging_index = 0;
+
+        using namespace std::placeholders;
+        kernel.set_chunks(iterationCbInterval(),
+                          std::bind(&OpenCLParticleSystem::enqueueFrameCopy, this, _1, _2, _3, _4, _5));
+    }
+
     kernel.execute();
-}
 
+    // older frame first
+    for (size_t i = 0; i < 2; i++) {
+        FrameStaging& staging = m_staging[(m_staging_index + i) % 2];
+        if (staging.pending) {
+            completeFrame(staging);
+        }
+    }
+
+    std::vector<cl::Event> unmapped;
+    for (FrameStaging& staging : m_staging) {
+        unmapFrame(staging, unmapped);
+    }
+    cl::WaitForEvents(unmapped);
+
+    m_iteration += iterations;
+    m_has_pos_prev = true;
+}
@@ -0,0 +1,236 @@
+#include <platforms/opencl/profiler.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+// pending events are read once this many are recorded
+static const size_t max_pending = 1024;
+
+void OpenCLProfiler::setEnabled(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_enabled = enabled;
+}
+
+bool OpenCLProfiler::enabled() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_enabled;
+}
+
+void OpenCLProfiler::setTimeline(bool timeline)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_timeline = timeline;
+}
+
+cl_command_queue_properties OpenCLProfiler::queueProperties() const
+{
+    return enabled() ? CL_QUEUE_PROFILING_ENABLE : 0;
+}
+
+void OpenCLProfiler::record(const std::string& name, const cl::Event& event)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_enabled) {
+        return;
+    }
+
+    Pending pending;
+    pending.name = name;
+    pending.event = event;
+    m_pending.push_back(pending);
+
+    if (m_pending.size() >= max_pending) {
+        collectLocked(false);
+    }
+}
+
+void OpenCLProfiler::record(const cl::Kernel& kernel, const cl::Event& event)
+{
+    if (!enabled()) {
+        return;
+    }
+
+    record(kernel.getInfo<CL_KERNEL_FUNCTION_NAME>(), event);
+}
+
+void OpenCLProfiler::collect()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    collectLocked(true);
+}
+
+void OpenCLProfiler::collectLocked(bool wait)
+{
+    std::vector<Pending> in_flight;
+
+    for (Pending& pending : m_pending) {
+        if (!wait && pending.event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE) {
+            in_flight.push_back(pending);
+            continue;
+        }
+
+        Record rec;
+        rec.name = pending.name;
+        try {
+            pending.event.wait();
+            rec.queued = pending.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+            rec.submit = pending.event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+            rec.start = pending.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+            rec.end = pending.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+        } catch (cl::Error&) {
+            // CL_PROFILING_INFO_NOT_AVAILABLE, queue created before profiler was enabled
+            m_skipped++;
+            continue;
+        }
+
+        // queues are numbered in order of first command
+        cl_command_queue queue = pending.event.getInfo<CL_EVENT_COMMAND_QUEUE>();
+        rec.queue = m_queues.insert(std::make_pair(queue, m_queues.size())).first->second;
+
+        cl_ulong duration = rec.end - rec.start;
+        Stats& stats = m_stats[rec.name];
+        stats.min_ns = stats.count ? std::min(stats.min_ns, duration) : duration;
+        stats.max_ns = std::max(stats.max_ns, duration);
+        stats.total_ns += duration;
+        stats.wait_ns += rec.start - rec.queued;
+        stats.count++;
+
+        if (m_timeline) {
+            m_records.push_back(rec);
+        }
+    }
+
+    m_pending.swap(in_flight);
+}
+
+void OpenCLProfiler::reset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.clear();
+    m_stats.clear();
+    m_records.clear();
+    m_queues.clear();
+    m_skipped = 0;
+}
+
+std::map<std::string, OpenCLProfiler::Stats> OpenCLProfiler::stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+std::vector<OpenCLProfiler::Record> OpenCLProfiler::timeline()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_records;
+}
+
+// names are kernel identifiers and fixed transfer names, only quotes and
+// backslashes need escaping
+static std::string jsonString(const std::string& str)
+{
+    std::string result = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result + "\"";
+}
+
+void OpenCLProfiler::writeJson(std::ostream& os)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    os << "{\n  \"skipped\": " << m_skipped << ",\n  \"commands\": [";
+
+    const char* separator = "\n";
+    for (auto& entry : m_stats) {
+        const Stats& stats = entry.second;
+        os << separator << "    {\"name\": " << jsonString(entry.first)
+           << ", \"count\": " << stats.count
+           << ", \"total_ns\": " << stats.total_ns
+           << ", \"avg_ns\": " << stats.total_ns / stats.count
+           << ", \"min_ns\": " << stats.min_ns
+           << ", \"max_ns\": " << stats.max_ns
+           << ", \"wait_ns\": " << stats.wait_ns << "}";
+        separator = ",\n";
+    }
+
+    os << "\n  ]\n}\n";
+}
+
+void OpenCLProfiler::writeCsv(std::ostream& os)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    os << "name,count,total_ns,avg_ns,min_ns,max_ns,wait_ns\n";
+    for (auto& entry : m_stats) {
+        const Stats& stats = entry.second;
+        os << entry.first << "," << stats.count << "," << stats.total_ns << "," << stats.total_ns / stats.count
+           << "," << stats.min_ns << "," << stats.max_ns << "," << stats.wait_ns << "\n";
+    }
+}
+
+void OpenCLProfiler::writeTimeline(std::ostream& os)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    cl_ulong origin = std::numeric_limits<cl_ulong>::max();
+    for (const Record& rec : m_records) {
+        origin = std::min(origin, rec.queued);
+    }
+
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    os.setf(std::ios::fixed, std::ios::floatfield);
+    os.precision(3);
+
+    // complete events, microseconds from the first enqueue
+    os << "{\"traceEvents\": [";
+    const char* separator = "\n";
+    for (const Record& rec : m_records) {
+        os << separator << "  {\"name\": " << jsonString(rec.name) << ", \"ph\": \"X\", \"pid\": 0"
+           << ", \"tid\": " << rec.queue
+           << ", \"ts\": " << (rec.start - origin) / 1000.0
+           << ", \"dur\": " << (rec.end - rec.start) / 1000.0
+           << ", \"args\": {\"queued_us\": " << (rec.queued - origin) / 1000.0
+           << ", \"submit_us\": " << (rec.submit - origin) / 1000.0 << "}}";
+        separator = ",\n";
+    }
+    os << "\n]}\n";
+
+    os.flags(flags);
+    os.precision(precision);
+}
+
+static void checkOutput(const std::ofstream& ofs, const std::string& path)
+{
+    if (ofs.fail()) {
+        throw std::runtime_error("Unable to write OpenCL profile: " + path);
+    }
+}
+
+void OpenCLProfiler::save(const std::string& base, const std::string& timeline_file)
+{
+    collect();
+
+    std::ofstream json(base + ".json");
+    checkOutput(json, base + ".json");
+    writeJson(json);
+
+    std::ofstream csv(base + ".csv");
+    checkOutput(csv, base + ".csv");
+    writeCsv(csv);
+
+    if (!timeline_file.empty()) {
+        std::ofstream timeline(timeline_file);
+        checkOutput(timeline, timeline_file);
+        writeTimeline(timeline);
+    }
+}
@@ -0,0 +1,246 @@
+#include <platforms/opencl/program_cache.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char cache_magic[8] = { 'M', 'D', 'C', 'L', 'P', 'R', 'O', 'G' };
+static const uint32_t cache_version = 1;
+
+// FNV-1a, only used to name cache files, the full key is stored in the file
+static uint64_t hashString(const std::string& str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : str) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string makeKey(const std::vector<cl::Device>& devices, const std::string& source,
+                           const std::string& build_options)
+{
+    std::ostringstream oss;
+    for (const cl::Device& device : devices) {
+        oss << device.getInfo<CL_DEVICE_NAME>() << "|"
+            << device.getInfo<CL_DEVICE_VENDOR>() << "|"
+            << device.getInfo<CL_DEVICE_VERSION>() << "|"
+            << device.getInfo<CL_DRIVER_VERSION>() << "\n";
+    }
+    oss << build_options << "\n" << source;
+    return oss.str();
+}
+
+template <class T>
+static void writeValue(std::ostream& os, T value)
+{
+    os.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <class T>
+static bool readValue(std::istream& is, T& value)
+{
+    return bool(is.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+void OpenCLProgramCache::setCacheDir(std::string dir)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cache_dir = dir;
+}
+
+std::string OpenCLProgramCache::cacheDir() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cache_dir;
+}
+
+cl::Program OpenCLProgramCache::getProgram(const cl::Context& context, const std::vector<cl::Device>& devices,
+                                           const std::string& source, const std::string& build_options,
+                                           BuildFn build)
+{
+    std::string key = makeKey(devices, source, build_options);
+
+    // lock is held during build, so concurrent requests of the same program
+    // do not compile it twice
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto mem_key = std::make_pair(context(), key);
+    auto found = m_programs.find(mem_key);
+    if (found != m_programs.end()) {
+        m_stats.memory_hits++;
+        return found->second;
+    }
+
+    cl::Program program;
+    if (load(key, context, devices, build_options, program)) {
+        m_stats.disk_hits++;
+    } else {
+        program = build();
+        m_stats.builds++;
+        store(key, program, devices.size());
+    }
+
+    m_programs[mem_key] = program;
+    return program;
+}
+
+void OpenCLProgramCache::clearMemory()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_programs.clear();
+}
+
+OpenCLProgramCache::Stats OpenCLProgramCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+std::string OpenCLProgramCache::filePath(const std::string& key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.clbin", static_cast<unsigned long long>(hashString(key)));
+    return m_cache_dir + "/" + name;
+}
+
+// File layout:
+//   magic[8] version:u32 key_size:u64 key[key_size]
+//   num_binaries:u32 { size:u64 binary[size] } * num_binaries
+bool OpenCLProgramCache::load(const std::string& key, const cl::Context& context,
+                              const std::vector<cl::Device>& devices, const std::string& build_options,
+                              cl::Program& program)
+{
+    if (m_cache_dir.empty()) {
+        return false;
+    }
+
+    std::ifstream ifs(filePath(key), std::ios::binary);
+    if (ifs.fail()) {
+        return false;
+    }
+
+    char magic[sizeof(cache_magic)];
+    uint32_t version = 0;
+    uint64_t key_size = 0;
+    if (!ifs.read(magic, sizeof(magic)) || std::memcmp(magic, cache_magic, sizeof(magic)) != 0 ||
+        !readValue(ifs, version) || version != cache_version ||
+        !readValue(ifs, key_size) || key_size != key.size())
+    {
+        return false;
+    }
+
+    // hash collision or stale file
+    std::string stored_key(key_size, '\0');
+    if (!ifs.read(&stored_key[0], key_size) || stored_key != key) {
+        return false;
+    }
+
+    uint32_t num_binaries = 0;
+    if (!readValue(ifs, num_binaries) || num_binaries != devices.size()) {
+        return false;
+    }
+
+    std::vector<std::vector<char> > binaries(num_binaries);
+    cl::Program::Binaries cl_binaries;
+    for (auto& binary : binaries) {
+        uint64_t size = 0;
+        if (!readValue(ifs, size)) {
+            return false;
+        }
+
+        binary.resize(size);
+        if (size == 0 || !ifs.read(&binary[0], size)) {
+            return false;
+        }
+
+        cl_binaries.push_back(std::make_pair(static_cast<const void*>(&binary[0]), binary.size()));
+    }
+
+    try {
+        program = cl::Program(context, devices, cl_binaries);
+        program.build(devices, build_options.c_str());
+    } catch (cl::Error&) {
+        // binary rejected by driver, rebuild from source
+        return false;
+    }
+
+    return true;
+}
+
+void OpenCLProgramCache::store(const std::string& key, const cl::Program& program, size_t num_devices)
+{
+    if (m_cache_dir.empty()) {
+        return;
+    }
+
+    if (::mkdir(m_cache_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        return;
+    }
+
+    // cl.hpp 1.2 getInfo<CL_PROGRAM_BINARIES> does not allocate output buffers,
+    // so binaries are queried with C API
+    std::vector< ::size_t> sizes(num_devices, 0);
+    if (::clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizes.size() * sizeof(::size_t),
+                           &sizes[0], NULL) != CL_SUCCESS)
+    {
+        return;
+    }
+
+    std::vector<std::vector<unsigned char> > binaries(num_devices);
+    std::vector<unsigned char*> pointers(num_devices, NULL);
+    for (size_t i = 0; i < num_devices; i++) {
+        if (sizes[i] == 0) {
+            // program is not built for some device, nothing to reuse
+            return;
+        }
+
+        binaries[i].resize(sizes[i]);
+        pointers[i] = &binaries[i][0];
+    }
+
+    if (::clGetProgramInfo(program(), CL_PROGRAM_BINARIES, pointers.size() * sizeof(unsigned char*),
+                           &pointers[0], NULL) != CL_SUCCESS)
+    {
+        return;
+    }
+
+    // write to temporary file and rename, so concurrent processes
+    // never see partially written binaries
+    std::string path = filePath(key);
+    std::string tmp_path = path + "." + std::to_string(::getpid()) + ".tmp";
+    {
+        std::ofstream ofs(tmp_path, std::ios::binary);
+        if (ofs.fail()) {
+            return;
+        }
+
+        ofs.write(cache_magic, sizeof(cache_magic));
+        writeValue<uint32_t>(ofs, cache_version);
+        writeValue<uint64_t>(ofs, key.size());
+        ofs.write(key.data(), key.size());
+
+        writeValue<uint32_t>(ofs, binaries.size());
+        for (auto& binary : binaries) {
+            writeValue<uint64_t>(ofs, binary.size());
+            ofs.write(reinterpret_cast<const char*>(&binary[0]), binary.size());
+        }
+
+        if (ofs.fail()) {
+            ofs.close();
+            std::remove(tmp_path.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+    }
+}
@@ -0,0 +1,282 @@
+#include <platforms/opencl/tuning.hpp>
+#include <platforms/opencl/opencl_platform.hpp>
+#include <platforms/opencl/opencl_dispatcher.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <errno.h>
+#include <sys/stat.h>
+
+std::ostream& operator<<(std::ostream& os, const KernelTuning& tuning)
+{
+    os << "work_group_size " << tuning.work_group_size
+       << " tile_size " << tuning.tile_size
+       << " unroll " << tuning.unroll;
+    return os;
+}
+
+static std::string deviceKey(const cl::Device& device)
+{
+    return device.getInfo<CL_DEVICE_NAME>() + "|" + device.getInfo<CL_DRIVER_VERSION>();
+}
+
+void OpenCLTuningProfiles::setProfileDir(std::string dir)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_profile_dir = dir;
+    m_profiles.clear();
+}
+
+std::string OpenCLTuningProfiles::profileDir() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_profile_dir;
+}
+
+std::string OpenCLTuningProfiles::profilePath(const cl::Device& device) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return pathFor(device);
+}
+
+std::string OpenCLTuningProfiles::pathFor(const cl::Device& device) const
+{
+    std::string name = device.getInfo<CL_DEVICE_NAME>() + "-" + device.getInfo<CL_DRIVER_VERSION>();
+
+    // device names contain spaces, parentheses and such
+    for (char& c : name) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-') {
+            c = '_';
+        }
+    }
+
+    return m_profile_dir + "/" + name + ".profile";
+}
+
+OpenCLTuningProfiles::Profile& OpenCLTuningProfiles::profile(const cl::Device& device)
+{
+    std::string key = deviceKey(device);
+
+    auto found = m_profiles.find(key);
+    if (found != m_profiles.end()) {
+        return found->second;
+    }
+
+    Profile& result = m_profiles[key];
+    if (m_profile_dir.empty()) {
+        return result;
+    }
+
+    std::ifstream ifs(pathFor(device));
+    for (std::string line; std::getline(ifs, line); ) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream iss(line);
+        std::string kernel;
+        iss >> kernel;
+
+        KernelTuning tuning;
+        for (std::string param; iss >> param; ) {
+            size_t value = 0;
+            if (!(iss >> value)) {
+                break;
+            }
+
+            if (param == "work_group_size") {
+                tuning.work_group_size = value;
+            } else if (param == "tile_size") {
+                tuning.tile_size = value;
+            } else if (param == "unroll") {
+                tuning.unroll = value;
+            }
+        }
+
+        result[kernel] = tuning;
+    }
+
+    return result;
+}
+
+bool OpenCLTuningProfiles::find(const cl::Device& device, const std::string& kernel, KernelTuning& tuning)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Profile& prof = profile(device);
+
+    auto found = prof.find(kernel);
+    if (found == prof.end()) {
+        return false;
+    }
+
+    tuning = found->second;
+    return true;
+}
+
+void OpenCLTuningProfiles::set(const cl::Device& device, const std::string& kernel, const KernelTuning& tuning)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    profile(device)[kernel] = tuning;
+}
+
+void OpenCLTuningProfiles::erase(const cl::Device& device, const std::string& kernel)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    profile(device).erase(kernel);
+}
+
+void OpenCLTuningProfiles::save(const cl::Device& device)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_profile_dir.empty()) {
+        throw std::runtime_error("OpenCL profile directory is not set");
+    }
+
+    std::string path = pathFor(device);
+
+    if (::mkdir(m_profile_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Unable to create OpenCL profile directory: " + m_profile_dir);
+    }
+
+    std::ofstream ofs(path);
+    if (ofs.fail()) {
+        throw std::runtime_error("Unable to write OpenCL profile: " + path);
+    }
+
+    ofs << "# " << deviceKey(device) << std::endl;
+    for (auto& entry : profile(device)) {
+        ofs << entry.first << " " << entry.second << std::endl;
+    }
+}
+
+OpenCLAutotuner::OpenCLAutotuner(OpenCLParticleSystem& sys, size_t repeats)
+    : m_sys(sys)
+    , m_repeats(std::max<size_t>(repeats, 1))
+{
+}
+
+double OpenCLAutotuner::benchmark()
+{
+    typedef std::chrono::steady_clock clock;
+
+    LennardJonesInteractionKernel kernel;
+    kernel.set_system(&m_sys);
+
+    // first run includes program build
+    kernel.execute();
+
+    double best = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < m_repeats; i++) {
+        clock::time_point start = clock::now();
+        kernel.execute();
+        std::chrono::duration<double> elapsed = clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+
+    return best;
+}
+
+void OpenCLAutotuner::tune(const std::string& kernel, const std::vector<KernelTuning>& candidates,
+                           std::ostream& log)
+{
+    OpenCLTuningProfiles& profiles = OpenCLTuningProfiles::Instance();
+    const cl::Device& device = OpenCLDispatcher::Instance().getDeviceFor(*this)->get_device();
+
+    KernelTuning best;
+    double best_time = std::numeric_limits<double>::max();
+
+    for (const KernelTuning& candidate : candidates) {
+        profiles.set(device, kernel, candidate);
+
+        try {
+            double time = benchmark();
+            log << kernel << " " << candidate << ": " << time << " s" << std::endl;
+
+            if (time < best_time) {
+                best_time = time;
+                best = candidate;
+            }
+        } catch (cl::Error& err) {
+            // e.g. not enough local memory for the tile
+            log << kernel << " " << candidate << ": failed (" << err.err() << ")" << std::endl;
+        }
+    }
+
+    if (best_time == std::numeric_limits<double>::max()) {
+        profiles.erase(device, kernel);
+        throw std::runtime_error("No valid configuration found for kernel " + kernel);
+    }
+
+    profiles.set(device, kernel, best);
+    log << kernel << " best: " << best << std::endl;
+}
+
+void OpenCLAutotuner::run(std::ostream& log)
+{
+    const cl::Device& device = OpenCLDispatcher::Instance().getDeviceFor(*this)->get_device();
+    size_t max_work_group_size = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+
+    std::vector<size_t> work_group_sizes;
+    for (size_t wg = 32; wg <= std::min<size_t>(max_work_group_size, 256); wg *= 2) {
+        work_group_sizes.push_back(wg);
+    }
+    // small devices, e.g. some CPU and embedded runtimes
+    if (work_group_sizes.empty()) {
+        work_group_sizes.push_back(max_work_group_size);
+    }
+
+    std::vector<KernelTuning> candidates;
+    std::string kernel;
+
+    if (m_sys.config().use_cutoff && m_sys.openCLConfig().cell_list) {
+        kernel = "CellForces";
+
+        // runtime choice is a candidate too
+        candidates.push_back(KernelTuning());
+        for (size_t wg : work_group_sizes) {
+            KernelTuning tuning;
+            tuning.work_group_size = wg;
+            candidates.push_back(tuning);
+        }
+    } else if (m_sys.openCLConfig().lj_kernel.value() == "tiled") {
+        kernel = "LennardJonesInteractionTiled";
+
+        for (size_t wg : work_group_sizes) {
+            for (size_t tiles : { 1, 2, 4 }) {
+                for (size_t unroll : { 1, 2, 4, 8 }) {
+                    KernelTuning tuning;
+                    tuning.work_group_size = wg;
+                    tuning.tile_size = wg * tiles;
+                    tuning.unroll = unroll;
+                    candidates.push_back(tuning);
+                }
+            }
+        }
+    } else {
+        kernel = "LennardJonesInteraction";
+
+        candidates.push_back(KernelTuning());
+        for (size_t wg : work_group_sizes) {
+            KernelTuning tuning;
+            tuning.work_group_size = wg;
+            candidates.push_back(tuning);
+        }
+    }
+
+    log << "Tuning " << kernel << " on " << device.getInfo<CL_DEVICE_NAME>()
+        << ", " << candidates.size() << " configurations" << std::endl;
+
+    tune(kernel, candidates, log);
+
+    if (!OpenCLTuningProfiles::Instance().profileDir().empty()) {
+        OpenCLTuningProfiles::Instance().save(device);
+        log << "Profile saved: " << OpenCLTuningProfiles::Instance().profilePath(device) << std::endl;
+    }
+}
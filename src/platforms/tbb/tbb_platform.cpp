@@ -10,11 +10,18 @@ TBBParticleSystem::TBBParticleSystem(ParticleSystemConfig conf) : NativeParticle
 }
 
 void TBBParticleSystem::applyLennardJonesInteraction()
+{
+    applyLennardJonesInteraction(0, m_pos.size());
+}
+
+void TBBParticleSystem::applyLennardJonesInteraction(size_t first, size_t last)
 {
     LennardJonesConstants lj_constants = m_lj_config.getConstants();
-    tbb::parallel_for(tbb::blocked_range<size_t>(0,m_pos.size()),
+    tbb::parallel_for(tbb::blocked_range<size_t>(first, last),
         [&](const tbb::blocked_range<size_t>& r) {
             for (size_t i = r.begin(), end = r.end(); i != end; i++) {
+                m_accel[i] = float3(0, 0, 0);
+
                 for (size_t j = 0; j < i; j++) {
                     singleLennardJonesInteraction(m_pos[i], m_pos[j], m_accel[i], lj_constants);
                 }
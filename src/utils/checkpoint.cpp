@@ -0,0 +1,290 @@
+#include <utils/checkpoint.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+
+static_assert(sizeof(md::float3) == 3 * sizeof(float), "Checkpoint fields are written as raw floats");
+
+static const uint64_t fnv_offset = 14695981039346656037ull;
+static const uint64_t fnv_prime = 1099511628211ull;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * fnv_prime;
+    }
+    return hash;
+}
+
+// file keeps x, y, z of every particle, padding of float3vec elements is not stored
+static void packField(const float3vec& field, std::vector<md::float3>& packed)
+{
+    packed.assign(field.begin(), field.end());
+}
+
+static void unpackField(const std::vector<md::float3>& packed, float3vec& field)
+{
+    field.assign(packed.begin(), packed.end());
+}
+
+void Checkpoint::save(const std::string& filename) const
+{
+    const float3vec* fields[4] = { &state.pos, &state.pos_prev, &state.vel, &state.accel };
+    size_t particles = state.pos.size();
+    for (size_t f = 0; f < 4; f++) {
+        if (fields[f]->size() != particles) {
+            throw CheckpointError("Inconsistent particle state, checkpoint is not written");
+        }
+    }
+
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = checkpoint_version;
+    header.precision = sizeof(float);
+    header.iteration = state.iteration;
+    header.particles = particles;
+    header.config_size = config.size();
+
+    std::vector<md::float3> packed[4];
+    header.checksum = fnv1a(fnv_offset, config.data(), config.size());
+    for (size_t f = 0; f < 4; f++) {
+        packField(*fields[f], packed[f]);
+        header.checksum = fnv1a(header.checksum, packed[f].data(), sizeof(md::float3) * particles);
+    }
+
+    std::string tmp_filename = filename + ".tmp";
+    {
+        std::ofstream os(tmp_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!os.is_open()) {
+            throw CheckpointError("Unable to open checkpoint: " + tmp_filename);
+        }
+
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        os.write(config.data(), config.size());
+        for (size_t f = 0; f < 4; f++) {
+            os.write(reinterpret_cast<const char*>(packed[f].data()), sizeof(md::float3) * particles);
+        }
+
+        os.flush();
+        if (!os.good()) {
+            throw CheckpointError("Unable to write checkpoint: " + tmp_filename);
+        }
+    }
+
+#ifdef _WIN32
+    // rename does not replace existing files
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        throw CheckpointError("Unable to replace checkpoint: " + filename);
+    }
+}
+
+Checkpoint Checkpoint::load(const std::string& filename)
+{
+    std::ifstream is(filename, std::ios::in | std::ios::binary);
+    if (!is.is_open()) {
+        throw CheckpointError("Unable to open checkpoint: " + filename);
+    }
+
+    CheckpointHeader header;
+    is.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!is.good() || std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0 ||
+        header.version != checkpoint_version || header.precision != sizeof(float)) {
+        throw CheckpointError("Not a checkpoint or unsupported version: " + filename);
+    }
+
+    is.seekg(0, std::ios::end);
+    uint64_t size = static_cast<uint64_t>(is.tellg());
+    uint64_t expected = sizeof(header) + header.config_size + 4 * sizeof(md::float3) * header.particles;
+    if (size != expected) {
+        throw CheckpointError("Truncated checkpoint: " + filename);
+    }
+    is.seekg(sizeof(header));
+
+    Checkpoint checkpoint;
+    checkpoint.state.iteration = header.iteration;
+
+    checkpoint.config.resize(header.config_size);
+    if (!checkpoint.config.empty()) {
+        is.read(&checkpoint.config[0], checkpoint.config.size());
+    }
+
+    float3vec* fields[4] = { &checkpoint.state.pos, &checkpoint.state.pos_prev, &checkpoint.state.vel,
+                             &checkpoint.state.accel };
+    std::vector<md::float3> packed[4];
+    for (size_t f = 0; f < 4; f++) {
+        packed[f].resize(header.particles);
+        is.read(reinterpret_cast<char*>(packed[f].data()), sizeof(md::float3) * header.particles);
+    }
+
+    if (!is.good()) {
+        throw CheckpointError("Unable to read checkpoint: " + filename);
+    }
+
+    uint64_t checksum = fnv1a(fnv_offset, checkpoint.config.data(), checkpoint.config.size());
+    for (size_t f = 0; f < 4; f++) {
+        checksum = fnv1a(checksum, packed[f].data(), sizeof(md::float3) * header.particles);
+    }
+
+    if (checksum != header.checksum) {
+        throw CheckpointError("Corrupted checkpoint: " + filename);
+    }
+
+    for (size_t f = 0; f < 4; f++) {
+        unpackField(packed[f], *fields[f]);
+    }
+
+    return checkpoint;
+}
+
+CheckpointWriter::CheckpointWriter()
+    : m_last_iteration(0)
+    , m_conf(ConfigManager::Instance().getCheckpointConfig())
+    , m_pending(false)
+    , m_stop(false)
+    , m_written(0)
+{
+    init();
+}
+
+CheckpointWriter::CheckpointWriter(CheckpointConfig conf)
+    : m_last_iteration(0)
+    , m_conf(conf)
+    , m_pending(false)
+    , m_stop(false)
+    , m_written(0)
+{
+    init();
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    if (m_writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_writer.join();
+    }
+}
+
+void CheckpointWriter::init()
+{
+    if (!m_conf.enabled || !m_conf.async) {
+        return;
+    }
+
+    m_writer = std::thread(&CheckpointWriter::writerLoop, this);
+}
+
+void CheckpointWriter::attach(ParticleSystem& par_sys)
+{
+    if (!m_conf.enabled) {
+        return;
+    }
+
+    m_last_iteration = par_sys.iteration();
+
+    using namespace std::placeholders;
+    ParticleSystem::IterationCb cb = std::bind(&CheckpointWriter::onIteration, this, _1, _2);
+    par_sys.registerOnIterationCb(cb, m_conf.iterations_threshold, m_cb_owner);
+}
+
+void CheckpointWriter::onIteration(ParticleSystem* pSys, size_t iteration)
+{
+    if (!m_conf.enabled) {
+        return;
+    }
+
+    if ((iteration - m_last_iteration) < m_conf.iterations_threshold) {
+        return;
+    }
+
+    m_last_iteration = iteration;
+
+    // previous checkpoint owns m_checkpoint until written
+    flush();
+
+    pSys->saveState(m_checkpoint.state);
+    // callback comes after the step
+    m_checkpoint.state.iteration = iteration + 1;
+    submit();
+}
+
+void CheckpointWriter::write(ParticleSystem& par_sys)
+{
+    if (!m_conf.enabled) {
+        return;
+    }
+
+    flush();
+
+    par_sys.saveState(m_checkpoint.state);
+    m_checkpoint.state.iteration = par_sys.iteration();
+    submit();
+    flush();
+}
+
+void CheckpointWriter::submit()
+{
+    if (!m_writer.joinable()) {
+        m_checkpoint.save(m_conf.filename);
+        m_written++;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending = true;
+    }
+    m_cv.notify_all();
+}
+
+void CheckpointWriter::flush()
+{
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return !m_pending; });
+        std::swap(error, m_writer_error);
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void CheckpointWriter::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cv.wait(lock, [this]() { return m_pending || m_stop; });
+        if (!m_pending) {
+            return;
+        }
+
+        // simulation thread waits for m_pending before touching m_checkpoint
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            m_checkpoint.save(m_conf.filename);
+            m_written++;
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+
+        if (error && !m_writer_error) {
+            m_writer_error = error;
+        }
+
+        m_pending = false;
+        m_cv.notify_all();
+    }
+}
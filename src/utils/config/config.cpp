@@ -63,3 +63,18 @@ void IConfig::loadFromStream(std::istream& is)
 
     onLoad();
 }
+
+void IConfig::setEntry(std::string entry_name, std::string value)
+{
+    if (!m_strEntryMap.count(entry_name)) {
+        throw ConfigError("Unrecognized config entry: " + entry_name);
+    }
+
+    std::istringstream iss(value);
+    m_strEntryMap[entry_name]->readValueFromStream(iss);
+    if (iss.fail()) {
+        throw ConfigError("Invalid value for config entry " + entry_name + ": " + value);
+    }
+
+    onLoad();
+}
@@ -7,7 +7,12 @@ void ConfigManager::loadFromFile(std::string filename)
         throw std::runtime_error("Unable to open config: " + filename);
     }
 
-    for (std::string line; std::getline(ifs, line); ) {
+    loadFromStream(ifs);
+}
+
+void ConfigManager::loadFromStream(std::istream& is)
+{
+    for (std::string line; std::getline(is, line); ) {
         size_t open_bracket = line.find('[');
         size_t close_bracket = line.find(']', open_bracket);
 
@@ -18,11 +23,60 @@ void ConfigManager::loadFromFile(std::string filename)
         }
 
         std::string config_name = line.substr(open_bracket + 1, close_bracket - open_bracket - 1);
-        if (m_strConfMap.count(config_name)) {
-            m_strConfMap[config_name]->loadFromStream(ifs);
+        if (config_name == TraceSelectionConfig().name()) {
+            loadTraceSelection(is);
+        } else if (m_strConfMap.count(config_name)) {
+            m_strConfMap[config_name]->loadFromStream(is);
         } else {
             throw ConfigError("Unknown config: " + config_name);
         }
     }
 }
 
+void ConfigManager::loadTraceSelection(std::istream& is)
+{
+    TraceSelectionConfig selection;
+    selection.loadFromStream(is);
+
+    for (auto& loaded : m_trace_selection_configs) {
+        if (loaded.label.value() == selection.label.value()) {
+            loaded = selection;
+            return;
+        }
+    }
+
+    m_trace_selection_configs.push_back(selection);
+}
+
+void ConfigManager::setEntry(std::string entry, std::string value)
+{
+    size_t dot = entry.find('.');
+    if (dot != std::string::npos) {
+        std::string config_name = entry.substr(0, dot);
+        if (!m_strConfMap.count(config_name)) {
+            throw ConfigError("Unknown config: " + config_name);
+        }
+
+        m_strConfMap[config_name]->setEntry(entry.substr(dot + 1), value);
+        return;
+    }
+
+    IConfig* found = nullptr;
+    std::string found_name;
+    for (auto& conf : m_strConfMap) {
+        if (!conf.second->hasEntry(entry)) {
+            continue;
+        }
+        if (found) {
+            throw ConfigError("Ambiguous config entry: " + entry + " is in " + found_name + " and " +
+                              conf.first + ", use ConfigName." + entry);
+        }
+        found = conf.second;
+        found_name = conf.first;
+    }
+
+    if (!found) {
+        throw ConfigError("Unrecognized config entry: " + entry);
+    }
+    found->setEntry(entry, value);
+}
@@ -0,0 +1,419 @@
+#include <utils/frame_ring.hpp>
+#include <utils/config/config_manager.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(md::float3a) == 4 * sizeof(float), "Frames are copied as raw 16 byte elements");
+
+static const uint32_t field_bits[3] = { binary_trace_pos, binary_trace_vel, binary_trace_accel };
+
+static size_t fieldCount(uint32_t fields)
+{
+    size_t count = 0;
+    for (size_t f = 0; f < 3; f++) {
+        count += (fields & field_bits[f]) != 0;
+    }
+    return count;
+}
+
+static const FrameRingSlot* slotAt(const char* data, const FrameRingHeader* header, uint64_t frame)
+{
+    return reinterpret_cast<const FrameRingSlot*>(data + sizeof(FrameRingHeader) +
+                                                  (frame % header->slots) * header->slot_size);
+}
+
+static float* components(md::float3& value)
+{
+    return &value.x;
+}
+
+static float* components(cl_float3& value)
+{
+    return value.s;
+}
+
+#ifndef _WIN32
+
+FrameRingWriter::FrameRingWriter(const std::string& name, size_t slots, size_t capacity, uint32_t fields,
+                                 md::float3 area)
+    : m_name(name)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_header(nullptr)
+    , m_next(0)
+{
+    if (slots < 2 || fieldCount(fields) == 0) {
+        throw FrameRingError("Frame ring needs at least 2 slots and one field: " + name);
+    }
+
+    // slots start at cache line boundary
+    size_t slot_size = sizeof(FrameRingSlot) + fieldCount(fields) * capacity * sizeof(md::float3a);
+    slot_size = (slot_size + 63) / 64 * 64;
+    m_size = sizeof(FrameRingHeader) + slots * slot_size;
+
+    // ring of a previous run is replaced, not reused
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        throw FrameRingError("Unable to create frame ring: " + name);
+    }
+
+    if (ftruncate(fd, m_size) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        throw FrameRingError("Unable to allocate frame ring: " + name);
+    }
+
+    void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw FrameRingError("Unable to map frame ring: " + name);
+    }
+
+    // new shared memory is zero filled, zero sequences mean empty slots
+    m_data = static_cast<char*>(data);
+    m_header = reinterpret_cast<FrameRingHeader*>(m_data);
+    m_header->version = frame_ring_version;
+    m_header->fields = fields;
+    m_header->capacity = capacity;
+    m_header->slots = slots;
+    m_header->slot_size = slot_size;
+    m_header->area[0] = area.x;
+    m_header->area[1] = area.y;
+    m_header->area[2] = area.z;
+    m_header->published.store(0, std::memory_order_relaxed);
+
+    // readers check magic last written
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(m_header->magic, frame_ring_magic, sizeof(m_header->magic));
+}
+
+FrameRingWriter::~FrameRingWriter()
+{
+    munmap(m_data, m_size);
+    shm_unlink(m_name.c_str());
+}
+
+void FrameRingWriter::publish(const ParticleFrame& frame)
+{
+    const float3vec* frame_fields[3] = { &frame.pos, &frame.vel, &frame.accel };
+    size_t particles = 0;
+    for (size_t f = 0; f < 3; f++) {
+        particles = std::max(particles, frame_fields[f]->size());
+    }
+
+    if (particles > m_header->capacity) {
+        throw FrameRingError("Frame has more particles than frame ring " + m_name + " holds");
+    }
+
+    FrameRingSlot* slot = const_cast<FrameRingSlot*>(slotAt(m_data, m_header, m_next));
+    float* values = reinterpret_cast<float*>(slot + 1);
+
+    // odd sequence is visible before any value changes
+    slot->sequence.store(2 * m_next + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->iteration = frame.iteration;
+    slot->particles = particles;
+    for (size_t f = 0; f < 3; f++) {
+        if (!(m_header->fields & field_bits[f])) {
+            continue;
+        }
+
+        const float3vec& field = *frame_fields[f];
+        if (field.size() == particles) {
+            std::memcpy(values, field.data(), particles * sizeof(md::float3a));
+        } else {
+            std::memset(values, 0, particles * sizeof(md::float3a));
+        }
+        values += 4 * m_header->capacity;
+    }
+
+    slot->sequence.store(2 * m_next + 2, std::memory_order_release);
+    m_header->published.store(m_next + 1, std::memory_order_release);
+    m_next++;
+}
+
+FrameRingReader::FrameRingReader(const std::string& name)
+    : m_name(name)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_header(nullptr)
+    , m_last_read(0)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        throw FrameRingError("Unable to open frame ring: " + name);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(FrameRingHeader)) {
+        ::close(fd);
+        throw FrameRingError("Frame ring is not initialized: " + name);
+    }
+
+    m_size = st.st_size;
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+        throw FrameRingError("Unable to map frame ring: " + name);
+    }
+
+    m_data = static_cast<const char*>(data);
+    m_header = reinterpret_cast<const FrameRingHeader*>(m_data);
+
+    bool valid = std::memcmp(m_header->magic, frame_ring_magic, sizeof(m_header->magic)) == 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    valid = valid && m_header->version == frame_ring_version && m_header->slots >= 2 &&
+            sizeof(FrameRingHeader) + m_header->slots * m_header->slot_size <= m_size;
+    if (!valid) {
+        munmap(const_cast<char*>(m_data), m_size);
+        throw FrameRingError("Frame ring is not initialized or has unsupported version: " + name);
+    }
+}
+
+FrameRingReader::~FrameRingReader()
+{
+    munmap(const_cast<char*>(m_data), m_size);
+}
+
+bool FrameRingReader::readLatest(ParticleFrame& frame)
+{
+    float3vec* frame_fields[3] = { &frame.pos, &frame.vel, &frame.accel };
+
+    while (true) {
+        uint64_t published = m_header->published.load(std::memory_order_acquire);
+        if (published == 0 || published == m_last_read) {
+            return false;
+        }
+
+        uint64_t newest = published - 1;
+        const FrameRingSlot* slot = slotAt(m_data, m_header, newest);
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * newest + 2) {
+            // overwritten by a newer frame
+            continue;
+        }
+
+        frame.iteration = slot->iteration;
+        size_t particles = std::min<uint64_t>(slot->particles, m_header->capacity);
+        const float* values = reinterpret_cast<const float*>(slot + 1);
+        for (size_t f = 0; f < 3; f++) {
+            if (!(m_header->fields & field_bits[f])) {
+                frame_fields[f]->clear();
+                continue;
+            }
+
+            frame_fields[f]->resize(particles);
+            std::memcpy(reinterpret_cast<float*>(frame_fields[f]->data()), values, particles * sizeof(md::float3a));
+            values += 4 * m_header->capacity;
+        }
+        frame.ids.clear();
+
+        // values were copied before the sequence is checked again
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->sequence.load(std::memory_order_relaxed) == sequence) {
+            m_last_read = published;
+            return true;
+        }
+    }
+}
+
+#else
+
+FrameRingWriter::FrameRingWriter(const std::string& name, size_t slots, size_t capacity, uint32_t fields,
+                                 md::float3 area)
+    : m_name(name)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_header(nullptr)
+    , m_next(0)
+{
+    throw FrameRingError("Shared memory frame rings are not supported on this platform");
+}
+
+FrameRingWriter::~FrameRingWriter()
+{
+}
+
+void FrameRingWriter::publish(const ParticleFrame& frame)
+{
+}
+
+FrameRingReader::FrameRingReader(const std::string& name)
+    : m_name(name)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_header(nullptr)
+    , m_last_read(0)
+{
+    throw FrameRingError("Shared memory frame rings are not supported on this platform");
+}
+
+FrameRingReader::~FrameRingReader()
+{
+}
+
+bool FrameRingReader::readLatest(ParticleFrame& frame)
+{
+    return false;
+}
+
+#endif
+
+FrameRingPublisher::FrameRingPublisher()
+    : m_last_iteration(0)
+    , m_conf(ConfigManager::Instance().getFrameRingConfig())
+    , m_area(0)
+{
+}
+
+FrameRingPublisher::FrameRingPublisher(FrameRingConfig conf)
+    : m_last_iteration(0)
+    , m_conf(conf)
+    , m_area(0)
+{
+}
+
+void FrameRingPublisher::attach(ParticleSystem& par_sys)
+{
+    // disabled publisher does not make platforms synchronize state
+    if (!m_conf.enabled) {
+        return;
+    }
+
+    m_area = par_sys.config().area_size;
+    m_last_iteration = par_sys.iteration();
+
+    using namespace std::placeholders;
+    ParticleSystem::IterationCb cb = std::bind(&FrameRingPublisher::onIteration, this, _1, _2);
+    par_sys.registerOnIterationCb(cb, m_conf.iterations_threshold, m_cb_owner);
+}
+
+void FrameRingPublisher::onIteration(ParticleSystem* pSys, size_t iteration)
+{
+    if (!m_conf.enabled) {
+        return;
+    }
+
+    if ((iteration - m_last_iteration) < m_conf.iterations_threshold) {
+        return;
+    }
+
+    m_last_iteration = iteration;
+
+    pSys->snapshot(m_frame);
+    m_frame.iteration = iteration;
+
+    if (!m_writer) {
+        uint32_t fields = (m_conf.pos ? binary_trace_pos : 0) | (m_conf.vel ? binary_trace_vel : 0) |
+                          (m_conf.accel ? binary_trace_accel : 0);
+        m_writer.reset(new FrameRingWriter(m_conf.shm_name, m_conf.slots, m_frame.size(), fields, m_area));
+    }
+
+    m_writer->publish(m_frame);
+}
+
+FrameRingIStream::FrameRingIStream() : m_particle(0)
+{
+}
+
+FrameRingIStream::FrameRingIStream(std::string name) : m_particle(0)
+{
+    open(name);
+}
+
+void FrameRingIStream::open(std::string name)
+{
+    m_reader.reset(new FrameRingReader(name));
+    m_frame = ParticleFrame();
+    m_particle = 0;
+}
+
+bool FrameRingIStream::good()
+{
+    return m_reader != nullptr;
+}
+
+void FrameRingIStream::Read(md::float3& pos, md::float3& vel, md::float3& accel)
+{
+    if (m_reader && m_particle >= frameParticles()) {
+        m_reader->readLatest(m_frame);
+        m_particle = 0;
+    }
+
+    if (m_particle < frameParticles()) {
+        copyParticles(&pos, &vel, &accel, m_particle, 1);
+        m_particle++;
+    }
+}
+
+void FrameRingIStream::Read(cl_float3& pos, cl_float3& vel, cl_float3& accel)
+{
+    if (m_reader && m_particle >= frameParticles()) {
+        m_reader->readLatest(m_frame);
+        m_particle = 0;
+    }
+
+    if (m_particle < frameParticles()) {
+        copyParticles(&pos, &vel, &accel, m_particle, 1);
+        m_particle++;
+    }
+}
+
+void FrameRingIStream::ReadFrame(md::float3a* pos, md::float3a* vel, md::float3a* accel, size_t num)
+{
+    if (m_reader) {
+        m_reader->readLatest(m_frame);
+        m_particle = 0;
+    }
+    copyParticles(pos, vel, accel, 0, num);
+}
+
+void FrameRingIStream::ReadFrame(cl_float3* pos, cl_float3* vel, cl_float3* accel, size_t num)
+{
+    if (m_reader) {
+        m_reader->readLatest(m_frame);
+        m_particle = 0;
+    }
+    copyParticles(pos, vel, accel, 0, num);
+}
+
+size_t FrameRingIStream::frameParticles() const
+{
+    return std::max(m_frame.pos.size(), std::max(m_frame.vel.size(), m_frame.accel.size()));
+}
+
+template <class T>
+void FrameRingIStream::copyParticles(T* pos, T* vel, T* accel, size_t first, size_t num)
+{
+    T* out[3] = { !(m_ignore_flags & StreamIgnore::IGNORE_POS) ? pos : nullptr,
+                  !(m_ignore_flags & StreamIgnore::IGNORE_VEL) ? vel : nullptr,
+                  !(m_ignore_flags & StreamIgnore::IGNORE_ACCEL) ? accel : nullptr };
+    const float3vec* fields[3] = { &m_frame.pos, &m_frame.vel, &m_frame.accel };
+
+    for (size_t f = 0; f < 3; f++) {
+        if (!out[f] || fields[f]->size() <= first) {
+            continue;
+        }
+
+        size_t count = std::min(num, fields[f]->size() - first);
+        for (size_t i = 0; i < count; i++) {
+            const md::float3& value = (*fields[f])[first + i];
+            std::copy(&value.x, &value.x + 3, components(out[f][i]));
+        }
+    }
+}
@@ -0,0 +1,221 @@
+#include <utils/mapped_trace.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(md::float3) == 3 * sizeof(float), "Frame views reinterpret raw floats as float3");
+
+#ifndef _WIN32
+
+MappedTrace::MappedTrace(const std::string& filename)
+    : m_filename(filename)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_frames(0)
+    , m_index(nullptr)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw MappedTraceError("Unable to open trace: " + filename);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(BinaryTraceHeader)) {
+        ::close(fd);
+        throw MappedTraceError("Not a binary trace: " + filename);
+    }
+
+    m_size = st.st_size;
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    // mapping keeps the file referenced
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+        throw MappedTraceError("Unable to map trace: " + filename);
+    }
+    m_data = static_cast<const char*>(data);
+
+    std::memcpy(&m_header, m_data, sizeof(m_header));
+    if (!m_header.valid()) {
+        munmap(data, m_size);
+        throw MappedTraceError("Not a binary trace or unsupported version: " + filename);
+    }
+
+    if (m_header.codec != binary_trace_raw) {
+        munmap(data, m_size);
+        throw MappedTraceError("Compressed trace cannot be mapped, use ByteIStream: " + filename);
+    }
+
+    uint64_t index_end = m_header.index_offset + m_header.frames * sizeof(BinaryTraceIndexEntry);
+    if (m_header.index_offset != 0 && index_end <= m_size) {
+        m_frames = m_header.frames;
+        m_index = reinterpret_cast<const BinaryTraceIndexEntry*>(m_data + m_header.index_offset);
+    } else {
+        // unfinished trace, complete frames only
+        m_frames = (m_size - sizeof(BinaryTraceHeader)) / m_header.frameSize();
+    }
+}
+
+MappedTrace::~MappedTrace()
+{
+    munmap(const_cast<char*>(m_data), m_size);
+}
+
+void MappedTrace::advise(size_t first, size_t count, int advice) const
+{
+    if (first >= m_frames || count == 0) {
+        return;
+    }
+
+    count = std::min(count, m_frames - first);
+
+    // madvise needs page aligned start
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = m_header.frameOffset(first) / page * page;
+    size_t end = m_header.frameOffset(first + count);
+
+    // only a hint, errors are ignored
+    madvise(const_cast<char*>(m_data) + begin, end - begin, advice);
+}
+
+void MappedTrace::adviseSequential() const
+{
+    madvise(const_cast<char*>(m_data), m_size, MADV_SEQUENTIAL);
+}
+
+void MappedTrace::adviseRandom() const
+{
+    madvise(const_cast<char*>(m_data), m_size, MADV_RANDOM);
+}
+
+void MappedTrace::willNeed(size_t first, size_t count) const
+{
+    advise(first, count, MADV_WILLNEED);
+}
+
+void MappedTrace::dontNeed(size_t first, size_t count) const
+{
+    advise(first, count, MADV_DONTNEED);
+}
+
+#else
+
+MappedTrace::MappedTrace(const std::string& filename)
+    : m_filename(filename)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_frames(0)
+    , m_index(nullptr)
+{
+    throw MappedTraceError("Memory mapped traces are not supported on this platform");
+}
+
+MappedTrace::~MappedTrace()
+{
+}
+
+void MappedTrace::advise(size_t first, size_t count, int advice) const
+{
+}
+
+void MappedTrace::adviseSequential() const
+{
+}
+
+void MappedTrace::adviseRandom() const
+{
+}
+
+void MappedTrace::willNeed(size_t first, size_t count) const
+{
+}
+
+void MappedTrace::dontNeed(size_t first, size_t count) const
+{
+}
+
+#endif
+
+MappedTrace::Frame MappedTrace::frame(size_t index) const
+{
+    if (index >= m_frames) {
+        throw std::out_of_range("Trace frame " + std::to_string(index) + " is out of range in " + m_filename);
+    }
+
+    const char* frame = m_data + m_header.frameOffset(index);
+
+    uint64_t iteration = 0;
+    if (m_index) {
+        iteration = m_index[index].iteration;
+    } else {
+        std::memcpy(&iteration, frame, sizeof(iteration));
+    }
+
+    const md::float3* fields[3] = { nullptr, nullptr, nullptr };
+    uint32_t field_bits[3] = { binary_trace_pos, binary_trace_vel, binary_trace_accel };
+    for (size_t i = 0; i < 3; i++) {
+        if (m_header.has(field_bits[i])) {
+            fields[i] = reinterpret_cast<const md::float3*>(frame + m_header.fieldOffset(field_bits[i]));
+        }
+    }
+
+    return Frame(iteration, m_header.particles, fields[0], fields[1], fields[2]);
+}
+
+MappedTrace::Range MappedTrace::range(size_t first, size_t last, size_t stride, size_t read_ahead) const
+{
+    return Range(this, first, last, stride, read_ahead);
+}
+
+MappedTrace::Range::Range(const MappedTrace* trace, size_t first, size_t last, size_t stride, size_t read_ahead)
+    : m_trace(trace)
+    , m_first(first)
+    , m_end(first)
+    , m_stride(stride)
+    , m_read_ahead(read_ahead)
+{
+    if (stride == 0) {
+        throw std::invalid_argument("Trace range stride must be positive");
+    }
+
+    if (first > last || last > trace->frames()) {
+        throw std::out_of_range("Trace range [" + std::to_string(first) + ", " + std::to_string(last) +
+                                ") is out of range");
+    }
+
+    m_end = first + (last - first + stride - 1) / stride * stride;
+}
+
+MappedTrace::Range::iterator MappedTrace::Range::begin() const
+{
+    for (size_t i = 0; i < m_read_ahead; i++) {
+        size_t frame = m_first + i * m_stride;
+        if (frame >= m_end) {
+            break;
+        }
+        m_trace->willNeed(frame, 1);
+    }
+
+    return iterator(this, m_first);
+}
+
+MappedTrace::Range::iterator& MappedTrace::Range::iterator::operator++()
+{
+    m_frame += m_range->m_stride;
+
+    // keep read_ahead frames requested in front of the current one
+    size_t ahead = m_frame + (m_range->m_read_ahead - 1) * m_range->m_stride;
+    if (m_range->m_read_ahead != 0 && ahead < m_range->m_end) {
+        m_range->m_trace->willNeed(ahead, 1);
+    }
+
+    return *this;
+}
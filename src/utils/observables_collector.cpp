@@ -0,0 +1,68 @@
+#include <utils/observables_collector.hpp>
+
+ObservablesCollector::ObservablesCollector()
+    : m_last_iteration(0)
+    , m_conf(ConfigManager::Instance().getObservablesConfig())
+{
+    init();
+}
+
+ObservablesCollector::ObservablesCollector(ObservablesConfig conf)
+    : m_last_iteration(0)
+    , m_conf(conf)
+{
+    init();
+}
+
+void ObservablesCollector::init()
+{
+    if (!m_conf.enabled) {
+        return;
+    }
+
+    m_os.open(m_conf.filename.value());
+    if (m_os.fail()) {
+        throw ObservablesError("Unable to open observables file: " + m_conf.filename.value());
+    }
+
+    m_os.precision(9);
+    writeHeader(m_os);
+}
+
+void ObservablesCollector::attach(ParticleSystem& par_sys)
+{
+    if (!m_conf.enabled) {
+        return;
+    }
+
+    using namespace std::placeholders;
+    ParticleSystem::IterationCb cb = std::bind(&ObservablesCollector::onIteration, this, _1, _2);
+    par_sys.registerOnIterationCb(cb, m_conf.iterations_threshold, m_cb_owner);
+}
+
+void ObservablesCollector::onIteration(ParticleSystem* pSys, size_t iteration)
+{
+    if ((iteration - m_last_iteration) < m_conf.iterations_threshold) {
+        return;
+    }
+
+    m_last_iteration = iteration;
+
+    Observables obs = pSys->observe();
+    obs.iteration = iteration;
+    writeRow(m_os, obs);
+}
+
+void ObservablesCollector::writeHeader(std::ostream& os)
+{
+    os << "iteration,kinetic_energy,potential_energy,total_energy,temperature,"
+       << "momentum_x,momentum_y,momentum_z,virial" << std::endl;
+}
+
+void ObservablesCollector::writeRow(std::ostream& os, const Observables& obs)
+{
+    os << obs.iteration << "," << obs.kinetic_energy << "," << obs.potential_energy << ","
+       << obs.totalEnergy() << "," << obs.temperature << ","
+       << obs.momentum.x << "," << obs.momentum.y << "," << obs.momentum.z << ","
+       << obs.virial << "\n";
+}
@@ -0,0 +1,356 @@
+#include <utils/particle_generator.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// streams of CounterRng values
+static const uint64_t velocity_stream = ~0ull;
+// first stream of per cell positions, cell streams follow it
+static const uint64_t position_stream = 0;
+
+// candidate positions tried for one particle before giving up
+static const size_t max_attempts = 1000;
+// particles per cell of separated positions
+static const double cell_particles = 8;
+// particles per block of partial sums, sums do not depend on thread count
+static const int sum_block = 4096;
+
+static const double pi = 3.14159265358979323846;
+
+static const md::float3 fcc_basis[4] = { md::float3(0, 0, 0), md::float3(0.5f, 0.5f, 0), md::float3(0.5f, 0, 0.5f),
+                                         md::float3(0, 0.5f, 0.5f) };
+static const md::float3 bcc_basis[2] = { md::float3(0, 0, 0), md::float3(0.5f, 0.5f, 0.5f) };
+
+static float* components(md::float3& value)
+{
+    return &value.x;
+}
+
+static float* components(cl_float3& value)
+{
+    return value.s;
+}
+
+double CounterRng::normal(uint64_t stream, uint64_t counter) const
+{
+    // (0, 1], logarithm is finite
+    double u1 = 1.0 - uniform(stream, 2 * counter);
+    double u2 = uniform(stream, 2 * counter + 1);
+    return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * pi * u2);
+}
+
+ParticleGenerator::ParticleGenerator(const ParticleSystemConfig& conf)
+    : m_generator(conf.init_generator)
+    , m_num(conf.particles_num)
+    , m_area(conf.area_size)
+    , m_periodic(conf.periodic)
+    , m_min_distance(conf.init_min_distance)
+    , m_temperature(conf.init_temperature)
+    , m_rng(conf.init_seed)
+{
+    if (!isGenerator(m_generator)) {
+        throw GeneratorError("Unknown init_generator: " + m_generator);
+    }
+
+    if (m_area.x <= 0 || m_area.y <= 0 || m_area.z <= 0) {
+        throw GeneratorError("Generated particles require positive area_size");
+    }
+}
+
+bool ParticleGenerator::isGenerator(const std::string& name)
+{
+    return name == "uniform" || name == "fcc" || name == "bcc";
+}
+
+void ParticleGenerator::generate(float3vec& pos, float3vec& vel) const
+{
+    pos.resize(m_num);
+    vel.resize(m_num);
+
+    positions(pos);
+    velocities(vel);
+}
+
+void ParticleGenerator::positions(float3vec& pos) const
+{
+    if (m_generator == "fcc") {
+        latticePositions(pos, fcc_basis, 4);
+    } else if (m_generator == "bcc") {
+        latticePositions(pos, bcc_basis, 2);
+    } else if (m_min_distance > 0 && pos.size() > 1) {
+        separatedPositions(pos);
+    } else {
+        uniformPositions(pos);
+    }
+}
+
+void ParticleGenerator::uniformPositions(float3vec& pos) const
+{
+    int num = pos.size();
+
+    #pragma omp parallel for
+    for (int i = 0; i < num; i++) {
+        uint64_t counter = 3 * static_cast<uint64_t>(i);
+        pos[i] = m_area * md::float3(m_rng.uniform(position_stream, counter),
+                                     m_rng.uniform(position_stream, counter + 1),
+                                     m_rng.uniform(position_stream, counter + 2));
+    }
+}
+
+// Cells are at least m_min_distance wide, so only particles of the 27 neighbour
+// cells have to be checked. Every cell gets an equal share of particles. Cells
+// are processed by parity of their coordinates: cells of one parity are never
+// neighbours, they are filled in parallel and see complete cells of the parities
+// processed before. Result does not depend on thread count.
+void ParticleGenerator::separatedPositions(float3vec& pos) const
+{
+    size_t num = pos.size();
+
+    // several particles per cell leave room to place the last ones of dense systems,
+    // even cell count per dimension keeps cells of the same parity apart across
+    // periodic boundaries
+    double max_cells = std::max(1.0, std::floor(std::cbrt(static_cast<double>(num) / cell_particles)));
+    int cells[3];
+    for (int d = 0; d < 3; d++) {
+        double n = std::min(std::max(1.0, std::floor(static_cast<double>(m_area[d]) / m_min_distance)), max_cells);
+        cells[d] = static_cast<int>(n);
+        if (cells[d] > 1 && cells[d] % 2 == 1) {
+            cells[d]--;
+        }
+    }
+
+    md::float3 cell_size = m_area / md::float3(cells[0], cells[1], cells[2]);
+    int cells_num = cells[0] * cells[1] * cells[2];
+    size_t base = num / cells_num;
+    size_t extra = num % cells_num;
+    float min_sqr = m_min_distance * m_min_distance;
+
+    // particles of cell c are pos[offset(c), offset(c + 1)), extra particles are spread evenly
+    auto offset = [&](size_t c) { return c * base + c * extra / cells_num; };
+    auto parity = [&](int c) {
+        int x = c % cells[0];
+        int y = (c / cells[0]) % cells[1];
+        int z = c / (cells[0] * cells[1]);
+        return (x & 1) | ((y & 1) << 1) | ((z & 1) << 2);
+    };
+
+    bool placed = true;
+    for (int color = 0; color < 8; color++) {
+        std::vector<int> color_cells;
+        for (int c = 0; c < cells_num; c++) {
+            if (parity(c) == color) {
+                color_cells.push_back(c);
+            }
+        }
+
+        int color_num = color_cells.size();
+
+        #pragma omp parallel for schedule(dynamic) reduction(&&:placed)
+        for (int k = 0; k < color_num; k++) {
+            int c = color_cells[k];
+            int coord[3] = { c % cells[0], (c / cells[0]) % cells[1], c / (cells[0] * cells[1]) };
+
+            std::vector<int> neighbours;
+            for (int dz = -1; dz <= 1; dz++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int n[3] = { coord[0] + dx, coord[1] + dy, coord[2] + dz };
+                        bool inside = true;
+                        for (int d = 0; d < 3; d++) {
+                            if (m_periodic) {
+                                n[d] = (n[d] + cells[d]) % cells[d];
+                            } else if (n[d] < 0 || n[d] >= cells[d]) {
+                                inside = false;
+                            }
+                        }
+
+                        int neighbour = n[0] + cells[0] * (n[1] + cells[1] * n[2]);
+                        // only cells filled before this one, small counts wrap to the same cell
+                        if (inside && neighbour != c && parity(neighbour) < color &&
+                            std::find(neighbours.begin(), neighbours.end(), neighbour) == neighbours.end()) {
+                            neighbours.push_back(neighbour);
+                        }
+                    }
+                }
+            }
+
+            md::float3 origin = md::float3(coord[0], coord[1], coord[2]) * cell_size;
+            size_t first = offset(c);
+            size_t last = offset(c + 1);
+            uint64_t stream = position_stream + 1 + c;
+
+            for (size_t i = first; i < last && placed; i++) {
+                bool found = false;
+                for (size_t attempt = 0; attempt < max_attempts && !found; attempt++) {
+                    uint64_t counter = 3 * ((i - first) * max_attempts + attempt);
+                    md::float3 candidate = origin + cell_size * md::float3(m_rng.uniform(stream, counter),
+                                                                           m_rng.uniform(stream, counter + 1),
+                                                                           m_rng.uniform(stream, counter + 2));
+
+                    auto separated = [&](size_t begin, size_t end) {
+                        for (size_t j = begin; j < end; j++) {
+                            md::float3 diff = candidate - pos[j];
+                            if (m_periodic) {
+                                diff -= m_area * glm::round(diff / m_area);
+                            }
+                            if (diff.x * diff.x + diff.y * diff.y + diff.z * diff.z < min_sqr) {
+                                return false;
+                            }
+                        }
+                        return true;
+                    };
+
+                    found = separated(first, i);
+                    for (size_t n = 0; n < neighbours.size() && found; n++) {
+                        found = separated(offset(neighbours[n]), offset(neighbours[n] + 1));
+                    }
+
+                    if (found) {
+                        pos[i] = candidate;
+                    }
+                }
+
+                placed = placed && found;
+            }
+        }
+
+        if (!placed) {
+            throw GeneratorError("Unable to place " + std::to_string(num) + " particles " +
+                                 std::to_string(m_min_distance) + " apart, area_size is too small");
+        }
+    }
+}
+
+void ParticleGenerator::latticePositions(float3vec& pos, const md::float3* basis, size_t basis_size) const
+{
+    int num = pos.size();
+    size_t unit_cells = (num + basis_size - 1) / basis_size;
+
+    size_t m = std::max<size_t>(1, static_cast<size_t>(std::cbrt(static_cast<double>(unit_cells))));
+    while (m * m * m < unit_cells) {
+        m++;
+    }
+
+    // sites are shifted from cell borders, so that none of them lies on the boundary
+    md::float3 lattice_const = m_area / static_cast<float>(m);
+    md::float3 shift(0.25f);
+
+    #pragma omp parallel for
+    for (int i = 0; i < num; i++) {
+        size_t cell = i / basis_size;
+        md::float3 coord(cell % m, (cell / m) % m, cell / (m * m));
+        pos[i] = (coord + basis[i % basis_size] + shift) * lattice_const;
+    }
+}
+
+void ParticleGenerator::velocities(float3vec& vel) const
+{
+    int num = vel.size();
+    if (m_temperature <= 0) {
+        std::fill(vel.begin(), vel.end(), md::float3(0));
+        return;
+    }
+
+    // unit mass: variance of every velocity component is the temperature
+    double sigma = std::sqrt(static_cast<double>(m_temperature));
+    int blocks = (num + sum_block - 1) / sum_block;
+    std::vector<double> sums(3 * blocks, 0.0);
+
+    #pragma omp parallel for
+    for (int b = 0; b < blocks; b++) {
+        int end = std::min(num, (b + 1) * sum_block);
+        for (int i = b * sum_block; i < end; i++) {
+            uint64_t counter = 3 * static_cast<uint64_t>(i);
+            double v[3];
+            for (int d = 0; d < 3; d++) {
+                v[d] = sigma * m_rng.normal(velocity_stream, counter + d);
+                sums[3 * b + d] += v[d];
+            }
+            vel[i] = md::float3(v[0], v[1], v[2]);
+        }
+    }
+
+    if (num < 2) {
+        return;
+    }
+
+    // no center of mass drift
+    double drift[3] = { 0, 0, 0 };
+    for (int b = 0; b < blocks; b++) {
+        for (int d = 0; d < 3; d++) {
+            drift[d] += sums[3 * b + d];
+        }
+    }
+    md::float3 mean(drift[0] / num, drift[1] / num, drift[2] / num);
+
+    #pragma omp parallel for
+    for (int i = 0; i < num; i++) {
+        vel[i] -= mean;
+    }
+}
+
+GeneratorIStream::GeneratorIStream(const ParticleSystemConfig& conf)
+    : m_generator(conf)
+    , m_generated(false)
+    , m_next(0)
+{
+}
+
+bool GeneratorIStream::good()
+{
+    return !m_generated || m_next < m_pos.size();
+}
+
+void GeneratorIStream::Read(md::float3& pos, md::float3& vel, md::float3& accel)
+{
+    readParticles(&pos, &vel, &accel, 1);
+}
+
+void GeneratorIStream::Read(cl_float3& pos, cl_float3& vel, cl_float3& accel)
+{
+    readParticles(&pos, &vel, &accel, 1);
+}
+
+void GeneratorIStream::ReadFrame(md::float3a* pos, md::float3a* vel, md::float3a* accel, size_t num)
+{
+    readParticles(pos, vel, accel, num);
+}
+
+void GeneratorIStream::ReadFrame(cl_float3* pos, cl_float3* vel, cl_float3* accel, size_t num)
+{
+    readParticles(pos, vel, accel, num);
+}
+
+template <class T>
+void GeneratorIStream::readParticles(T* pos, T* vel, T* accel, size_t num)
+{
+    if (!m_generated) {
+        m_generator.generate(m_pos, m_vel);
+        m_generated = true;
+    }
+
+    num = std::min(num, m_pos.size() - m_next);
+    pos = !(m_ignore_flags & StreamIgnore::IGNORE_POS) ? pos : nullptr;
+    vel = !(m_ignore_flags & StreamIgnore::IGNORE_VEL) ? vel : nullptr;
+    accel = !(m_ignore_flags & StreamIgnore::IGNORE_ACCEL) ? accel : nullptr;
+
+    int count = num;
+
+    #pragma omp parallel for
+    for (int i = 0; i < count; i++) {
+        for (int d = 0; d < 3; d++) {
+            if (pos) {
+                components(pos[i])[d] = m_pos[m_next + i][d];
+            }
+            if (vel) {
+                components(vel[i])[d] = m_vel[m_next + i][d];
+            }
+            if (accel) {
+                components(accel[i])[d] = 0;
+            }
+        }
+    }
+
+    m_next += num;
+}
@@ -1,19 +1,145 @@
 #include <utils/stream.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <utils/particle_generator.hpp>
+#include <utils/text_codec.hpp>
+
+// xyz of a particle field value
+static const float* components(const md::float3& value)
+{
+    return &value.x;
+}
+
+static const float* components(const cl_float3& value)
+{
+    return value.s;
+}
+
+static float* components(md::float3& value)
+{
+    return &value.x;
+}
+
+static float* components(cl_float3& value)
+{
+    return value.s;
+}
+
+template <class T>
+static void writeByParticle(ParticleOStream& os, const T* pos, const T* vel, const T* accel, size_t num)
+{
+    T unused = T();
+    for (size_t i = 0; i < num; i++) {
+        os.Write(pos ? pos[i] : unused, vel ? vel[i] : unused, accel ? accel[i] : unused);
+    }
+}
+
+template <class T>
+static void readByParticle(ParticleIStream& is, T* pos, T* vel, T* accel, size_t num)
+{
+    T unused = T();
+    for (size_t i = 0; i < num; i++) {
+        is.Read(pos ? pos[i] : unused, vel ? vel[i] : unused, accel ? accel[i] : unused);
+    }
+}
+
+void ParticleOStream::WriteFrame(const md::float3a* pos, const md::float3a* vel, const md::float3a* accel, size_t num)
+{
+    writeByParticle(*this, pos, vel, accel, num);
+}
+
+void ParticleOStream::WriteFrame(const cl_float3* pos, const cl_float3* vel, const cl_float3* accel, size_t num)
+{
+    writeByParticle(*this, pos, vel, accel, num);
+}
+
+void ParticleIStream::ReadFrame(md::float3a* pos, md::float3a* vel, md::float3a* accel, size_t num)
+{
+    readByParticle(*this, pos, vel, accel, num);
+}
+
+void ParticleIStream::ReadFrame(cl_float3* pos, cl_float3* vel, cl_float3* accel, size_t num)
+{
+    readByParticle(*this, pos, vel, accel, num);
+}
+
+static uint32_t storedFields(StreamIgnore ignore_flags)
+{
+    uint32_t fields = 0;
+    fields |= !(ignore_flags & StreamIgnore::IGNORE_POS) ? binary_trace_pos : 0;
+    fields |= !(ignore_flags & StreamIgnore::IGNORE_VEL) ? binary_trace_vel : 0;
+    fields |= !(ignore_flags & StreamIgnore::IGNORE_ACCEL) ? binary_trace_accel : 0;
+    return fields;
+}
+
+static const uint32_t field_bits[3] = { binary_trace_pos, binary_trace_vel, binary_trace_accel };
+
+static void appendValues(std::vector<float>& values, float x, float y, float z)
+{
+    values.push_back(x);
+    values.push_back(y);
+    values.push_back(z);
+}
+
+template <class T>
+static void writeValues(std::ostream& os, const std::vector<T>& values)
+{
+    os.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+template <class T>
+static void writeValue(std::ostream& os, const T& value)
+{
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static const float unknown_area[3] = { 0, 0, 0 };
+
 ByteOStream::ByteOStream()
+    : m_header(BinaryTraceHeader::Make(0, 0, unknown_area))
+    , m_header_written(false)
+    , m_closed(false)
+    , m_offset(0)
+    , m_keyframe_interval(0)
+    , m_force_keyframe(false)
 {
 }
 
 ByteOStream::ByteOStream(std::string filename)
+    : m_header(BinaryTraceHeader::Make(0, 0, unknown_area))
+    , m_header_written(false)
+    , m_closed(false)
+    , m_offset(0)
+    , m_keyframe_interval(0)
+    , m_force_keyframe(false)
 {
     open(filename);
 }
 
 ByteOStream::ByteOStream(std::ostream& os)
+    : m_header(BinaryTraceHeader::Make(0, 0, unknown_area))
+    , m_header_written(false)
+    , m_closed(false)
+    , m_offset(0)
+    , m_keyframe_interval(0)
+    , m_force_keyframe(false)
 {
     m_stream_ptr.reset(&os);
 }
 
+ByteOStream::~ByteOStream()
+{
+    try {
+        close();
+    } catch (...) {
+        // frame of wrong size, already written frames are kept
+    }
+}
+
 void ByteOStream::open(std::string filename)
 {
     m_stream_ptr.reset(new std::ofstream(filename, std::ios::binary | std::ios::out));
@@ -27,87 +153,580 @@ bool ByteOStream::good()
 void ByteOStream::Write(md::float3 pos, md::float3 vel, md::float3 accel)
 {
     if (!(m_ignore_flags & StreamIgnore::IGNORE_POS)) {
-        *m_stream_ptr << pos;
+        appendValues(m_pos, pos.x, pos.y, pos.z);
     }
 
     if (!(m_ignore_flags & StreamIgnore::IGNORE_VEL)) {
-        *m_stream_ptr << vel;
+        appendValues(m_vel, vel.x, vel.y, vel.z);
     }
 
     if (!(m_ignore_flags & StreamIgnore::IGNORE_ACCEL)) {
-        *m_stream_ptr << accel;
+        appendValues(m_accel, accel.x, accel.y, accel.z);
     }
 }
 
 void ByteOStream::Write(cl_float3 pos, cl_float3 vel, cl_float3 accel)
 {
     if (!(m_ignore_flags & StreamIgnore::IGNORE_POS)) {
-        *m_stream_ptr << pos.s[0] << pos.s[1] << pos.s[2];
+        appendValues(m_pos, pos.s[0], pos.s[1], pos.s[2]);
     }
 
     if (!(m_ignore_flags & StreamIgnore::IGNORE_VEL)) {
-        *m_stream_ptr << vel.s[0] << vel.s[1] << vel.s[2];
+        appendValues(m_vel, vel.s[0], vel.s[1], vel.s[2]);
     }
 
     if (!(m_ignore_flags & StreamIgnore::IGNORE_ACCEL)) {
-        *m_stream_ptr << accel.s[0] << accel.s[1] << accel.s[2];
+        appendValues(m_accel, accel.s[0], accel.s[1], accel.s[2]);
     }
 }
 
+// elements are padded to 16 bytes, three floats of each are stored
+template <class T>
+static void appendField(std::vector<float>& values, const T* field, size_t num)
+{
+    values.reserve(values.size() + 3 * num);
+    for (size_t i = 0; i < num; i++) {
+        const float* data = components(field[i]);
+        values.insert(values.end(), data, data + 3);
+    }
+}
+
+template <class T>
+void ByteOStream::appendFrame(const T* pos, const T* vel, const T* accel, size_t num)
+{
+    if (num == 0) {
+        return;
+    }
+
+    if (!(m_ignore_flags & StreamIgnore::IGNORE_POS)) {
+        appendField(m_pos, pos, num);
+    }
+
+    if (!(m_ignore_flags & StreamIgnore::IGNORE_VEL)) {
+        appendField(m_vel, vel, num);
+    }
+
+    if (!(m_ignore_flags & StreamIgnore::IGNORE_ACCEL)) {
+        appendField(m_accel, accel, num);
+    }
+}
+
+void ByteOStream::WriteFrame(const md::float3a* pos, const md::float3a* vel, const md::float3a* accel, size_t num)
+{
+    appendFrame(pos, vel, accel, num);
+}
+
+void ByteOStream::WriteFrame(const cl_float3* pos, const cl_float3* vel, const cl_float3* accel, size_t num)
+{
+    appendFrame(pos, vel, accel, num);
+}
+
+void ByteOStream::setArea(md::float3 area_size)
+{
+    m_header.area[0] = area_size.x;
+    m_header.area[1] = area_size.y;
+    m_header.area[2] = area_size.z;
+}
+
+void ByteOStream::setQuantization(float quantum, size_t keyframe_interval)
+{
+    if (m_header_written) {
+        throw std::runtime_error("Binary trace quantization must be set before the first frame");
+    }
+
+    if (!(quantum > 0) || keyframe_interval == 0) {
+        throw std::runtime_error("Binary trace quantization requires positive quantum and keyframe interval");
+    }
+
+    m_header.codec = binary_trace_quantized;
+    m_header.quantum = quantum;
+    m_keyframe_interval = keyframe_interval;
+}
+
+void ByteOStream::writeHeader()
+{
+    writeValue(*m_stream_ptr, m_header);
+}
+
+void ByteOStream::endFrame(size_t iteration)
+{
+    uint32_t fields = storedFields(m_ignore_flags);
+    size_t particles = std::max(m_pos.size(), std::max(m_vel.size(), m_accel.size())) / 3;
+
+    if (!m_header_written) {
+        m_header.fields = fields;
+        m_header.particles = particles;
+        writeHeader();
+        m_header_written = true;
+        m_offset = sizeof(m_header);
+
+        if (m_header.codec == binary_trace_quantized) {
+            m_codecs.resize(3);
+            for (size_t f = 0; f < 3; f++) {
+                if (m_header.has(field_bits[f])) {
+                    m_codecs[f].reset(new TraceFrameCodec(m_header.quantum, 3 * particles));
+                }
+            }
+        }
+    }
+
+    // every stored field has a value for every particle
+    size_t expected = m_header.particles * 3;
+    if (fields != m_header.fields || m_pos.size() != (m_header.has(binary_trace_pos) ? expected : 0) ||
+        m_vel.size() != (m_header.has(binary_trace_vel) ? expected : 0) ||
+        m_accel.size() != (m_header.has(binary_trace_accel) ? expected : 0)) {
+        m_pos.clear();
+        m_vel.clear();
+        m_accel.clear();
+        throw std::runtime_error("Binary trace frame has " + std::to_string(particles) + " particles, expected " +
+                                 std::to_string(m_header.particles));
+    }
+
+    BinaryTraceIndexEntry entry;
+    entry.iteration = iteration;
+    entry.offset = m_offset;
+
+    try {
+        if (m_header.codec == binary_trace_quantized) {
+            writeQuantizedFrame(iteration);
+        } else {
+            writeRawFrame(iteration);
+        }
+    } catch (...) {
+        m_pos.clear();
+        m_vel.clear();
+        m_accel.clear();
+        throw;
+    }
+
+    m_index.push_back(entry);
+
+    // capacity is kept for the next frame
+    m_pos.clear();
+    m_vel.clear();
+    m_accel.clear();
+}
+
+void ByteOStream::writeRawFrame(uint64_t iteration)
+{
+    writeValue(*m_stream_ptr, iteration);
+    writeValues(*m_stream_ptr, m_pos);
+    writeValues(*m_stream_ptr, m_vel);
+    writeValues(*m_stream_ptr, m_accel);
+    m_offset += m_header.frameSize();
+}
+
+void ByteOStream::writeQuantizedFrame(uint64_t iteration)
+{
+    const std::vector<float>* values[3] = { &m_pos, &m_vel, &m_accel };
+
+    BinaryTraceFrameHeader frame;
+    frame.iteration = iteration;
+    frame.flags = 0;
+    frame.reserved = 0;
+
+    bool keyframe = m_force_keyframe || m_index.size() % m_keyframe_interval == 0;
+    m_force_keyframe = true;
+
+    // fields are encoded into one buffer, frame size goes before them
+    m_encoded.clear();
+    std::vector<uint8_t> field;
+    for (size_t f = 0; f < 3; f++) {
+        if (!m_codecs[f]) {
+            continue;
+        }
+
+        if (m_codecs[f]->encode(values[f]->data(), keyframe, field)) {
+            frame.flags |= binary_trace_keyframe;
+        }
+
+        uint64_t size = field.size();
+        const uint8_t* size_bytes = reinterpret_cast<const uint8_t*>(&size);
+        m_encoded.insert(m_encoded.end(), size_bytes, size_bytes + sizeof(size));
+        m_encoded.insert(m_encoded.end(), field.begin(), field.end());
+    }
+
+    // every codec encodes a keyframe after a failed frame
+    m_force_keyframe = false;
+
+    frame.size = m_encoded.size();
+    writeValue(*m_stream_ptr, frame);
+    writeValues(*m_stream_ptr, m_encoded);
+    m_offset += sizeof(frame) + m_encoded.size();
+}
+
+void ByteOStream::close()
+{
+    if (m_closed || !m_stream_ptr || !m_stream_ptr->good()) {
+        return;
+    }
+
+    m_closed = true;
+
+    if (!m_pos.empty() || !m_vel.empty() || !m_accel.empty()) {
+        endFrame(m_index.size());
+    }
+
+    if (!m_header_written) {
+        m_header.fields = storedFields(m_ignore_flags);
+        writeHeader();
+        m_header_written = true;
+        m_offset = sizeof(m_header);
+    }
+
+    m_header.frames = m_index.size();
+    m_header.index_offset = m_offset;
+    writeValues(*m_stream_ptr, m_index);
+
+    m_stream_ptr->seekp(0);
+    writeHeader();
+    m_stream_ptr->flush();
+}
+
 ByteIStream::ByteIStream()
+    : m_header(BinaryTraceHeader::Make(0, 0, unknown_area))
+    , m_frames(0)
+    , m_next_frame(0)
+    , m_particle(0)
+    , m_eof(true)
+    , m_decoded_frame(0)
 {
 }
 
 ByteIStream::ByteIStream(std::string filename)
+    : m_header(BinaryTraceHeader::Make(0, 0, unknown_area))
+    , m_frames(0)
+    , m_next_frame(0)
+    , m_particle(0)
+    , m_eof(true)
+    , m_decoded_frame(0)
 {
     open(filename);
 }
 
 ByteIStream::ByteIStream(std::istream& os)
+    : m_header(BinaryTraceHeader::Make(0, 0, unknown_area))
+    , m_frames(0)
+    , m_next_frame(0)
+    , m_particle(0)
+    , m_eof(true)
+    , m_decoded_frame(0)
 {
     m_stream_ptr.reset(&os);
+    readHeader();
 }
 
 void ByteIStream::open(std::string filename)
 {
     m_stream_ptr.reset(new std::ifstream(filename, std::ios::binary | std::ios::in));
+    readHeader();
 }
 
 bool ByteIStream::good()
 {
-    return m_stream_ptr->good();
+    return !m_eof && m_stream_ptr->good();
+}
+
+void ByteIStream::readHeader()
+{
+    std::istream& is = *m_stream_ptr;
+    if (!is.read(reinterpret_cast<char*>(&m_header), sizeof(m_header))) {
+        // missing or empty file, same as text stream
+        m_eof = true;
+        return;
+    }
+
+    if (!m_header.valid()) {
+        throw std::runtime_error("Stream is not a binary trace or has unsupported version");
+    }
+
+    m_index.clear();
+    if (m_header.index_offset != 0) {
+        m_frames = m_header.frames;
+        m_index.resize(m_frames);
+        is.seekg(m_header.index_offset);
+        is.read(reinterpret_cast<char*>(m_index.data()), m_frames * sizeof(BinaryTraceIndexEntry));
+        if (!is) {
+            throw std::runtime_error("Binary trace frame index is truncated");
+        }
+    } else {
+        scanFrames();
+    }
+
+    m_frame.resize(m_header.fieldCount() * m_header.particles * 3);
+
+    m_codecs.clear();
+    if (m_header.codec == binary_trace_quantized) {
+        m_codecs.resize(3);
+        for (size_t f = 0; f < 3; f++) {
+            if (m_header.has(field_bits[f])) {
+                m_codecs[f].reset(new TraceFrameCodec(m_header.quantum, 3 * m_header.particles));
+            }
+        }
+    }
+
+    m_decoded_frame = m_frames;
+    seekFrame(0);
+}
+
+void ByteIStream::scanFrames()
+{
+    // writer did not finish, complete frames are readable
+    std::istream& is = *m_stream_ptr;
+    is.seekg(0, std::ios::end);
+    uint64_t size = is.tellg();
+
+    uint64_t offset = sizeof(BinaryTraceHeader);
+    for (;;) {
+        BinaryTraceIndexEntry entry;
+        entry.offset = offset;
+
+        uint64_t frame_size = 0;
+        if (m_header.codec == binary_trace_quantized) {
+            BinaryTraceFrameHeader frame;
+            is.seekg(offset);
+            if (!is.read(reinterpret_cast<char*>(&frame), sizeof(frame))) {
+                break;
+            }
+            entry.iteration = frame.iteration;
+            frame_size = sizeof(frame) + frame.size;
+        } else {
+            is.seekg(offset);
+            if (!is.read(reinterpret_cast<char*>(&entry.iteration), sizeof(entry.iteration))) {
+                break;
+            }
+            frame_size = m_header.frameSize();
+        }
+
+        if (offset + frame_size > size) {
+            break;
+        }
+
+        m_index.push_back(entry);
+        offset += frame_size;
+    }
+
+    is.clear();
+    m_frames = m_index.size();
+}
+
+size_t ByteIStream::iteration(size_t frame)
+{
+    if (frame >= m_frames) {
+        throw std::out_of_range("Binary trace frame " + std::to_string(frame) + " is out of range");
+    }
+
+    return m_index[frame].iteration;
+}
+
+void ByteIStream::seekFrame(size_t frame)
+{
+    if (frame > m_frames) {
+        throw std::out_of_range("Binary trace frame " + std::to_string(frame) + " is out of range");
+    }
+
+    m_stream_ptr->clear();
+    m_next_frame = frame;
+    m_particle = m_header.particles;
+    m_eof = false;
+}
+
+void ByteIStream::readFrame(size_t frame)
+{
+    std::istream& is = *m_stream_ptr;
+
+    if (m_header.codec == binary_trace_raw) {
+        is.seekg(m_index[frame].offset + sizeof(uint64_t));
+        is.read(reinterpret_cast<char*>(m_frame.data()), m_frame.size() * sizeof(float));
+        return;
+    }
+
+    if (frame == m_decoded_frame) {
+        return;
+    }
+
+    // delta frames need the previous one, start from the keyframe
+    size_t first = frame;
+    if (m_decoded_frame >= m_frames || frame != m_decoded_frame + 1) {
+        for (;; first--) {
+            BinaryTraceFrameHeader header;
+            is.seekg(m_index[first].offset);
+            is.read(reinterpret_cast<char*>(&header), sizeof(header));
+            if (!is || (header.flags & binary_trace_keyframe) || first == 0) {
+                break;
+            }
+        }
+    }
+
+    for (size_t f = first; f <= frame && is; f++) {
+        decodeFrame(f);
+    }
+}
+
+void ByteIStream::decodeFrame(size_t frame)
+{
+    std::istream& is = *m_stream_ptr;
+
+    BinaryTraceFrameHeader header;
+    is.seekg(m_index[frame].offset);
+    if (!is.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return;
+    }
+
+    m_encoded.resize(header.size);
+    if (!is.read(reinterpret_cast<char*>(m_encoded.data()), m_encoded.size())) {
+        return;
+    }
+
+    // decoded frame is unknown until all fields are decoded
+    m_decoded_frame = m_frames;
+
+    bool keyframe = (header.flags & binary_trace_keyframe) != 0;
+    size_t pos = 0;
+    for (size_t f = 0; f < 3; f++) {
+        if (!m_codecs[f]) {
+            continue;
+        }
+
+        uint64_t size = 0;
+        if (pos + sizeof(size) > m_encoded.size()) {
+            throw TraceCodecError("Corrupted compressed trace frame");
+        }
+        std::memcpy(&size, &m_encoded[pos], sizeof(size));
+        pos += sizeof(size);
+
+        if (pos + size > m_encoded.size()) {
+            throw TraceCodecError("Corrupted compressed trace frame");
+        }
+
+        size_t field_start = (m_header.fieldOffset(field_bits[f]) - sizeof(uint64_t)) / sizeof(float);
+        m_codecs[f]->decode(&m_encoded[pos], size, keyframe, &m_frame[field_start]);
+        pos += size;
+    }
+
+    m_decoded_frame = frame;
+}
+
+bool ByteIStream::nextParticle()
+{
+    if (m_eof) {
+        return false;
+    }
+
+    if (m_particle < m_header.particles) {
+        return true;
+    }
+
+    if (m_next_frame >= m_frames || m_header.particles == 0) {
+        m_eof = true;
+        return false;
+    }
+
+    readFrame(m_next_frame);
+    if (!*m_stream_ptr) {
+        m_eof = true;
+        return false;
+    }
+
+    m_next_frame++;
+    m_particle = 0;
+    return true;
+}
+
+const float* ByteIStream::value(uint32_t field, StreamIgnore ignore)
+{
+    if (!m_header.has(field) || !!(m_ignore_flags & ignore)) {
+        return nullptr;
+    }
+
+    size_t field_start = (m_header.fieldOffset(field) - sizeof(uint64_t)) / sizeof(float);
+    return &m_frame[field_start + m_particle * 3];
 }
 
 void ByteIStream::Read(md::float3& pos, md::float3& vel, md::float3& accel)
 {
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_POS)) {
-        *m_stream_ptr >> pos;
+    if (!nextParticle()) {
+        return;
     }
 
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_VEL)) {
-        *m_stream_ptr >> vel;
+    if (const float* v = value(binary_trace_pos, StreamIgnore::IGNORE_POS)) {
+        pos = md::float3(v[0], v[1], v[2]);
     }
 
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_ACCEL)) {
-        *m_stream_ptr >> accel;
+    if (const float* v = value(binary_trace_vel, StreamIgnore::IGNORE_VEL)) {
+        vel = md::float3(v[0], v[1], v[2]);
     }
+
+    if (const float* v = value(binary_trace_accel, StreamIgnore::IGNORE_ACCEL)) {
+        accel = md::float3(v[0], v[1], v[2]);
+    }
+
+    m_particle++;
 }
 
 void ByteIStream::Read(cl_float3& pos, cl_float3& vel, cl_float3& accel)
 {
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_POS)) {
-        *m_stream_ptr >> pos.s[0] >> pos.s[1] >> pos.s[2];
+    if (!nextParticle()) {
+        return;
     }
 
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_VEL)) {
-        *m_stream_ptr >> vel.s[0] >> vel.s[1] >> vel.s[2];
+    if (const float* v = value(binary_trace_pos, StreamIgnore::IGNORE_POS)) {
+        std::copy(v, v + 3, pos.s);
     }
 
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_ACCEL)) {
-        *m_stream_ptr >> accel.s[0] >> accel.s[1] >> accel.s[2];
+    if (const float* v = value(binary_trace_vel, StreamIgnore::IGNORE_VEL)) {
+        std::copy(v, v + 3, vel.s);
+    }
+
+    if (const float* v = value(binary_trace_accel, StreamIgnore::IGNORE_ACCEL)) {
+        std::copy(v, v + 3, accel.s);
+    }
+
+    m_particle++;
+}
+
+template <class T>
+static void copyField(const float* values, T* field, size_t num)
+{
+    for (size_t i = 0; i < num; i++) {
+        std::copy(values + 3 * i, values + 3 * i + 3, components(field[i]));
+    }
+}
+
+template <class T>
+void ByteIStream::readParticles(T* pos, T* vel, T* accel, size_t num)
+{
+    size_t done = 0;
+    while (done < num && nextParticle()) {
+        size_t count = std::min<size_t>(num - done, m_header.particles - m_particle);
+
+        if (const float* values = value(binary_trace_pos, StreamIgnore::IGNORE_POS)) {
+            copyField(values, pos + done, count);
+        }
+
+        if (const float* values = value(binary_trace_vel, StreamIgnore::IGNORE_VEL)) {
+            copyField(values, vel + done, count);
+        }
+
+        if (const float* values = value(binary_trace_accel, StreamIgnore::IGNORE_ACCEL)) {
+            copyField(values, accel + done, count);
+        }
+
+        m_particle += count;
+        done += count;
     }
 }
 
+void ByteIStream::ReadFrame(md::float3a* pos, md::float3a* vel, md::float3a* accel, size_t num)
+{
+    readParticles(pos, vel, accel, num);
+}
+
+void ByteIStream::ReadFrame(cl_float3* pos, cl_float3* vel, cl_float3* accel, size_t num)
+{
+    readParticles(pos, vel, accel, num);
+}
+
 TextOStream::TextOStream()
 {
 }
@@ -166,60 +785,221 @@ void TextOStream::Write(cl_float3 pos, cl_float3 vel, cl_float3 accel)
     *m_stream_ptr << "\n";
 }
 
+// particles formatted by one thread at once
+static const size_t format_block = 4096;
+
+template <class T>
+void TextOStream::writeParticles(const T* pos, const T* vel, const T* accel, size_t num)
+{
+    bool write_pos = !(m_ignore_flags & StreamIgnore::IGNORE_POS);
+    bool write_vel = !(m_ignore_flags & StreamIgnore::IGNORE_VEL);
+    bool write_accel = !(m_ignore_flags & StreamIgnore::IGNORE_ACCEL);
+    const T* fields[3] = { write_pos ? pos : nullptr, write_vel ? vel : nullptr, write_accel ? accel : nullptr };
+
+    std::ostream& os = *m_stream_ptr;
+
+    // printf %g matches only the default iostream format
+    std::ios::fmtflags custom = std::ios::floatfield | std::ios::showpoint | std::ios::showpos | std::ios::uppercase;
+    if (os.flags() & custom) {
+        m_buffer.str("");
+        m_buffer.copyfmt(os);
+        for (size_t i = 0; i < num; i++) {
+            for (size_t f = 0; f < 3; f++) {
+                if (fields[f]) {
+                    const float* v = components(fields[f][i]);
+                    m_buffer << v[0] << " " << v[1] << " " << v[2] << " ";
+                }
+            }
+            m_buffer << "\n";
+        }
+
+        const std::string& text = m_buffer.str();
+        os.write(text.data(), text.size());
+        return;
+    }
+
+    int precision = static_cast<int>(os.precision());
+    int blocks = static_cast<int>((num + format_block - 1) / format_block);
+    if (m_chunks.size() < static_cast<size_t>(blocks)) {
+        m_chunks.resize(blocks);
+    }
+
+    // same format as Write()
+    #pragma omp parallel for schedule(static) if (blocks > 1)
+    for (int b = 0; b < blocks; b++) {
+        std::string& out = m_chunks[b];
+        out.clear();
+
+        size_t last = std::min(num, (b + 1) * format_block);
+        for (size_t i = b * format_block; i < last; i++) {
+            for (size_t f = 0; f < 3; f++) {
+                if (fields[f]) {
+                    const float* v = components(fields[f][i]);
+                    for (size_t k = 0; k < 3; k++) {
+                        TextCodec::appendNumber(out, v[k], precision);
+                        out += ' ';
+                    }
+                }
+            }
+            out += '\n';
+        }
+    }
+
+    for (int b = 0; b < blocks; b++) {
+        os.write(m_chunks[b].data(), m_chunks[b].size());
+    }
+}
+
+void TextOStream::WriteFrame(const md::float3a* pos, const md::float3a* vel, const md::float3a* accel, size_t num)
+{
+    writeParticles(pos, vel, accel, num);
+}
+
+void TextOStream::WriteFrame(const cl_float3* pos, const cl_float3* vel, const cl_float3* accel, size_t num)
+{
+    writeParticles(pos, vel, accel, num);
+}
+
 TextIStream::TextIStream()
+    : m_pos(nullptr)
+    , m_file_good(false)
 {
 }
 
 TextIStream::TextIStream(std::string filename)
+    : m_pos(nullptr)
+    , m_file_good(false)
 {
     open(filename);
 }
 
 TextIStream::TextIStream(std::istream& os)
+    : m_pos(nullptr)
+    , m_file_good(false)
 {
     m_stream_ptr.reset(&os);
 }
 
 void TextIStream::open(std::string filename)
 {
+    m_file.reset(new TextFile(filename));
+    if (m_file->is_open()) {
+        m_pos = m_file->begin();
+        m_file_good = true;
+        m_stream_ptr.reset();
+        return;
+    }
+
+    // missing file, stream reports failure
+    m_file.reset();
     m_stream_ptr.reset(new std::ifstream(filename, std::ios::in));
 }
 
 bool TextIStream::good()
 {
+    if (m_file) {
+        return m_file_good;
+    }
     return m_stream_ptr->good();
 }
 
 void TextIStream::Read(md::float3& pos, md::float3& vel, md::float3& accel)
 {
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_POS)) {
-        *m_stream_ptr >> pos;
-    }
+    readParticles(&pos, &vel, &accel, 1);
+}
 
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_VEL)) {
-        *m_stream_ptr >> vel;
+void TextIStream::Read(cl_float3& pos, cl_float3& vel, cl_float3& accel)
+{
+    readParticles(&pos, &vel, &accel, 1);
+}
+
+// particles below this are not worth parallel parsing
+static const int parallel_particles = 1024;
+
+template <class T>
+void TextIStream::readParticles(T* pos, T* vel, T* accel, size_t num)
+{
+    bool read_pos = !(m_ignore_flags & StreamIgnore::IGNORE_POS);
+    bool read_vel = !(m_ignore_flags & StreamIgnore::IGNORE_VEL);
+    bool read_accel = !(m_ignore_flags & StreamIgnore::IGNORE_ACCEL);
+    T* fields[3] = { read_pos ? pos : nullptr, read_vel ? vel : nullptr, read_accel ? accel : nullptr };
+
+    if (!m_file) {
+        std::istream& is = *m_stream_ptr;
+        for (size_t i = 0; i < num; i++) {
+            for (size_t f = 0; f < 3; f++) {
+                if (fields[f]) {
+                    float* v = components(fields[f][i]);
+                    is >> v[0] >> v[1] >> v[2];
+                }
+            }
+        }
+        return;
     }
 
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_ACCEL)) {
-        *m_stream_ptr >> accel;
+    if (!m_file_good) {
+        return;
     }
-}
 
-void TextIStream::Read(cl_float3& pos, cl_float3& vel, cl_float3& accel)
-{
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_POS)) {
-        *m_stream_ptr >> pos.s[0] >> pos.s[1] >> pos.s[2];
+    size_t line_values = 3 * (read_pos + read_vel + read_accel);
+    const char* end = m_file->end();
+
+    // one particle per line as written by TextOStream, lines are parsed in parallel
+    bool lines_parsed = TextCodec::findLines(m_pos, end, num, m_lines) == num && line_values != 0;
+    if (lines_parsed) {
+        int lines = static_cast<int>(num);
+
+        #pragma omp parallel for schedule(static) reduction(&&:lines_parsed) if (lines >= parallel_particles)
+        for (int i = 0; i < lines; i++) {
+            float values[9];
+            const char* line_end = TextCodec::lineEnd(m_lines[i], m_lines[i + 1]);
+            bool parsed = TextCodec::parseLine(m_lines[i], line_end, values, line_values);
+            if (parsed) {
+                const float* v = values;
+                for (size_t f = 0; f < 3; f++) {
+                    if (fields[f]) {
+                        std::copy(v, v + 3, components(fields[f][i]));
+                        v += 3;
+                    }
+                }
+            }
+            lines_parsed = parsed && lines_parsed;
+        }
     }
 
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_VEL)) {
-        *m_stream_ptr >> vel.s[0] >> vel.s[1] >> vel.s[2];
+    if (lines_parsed) {
+        m_pos = m_lines[num];
+        return;
     }
 
-    if (!(m_ignore_flags & StreamIgnore::IGNORE_ACCEL)) {
-        *m_stream_ptr >> accel.s[0] >> accel.s[1] >> accel.s[2];
+    // any other layout of whitespace separated values
+    for (size_t i = 0; i < num; i++) {
+        for (size_t f = 0; f < 3; f++) {
+            if (!fields[f]) {
+                continue;
+            }
+
+            float* v = components(fields[f][i]);
+            for (size_t k = 0; k < 3; k++) {
+                if (!TextCodec::parseNext(m_pos, end, v[k])) {
+                    m_file_good = false;
+                    return;
+                }
+            }
+        }
     }
 }
 
+void TextIStream::ReadFrame(md::float3a* pos, md::float3a* vel, md::float3a* accel, size_t num)
+{
+    readParticles(pos, vel, accel, num);
+}
+
+void TextIStream::ReadFrame(cl_float3* pos, cl_float3* vel, cl_float3* accel, size_t num)
+{
+    readParticles(pos, vel, accel, num);
+}
+
 StringStream::StringStream()
 {
     m_stream_ptr.reset(&m_ss, [](decltype(m_ss)* ptr){});
@@ -237,7 +1017,11 @@ ParticleIStreamPtr StreamFactory::MakeTraceIStream(TraceConfig conf)
 ParticleOStreamPtr StreamFactory::MakeTraceOStream(TraceConfig conf)
 {
     if (conf.binary_file) {
-        return std::make_shared<ByteOStream>(conf.filename);
+        std::shared_ptr<ByteOStream> os = std::make_shared<ByteOStream>(conf.filename);
+        if (conf.value_threshold > 0) {
+            os->setQuantization(conf.value_threshold, conf.keyframe_interval);
+        }
+        return os;
     } else {
         return std::make_shared<TextOStream>(conf.filename);
     }
@@ -245,7 +1029,10 @@ ParticleOStreamPtr StreamFactory::MakeTraceOStream(TraceConfig conf)
 
 ParticleIStreamPtr StreamFactory::MakeInitIStream(ParticleSystemConfig conf)
 {
-    if (conf.init_file_binary) {
+    std::string generator = conf.init_generator;
+    if (generator != "") {
+        return std::make_shared<GeneratorIStream>(conf);
+    } else if (conf.init_file_binary) {
         return std::make_shared<ByteIStream>(conf.init_file);
     } else {
         return std::make_shared<TextIStream>(conf.init_file);
@@ -255,7 +1042,9 @@ ParticleIStreamPtr StreamFactory::MakeInitIStream(ParticleSystemConfig conf)
 ParticleOStreamPtr StreamFactory::MakeResultOStream(ParticleSystemConfig conf)
 {
     if (conf.result_file_binary) {
-        return std::make_shared<ByteOStream>(conf.result_file);
+        ParticleOStreamPtr os = std::make_shared<ByteOStream>(conf.result_file);
+        os->setArea(conf.area_size);
+        return os;
     } else {
         return std::make_shared<TextOStream>(conf.result_file);
     }
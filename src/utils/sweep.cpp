@@ -0,0 +1,182 @@
+#include <utils/sweep.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+static std::vector<std::string> split(const std::string& str, char delim)
+{
+    std::vector<std::string> result;
+    std::istringstream iss(str);
+    for (std::string item; std::getline(iss, item, delim); ) {
+        result.push_back(item);
+    }
+    return result;
+}
+
+static bool isInteger(const std::string& str)
+{
+    if (str.empty()) {
+        return false;
+    }
+
+    size_t start = (str[0] == '-' || str[0] == '+') ? 1 : 0;
+    return start < str.size() && str.find_first_not_of("0123456789", start) == std::string::npos;
+}
+
+SweepRange SweepRange::parse(std::string spec)
+{
+    size_t eq = spec.find('=');
+    if (eq == std::string::npos || eq == 0 || eq + 1 == spec.size()) {
+        throw SweepError("Invalid sweep range, expected entry=values: " + spec);
+    }
+
+    SweepRange range;
+    range.entry = spec.substr(0, eq);
+    std::string values = spec.substr(eq + 1);
+
+    std::vector<std::string> bounds = split(values, ':');
+    if (bounds.size() == 1) {
+        range.values = split(values, ',');
+        return range;
+    }
+
+    if (bounds.size() != 3) {
+        throw SweepError("Invalid sweep range, expected begin:end:step: " + spec);
+    }
+
+    try {
+        if (isInteger(bounds[0]) && isInteger(bounds[1]) && isInteger(bounds[2])) {
+            long long begin = std::stoll(bounds[0]);
+            long long end = std::stoll(bounds[1]);
+            long long step = std::stoll(bounds[2]);
+            if (step <= 0 || end < begin) {
+                throw SweepError("Invalid sweep range bounds: " + spec);
+            }
+
+            for (long long val = begin; val <= end; val += step) {
+                range.values.push_back(std::to_string(val));
+            }
+        } else {
+            double begin = std::stod(bounds[0]);
+            double end = std::stod(bounds[1]);
+            double step = std::stod(bounds[2]);
+            if (step <= 0 || end < begin) {
+                throw SweepError("Invalid sweep range bounds: " + spec);
+            }
+
+            // computed from index to avoid accumulating step error
+            size_t steps = static_cast<size_t>(std::floor((end - begin) / step + 1e-9));
+            for (size_t i = 0; i <= steps; i++) {
+                std::ostringstream oss;
+                oss.precision(9);
+                oss << begin + i * step;
+                range.values.push_back(oss.str());
+            }
+        }
+    } catch (std::logic_error&) {
+        throw SweepError("Invalid sweep range value: " + spec);
+    }
+
+    return range;
+}
+
+void Sweep::addRange(const SweepRange& range)
+{
+    if (range.values.empty()) {
+        throw SweepError("Empty sweep range for entry " + range.entry);
+    }
+
+    m_ranges.push_back(range);
+}
+
+std::vector<SweepPoint> Sweep::points() const
+{
+    std::vector<SweepPoint> result(1);
+
+    for (const SweepRange& range : m_ranges) {
+        std::vector<SweepPoint> next;
+        next.reserve(result.size() * range.values.size());
+
+        for (const SweepPoint& point : result) {
+            for (const std::string& value : range.values) {
+                next.push_back(point);
+                next.back().push_back(std::make_pair(range.entry, value));
+            }
+        }
+
+        result.swap(next);
+    }
+
+    return result;
+}
+
+SweepScheduler::SweepScheduler(size_t cores_per_run, size_t total_cores)
+    : m_cores_per_run(std::max<size_t>(cores_per_run, 1))
+{
+    if (total_cores == 0) {
+        total_cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+
+    m_cores_per_run = std::min(m_cores_per_run, total_cores);
+    m_workers = total_cores / m_cores_per_run;
+}
+
+static std::string csvEscape(std::string str)
+{
+    std::replace(str.begin(), str.end(), ',', ';');
+    std::replace(str.begin(), str.end(), '\n', ' ');
+    return str;
+}
+
+void SweepScheduler::run(const Sweep& sweep, RunFn fn, std::ostream& csv)
+{
+    std::vector<SweepPoint> points = sweep.points();
+
+    csv << "run";
+    for (const SweepRange& range : sweep.ranges()) {
+        csv << "," << range.entry;
+    }
+    csv << ",seconds,status" << std::endl;
+
+    std::atomic<size_t> next_run(0);
+    std::mutex csv_mutex;
+
+    auto worker = [&]() {
+        for (size_t run = next_run++; run < points.size(); run = next_run++) {
+            const SweepPoint& point = points[run];
+            std::string status = "ok";
+
+            auto start = std::chrono::steady_clock::now();
+            try {
+                fn(run, point, m_cores_per_run);
+            } catch (std::exception& ex) {
+                status = csvEscape(ex.what());
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            std::lock_guard<std::mutex> lock(csv_mutex);
+            csv << run;
+            for (auto& entry : point) {
+                csv << "," << csvEscape(entry.second);
+            }
+            csv << "," << elapsed.count() << "," << status << std::endl;
+        }
+    };
+
+    size_t workers_num = std::min(m_workers, points.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < workers_num; i++) {
+        workers.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
@@ -2,11 +2,90 @@
 
 using namespace md;
 
+TraceCollector::TraceCollector()
+    : m_last_iteration(0)
+    , m_trace_conf(ConfigManager::Instance().getTraceConfig())
+    , m_os(nullptr)
+    , m_pending_frames(0)
+    , m_dropped_frames(0)
+{
+    init();
+}
+
+TraceCollector::TraceCollector(TraceConfig conf)
+    : m_last_iteration(0)
+    , m_trace_conf(conf)
+    , m_os(nullptr)
+    , m_pending_frames(0)
+    , m_dropped_frames(0)
+{
+    init();
+}
+
+TraceCollector::TraceCollector(TraceConfig conf, const TraceSelectionConfig& selection)
+    : m_last_iteration(0)
+    , m_trace_conf(TraceSelection::traceConfig(selection, conf))
+    , m_selection(selection)
+    , m_os(nullptr)
+    , m_pending_frames(0)
+    , m_dropped_frames(0)
+{
+    init();
+}
+
+TraceCollector::~TraceCollector()
+{
+    if (m_writer.joinable()) {
+        m_queued_frames->close();
+        m_writer.join();
+    }
+}
+
+void TraceCollector::init()
+{
+    m_os = StreamFactory::Instance()->MakeTraceOStream(m_trace_conf);
+    if (!m_selection.all()) {
+        m_os->setIgnore(m_selection.ignoreFlags());
+    }
+
+    if (m_trace_conf.enabled && m_selection.spatial()) {
+        std::string ids_filename = m_trace_conf.filename.value() + ".ids";
+        m_ids_os.open(ids_filename);
+        if (!m_ids_os.is_open()) {
+            throw TraceError("Unable to open trace selection ids: " + ids_filename);
+        }
+    }
+
+    if (!m_trace_conf.enabled || !m_trace_conf.async) {
+        return;
+    }
+
+    size_t pool_size = std::max<size_t>(m_trace_conf.frames_pool, 1);
+
+    m_free_frames.reset(new BoundedQueue<ParticleFrame*>(pool_size));
+    m_queued_frames.reset(new BoundedQueue<ParticleFrame*>(pool_size));
+
+    for (size_t i = 0; i < pool_size; i++) {
+        m_frames.emplace_back(new ParticleFrame());
+        m_free_frames->push(m_frames.back().get());
+    }
+
+    m_writer = std::thread(&TraceCollector::writerLoop, this);
+}
+
 void TraceCollector::attach(ParticleSystem& par_sys)
 {
+    // disabled collector does not make platforms synchronize state
+    if (!m_trace_conf.enabled) {
+        return;
+    }
+
+    m_os->setArea(par_sys.config().area_size);
+    m_selection.setArea(par_sys.config().area_size, par_sys.config().periodic);
+
     using namespace std::placeholders;
     ParticleSystem::IterationCb cb = std::bind(&TraceCollector::onInteration, this, _1, _2);
-    par_sys.registerOnIterationCb(cb);
+    par_sys.registerOnIterationCb(cb, m_trace_conf.iterations_threshold, m_cb_owner);
 }
 
 void TraceCollector::onInteration(ParticleSystem* pSys, size_t iteration)
@@ -19,7 +98,116 @@ void TraceCollector::onInteration(ParticleSystem* pSys, size_t iteration)
         return;
     }
 
-    pSys->storeParticles(m_os);
-
     m_last_iteration = iteration;
+
+    if (!m_trace_conf.async) {
+        if (m_selection.all()) {
+            pSys->storeParticles(m_os);
+            m_os->endFrame(iteration);
+        } else {
+            takeFrame(pSys, iteration, m_selected);
+            writeFrame(m_selected);
+        }
+        return;
+    }
+
+    rethrowWriterError();
+
+    ParticleFrame* frame = nullptr;
+    if (m_trace_conf.backpressure.value() == "drop") {
+        if (!m_free_frames->tryPop(frame)) {
+            m_dropped_frames++;
+            return;
+        }
+    } else {
+        m_free_frames->pop(frame);
+    }
+
+    takeFrame(pSys, iteration, *frame);
+
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        m_pending_frames++;
+    }
+
+    m_queued_frames->push(frame);
+}
+
+void TraceCollector::takeFrame(ParticleSystem* pSys, size_t iteration, ParticleFrame& frame)
+{
+    if (m_selection.all()) {
+        pSys->snapshot(frame);
+        frame.iteration = iteration;
+        return;
+    }
+
+    pSys->snapshot(m_snapshot);
+    m_snapshot.iteration = iteration;
+    m_selection.apply(m_snapshot, frame);
+}
+
+void TraceCollector::flush()
+{
+    if (m_writer.joinable()) {
+        std::unique_lock<std::mutex> lock(m_pending_mutex);
+        m_pending_cv.wait(lock, [this]() { return m_pending_frames == 0; });
+    }
+
+    rethrowWriterError();
+}
+
+void TraceCollector::writerLoop()
+{
+    ParticleFrame* frame = nullptr;
+    while (m_queued_frames->pop(frame)) {
+        std::exception_ptr error;
+        try {
+            writeFrame(*frame);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        m_free_frames->push(frame);
+
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        if (error && !m_writer_error) {
+            m_writer_error = error;
+        }
+
+        m_pending_frames--;
+        m_pending_cv.notify_all();
+    }
+}
+
+void TraceCollector::writeFrame(const ParticleFrame& frame)
+{
+    size_t num = frame.ids.empty() ? frame.size() : frame.ids.size();
+    m_os->WriteFrame(frame.pos.data(), frame.vel.data(), frame.accel.data(), num);
+    m_os->endFrame(frame.iteration);
+
+    if (m_ids_os.is_open()) {
+        m_ids_os << frame.iteration << " " << frame.ids.size();
+        for (size_t id : frame.ids) {
+            m_ids_os << " " << id;
+        }
+        m_ids_os << "\n";
+        m_ids_os.flush();
+
+        if (!m_ids_os.good()) {
+            throw TraceError("Unable to write trace selection ids");
+        }
+    }
+}
+
+void TraceCollector::rethrowWriterError()
+{
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        error = m_writer_error;
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
 }
@@ -0,0 +1,249 @@
+#include <utils/trace_codec.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+
+// runs of equal bytes shorter than this are stored as literals
+static const size_t min_run = 3;
+static const size_t max_run = min_run + 0x7f;
+static const size_t max_literals = 0x80;
+
+static uint32_t zigzag(uint32_t delta)
+{
+    int32_t value = static_cast<int32_t>(delta);
+    return (delta << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+static uint32_t unzigzag(uint32_t value)
+{
+    return (value >> 1) ^ (0u - (value & 1));
+}
+
+static size_t runLength(const uint8_t* data, size_t pos, size_t size)
+{
+    size_t end = pos + 1;
+    while (end < size && end - pos < max_run && data[end] == data[pos]) {
+        end++;
+    }
+    return end - pos;
+}
+
+// control byte < 0x80: (control + 1) literal bytes follow,
+// otherwise next byte is repeated (control - 0x80 + min_run) times
+static void runLengthEncode(const std::vector<uint8_t>& data, std::vector<uint8_t>& out)
+{
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t run = runLength(data.data(), pos, data.size());
+        if (run >= min_run) {
+            out.push_back(static_cast<uint8_t>(0x80 + run - min_run));
+            out.push_back(data[pos]);
+            pos += run;
+            continue;
+        }
+
+        size_t start = pos;
+        while (pos < data.size() && pos - start < max_literals && runLength(data.data(), pos, data.size()) < min_run) {
+            pos++;
+        }
+
+        out.push_back(static_cast<uint8_t>(pos - start - 1));
+        out.insert(out.end(), data.begin() + start, data.begin() + pos);
+    }
+}
+
+static bool runLengthDecode(const uint8_t* data, size_t size, uint8_t* out, size_t out_size)
+{
+    size_t pos = 0;
+    size_t written = 0;
+    while (pos < size) {
+        uint8_t control = data[pos++];
+        if (control < 0x80) {
+            size_t len = control + 1;
+            if (pos + len > size || written + len > out_size) {
+                return false;
+            }
+            std::memcpy(out + written, data + pos, len);
+            pos += len;
+            written += len;
+        } else {
+            size_t len = control - 0x80 + min_run;
+            if (pos + 1 > size || written + len > out_size) {
+                return false;
+            }
+            std::memset(out + written, data[pos++], len);
+            written += len;
+        }
+    }
+
+    return written == out_size;
+}
+
+// false if a value does not fit int32 after quantization
+static bool encodeBlock(const float* values, int32_t* reference, size_t count, float quantum, bool keyframe,
+                        std::vector<uint8_t>& planes, std::vector<uint8_t>& out)
+{
+    const double limit = std::numeric_limits<int32_t>::max();
+    bool fits = true;
+
+    planes.resize(4 * count);
+    for (size_t i = 0; i < count; i++) {
+        double scaled = values[i] / static_cast<double>(quantum);
+        if (!(std::fabs(scaled) < limit)) {
+            fits = false;
+            scaled = 0;
+        }
+
+        int32_t quantized = static_cast<int32_t>(std::floor(scaled + 0.5));
+        uint32_t prev = keyframe ? 0 : static_cast<uint32_t>(reference[i]);
+        uint32_t encoded = zigzag(static_cast<uint32_t>(quantized) - prev);
+        reference[i] = quantized;
+
+        for (size_t b = 0; b < 4; b++) {
+            planes[b * count + i] = static_cast<uint8_t>(encoded >> (8 * b));
+        }
+    }
+
+    out.clear();
+    runLengthEncode(planes, out);
+    return fits;
+}
+
+static bool decodeBlock(const uint8_t* data, size_t size, int32_t* reference, size_t count, float quantum,
+                        bool keyframe, std::vector<uint8_t>& planes, float* values)
+{
+    planes.resize(4 * count);
+    if (!runLengthDecode(data, size, planes.data(), planes.size())) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t encoded = 0;
+        for (size_t b = 0; b < 4; b++) {
+            encoded |= static_cast<uint32_t>(planes[b * count + i]) << (8 * b);
+        }
+
+        uint32_t prev = keyframe ? 0 : static_cast<uint32_t>(reference[i]);
+        int32_t quantized = static_cast<int32_t>(prev + unzigzag(encoded));
+        reference[i] = quantized;
+        values[i] = static_cast<float>(quantized * static_cast<double>(quantum));
+    }
+
+    return true;
+}
+
+static void append(std::vector<uint8_t>& out, uint32_t value)
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+static uint32_t load(const uint8_t* data)
+{
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+TraceFrameCodec::TraceFrameCodec(float quantum, size_t values, size_t block_values)
+    : m_quantum(quantum)
+    , m_block_values(block_values)
+    , m_has_reference(false)
+    , m_reference(values)
+{
+    if (!(quantum > 0)) {
+        throw TraceCodecError("Trace codec quantum must be positive");
+    }
+
+    if (block_values == 0) {
+        throw TraceCodecError("Trace codec block size must be positive");
+    }
+
+    m_blocks.resize(2 * blockCount());
+}
+
+bool TraceFrameCodec::encode(const float* values, bool keyframe, std::vector<uint8_t>& out)
+{
+    keyframe = keyframe || !m_has_reference;
+
+    int blocks = static_cast<int>(blockCount());
+    bool fits = true;
+
+    #pragma omp parallel for schedule(dynamic) reduction(&&:fits)
+    for (int b = 0; b < blocks; b++) {
+        size_t first = b * m_block_values;
+        size_t count = std::min(m_block_values, m_reference.size() - first);
+        fits = encodeBlock(values + first, &m_reference[first], count, m_quantum, keyframe,
+                           m_blocks[2 * b], m_blocks[2 * b + 1]) && fits;
+    }
+
+    if (!fits) {
+        // reference is partially updated
+        m_has_reference = false;
+        throw TraceCodecError("Trace value is out of range of quantum " + std::to_string(m_quantum));
+    }
+
+    m_has_reference = true;
+
+    out.clear();
+    append(out, static_cast<uint32_t>(blocks));
+    append(out, static_cast<uint32_t>(m_block_values));
+    for (int b = 0; b < blocks; b++) {
+        append(out, static_cast<uint32_t>(m_blocks[2 * b + 1].size()));
+    }
+    for (int b = 0; b < blocks; b++) {
+        out.insert(out.end(), m_blocks[2 * b + 1].begin(), m_blocks[2 * b + 1].end());
+    }
+
+    return keyframe;
+}
+
+void TraceFrameCodec::decode(const uint8_t* data, size_t size, bool keyframe, float* values)
+{
+    if (!keyframe && !m_has_reference) {
+        throw TraceCodecError("Trace frame is encoded relative to a frame that was not decoded");
+    }
+
+    if (size < 2 * sizeof(uint32_t)) {
+        throw TraceCodecError("Corrupted compressed trace frame");
+    }
+
+    size_t blocks = load(data);
+    size_t block_values = load(data + sizeof(uint32_t));
+    size_t header_size = (2 + blocks) * sizeof(uint32_t);
+    if (block_values == 0 || blocks != (m_reference.size() + block_values - 1) / block_values || size < header_size) {
+        throw TraceCodecError("Corrupted compressed trace frame");
+    }
+
+    std::vector<size_t> offsets(blocks + 1, header_size);
+    for (size_t b = 0; b < blocks; b++) {
+        offsets[b + 1] = offsets[b] + load(data + (2 + b) * sizeof(uint32_t));
+    }
+
+    if (offsets[blocks] != size) {
+        throw TraceCodecError("Corrupted compressed trace frame");
+    }
+
+    m_blocks.resize(std::max(m_blocks.size(), 2 * blocks));
+    m_has_reference = false;
+
+    bool valid = true;
+    int block_count = static_cast<int>(blocks);
+
+    #pragma omp parallel for schedule(dynamic) reduction(&&:valid)
+    for (int b = 0; b < block_count; b++) {
+        size_t first = b * block_values;
+        size_t count = std::min(block_values, m_reference.size() - first);
+        valid = decodeBlock(data + offsets[b], offsets[b + 1] - offsets[b], &m_reference[first], count, m_quantum,
+                            keyframe, m_blocks[2 * b], values + first) && valid;
+    }
+
+    if (!valid) {
+        throw TraceCodecError("Corrupted compressed trace frame");
+    }
+
+    m_has_reference = true;
+}
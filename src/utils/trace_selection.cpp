@@ -0,0 +1,177 @@
+#include <utils/trace_selection.hpp>
+
+#include <algorithm>
+
+// candidates per block of the region test
+static const size_t filter_block = 4096;
+
+static void gather(const float3vec& field, bool selected, const std::vector<size_t>& ids, float3vec& out)
+{
+    if (!selected || field.empty()) {
+        out.clear();
+        return;
+    }
+
+    int num = ids.size();
+    out.resize(num);
+
+    #pragma omp parallel for schedule(static) if (num >= static_cast<int>(filter_block))
+    for (int i = 0; i < num; i++) {
+        out[i] = field[ids[i]];
+    }
+}
+
+TraceSelection::TraceSelection()
+    : m_id_begin(0)
+    , m_id_end(0)
+    , m_id_stride(1)
+    , m_ignore_flags(StreamIgnore::NO_IGNORE)
+    , m_region(region_none)
+    , m_sphere_radius(0)
+    , m_area(0)
+    , m_periodic(false)
+{
+}
+
+TraceSelection::TraceSelection(const TraceSelectionConfig& conf)
+    : m_id_begin(conf.id_begin)
+    , m_id_end(conf.id_end)
+    , m_id_stride(std::max<size_t>(conf.id_stride, 1))
+    , m_ignore_flags(StreamIgnore::NO_IGNORE)
+    , m_region(region_none)
+    , m_box_min(conf.box_min)
+    , m_box_max(conf.box_max)
+    , m_sphere_center(conf.sphere_center)
+    , m_sphere_radius(conf.sphere_radius)
+    , m_area(0)
+    , m_periodic(false)
+{
+    if (!conf.pos) {
+        m_ignore_flags = m_ignore_flags | StreamIgnore::IGNORE_POS;
+    }
+    if (!conf.vel) {
+        m_ignore_flags = m_ignore_flags | StreamIgnore::IGNORE_VEL;
+    }
+    if (!conf.accel) {
+        m_ignore_flags = m_ignore_flags | StreamIgnore::IGNORE_ACCEL;
+    }
+
+    if (conf.region.value() == "box") {
+        m_region = region_box;
+    } else if (conf.region.value() == "sphere") {
+        m_region = region_sphere;
+    }
+}
+
+bool TraceSelection::all() const
+{
+    return m_id_begin == 0 && m_id_end == 0 && m_id_stride == 1 && m_region == region_none && !m_ignore_flags;
+}
+
+StreamIgnore TraceSelection::ignoreFlags() const
+{
+    return m_ignore_flags;
+}
+
+void TraceSelection::setArea(md::float3 area_size, bool periodic)
+{
+    m_area = area_size;
+    m_periodic = periodic && area_size.x > 0 && area_size.y > 0 && area_size.z > 0;
+}
+
+void TraceSelection::apply(const ParticleFrame& frame, ParticleFrame& out)
+{
+    out.iteration = frame.iteration;
+    selectIds(frame, out.ids);
+
+    gather(frame.pos, !(m_ignore_flags & StreamIgnore::IGNORE_POS), out.ids, out.pos);
+    gather(frame.vel, !(m_ignore_flags & StreamIgnore::IGNORE_VEL), out.ids, out.vel);
+    gather(frame.accel, !(m_ignore_flags & StreamIgnore::IGNORE_ACCEL), out.ids, out.accel);
+}
+
+void TraceSelection::selectIds(const ParticleFrame& frame, std::vector<size_t>& ids)
+{
+    size_t num = frame.size();
+    size_t begin = std::min(m_id_begin, num);
+    size_t end = (m_id_end == 0) ? num : std::min(m_id_end, num);
+    size_t candidates = (end > begin) ? (end - begin + m_id_stride - 1) / m_id_stride : 0;
+
+    if (m_region == region_none) {
+        ids.resize(candidates);
+        for (size_t k = 0; k < candidates; k++) {
+            ids[k] = begin + k * m_id_stride;
+        }
+        return;
+    }
+
+    int blocks = static_cast<int>((candidates + filter_block - 1) / filter_block);
+    m_mask.resize(candidates);
+    m_block_offsets.assign(blocks + 1, 0);
+
+    const md::float3a* pos = frame.pos.data();
+    size_t stride = m_id_stride;
+
+    // comparisons are combined without branches, the loop is vectorized by the compiler
+    #pragma omp parallel for schedule(static) if (blocks > 1)
+    for (int b = 0; b < blocks; b++) {
+        size_t first = b * filter_block;
+        size_t last = std::min(candidates, first + filter_block);
+        unsigned char* mask = m_mask.data();
+        size_t selected = 0;
+
+        if (m_region == region_box) {
+            md::float3 lo = m_box_min;
+            md::float3 hi = m_box_max;
+            for (size_t k = first; k < last; k++) {
+                const md::float3& p = pos[begin + k * stride];
+                unsigned char inside = (p.x >= lo.x) & (p.x < hi.x) & (p.y >= lo.y) & (p.y < hi.y) & (p.z >= lo.z) &
+                                       (p.z < hi.z);
+                mask[k] = inside;
+                selected += inside;
+            }
+        } else {
+            md::float3 center = m_sphere_center;
+            md::float3 area = m_area;
+            md::float3 period = m_periodic ? area : md::float3(0);
+            md::float3 inv_area = m_periodic ? md::float3(1.0f) / area : md::float3(0);
+            float sqr_radius = m_sphere_radius * m_sphere_radius;
+            for (size_t k = first; k < last; k++) {
+                md::float3 d = pos[begin + k * stride] - center;
+                // minimum image, no-op when not periodic
+                d -= period * glm::round(d * inv_area);
+                unsigned char inside = (d.x * d.x + d.y * d.y + d.z * d.z) <= sqr_radius;
+                mask[k] = inside;
+                selected += inside;
+            }
+        }
+
+        m_block_offsets[b + 1] = selected;
+    }
+
+    for (int b = 0; b < blocks; b++) {
+        m_block_offsets[b + 1] += m_block_offsets[b];
+    }
+
+    ids.resize(m_block_offsets[blocks]);
+
+    #pragma omp parallel for schedule(static) if (blocks > 1)
+    for (int b = 0; b < blocks; b++) {
+        size_t first = b * filter_block;
+        size_t last = std::min(candidates, first + filter_block);
+        size_t at = m_block_offsets[b];
+        for (size_t k = first; k < last; k++) {
+            if (m_mask[k]) {
+                ids[at++] = begin + k * stride;
+            }
+        }
+    }
+}
+
+TraceConfig TraceSelection::traceConfig(const TraceSelectionConfig& conf, TraceConfig base)
+{
+    base.enabled = true;
+    base.filename = conf.filename.value();
+    base.binary_file = conf.binary_file.value();
+    base.iterations_threshold = conf.iterations_threshold.value();
+    return base;
+}
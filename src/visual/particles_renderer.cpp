@@ -15,7 +15,7 @@ ParticleRenderer::ParticleRenderer()
 ParticleRenderer::~ParticleRenderer() {}
 
 void
-ParticleRenderer::set_particles_positions(const std::vector<glm::vec3>& pos, glm::vec3 area_size)
+ParticleRenderer::set_particles_positions(const md::float3vec& pos, glm::vec3 area_size)
 {
     positions.resize(pos.size());
 
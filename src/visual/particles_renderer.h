@@ -9,6 +9,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <md_types.h>
+#include <platforms/native/types.hpp>
 
 #include "renderer.hpp"
 
@@ -19,7 +20,7 @@ public:
     ~ParticleRenderer();
 
     void display();
-    void set_particles_positions(const std::vector<glm::vec3>& pos, glm::vec3 area_size);
+    void set_particles_positions(const md::float3vec& pos, glm::vec3 area_size);
 
 protected:
     void setup_program();
@@ -14,6 +14,7 @@
 #include <platforms/native/native_platform.hpp>
 
 #include <utils/stream.hpp>
+#include <utils/frame_ring.hpp>
 
 #include <boost/program_options.hpp>
 
@@ -123,6 +124,7 @@ int main(int argc, char** argv)
     try {
         std::vector<std::string> config_files;
         std::string trace_file;
+        bool live = false;
 
         po::options_description desc("Allowed options");
         desc.add_options()
@@ -130,6 +132,7 @@ int main(int argc, char** argv)
             ("config,c", po::value<std::vector<std::string> >(&config_files)->required()->multitoken(),
              "path to particle system config")
             ("trace,t", po::value<std::string>(&trace_file), "use another trace file")
+            ("live,l", po::bool_switch(&live), "show frames of running launcher from FrameRingConfig ring")
         ;
 
         po::variables_map vm;
@@ -149,17 +152,24 @@ int main(int argc, char** argv)
         ParticleSystemConfig psys_conf = conf_man.getParticleSystemConfig();
         NativeParticleSystem native_system(psys_conf);
 
-        TraceConfig trace_conf = conf_man.getTraceConfig();
-        if (trace_conf.filename.value() == "") {
-            throw std::runtime_error("TraceConfig does not contain filename to read");
+        ParticleIStreamPtr trace;
+        if (live) {
+            // launcher has to be started with the same FrameRingConfig
+            trace = std::make_shared<FrameRingIStream>(conf_man.getFrameRingConfig().shm_name);
+        } else {
+            TraceConfig trace_conf = conf_man.getTraceConfig();
+            if (trace_conf.filename.value() == "") {
+                throw std::runtime_error("TraceConfig does not contain filename to read");
+            }
+
+            // override default filename with user-supplied one
+            if (trace_file != "") {
+                trace_conf.filename = trace_file;
+            }
+
+            trace = StreamFactory::Instance()->MakeTraceIStream(trace_conf);
         }
 
-        // override default filename with user-supplied one
-        if (trace_file != "") {
-            trace_conf.filename = trace_file;
-        }
-
-        ParticleIStreamPtr trace = StreamFactory::Instance()->MakeTraceIStream(trace_conf);
         VisualizerWindow window(native_system, trace);
 
         window.start();
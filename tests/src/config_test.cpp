@@ -56,6 +56,49 @@ TEST(config, trace)
     ASSERT_EQ(1000, trace_config.iterations_threshold);
 }
 
+TEST(config, set_entry)
+{
+    ConfigManager conf_man;
+    conf_man.loadFromFile("config_test.conf");
+
+    conf_man.setEntry("dt", "0.25");
+    conf_man.setEntry("LennardJonesConfig.sigma", "0.5");
+    conf_man.setEntry("area_size", "1 2 3");
+
+    ParticleSystemConfig psys_conf = conf_man.getParticleSystemConfig();
+    LennardJonesConstants lj_const = conf_man.getLennardJonesConfig().getConstants();
+
+    ASSERT_FLOAT_EQ(0.25, psys_conf.dt);
+    ASSERT_EQ(float3(1, 2, 3), psys_conf.area_size.value());
+    ASSERT_FLOAT_EQ(0.5, lj_const.get_sigma());
+    ASSERT_FLOAT_EQ(0.001, lj_const.get_eps());
+
+    ASSERT_THROW(conf_man.setEntry("not_exist", "1"), ConfigError);
+    ASSERT_THROW(conf_man.setEntry("NotExist.dt", "1"), ConfigError);
+    ASSERT_THROW(conf_man.setEntry("dt", "abc"), ConfigError);
+
+    // filename is in several configs
+    ASSERT_THROW(conf_man.setEntry("filename", "\"trace.txt\""), ConfigError);
+    conf_man.setEntry("TraceConfig.filename", "\"trace.txt\"");
+    ASSERT_EQ("trace.txt", conf_man.getTraceConfig().filename.value());
+}
+
+TEST(config, set_entry_shared_name)
+{
+    // enabled is in trace, observables, checkpoint and frame ring configs
+    ConfigManager conf_man;
+    conf_man.setEntry("ObservablesConfig.enabled", "1");
+
+    ASSERT_TRUE(conf_man.getObservablesConfig().enabled);
+    ASSERT_FALSE(conf_man.getCheckpointConfig().enabled);
+    ASSERT_FALSE(conf_man.getTraceConfig().enabled);
+    ASSERT_FALSE(conf_man.getFrameRingConfig().enabled);
+
+    ASSERT_THROW(conf_man.setEntry("enabled", "1"), ConfigError);
+    ASSERT_THROW(conf_man.setEntry("iterations_threshold", "10"), ConfigError);
+    ASSERT_FALSE(conf_man.getCheckpointConfig().enabled);
+}
+
 TEST(config, init_file_native)
 {
     ConfigManager& conf_man = ConfigManager::Instance();
@@ -1,6 +1,8 @@
 #include <md_helpers.h>
 #include "gtest/gtest.h"
 
+#include <cstdio>
+
 std::vector<Molecule> read_molecules_from_file(std::string filepath);
 
 TEST(file_io, state_read)
@@ -126,3 +128,95 @@ TEST(file_io, trace_read_write)
     check_mol_vectors_equal(molecules_final_reference, molecules_final);
     check_mol_vectors_equal(molecules_final, molecules_final_2);
 }
+
+TEST(file_io, trace_index)
+{
+    std::vector<std::vector<Molecule> > frames;
+    for (size_t i = 0; i < 5; i++) {
+        frames.push_back(generate_random_molecules_vector(7));
+    }
+
+    trace_write _trace_write("trace_index_test.xyztrace");
+    _trace_write.initial(frames[0]);
+    _trace_write.next(frames[1]);
+    _trace_write.next(frames[2]);
+    _trace_write.next(frames[3]);
+    _trace_write.final(frames[4]);
+    _trace_write.close();
+
+    std::remove(trace_index::sidecar_path("trace_index_test.xyztrace").c_str());
+
+    // chunk boundaries fall everywhere inside lines
+    trace_index reference = trace_index::build("trace_index_test.xyztrace", 1 << 20);
+    ASSERT_EQ(5u, reference.frames());
+    ASSERT_EQ(7u, reference.molecules());
+    for (uint64_t chunk_size = 1; chunk_size < 64; chunk_size += 7) {
+        trace_index index = trace_index::build("trace_index_test.xyztrace", chunk_size);
+        ASSERT_EQ(reference.frames(), index.frames());
+        for (size_t k = 0; k < index.frames(); k++) {
+            ASSERT_EQ(reference.begin(k), index.begin(k));
+            ASSERT_EQ(reference.end(k), index.end(k));
+        }
+    }
+
+    // sidecar is written on first open
+    std::vector<std::vector<Molecule> > sequential;
+    trace_read _trace_read("trace_index_test.xyztrace");
+    ASSERT_EQ(5u, _trace_read.frames());
+    for (size_t k = 0; k < 5; k++) {
+        sequential.push_back(_trace_read.next());
+        ASSERT_EQ(7u, sequential[k].size());
+        for (size_t i = 0; i < 7; i++) {
+            ASSERT_NEAR(frames[k][i].pos.x, sequential[k][i].pos.x, 1e-12);
+            ASSERT_NEAR(frames[k][i].accel.z, sequential[k][i].accel.z, 1e-12);
+        }
+    }
+    std::ifstream sidecar(trace_index::sidecar_path("trace_index_test.xyztrace"));
+    ASSERT_TRUE(sidecar.is_open());
+
+    trace_read _trace_read_2("trace_index_test.xyztrace");
+    ASSERT_TRUE(sequential[4] == _trace_read_2.final());
+    ASSERT_TRUE(sequential[2] == _trace_read_2.seek(2));
+    ASSERT_TRUE(sequential[3] == _trace_read_2.next());
+    ASSERT_THROW(_trace_read_2.seek(5), std::out_of_range);
+
+    // frames of unfinished trace are readable
+    trace_write unfinished("trace_index_test_unfinished.xyztrace");
+    unfinished.initial(frames[0]);
+    unfinished.next(frames[1]);
+    unfinished.close();
+
+    trace_read _trace_read_3("trace_index_test_unfinished.xyztrace");
+    ASSERT_EQ(2u, _trace_read_3.frames());
+    ASSERT_TRUE(sequential[1] == _trace_read_3.final());
+}
+
+TEST(file_io, trace_index_single_molecule)
+{
+    std::vector<std::vector<Molecule> > frames;
+    for (size_t i = 0; i < 3; i++) {
+        frames.push_back(generate_random_molecules_vector(1));
+    }
+
+    trace_write _trace_write("trace_index_single_test.xyztrace");
+    _trace_write.initial(frames[0]);
+    _trace_write.next(frames[1]);
+    _trace_write.final(frames[2]);
+    _trace_write.close();
+
+    std::remove(trace_index::sidecar_path("trace_index_single_test.xyztrace").c_str());
+
+    // "total steps" line has the position of a frame line
+    for (uint64_t chunk_size = 1; chunk_size < 64; chunk_size += 7) {
+        trace_index index = trace_index::build("trace_index_single_test.xyztrace", chunk_size);
+        ASSERT_EQ(3u, index.frames());
+        ASSERT_EQ(1u, index.molecules());
+    }
+
+    trace_read _trace_read("trace_index_single_test.xyztrace");
+    ASSERT_EQ(3u, _trace_read.frames());
+    std::vector<Molecule> last = _trace_read.final();
+    ASSERT_EQ(1u, last.size());
+    ASSERT_NEAR(frames[2][0].pos.x, last[0].pos.x, 1e-12);
+    ASSERT_NEAR(frames[2][0].accel.z, last[0].accel.z, 1e-12);
+}
@@ -0,0 +1,70 @@
+#include "gtest/gtest.h"
+
+#include <platforms/hybrid/hybrid_platform.hpp>
+#include <platforms/native/native_platform.hpp>
+
+#include <md_types.h>
+#include <md_algorithms.h>
+
+#include "utils.hpp"
+
+// CPU OpenCL runtime (e.g. PoCL) is enough to run these tests
+
+void lennard_jones_reference(size_t num, double cpu_ratio)
+{
+    std::vector<Molecule> ref_mol = generate_random_molecules_vector(num);
+
+    ParticleSystemConfig conf;
+    conf.dt = 0.5;
+
+    NativeParticleSystem native = md::legacy::convertToNativeSystem(ref_mol, conf);
+
+    HybridParticleSystem hybrid(conf);
+    hybrid.loadParticles(md::float3vec(native.pos()), md::float3vec(native.pos_prev()),
+                         md::float3vec(native.vel()), md::float3vec(native.accel()));
+    hybrid.setAutoTune(false);
+    hybrid.setCpuRatio(cpu_ratio);
+
+    native.applyLennardJonesInteraction();
+    hybrid.applyLennardJonesInteraction();
+
+    for (size_t i = 0; i < num; i++) {
+        ASSERT_NEAR(native.accel()[i].x, hybrid.accel()[i].x, std::abs(native.accel()[i].x) * 1e-4) << "particle " << i;
+        ASSERT_NEAR(native.accel()[i].y, hybrid.accel()[i].y, std::abs(native.accel()[i].y) * 1e-4) << "particle " << i;
+        ASSERT_NEAR(native.accel()[i].z, hybrid.accel()[i].z, std::abs(native.accel()[i].z) * 1e-4) << "particle " << i;
+    }
+}
+
+TEST(hybrid_platform, lennard_jones_device_only)
+{
+    lennard_jones_reference(1024, 0);
+}
+
+TEST(hybrid_platform, lennard_jones_cpu_only)
+{
+    lennard_jones_reference(1024, 1);
+}
+
+TEST(hybrid_platform, lennard_jones_split)
+{
+    lennard_jones_reference(1024, 0.3);
+}
+
+TEST(hybrid_platform, auto_tune)
+{
+    std::vector<Molecule> ref_mol = generate_random_molecules_vector(2048);
+
+    ParticleSystemConfig conf;
+    NativeParticleSystem native = md::legacy::convertToNativeSystem(ref_mol, conf);
+
+    HybridParticleSystem hybrid(conf);
+    hybrid.loadParticles(md::float3vec(native.pos()), md::float3vec(native.pos_prev()),
+                         md::float3vec(native.vel()), md::float3vec(native.accel()));
+
+    for (size_t i = 0; i < 5; i++) {
+        hybrid.applyLennardJonesInteraction();
+
+        ASSERT_GT(hybrid.cpuRatio(), 0);
+        ASSERT_LT(hybrid.cpuRatio(), 1);
+    }
+}
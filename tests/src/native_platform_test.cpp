@@ -1,6 +1,11 @@
 #include "gtest/gtest.h"
 
 #include <platforms/native/native_platform.hpp>
+#include <utils/checkpoint.hpp>
+#include <utils/particle_generator.hpp>
+
+#include <fstream>
+#include <limits>
 
 #include <md_types.h>
 #include <md_algorithms.h>
@@ -94,3 +99,220 @@ TEST(native_platform, euler_reference_bruteforce_heavy)
     euler_reference_bruteforce(1024 * 1024);
 }
 
+
+TEST(native_platform, observe_pair)
+{
+    ParticleSystemConfig conf;
+    conf.dt = 0.5;
+
+    const float r = 0.15f;
+    float3vec pos = { float3(0, 0, 0), float3(r, 0, 0) };
+    // velocities (0.2, 0, 0) and (0, -0.4, 0)
+    float3vec pos_prev = { float3(-0.1f, 0, 0), float3(r, 0.2f, 0) };
+    float3vec vel(2), accel(2);
+
+    NativeParticleSystem sys(conf);
+    sys.loadParticles(std::move(pos), std::move(pos_prev), std::move(vel), std::move(accel));
+
+    Observables obs = sys.observe();
+
+    md::LennardJonesConstants lj = sys.lennardJonesConfig().getConstants();
+    double ri6 = std::pow(1.0 / r, 6);
+    double potential = 4 * lj.get_eps() * ri6 * (ri6 * lj.get_sigma_pow_12() - lj.get_sigma_pow_6());
+    double force = 48 * lj.get_eps() * ri6 / (r * r) * (lj.get_sigma_pow_12() * ri6 - lj.get_sigma_pow_6() / 2);
+
+    EXPECT_NEAR(0.5 * (0.04 + 0.16), obs.kinetic_energy, 1e-5);
+    EXPECT_NEAR(2 * obs.kinetic_energy / 6, obs.temperature, 1e-6);
+    EXPECT_NEAR(0.2, obs.momentum.x, 1e-5);
+    EXPECT_NEAR(-0.4, obs.momentum.y, 1e-5);
+    EXPECT_NEAR(potential, obs.potential_energy, 1e-4 * std::abs(potential));
+    EXPECT_NEAR(r * force, obs.virial, 1e-4 * std::abs(r * force));
+    EXPECT_DOUBLE_EQ(obs.kinetic_energy + obs.potential_energy, obs.totalEnergy());
+}
+
+// particles close through the boundary interact as a pair at distance r
+TEST(native_platform, periodic_minimum_image)
+{
+    ParticleSystemConfig conf;
+    conf.periodic = true;
+    conf.area_size = float3(1, 2, 2);
+
+    const float r = 0.15f;
+    float3vec pos = { float3(0.05f, 1, 1), float3(1.05f - r, 1, 1) };
+    float3vec pos_prev = pos;
+    float3vec vel(2), accel(2);
+
+    NativeParticleSystem sys(conf);
+    sys.loadParticles(std::move(pos), std::move(pos_prev), std::move(vel), std::move(accel));
+    sys.applyLennardJonesInteraction();
+
+    md::LennardJonesConstants lj = sys.lennardJonesConfig().getConstants();
+    double ri6 = std::pow(1.0 / r, 6);
+    double force = 48 * lj.get_eps() * ri6 / (r * r) * (lj.get_sigma_pow_12() * ri6 - lj.get_sigma_pow_6() / 2);
+
+    // image of the second particle is on the left of the first one
+    EXPECT_NEAR(force, sys.accel()[0].x, 1e-3 * std::abs(force));
+    EXPECT_NEAR(-force, sys.accel()[1].x, 1e-3 * std::abs(force));
+    EXPECT_NEAR(0, sys.accel()[0].y, 1e-6);
+
+    Observables obs = sys.observe();
+    EXPECT_NEAR(r * force, obs.virial, 1e-3 * std::abs(r * force));
+
+    // integration wraps positions into the area
+    sys.iterate(10);
+    for (auto& p : sys.pos()) {
+        for (int c = 0; c < 3; c++) {
+            EXPECT_LE(0, p[c]);
+            EXPECT_GT(conf.area_size.value()[c], p[c]);
+        }
+    }
+}
+
+static NativeParticleSystem make_checkpoint_system(ParticleSystemConfig conf)
+{
+    float3vec pos, vel;
+    for (size_t i = 0; i < 64; i++) {
+        pos.push_back(float3(0.3f * (i % 4) + 0.1f, 0.3f * (i / 4 % 4) + 0.1f, 0.3f * (i / 16) + 0.1f));
+        vel.push_back(float3(0.01f * (i % 3), -0.01f * (i % 5), 0.005f * (i % 7)));
+    }
+    float3vec pos_prev(pos.size()), accel(pos.size());
+
+    NativeParticleSystem sys(conf);
+    sys.loadParticles(std::move(pos), std::move(pos_prev), std::move(vel), std::move(accel));
+    return sys;
+}
+
+TEST(native_platform, checkpoint_restart)
+{
+    ParticleSystemConfig conf;
+    conf.periodic = true;
+    conf.area_size = float3(1.2f);
+    conf.dt = 0.001f;
+
+    NativeParticleSystem uninterrupted = make_checkpoint_system(conf);
+    uninterrupted.iterate(20);
+
+    CheckpointConfig checkpoint_conf;
+    checkpoint_conf.enabled = true;
+    checkpoint_conf.filename = "native_platform_test_checkpoint.bin";
+    checkpoint_conf.iterations_threshold = 4;
+
+    std::vector<size_t> iterations;
+    {
+        NativeParticleSystem first = make_checkpoint_system(conf);
+        CheckpointWriter writer(checkpoint_conf);
+        writer.setConfigText("[ParticleSystemConfig]\nperiodic 1\n");
+        writer.attach(first);
+        first.iterate(6);
+
+        // periodic checkpoint after the 5th iteration
+        writer.flush();
+        ASSERT_EQ(1u, writer.checkpointsWritten());
+        ASSERT_EQ(5u, Checkpoint::load(checkpoint_conf.filename).state.iteration);
+
+        writer.write(first);
+        ASSERT_EQ(2u, writer.checkpointsWritten());
+    }
+
+    Checkpoint checkpoint = Checkpoint::load(checkpoint_conf.filename);
+    ASSERT_EQ(6u, checkpoint.state.iteration);
+    ASSERT_EQ("[ParticleSystemConfig]\nperiodic 1\n", checkpoint.config);
+
+    // resumed run does not start with Euler step and continues iteration numbers
+    NativeParticleSystem resumed(conf);
+    resumed.restoreState(checkpoint.state);
+    resumed.registerOnIterationCb([&](ParticleSystem*, size_t iteration) { iterations.push_back(iteration); });
+    resumed.iterate(14);
+
+    ASSERT_EQ(20u, resumed.iteration());
+    ASSERT_EQ(14u, iterations.size());
+    ASSERT_EQ(6u, iterations.front());
+
+    EXPECT_CONTAINERS_EQUAL(uninterrupted.pos(), resumed.pos());
+    EXPECT_CONTAINERS_EQUAL(uninterrupted.pos_prev(), resumed.pos_prev());
+    EXPECT_CONTAINERS_EQUAL(uninterrupted.accel(), resumed.accel());
+
+    // truncated checkpoint is rejected
+    {
+        std::ifstream is(checkpoint_conf.filename.value(), std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+        std::ofstream os("native_platform_test_checkpoint_truncated.bin", std::ios::binary);
+        os.write(contents.data(), contents.size() - 1);
+    }
+    ASSERT_THROW(Checkpoint::load("native_platform_test_checkpoint_truncated.bin"), CheckpointError);
+    ASSERT_THROW(Checkpoint::load("native_platform_test_checkpoint_missing.bin"), CheckpointError);
+}
+
+static float min_sqr_distance(const float3vec& pos, float3 area)
+{
+    float result = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < pos.size(); i++) {
+        for (size_t j = i + 1; j < pos.size(); j++) {
+            float3 diff = pos[i] - pos[j];
+            diff -= area * glm::round(diff / area);
+            result = std::min(result, diff.x * diff.x + diff.y * diff.y + diff.z * diff.z);
+        }
+    }
+    return result;
+}
+
+TEST(native_platform, generator)
+{
+    ParticleSystemConfig conf;
+    conf.periodic = true;
+    conf.area_size = float3(10);
+    conf.particles_num = 500;
+
+    // 5^3 cells of 4 sites fill the area exactly
+    conf.init_generator = "fcc";
+    NativeParticleSystem fcc(conf);
+    ASSERT_EQ(500u, fcc.pos().size());
+    ASSERT_NEAR(2.0f, min_sqr_distance(fcc.pos(), conf.area_size), 1e-4);
+    for (auto& p : fcc.pos()) {
+        for (int c = 0; c < 3; c++) {
+            EXPECT_LT(0, p[c]);
+            EXPECT_GT(10, p[c]);
+        }
+    }
+
+    conf.init_generator = "bcc";
+    NativeParticleSystem bcc(conf);
+    // 7^3 cells hold 250 of them
+    ASSERT_NEAR(3 * (10 / 7.0f) * (10 / 7.0f) / 4, min_sqr_distance(bcc.pos(), conf.area_size), 1e-4);
+
+    conf.init_generator = "uniform";
+    conf.particles_num = 1000;
+    conf.init_min_distance = 0.7f;
+    conf.init_temperature = 2.0f;
+    conf.init_seed = 7;
+    NativeParticleSystem uniform(conf);
+    ASSERT_EQ(1000u, uniform.pos().size());
+    ASSERT_LE(0.49f, min_sqr_distance(uniform.pos(), conf.area_size));
+
+    // same seed gives the same particles
+    float3vec pos, vel;
+    ParticleGenerator(conf).generate(pos, vel);
+    EXPECT_CONTAINERS_EQUAL(uniform.pos(), pos);
+    EXPECT_CONTAINERS_EQUAL(uniform.vel(), vel);
+
+    conf.init_seed = 8;
+    float3vec other_pos, other_vel;
+    ParticleGenerator(conf).generate(other_pos, other_vel);
+    ASSERT_NE(pos[0], other_pos[0]);
+
+    // Maxwell-Boltzmann velocities without drift
+    double sqr_vel = 0;
+    float3 momentum(0);
+    for (auto& v : uniform.vel()) {
+        sqr_vel += v.x * v.x + v.y * v.y + v.z * v.z;
+        momentum += v;
+    }
+    ASSERT_NEAR(2.0, sqr_vel / (3 * 1000), 0.2);
+    ASSERT_NEAR(0, momentum.x, 1e-3);
+    ASSERT_NEAR(0, momentum.y, 1e-3);
+    ASSERT_NEAR(0, momentum.z, 1e-3);
+
+    // particles do not fit
+    conf.area_size = float3(2);
+    ASSERT_THROW(NativeParticleSystem dense(conf), GeneratorError);
+}
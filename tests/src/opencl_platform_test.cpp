@@ -1,8 +1,20 @@
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <sstream>
+
 #include <platforms/opencl/opencl_platform.hpp>
+#include <platforms/opencl/multi_device_platform.hpp>
 #include <platforms/opencl/opencl_dispatcher.hpp>
 #include <platforms/opencl/opencl_helpers.hpp>
+#include <platforms/opencl/program_cache.hpp>
+#include <platforms/opencl/kernel_generator.hpp>
+#include <platforms/opencl/profiler.hpp>
+#include <platforms/opencl/tuning.hpp>
 
 #include <md_types.h>
 #include <md_algorithms.h>
@@ -54,6 +66,29 @@ TEST(opencl_platform, native_to_cl_system_conversion_simple)
     EXPECT_CONTAINERS_EQUAL(native.accel(), converted_native.accel());
 }
 
+TEST(opencl_platform, native_to_cl_system_moved)
+{
+    md::float3vec pos = { float3(0,0,0), float3(1,1,1), float3(2, 2, 3) };
+    md::float3vec expected = pos;
+    md::float3vec pos_prev(pos), vel(3), accel(3);
+
+    NativeParticleSystem native;
+    native.loadParticles(std::move(pos), std::move(pos_prev),
+                         std::move(vel), std::move(accel));
+    const md::float3a* native_data = native.pos().data();
+
+    OpenCLParticleSystem cl_sys;
+    cl_sys.fromNative(std::move(native));
+
+    // buffer is created over native memory, mapping hands it out again
+    cl::mapping<cl_float3> mapped(cl_sys.pos(), CL_MAP_READ);
+    EXPECT_EQ(native_data, mapped.data());
+    EXPECT_TRUE(native.pos().empty());
+
+    md::float3vec converted(mapped.data(), mapped.data() + mapped.size());
+    EXPECT_CONTAINERS_EQUAL(expected, converted);
+}
+
 void verlet_reference_bruteforce(size_t num)
 {
     std::vector<Molecule> ref_mol = generate_random_molecules_vector(num);
@@ -145,6 +180,413 @@ TEST(opencl_platform, euler_reference_bruteforce_heavy)
     euler_reference_bruteforce(1024 * 1024);
 }
 
+// periodic runs compare minimum image differences, positions close to the
+// boundary may be wrapped on one platform and not on the other
+static float periodicDiff(float a, float b, float area)
+{
+    float d = a - b;
+    return area > 0 ? d - area * std::round(d / area) : d;
+}
+
+void iterate_reference(size_t num, size_t iterations, const OpenCLConfig& ocl_conf = OpenCLConfig(),
+                       float periodic_area = 0)
+{
+    std::vector<Molecule> ref_mol = generate_random_molecules_vector(num);
+
+    ParticleSystemConfig conf;
+    conf.dt = 0.00001;
+    if (periodic_area > 0) {
+        conf.periodic = true;
+        conf.area_size = float3(periodic_area);
+    }
+
+    NativeParticleSystem native = md::legacy::convertToNativeSystem(ref_mol, conf);
+    OpenCLParticleSystem cl_sys;
+    cl_sys.setOpenCLConfig(ocl_conf);
+    cl_sys.fromNative(native);
+
+    native.iterate(iterations);
+    cl_sys.iterate(iterations);
+
+    NativeParticleSystem converted_native = cl_sys.convertToNative();
+
+    for (size_t i = 0; i < num; i++) {
+        for (int c = 0; c < 3; c++) {
+            float expected = native.pos()[i][c];
+            float actual = converted_native.pos()[i][c];
+            ASSERT_NEAR(0, periodicDiff(expected, actual, periodic_area), 1e-4 * std::max(1.0f, std::abs(expected)))
+                << "particle " << i;
+
+            expected = native.pos_prev()[i][c];
+            actual = converted_native.pos_prev()[i][c];
+            ASSERT_NEAR(0, periodicDiff(expected, actual, periodic_area), 1e-4 * std::max(1.0f, std::abs(expected)))
+                << "particle " << i;
+        }
+    }
+}
+
+TEST(opencl_platform, iterate_reference_single)
+{
+    iterate_reference(256, 1);
+}
+
+TEST(opencl_platform, iterate_reference_even)
+{
+    iterate_reference(256, 2);
+}
+
+// exceeds number of steps in flight
+TEST(opencl_platform, iterate_reference_long)
+{
+    iterate_reference(256, 151);
+}
+
+TEST(opencl_platform, iterate_reference_separate_kernels)
+{
+    OpenCLConfig ocl_conf;
+    ocl_conf.fused_kernels = false;
+    iterate_reference(256, 5, ocl_conf);
+}
+
+// particles number is not a multiple of work-group size
+TEST(opencl_platform, iterate_reference_fused_tiled)
+{
+    OpenCLConfig ocl_conf;
+    ocl_conf.lj_kernel = std::string("tiled");
+    ocl_conf.work_group_size = 32;
+    ocl_conf.tile_size = 64;
+    ocl_conf.unroll = 4;
+    iterate_reference(300, 5, ocl_conf);
+}
+
+TEST(opencl_platform, iterate_reference_fused_double)
+{
+    OpenCLConfig ocl_conf;
+    ocl_conf.precision = std::string("double");
+
+    const cl::Device& device = OpenCLDispatcher::Instance().getDeviceFor(*this)->get_device();
+    std::string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+    if (extensions.find("cl_khr_fp64") == std::string::npos) {
+        std::cout << "cl_khr_fp64 is not supported, skipped" << std::endl;
+        return;
+    }
+
+    iterate_reference(256, 5, ocl_conf);
+}
+
+// random particles are in [0, 5), area of 3 wraps most of them on the first step
+TEST(opencl_platform, iterate_reference_periodic)
+{
+    iterate_reference(256, 5, OpenCLConfig(), 3);
+}
+
+TEST(opencl_platform, iterate_reference_periodic_separate_kernels)
+{
+    OpenCLConfig ocl_conf;
+    ocl_conf.fused_kernels = false;
+    iterate_reference(256, 5, ocl_conf, 3);
+}
+
+// state saved on device is continued on native platform, pos_prev of wrapped
+// particles must be shifted with them as native platform does
+void periodic_restart_reference(const OpenCLConfig& ocl_conf)
+{
+    const size_t num = 256;
+    const float area = 3;
+    std::vector<Molecule> ref_mol = generate_random_molecules_vector(num);
+
+    ParticleSystemConfig conf;
+    conf.dt = 0.00001;
+    conf.periodic = true;
+    conf.area_size = float3(area);
+
+    NativeParticleSystem native = md::legacy::convertToNativeSystem(ref_mol, conf);
+    OpenCLParticleSystem cl_sys;
+    cl_sys.setOpenCLConfig(ocl_conf);
+    cl_sys.fromNative(native);
+
+    native.iterate(10);
+    cl_sys.iterate(5);
+
+    ParticleState state;
+    cl_sys.saveState(state);
+    NativeParticleSystem resumed(conf);
+    resumed.restoreState(state);
+    resumed.iterate(5);
+
+    ASSERT_EQ(10u, resumed.iteration());
+    for (size_t i = 0; i < num; i++) {
+        for (int c = 0; c < 3; c++) {
+            float expected = native.pos()[i][c];
+            float actual = resumed.pos()[i][c];
+            ASSERT_NEAR(0, periodicDiff(expected, actual, area), 1e-4 * std::max(1.0f, std::abs(expected)))
+                << "particle " << i;
+
+            // displacement of the last step
+            expected = native.pos()[i][c] - native.pos_prev()[i][c];
+            actual = resumed.pos()[i][c] - resumed.pos_prev()[i][c];
+            ASSERT_NEAR(expected, actual, 1e-4) << "particle " << i;
+        }
+    }
+}
+
+TEST(opencl_platform, restart_native_periodic)
+{
+    periodic_restart_reference(OpenCLConfig());
+}
+
+TEST(opencl_platform, restart_native_periodic_separate_kernels)
+{
+    OpenCLConfig ocl_conf;
+    ocl_conf.fused_kernels = false;
+    periodic_restart_reference(ocl_conf);
+}
+
+TEST(opencl_platform, kernel_generator)
+{
+    KernelGenerator& generator = KernelGenerator::Instance();
+
+    KernelSpec spec;
+    const std::string& source = generator.source(spec);
+    size_t variants = generator.size();
+
+    // same spec is generated once
+    EXPECT_EQ(&source, &generator.source(spec));
+    EXPECT_EQ(variants, generator.size());
+    EXPECT_NE(std::string::npos, source.find("FusedStep"));
+    EXPECT_EQ(std::string::npos, source.find("cl_khr_fp64"));
+    EXPECT_EQ(std::string::npos, source.find("AREA"));
+
+    KernelSpec periodic_double = spec;
+    periodic_double.periodic = true;
+    periodic_double.precision = "double";
+    EXPECT_NE(spec.key(), periodic_double.key());
+
+    const std::string& other = generator.source(periodic_double);
+    EXPECT_NE(std::string::npos, other.find("cl_khr_fp64"));
+    EXPECT_NE(std::string::npos, other.find("AREA"));
+    EXPECT_LE(variants + 1, generator.size());
+
+    KernelSpec euler = spec;
+    euler.integrator = "euler";
+    euler.species = 2;
+    euler.energy = true;
+    std::string euler_source = KernelGenerator::generate(euler);
+    EXPECT_NE(std::string::npos, euler_source.find("vel"));
+    EXPECT_NE(std::string::npos, euler_source.find("pair_coeffs"));
+    EXPECT_NE(std::string::npos, euler_source.find("energy"));
+
+    KernelSpec unsupported = spec;
+    unsupported.potential = "coulomb";
+    EXPECT_THROW(generator.source(unsupported), std::runtime_error);
+}
+
+// callbacks see state of the chunk end while next chunk runs
+TEST(opencl_platform, iterate_callbacks)
+{
+    const size_t num = 256;
+    const size_t interval = 4;
+    std::vector<Molecule> ref_mol = generate_random_molecules_vector(num);
+
+    ParticleSystemConfig conf;
+    conf.dt = 0.00001;
+
+    NativeParticleSystem native = md::legacy::convertToNativeSystem(ref_mol, conf);
+    OpenCLParticleSystem cl_sys;
+    cl_sys.fromNative(native);
+
+    std::map<size_t, ParticleFrame> native_frames;
+    native.registerOnIterationCb([&](ParticleSystem* sys, size_t iteration) {
+        sys->snapshot(native_frames[iteration]);
+    });
+
+    std::map<size_t, ParticleFrame> cl_frames;
+    cl_sys.registerOnIterationCb([&](ParticleSystem* sys, size_t iteration) {
+        sys->snapshot(cl_frames[iteration]);
+    }, interval);
+
+    native.iterate(10);
+    cl_sys.iterate(10);
+
+    ASSERT_EQ(3, cl_frames.size());
+    for (auto& entry : cl_frames) {
+        ASSERT_EQ(0, entry.first % interval);
+
+        const ParticleFrame& expected = native_frames[entry.first];
+        ASSERT_EQ(num, entry.second.size());
+        for (size_t i = 0; i < num; i++) {
+            for (int c = 0; c < 3; c++) {
+                ASSERT_NEAR(expected.pos[i][c], entry.second.pos[i][c], 1e-4 * std::max(1.0f, std::abs(expected.pos[i][c])))
+                    << "iteration " << entry.first << " particle " << i;
+            }
+        }
+    }
+}
+
+// chunks of a continued run end at the same iterations as native callbacks
+TEST(opencl_platform, iterate_callbacks_continued)
+{
+    const size_t num = 256;
+    const size_t interval = 4;
+    std::vector<Molecule> ref_mol = generate_random_molecules_vector(num);
+
+    ParticleSystemConfig conf;
+    conf.dt = 0.00001;
+
+    NativeParticleSystem native = md::legacy::convertToNativeSystem(ref_mol, conf);
+    OpenCLParticleSystem cl_sys;
+    cl_sys.fromNative(native);
+
+    std::map<size_t, ParticleFrame> native_frames;
+    native.registerOnIterationCb([&](ParticleSystem* sys, size_t iteration) {
+        if (iteration % interval == 0) {
+            sys->snapshot(native_frames[iteration]);
+        }
+    });
+
+    std::map<size_t, ParticleFrame> cl_frames;
+    cl_sys.registerOnIterationCb([&](ParticleSystem* sys, size_t iteration) {
+        sys->snapshot(cl_frames[iteration]);
+    }, interval);
+
+    native.iterate(6);
+    native.iterate(6);
+    cl_sys.iterate(6);
+    cl_sys.iterate(6);
+
+    ASSERT_EQ(native_frames.size(), cl_frames.size());
+    for (auto& entry : cl_frames) {
+        ASSERT_EQ(1, native_frames.count(entry.first)) << "iteration " << entry.first;
+
+        const ParticleFrame& expected = native_frames[entry.first];
+        ASSERT_EQ(num, entry.second.size());
+        for (size_t i = 0; i < num; i++) {
+            for (int c = 0; c < 3; c++) {
+                ASSERT_NEAR(expected.pos[i][c], entry.second.pos[i][c], 1e-4 * std::max(1.0f, std::abs(expected.pos[i][c])))
+                    << "iteration " << entry.first << " particle " << i;
+            }
+        }
+    }
+}
+
+TEST(opencl_platform, observe_reference)
+{
+    std::vector<Molecule> ref_mol = generate_random_molecules_vector(1000);
+
+    ParticleSystemConfig conf;
+    conf.dt = 0.00001;
+
+    NativeParticleSystem native = md::legacy::convertToNativeSystem(ref_mol, conf);
+    OpenCLParticleSystem cl_sys;
+    cl_sys.fromNative(native);
+
+    native.iterate(3);
+    cl_sys.iterate(3);
+
+    Observables expected = native.observe();
+    Observables obs = cl_sys.observe();
+
+    EXPECT_NEAR(expected.kinetic_energy, obs.kinetic_energy, 1e-3 * std::abs(expected.kinetic_energy));
+    EXPECT_NEAR(expected.potential_energy, obs.potential_energy, 1e-3 * std::abs(expected.potential_energy));
+    EXPECT_NEAR(expected.virial, obs.virial, 1e-3 * std::abs(expected.virial));
+    EXPECT_NEAR(expected.temperature, obs.temperature, 1e-3 * std::abs(expected.temperature));
+    for (int c = 0; c < 3; c++) {
+        EXPECT_NEAR(expected.momentum[c], obs.momentum[c], 1e-3 * std::max(1.0f, std::abs(expected.momentum[c])));
+    }
+}
+
+void lennard_jones_reference(size_t num, std::string lj_kernel, size_t work_group_size, size_t tile_size,
+                             bool use_cutoff = false, float area = 0, size_t unroll = 1, bool periodic = false)
+{
+    std::vector<Molecule> ref_mol = generate_random_molecules_vector(num);
+
+    ParticleSystemConfig conf;
+    conf.use_cutoff = use_cutoff;
+    conf.area_size = float3(area);
+    conf.periodic = periodic;
+
+    NativeParticleSystem native = md::legacy::convertToNativeSystem(ref_mol, conf);
+
+    OpenCLConfig ocl_conf;
+    ocl_conf.lj_kernel = lj_kernel;
+    ocl_conf.work_group_size = work_group_size;
+    ocl_conf.tile_size = tile_size;
+    ocl_conf.unroll = unroll;
+
+    OpenCLParticleSystem cl_sys;
+    cl_sys.setOpenCLConfig(ocl_conf);
+    cl_sys.fromNative(native);
+
+    native.applyLennardJonesInteraction();
+    cl_sys.applyLennardJonesInteraction();
+
+    md::float3vec accel = cl_sys.accel().to_native();
+
+    for (size_t i = 0; i < num; i++) {
+        for (int c = 0; c < 3; c++) {
+            float expected = native.accel()[i][c];
+            ASSERT_NEAR(expected, accel[i][c], 1e-3 * std::max(1.0f, std::abs(expected))) << "particle " << i;
+        }
+    }
+}
+
+TEST(opencl_platform, lennard_jones_reference_simple)
+{
+    lennard_jones_reference(1000, "simple", 64, 0);
+}
+
+// particles number is not a multiple of work-group or tile size
+TEST(opencl_platform, lennard_jones_reference_tiled)
+{
+    lennard_jones_reference(1000, "tiled", 64, 0);
+}
+
+TEST(opencl_platform, lennard_jones_reference_tiled_large_tile)
+{
+    lennard_jones_reference(1000, "tiled", 32, 128);
+}
+
+// unroll does not divide tile size
+TEST(opencl_platform, lennard_jones_reference_tiled_unroll)
+{
+    lennard_jones_reference(1000, "tiled", 32, 96, false, 0, 8);
+}
+
+// random particles are in [0, 5), cell list is used for cutoff runs
+TEST(opencl_platform, lennard_jones_reference_cell_list)
+{
+    lennard_jones_reference(2000, "simple", 64, 0, true, 5);
+}
+
+// some particles are outside of area and land in boundary cells
+TEST(opencl_platform, lennard_jones_reference_cell_list_small_area)
+{
+    lennard_jones_reference(2000, "simple", 64, 0, true, 3);
+}
+
+// single cell
+TEST(opencl_platform, lennard_jones_reference_cell_list_no_area)
+{
+    lennard_jones_reference(500, "simple", 64, 0, true, 0);
+}
+
+TEST(opencl_platform, lennard_jones_reference_periodic_tiled)
+{
+    lennard_jones_reference(1000, "tiled", 64, 0, false, 5, 1, true);
+}
+
+// wrapped adjacent cells
+TEST(opencl_platform, lennard_jones_reference_cell_list_periodic)
+{
+    lennard_jones_reference(2000, "simple", 64, 0, true, 5, 1, true);
+}
+
+// less than 3 cells per dimension, every cell is adjacent
+TEST(opencl_platform, lennard_jones_reference_cell_list_periodic_small_grid)
+{
+    lennard_jones_reference(500, "simple", 64, 0, true, 0.5f, 1, true);
+}
+
 TEST(opencl_platform, store)
 {
     std::vector<Molecule> ref_mol = generate_random_molecules_vector(10);
@@ -156,9 +598,274 @@ TEST(opencl_platform, store)
     OpenCLParticleSystem cl_sys;
     cl_sys.fromNative(native);
 
-    // TODO: add result check
-    // std::cout << "Native:\n";
-    // native.storeParticles(std::cout);
-    // std::cout << "OpenCL:\n";
-    // cl_sys.storeParticles(std::cout);
+    const std::string filename = "opencl_platform_store.tmp";
+    cl_sys.storeParticles(std::make_shared<TextOStream>(filename));
+
+    // buffers are unmapped after store, system is still usable
+    NativeParticleSystem converted_native = cl_sys.convertToNative();
+    EXPECT_CONTAINERS_EQUAL(native.pos(), converted_native.pos());
+
+    // load from stored data gives the same particles
+    OpenCLParticleSystem loaded;
+    loaded.loadParticles(std::make_shared<TextIStream>(filename), ref_mol.size());
+    NativeParticleSystem loaded_native = loaded.convertToNative();
+
+    for (size_t i = 0; i < ref_mol.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            EXPECT_NEAR(native.pos()[i][c], loaded_native.pos()[i][c], 1e-4);
+            EXPECT_NEAR(native.vel()[i][c], loaded_native.vel()[i][c], 1e-4);
+        }
+    }
+
+    std::remove(filename.c_str());
+}
+
+TEST(opencl_platform, program_cache_memory)
+{
+    OpenCLDispatcher::DevicePtr device = OpenCLDispatcher::Instance().getDeviceFor(*this);
+    std::string source = "__kernel void cache_memory_test(__global int* a) { a[get_global_id(0)] = 1; }";
+
+    device->CreateProgram(source);
+    OpenCLProgramCache::Stats before = OpenCLProgramCache::Instance().stats();
+
+    device->CreateProgram(source);
+    OpenCLProgramCache::Stats after = OpenCLProgramCache::Instance().stats();
+
+    EXPECT_EQ(before.memory_hits + 1, after.memory_hits);
+    EXPECT_EQ(before.builds, after.builds);
+
+    // different build options are different programs
+    device->CreateProgram(source, "-DCACHE_TEST");
+    EXPECT_EQ(after.builds + 1, OpenCLProgramCache::Instance().stats().builds);
+}
+
+TEST(opencl_platform, program_cache_disk)
+{
+    OpenCLProgramCache& cache = OpenCLProgramCache::Instance();
+    OpenCLDispatcher::DevicePtr device = OpenCLDispatcher::Instance().getDeviceFor(*this);
+
+    // unique source, so binaries left by previous test runs are not used
+    std::string source = "__kernel void cache_disk_test(__global int* a) { a[get_global_id(0)] = "
+                       + std::to_string(time(NULL)) + "; }";
+
+    cache.setCacheDir("program_cache_test");
+
+    cache.clearMemory();
+    OpenCLProgramCache::Stats before = cache.stats();
+    device->CreateProgram(source);
+    EXPECT_EQ(before.builds + 1, cache.stats().builds);
+
+    cache.clearMemory();
+    before = cache.stats();
+    cl::Program program = device->CreateProgram(source);
+    EXPECT_EQ(before.disk_hits + 1, cache.stats().disk_hits);
+    EXPECT_EQ(before.builds, cache.stats().builds);
+
+    // program loaded from binaries is usable
+    cl::Kernel kernel(program, "cache_disk_test");
+
+    cache.setCacheDir("");
+}
+
+TEST(opencl_platform, tuning_profile)
+{
+    OpenCLTuningProfiles& profiles = OpenCLTuningProfiles::Instance();
+    const cl::Device& device = OpenCLDispatcher::Instance().getDeviceFor(*this)->get_device();
+
+    profiles.setProfileDir("tuning_profile_test");
+
+    KernelTuning tuning;
+    tuning.work_group_size = 32;
+    tuning.tile_size = 64;
+    tuning.unroll = 2;
+    profiles.set(device, "ProfileTestKernel", tuning);
+    profiles.save(device);
+
+    // reload from file
+    profiles.setProfileDir("tuning_profile_test");
+
+    KernelTuning loaded;
+    ASSERT_TRUE(profiles.find(device, "ProfileTestKernel", loaded));
+    EXPECT_EQ(32u, loaded.work_group_size);
+    EXPECT_EQ(64u, loaded.tile_size);
+    EXPECT_EQ(2u, loaded.unroll);
+
+    ASSERT_FALSE(profiles.find(device, "UnknownKernel", loaded));
+
+    profiles.setProfileDir("");
+}
+
+TEST(opencl_platform, autotune_simple)
+{
+    std::vector<Molecule> ref_mol = generate_random_molecules_vector(512);
+
+    ParticleSystemConfig conf;
+    NativeParticleSystem native = md::legacy::convertToNativeSystem(ref_mol, conf);
+
+    OpenCLConfig ocl_conf;
+    ocl_conf.lj_kernel = std::string("simple");
+
+    OpenCLParticleSystem cl_sys;
+    cl_sys.setOpenCLConfig(ocl_conf);
+    cl_sys.fromNative(native);
+
+    std::stringstream log;
+    OpenCLAutotuner(cl_sys, 1).run(log);
+
+    const cl::Device& device = OpenCLDispatcher::Instance().getDeviceFor(*this)->get_device();
+    KernelTuning tuning;
+    EXPECT_TRUE(OpenCLTuningProfiles::Instance().find(device, "LennardJonesInteraction", tuning)) << log.str();
+
+    // tuned kernel gives the same forces
+    native.applyLennardJonesInteraction();
+    cl_sys.applyLennardJonesInteraction();
+
+    md::float3vec accel = cl_sys.accel().to_native();
+    for (size_t i = 0; i < accel.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            float expected = native.accel()[i][c];
+            ASSERT_NEAR(expected, accel[i][c], 1e-3 * std::max(1.0f, std::abs(expected))) << "particle " << i;
+        }
+    }
+
+    OpenCLTuningProfiles::Instance().erase(device, "LennardJonesInteraction");
+}
+
+TEST(opencl_platform, profiler)
+{
+    OpenCLProfiler& profiler = OpenCLProfiler::Instance();
+    profiler.reset();
+    profiler.setEnabled(true);
+    profiler.setTimeline(true);
+
+    // queue of a device created after profiler is enabled has profiling on
+    const OpenCLContext& context = OpenCLManager::Instance().getContext();
+    std::shared_ptr<OpenCLDevice> device = std::make_shared<OpenCLDevice>(context.context(), context.device());
+
+    const size_t num = 1000;
+    cl::Buffer pos(context.context(), cl::default_mem_flags, sizeof(cl_float3) * num);
+    cl::Buffer pos_prev(context.context(), cl::default_mem_flags, sizeof(cl_float3) * num);
+    cl::Buffer accel(context.context(), cl::default_mem_flags, sizeof(cl_float3) * num);
+
+    VerletIntegrationKernel verlet;
+    verlet.set_device(device);
+    for (int i = 0; i < 3; i++) {
+        verlet.enqueue(pos, pos_prev, accel, num, 0.001f);
+    }
+
+    std::vector<cl_float3> host(num);
+    cl::Event read;
+    device->get_queue().enqueueReadBuffer(pos, CL_TRUE, 0, sizeof(cl_float3) * num, &host[0], NULL, &read);
+    profiler.record("read:test", read);
+
+    profiler.collect();
+    profiler.setEnabled(false);
+
+    std::map<std::string, OpenCLProfiler::Stats> stats = profiler.stats();
+    ASSERT_EQ(1, stats.count("VerletIntegration"));
+    EXPECT_EQ(3, stats["VerletIntegration"].count);
+    EXPECT_LE(stats["VerletIntegration"].min_ns, stats["VerletIntegration"].max_ns);
+    EXPECT_LE(stats["VerletIntegration"].max_ns, stats["VerletIntegration"].total_ns);
+    ASSERT_EQ(1, stats.count("read:test"));
+
+    std::vector<OpenCLProfiler::Record> timeline = profiler.timeline();
+    ASSERT_EQ(4, timeline.size());
+    for (auto& rec : timeline) {
+        EXPECT_LE(rec.queued, rec.submit);
+        EXPECT_LE(rec.submit, rec.start);
+        EXPECT_LE(rec.start, rec.end);
+        EXPECT_EQ(0, rec.queue);
+    }
+
+    std::stringstream json, csv, trace;
+    profiler.writeJson(json);
+    profiler.writeCsv(csv);
+    profiler.writeTimeline(trace);
+    EXPECT_NE(std::string::npos, json.str().find("\"name\": \"VerletIntegration\", \"count\": 3"));
+    EXPECT_NE(std::string::npos, csv.str().find("VerletIntegration,3,"));
+    EXPECT_NE(std::string::npos, trace.str().find("\"traceEvents\""));
+
+    // disabled profiler ignores commands
+    profiler.record("read:test", read);
+    profiler.collect();
+    EXPECT_EQ(1, profiler.stats()["read:test"].count);
+
+    profiler.reset();
+    profiler.setTimeline(false);
+}
+
+TEST(opencl_platform, device_selection)
+{
+    OpenCLConfig conf;
+    std::vector<cl::Device> devices = OpenCLContext::FindDevices(conf);
+    ASSERT_FALSE(devices.empty());
+
+    conf.device_index = devices.size() - 1;
+    EXPECT_EQ(devices.back()(), OpenCLContext::SelectDevice(conf)());
+
+    conf.device_index = devices.size();
+    EXPECT_THROW(OpenCLContext::SelectDevice(conf), std::runtime_error);
+
+    conf.device_index = 0;
+    conf.device_vendor = std::string("no such vendor");
+    EXPECT_THROW(OpenCLContext::FindDevices(conf), std::runtime_error);
+}
+
+void multi_device_iterate_reference(size_t num, size_t iterations, const OpenCLConfig& ocl_conf)
+{
+    std::vector<Molecule> ref_mol = generate_random_molecules_vector(num);
+
+    ParticleSystemConfig conf;
+    conf.dt = 0.00001;
+
+    NativeParticleSystem native = md::legacy::convertToNativeSystem(ref_mol, conf);
+    OpenCLMultiDeviceParticleSystem multi_sys(conf);
+    multi_sys.setOpenCLConfig(ocl_conf);
+    multi_sys.loadParticles(md::float3vec(native.pos()), md::float3vec(native.pos_prev()),
+                            md::float3vec(native.vel()), md::float3vec(native.accel()));
+
+    size_t callbacks = 0;
+    multi_sys.registerOnIterationCb([&](ParticleSystem*, size_t) { callbacks++; });
+
+    native.iterate(iterations);
+    multi_sys.iterate(iterations);
+
+    EXPECT_EQ(iterations, callbacks);
+    for (size_t i = 0; i < num; i++) {
+        for (int c = 0; c < 3; c++) {
+            float expected = native.pos()[i][c];
+            ASSERT_NEAR(expected, multi_sys.pos()[i][c], 1e-4 * std::max(1.0f, std::abs(expected)))
+                << "particle " << i;
+
+            expected = native.pos_prev()[i][c];
+            ASSERT_NEAR(expected, multi_sys.pos_prev()[i][c], 1e-4 * std::max(1.0f, std::abs(expected)))
+                << "particle " << i;
+        }
+    }
+}
+
+TEST(opencl_platform, multi_device_iterate_reference)
+{
+    OpenCLConfig ocl_conf;
+    multi_device_iterate_reference(256, 5, ocl_conf);
+}
+
+TEST(opencl_platform, sub_devices_iterate_reference)
+{
+    OpenCLConfig ocl_conf;
+    cl::Device device = OpenCLContext::SelectDevice(ocl_conf);
+    if (device.getInfo<CL_DEVICE_PARTITION_MAX_SUB_DEVICES>() < 2) {
+        std::cout << "device can not be partitioned, skipped" << std::endl;
+        return;
+    }
+
+    ocl_conf.device_count = 1;
+    ocl_conf.sub_devices = std::string("equally");
+    ocl_conf.sub_device_units = (device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() + 1) / 2;
+
+    OpenCLMultiDeviceParticleSystem multi_sys;
+    multi_sys.setOpenCLConfig(ocl_conf);
+    EXPECT_LE(2, multi_sys.devicesNum());
+
+    multi_device_iterate_reference(256, 5, ocl_conf);
 }
@@ -0,0 +1,117 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+#include <utils/sweep.hpp>
+
+#include "utils.hpp"
+
+TEST(sweep, parse_list)
+{
+    SweepRange range = SweepRange::parse("sigma=0.1,0.2,0.3");
+
+    ASSERT_EQ("sigma", range.entry);
+    EXPECT_CONTAINERS_EQUAL(std::vector<std::string>({ "0.1", "0.2", "0.3" }), range.values);
+}
+
+TEST(sweep, parse_integer_range)
+{
+    SweepRange range = SweepRange::parse("particles_num=100:500:200");
+
+    ASSERT_EQ("particles_num", range.entry);
+    EXPECT_CONTAINERS_EQUAL(std::vector<std::string>({ "100", "300", "500" }), range.values);
+}
+
+TEST(sweep, parse_float_range)
+{
+    SweepRange range = SweepRange::parse("dt=0.001:0.003:0.001");
+
+    ASSERT_EQ(3, range.values.size());
+    ASSERT_FLOAT_EQ(0.001, std::stod(range.values[0]));
+    ASSERT_FLOAT_EQ(0.002, std::stod(range.values[1]));
+    ASSERT_FLOAT_EQ(0.003, std::stod(range.values[2]));
+}
+
+TEST(sweep, parse_neg)
+{
+    ASSERT_THROW(SweepRange::parse("dt"), SweepError);
+    ASSERT_THROW(SweepRange::parse("dt="), SweepError);
+    ASSERT_THROW(SweepRange::parse("dt=1:2"), SweepError);
+    ASSERT_THROW(SweepRange::parse("dt=2:1:1"), SweepError);
+    ASSERT_THROW(SweepRange::parse("dt=a:b:c"), SweepError);
+}
+
+TEST(sweep, points)
+{
+    Sweep sweep;
+    sweep.addRange(SweepRange::parse("dt=1,2"));
+    sweep.addRange(SweepRange::parse("eps=3,4,5"));
+
+    std::vector<SweepPoint> points = sweep.points();
+    ASSERT_EQ(6, points.size());
+
+    ASSERT_EQ("1", points[0][0].second);
+    ASSERT_EQ("3", points[0][1].second);
+    ASSERT_EQ("1", points[2][0].second);
+    ASSERT_EQ("5", points[2][1].second);
+    ASSERT_EQ("2", points[5][0].second);
+    ASSERT_EQ("5", points[5][1].second);
+}
+
+TEST(sweep, scheduler_no_oversubscription)
+{
+    Sweep sweep;
+    sweep.addRange(SweepRange::parse("particles_num=1:12:1"));
+
+    SweepScheduler scheduler(2, 6);
+    ASSERT_EQ(3, scheduler.workers());
+
+    std::atomic<size_t> running(0);
+    std::atomic<size_t> max_running(0);
+    std::atomic<size_t> runs(0);
+
+    std::stringstream csv;
+    scheduler.run(sweep, [&](size_t /*run*/, const SweepPoint& /*point*/, size_t cores) {
+        ASSERT_EQ(2, cores);
+
+        size_t now = ++running;
+        for (size_t prev = max_running; now > prev && !max_running.compare_exchange_weak(prev, now); ) {
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        --running;
+        ++runs;
+    }, csv);
+
+    ASSERT_EQ(12, runs);
+    ASSERT_LE(max_running, 3);
+
+    size_t lines = 0;
+    for (std::string line; std::getline(csv, line); ) {
+        lines++;
+    }
+    ASSERT_EQ(13, lines);
+}
+
+TEST(sweep, scheduler_failed_run)
+{
+    Sweep sweep;
+    sweep.addRange(SweepRange::parse("dt=1"));
+
+    SweepScheduler scheduler(1, 1);
+
+    std::stringstream csv;
+    scheduler.run(sweep, [&](size_t /*run*/, const SweepPoint& /*point*/, size_t /*cores*/) {
+        throw std::runtime_error("bad run, really");
+    }, csv);
+
+    std::string header, row;
+    std::getline(csv, header);
+    std::getline(csv, row);
+
+    ASSERT_EQ("run,dt,seconds,status", header);
+    ASSERT_NE(std::string::npos, row.find("bad run; really"));
+}
@@ -1,9 +1,18 @@
 #include "gtest/gtest.h"
 
+#include <cmath>
+#include <fstream>
+#include <sstream>
 #include <stdexcept>
+#include <thread>
 
 #include <utils/trace.hpp>
 #include <utils/stream.hpp>
+#include <utils/mapped_trace.hpp>
+#include <utils/trace_codec.hpp>
+#include <utils/trace_selection.hpp>
+#include <utils/frame_ring.hpp>
+#include <utils/config/config_manager.hpp>
 #include <platforms/native/native_platform.hpp>
 
 #include "utils.hpp"
@@ -17,7 +26,713 @@ TEST(trace, simple)
     p_sys.invokeOnIteration(1);
 }
 
-TEST(trace, bytestream)
+static NativeParticleSystem make_trace_system(size_t num)
 {
-    
+    float3vec pos(num), pos_prev(num), vel(num), accel(num);
+    for (size_t i = 0; i < num; i++) {
+        pos[i] = float3(i, i, i);
+    }
+
+    NativeParticleSystem p_sys;
+    p_sys.loadParticles(std::move(pos), std::move(pos_prev), std::move(vel), std::move(accel));
+    return p_sys;
+}
+
+static size_t count_lines(std::string filename)
+{
+    std::ifstream ifs(filename);
+    size_t lines = 0;
+    for (std::string line; std::getline(ifs, line); ) {
+        lines++;
+    }
+    return lines;
+}
+
+TEST(trace, async_block)
+{
+    NativeParticleSystem p_sys = make_trace_system(8);
+
+    TraceConfig conf;
+    conf.enabled = true;
+    conf.filename = std::string("trace_test_async_block.trace");
+    conf.frames_pool = 2;
+
+    {
+        TraceCollector trace(conf);
+        trace.attach(p_sys);
+
+        for (size_t i = 1; i <= 10; i++) {
+            p_sys.invokeOnIteration(i);
+        }
+
+        trace.flush();
+        ASSERT_EQ(0, trace.droppedFrames());
+    }
+
+    ASSERT_EQ(10 * 8, count_lines("trace_test_async_block.trace"));
+}
+
+TEST(trace, async_drop)
+{
+    NativeParticleSystem p_sys = make_trace_system(8);
+
+    TraceConfig conf;
+    conf.enabled = true;
+    conf.filename = std::string("trace_test_async_drop.trace");
+    conf.frames_pool = 1;
+    conf.backpressure = std::string("drop");
+
+    size_t dropped = 0;
+    {
+        TraceCollector trace(conf);
+        trace.attach(p_sys);
+
+        for (size_t i = 1; i <= 100; i++) {
+            p_sys.invokeOnIteration(i);
+        }
+
+        trace.flush();
+        dropped = trace.droppedFrames();
+    }
+
+    ASSERT_EQ((100 - dropped) * 8, count_lines("trace_test_async_drop.trace"));
+}
+
+TEST(trace, sync)
+{
+    NativeParticleSystem p_sys = make_trace_system(8);
+
+    TraceConfig conf;
+    conf.enabled = true;
+    conf.async = false;
+    conf.filename = std::string("trace_test_sync.trace");
+
+    {
+        TraceCollector trace(conf);
+        trace.attach(p_sys);
+
+        for (size_t i = 1; i <= 3; i++) {
+            p_sys.invokeOnIteration(i);
+        }
+    }
+
+    ASSERT_EQ(3 * 8, count_lines("trace_test_sync.trace"));
+}
+
+TEST(trace, destroyed_collector)
+{
+    NativeParticleSystem p_sys = make_trace_system(8);
+
+    TraceConfig conf;
+    conf.enabled = true;
+    conf.async = false;
+    conf.iterations_threshold = 2;
+    conf.filename = std::string("trace_test_destroyed.trace");
+
+    {
+        TraceCollector trace(conf);
+        trace.attach(p_sys);
+        p_sys.invokeOnIteration(2);
+    }
+
+    // callback of the destroyed collector is dropped, so is its interval
+    size_t invoked = 0;
+    p_sys.registerOnIterationCb([&](ParticleSystem*, size_t) { invoked++; }, 3);
+    p_sys.invokeOnIteration(4);
+
+    ASSERT_EQ(1u, invoked);
+    ASSERT_EQ(3u, p_sys.iterationCbInterval());
+    ASSERT_EQ(8, count_lines("trace_test_destroyed.trace"));
+}
+
+static TraceConfig binary_trace_config(std::string filename, bool async)
+{
+    TraceConfig conf;
+    conf.enabled = true;
+    conf.async = async;
+    conf.binary_file = true;
+    conf.filename = filename;
+    conf.iterations_threshold = 2;
+    return conf;
+}
+
+static void check_binary_trace(std::string filename)
+{
+    TraceConfig conf = binary_trace_config(filename, false);
+    ParticleIStreamPtr is = StreamFactory::Instance()->MakeTraceIStream(conf);
+    ByteIStream& trace = dynamic_cast<ByteIStream&>(*is);
+
+    ASSERT_EQ(5, trace.frames());
+    ASSERT_EQ(8, trace.particles());
+    ASSERT_EQ(float3(2, 3, 4), trace.area());
+
+    for (size_t frame = 0; frame < trace.frames(); frame++) {
+        ASSERT_EQ(2 * (frame + 1), trace.iteration(frame));
+    }
+
+    for (size_t frame = 0; frame < trace.frames(); frame++) {
+        for (size_t i = 0; i < trace.particles(); i++) {
+            float3 pos, vel, accel;
+            trace.Read(pos, vel, accel);
+            ASSERT_TRUE(trace.good());
+            ASSERT_EQ(float3(i, i, i), pos);
+            ASSERT_EQ(float3(0), vel);
+        }
+    }
+
+    float3 pos(-1), vel, accel;
+    trace.Read(pos, vel, accel);
+    ASSERT_FALSE(trace.good());
+    ASSERT_EQ(float3(-1), pos);
+
+    trace.seekFrame(3);
+    trace.Read(pos, vel, accel);
+    trace.Read(pos, vel, accel);
+    ASSERT_TRUE(trace.good());
+    ASSERT_EQ(float3(1, 1, 1), pos);
+}
+
+static void write_binary_trace(std::string filename, bool async)
+{
+    ParticleSystemConfig psys_conf;
+    psys_conf.area_size = float3(2, 3, 4);
+
+    NativeParticleSystem p_sys(psys_conf);
+    float3vec pos(8), pos_prev(8), vel(8), accel(8);
+    for (size_t i = 0; i < pos.size(); i++) {
+        pos[i] = float3(i, i, i);
+    }
+    p_sys.loadParticles(std::move(pos), std::move(pos_prev), std::move(vel), std::move(accel));
+
+    TraceCollector trace(binary_trace_config(filename, async));
+    trace.attach(p_sys);
+
+    for (size_t i = 1; i <= 10; i++) {
+        p_sys.invokeOnIteration(i);
+    }
+}
+
+TEST(trace, binary_sync)
+{
+    write_binary_trace("trace_test_binary_sync.trace", false);
+    check_binary_trace("trace_test_binary_sync.trace");
+}
+
+TEST(trace, binary_async)
+{
+    write_binary_trace("trace_test_binary_async.trace", true);
+    check_binary_trace("trace_test_binary_async.trace");
+
+    // header, 5 frames of iteration and 8 particles * (pos, vel, accel), index
+    std::ifstream ifs("trace_test_binary_async.trace", std::ios::binary | std::ios::ate);
+    ASSERT_EQ(64 + 5 * (8 + 8 * 3 * 3 * 4) + 5 * 16, static_cast<size_t>(ifs.tellg()));
+}
+
+TEST(trace, binary_ignore_and_unfinished)
+{
+    {
+        ByteOStream os("trace_test_binary_ignore.trace");
+        os.setIgnore(StreamIgnore::IGNORE_VEL | StreamIgnore::IGNORE_ACCEL);
+        for (size_t frame = 0; frame < 3; frame++) {
+            for (size_t i = 0; i < 4; i++) {
+                os.Write(float3(frame, i, 0), float3(1), float3(2));
+            }
+            os.endFrame(frame);
+        }
+
+        // wrong particle count
+        os.Write(float3(0), float3(0), float3(0));
+        ASSERT_THROW(os.endFrame(3), std::runtime_error);
+    }
+
+    ByteIStream is("trace_test_binary_ignore.trace");
+    ASSERT_EQ(3, is.frames());
+    ASSERT_EQ(binary_trace_pos, is.header().fields);
+
+    is.seekFrame(2);
+    float3 pos, vel(5), accel(5);
+    is.Read(pos, vel, accel);
+    ASSERT_EQ(float3(2, 0, 0), pos);
+    ASSERT_EQ(float3(5), vel);
+    ASSERT_EQ(float3(5), accel);
+
+    // trace without index, e.g. of a killed run
+    {
+        std::fstream fs("trace_test_binary_ignore.trace", std::ios::binary | std::ios::in | std::ios::out);
+        BinaryTraceHeader header;
+        fs.read(reinterpret_cast<char*>(&header), sizeof(header));
+        header.frames = 0;
+        header.index_offset = 0;
+        fs.seekp(0);
+        fs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    ByteIStream unfinished("trace_test_binary_ignore.trace");
+    // index entries look like a part of incomplete frame
+    ASSERT_EQ(3, unfinished.frames());
+    ASSERT_EQ(1, unfinished.iteration(1));
+}
+
+TEST(trace, mapped)
+{
+    write_binary_trace("trace_test_mapped.trace", true);
+
+    MappedTrace trace("trace_test_mapped.trace");
+    ASSERT_EQ(5, trace.frames());
+    ASSERT_EQ(8, trace.particles());
+    ASSERT_EQ(float3(2, 3, 4), trace.area());
+
+    MappedTrace::Frame frame = trace.frame(4);
+    ASSERT_EQ(10, frame.iteration());
+    ASSERT_EQ(8, frame.size());
+    for (size_t i = 0; i < frame.size(); i++) {
+        ASSERT_EQ(float3(i, i, i), frame.pos()[i]);
+        ASSERT_EQ(float3(0), frame.vel()[i]);
+        ASSERT_EQ(float3(0), frame.accel()[i]);
+    }
+
+    ASSERT_THROW(trace.frame(5), std::out_of_range);
+
+    std::vector<size_t> iterations;
+    for (MappedTrace::Frame f : trace.range(1, 5, 2)) {
+        iterations.push_back(f.iteration());
+    }
+    ASSERT_EQ(std::vector<size_t>({ 4, 8 }), iterations);
+    ASSERT_EQ(2, trace.range(1, 5, 2).size());
+    ASSERT_EQ(5, trace.all().size());
+
+    trace.adviseSequential();
+    trace.willNeed(0, 5);
+    trace.dontNeed(0, 5);
+
+    ASSERT_THROW(MappedTrace("trace_test_sync.trace"), MappedTraceError);
+}
+
+TEST(trace, codec)
+{
+    const size_t values = 3 * 1000;
+    const float quantum = 1e-3f;
+
+    std::vector<float> frame(values);
+    for (size_t i = 0; i < values; i++) {
+        frame[i] = 0.37f * i;
+    }
+
+    // small blocks to run several of them
+    TraceFrameCodec encoder(quantum, values, 256);
+    TraceFrameCodec decoder(quantum, values, 256);
+    std::vector<uint8_t> encoded;
+    std::vector<float> decoded(values);
+
+    for (size_t step = 0; step < 5; step++) {
+        bool keyframe = encoder.encode(frame.data(), false, encoded);
+        ASSERT_EQ(step == 0, keyframe);
+
+        decoder.decode(encoded.data(), encoded.size(), keyframe, decoded.data());
+        for (size_t i = 0; i < values; i++) {
+            ASSERT_NEAR(frame[i], decoded[i], quantum / 2 + 1e-6f * std::fabs(frame[i]));
+        }
+
+        for (size_t i = 0; i < values; i++) {
+            frame[i] += 0.01f * (i % 7);
+        }
+    }
+
+    // only the low byte plane of delta frames is not a zero run
+    ASSERT_LT(encoded.size(), values * sizeof(float) / 3);
+
+    encoded.back() ^= 0xff;
+    encoded.pop_back();
+    ASSERT_THROW(decoder.decode(encoded.data(), encoded.size(), false, decoded.data()), TraceCodecError);
+
+    frame[0] = 1e10f;
+    ASSERT_THROW(encoder.encode(frame.data(), false, encoded), TraceCodecError);
+}
+
+TEST(trace, binary_quantized)
+{
+    const size_t particles = 64;
+    const float quantum = 1e-4f;
+
+    {
+        ByteOStream os("trace_test_binary_quantized.trace");
+        os.setIgnore(StreamIgnore::IGNORE_ACCEL);
+        os.setQuantization(quantum, 4);
+        for (size_t frame = 0; frame < 10; frame++) {
+            for (size_t i = 0; i < particles; i++) {
+                os.Write(float3(i * 0.01f + frame * 1e-3f, 0.5f, -0.25f * frame), float3(frame * 0.1f), float3(7));
+            }
+            os.endFrame(frame * 10);
+        }
+    }
+
+    std::ifstream ifs("trace_test_binary_quantized.trace", std::ios::binary | std::ios::ate);
+    ASSERT_LT(static_cast<size_t>(ifs.tellg()), 10 * particles * 2 * sizeof(float3) / 3);
+
+    TraceConfig conf = binary_trace_config("trace_test_binary_quantized.trace", false);
+    ParticleIStreamPtr is = StreamFactory::Instance()->MakeTraceIStream(conf);
+    ByteIStream& trace = dynamic_cast<ByteIStream&>(*is);
+    ASSERT_EQ(10, trace.frames());
+    ASSERT_EQ(binary_trace_quantized, trace.header().codec);
+
+    // sequential, then random access into delta frames
+    size_t frames[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 7, 2, 9 };
+    for (size_t frame : frames) {
+        trace.seekFrame(frame);
+        ASSERT_EQ(frame * 10, trace.iteration(frame));
+        for (size_t i = 0; i < particles; i++) {
+            float3 pos, vel, accel(-1);
+            trace.Read(pos, vel, accel);
+            ASSERT_TRUE(trace.good());
+            ASSERT_NEAR(i * 0.01f + frame * 1e-3f, pos.x, quantum);
+            ASSERT_NEAR(0.5f, pos.y, quantum);
+            ASSERT_NEAR(-0.25f * frame, pos.z, quantum);
+            ASSERT_NEAR(frame * 0.1f, vel.x, quantum);
+            ASSERT_EQ(float3(-1), accel);
+        }
+    }
+
+    ASSERT_THROW(MappedTrace("trace_test_binary_quantized.trace"), MappedTraceError);
+}
+
+static std::string read_file(std::string filename)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+TEST(trace, frame_api)
+{
+    const size_t num = 10;
+    float3vec pos(num), vel(num), accel(num);
+    std::vector<cl_float3> cl_pos(num), cl_vel(num);
+    for (size_t i = 0; i < num; i++) {
+        pos[i] = float3(i, i + 0.5f, -1.0f * i);
+        vel[i] = float3(0.25f * i);
+        accel[i] = float3(1e-3f * i);
+        for (size_t k = 0; k < 3; k++) {
+            cl_pos[i].s[k] = pos[i][k];
+            cl_vel[i].s[k] = vel[i][k];
+        }
+    }
+
+    // frame API writes the same as per particle calls
+    {
+        TextOStream by_particle("trace_test_frame_api_particle.txt");
+        TextOStream by_frame("trace_test_frame_api_frame.txt");
+        TextOStream by_cl_frame("trace_test_frame_api_cl_frame.txt");
+        by_particle.setIgnore(StreamIgnore::IGNORE_ACCEL);
+        by_frame.setIgnore(StreamIgnore::IGNORE_ACCEL);
+        by_cl_frame.setIgnore(StreamIgnore::IGNORE_ACCEL);
+
+        for (size_t i = 0; i < num; i++) {
+            by_particle.Write(pos[i], vel[i], accel[i]);
+        }
+        by_frame.WriteFrame(pos.data(), vel.data(), nullptr, num);
+        by_cl_frame.WriteFrame(cl_pos.data(), cl_vel.data(), nullptr, num);
+    }
+
+    std::string expected = read_file("trace_test_frame_api_particle.txt");
+    ASSERT_EQ(expected, read_file("trace_test_frame_api_frame.txt"));
+    ASSERT_EQ(expected, read_file("trace_test_frame_api_cl_frame.txt"));
+
+    {
+        ByteOStream by_particle("trace_test_frame_api_particle.trace");
+        ByteOStream by_frame("trace_test_frame_api_frame.trace");
+        for (size_t frame = 0; frame < 2; frame++) {
+            for (size_t i = 0; i < num; i++) {
+                by_particle.Write(pos[i], vel[i], accel[i]);
+            }
+            by_particle.endFrame(frame);
+            by_frame.WriteFrame(pos.data(), vel.data(), accel.data(), num);
+            by_frame.endFrame(frame);
+        }
+    }
+
+    ASSERT_EQ(read_file("trace_test_frame_api_particle.trace"), read_file("trace_test_frame_api_frame.trace"));
+
+    // reads may span frames
+    ByteIStream is("trace_test_frame_api_frame.trace");
+    is.setIgnore(StreamIgnore::IGNORE_VEL);
+    float3vec read_pos(2 * num), read_accel(2 * num);
+    is.ReadFrame(read_pos.data(), nullptr, read_accel.data(), 3);
+    is.ReadFrame(read_pos.data() + 3, nullptr, read_accel.data() + 3, 2 * num - 3);
+    ASSERT_TRUE(is.good());
+    for (size_t i = 0; i < 2 * num; i++) {
+        ASSERT_EQ(pos[i % num], read_pos[i]);
+        ASSERT_EQ(accel[i % num], read_accel[i]);
+    }
+
+    TextIStream text_is("trace_test_frame_api_frame.txt");
+    text_is.setIgnore(StreamIgnore::IGNORE_ACCEL);
+    std::vector<cl_float3> text_pos(num), text_vel(num);
+    text_is.ReadFrame(text_pos.data(), text_vel.data(), nullptr, num);
+    ASSERT_TRUE(text_is.good());
+    for (size_t i = 0; i < num; i++) {
+        ASSERT_FLOAT_EQ(pos[i].y, text_pos[i].s[1]);
+        ASSERT_FLOAT_EQ(vel[i].z, text_vel[i].s[2]);
+    }
+}
+
+TEST(trace, text_parallel)
+{
+    // several formatting and parsing blocks
+    const size_t num = 10000;
+    float3vec pos(num), vel(num), accel(num);
+    for (size_t i = 0; i < num; i++) {
+        pos[i] = float3(0.1f * i, 1e-7f * i, -1e7f * i);
+        vel[i] = float3(1.0f / (i + 1));
+        accel[i] = float3(-0.5f * i);
+    }
+
+    // same text as formatted by iostreams
+    {
+        TextOStream os("trace_test_text_parallel.txt");
+        os.WriteFrame(pos.data(), vel.data(), accel.data(), num);
+    }
+
+    std::ostringstream expected;
+    for (size_t i = 0; i < num; i++) {
+        for (size_t k = 0; k < 3; k++) {
+            expected << pos[i][k] << " ";
+        }
+        for (size_t k = 0; k < 3; k++) {
+            expected << vel[i][k] << " ";
+        }
+        for (size_t k = 0; k < 3; k++) {
+            expected << accel[i][k] << " ";
+        }
+        expected << "\n";
+    }
+    ASSERT_EQ(expected.str(), read_file("trace_test_text_parallel.txt"));
+
+    TextIStream is("trace_test_text_parallel.txt");
+    float3vec read_pos(num), read_vel(num), read_accel(num);
+    is.ReadFrame(read_pos.data(), read_vel.data(), read_accel.data(), num);
+    ASSERT_TRUE(is.good());
+
+    // same values as parsed by iostreams
+    std::istringstream expected_is(expected.str());
+    for (size_t i = 0; i < num; i++) {
+        float values[9];
+        for (size_t k = 0; k < 9; k++) {
+            expected_is >> values[k];
+        }
+        for (size_t k = 0; k < 3; k++) {
+            ASSERT_EQ(values[k], read_pos[i][k]);
+            ASSERT_EQ(values[3 + k], read_vel[i][k]);
+            ASSERT_EQ(values[6 + k], read_accel[i][k]);
+        }
+    }
+
+    // reading past the end fails
+    is.ReadFrame(read_pos.data(), read_vel.data(), read_accel.data(), 1);
+    ASSERT_FALSE(is.good());
+
+    // values not laid out one particle per line
+    {
+        std::ofstream os("trace_test_text_parallel_layout.txt");
+        os << "1 2\n 3 4 5 6\n\n7 8 9 10 11 12";
+    }
+
+    TextIStream layout_is("trace_test_text_parallel_layout.txt");
+    layout_is.setIgnore(StreamIgnore::IGNORE_ACCEL);
+    std::vector<cl_float3> layout_pos(2), layout_vel(2);
+    layout_is.ReadFrame(layout_pos.data(), layout_vel.data(), nullptr, 2);
+    ASSERT_TRUE(layout_is.good());
+    for (size_t i = 0; i < 2; i++) {
+        for (size_t k = 0; k < 3; k++) {
+            ASSERT_EQ(6.0f * i + k + 1, layout_pos[i].s[k]);
+            ASSERT_EQ(6.0f * i + k + 4, layout_vel[i].s[k]);
+        }
+    }
+
+    ASSERT_FALSE(TextIStream("trace_test_text_parallel_missing.txt").good());
+}
+
+TEST(trace, selection)
+{
+    NativeParticleSystem p_sys = make_trace_system(100);
+
+    std::istringstream iss("[TraceSelectionConfig]\n"
+                           "label \"sparse\"\n"
+                           "filename \"trace_test_selection_replaced.trace\"\n"
+                           "[TraceSelectionConfig]\n"
+                           "label \"box\"\n"
+                           "filename \"trace_test_selection_box.trace\"\n"
+                           "iterations_threshold 2\n"
+                           "region \"box\"\n"
+                           "box_min 20 20 20\n"
+                           "box_max 30 30 30\n"
+                           "[TraceSelectionConfig]\n"
+                           "label \"sparse\"\n"
+                           "filename \"trace_test_selection_sparse.trace\"\n"
+                           "binary_file 1\n"
+                           "id_begin 10\n"
+                           "id_end 50\n"
+                           "id_stride 10\n"
+                           "vel 0\n"
+                           "accel 0\n");
+    ConfigManager conf_man;
+    conf_man.loadFromStream(iss);
+
+    // later section replaces the one with the same label
+    std::vector<TraceSelectionConfig> selections = conf_man.getTraceSelectionConfigs();
+    ASSERT_EQ(2u, selections.size());
+    ASSERT_EQ("trace_test_selection_sparse.trace", selections[0].filename.value());
+
+    {
+        TraceCollector sparse(TraceConfig(), selections[0]);
+        sparse.attach(p_sys);
+
+        TraceConfig sync;
+        sync.async = false;
+        TraceCollector box(sync, selections[1]);
+        box.attach(p_sys);
+
+        for (size_t i = 1; i <= 4; i++) {
+            p_sys.invokeOnIteration(i);
+        }
+
+        sparse.flush();
+    }
+
+    ByteIStream sparse("trace_test_selection_sparse.trace");
+    ASSERT_EQ(4u, sparse.frames());
+    ASSERT_EQ(4u, sparse.particles());
+    ASSERT_EQ(binary_trace_pos, sparse.header().fields);
+
+    float3vec pos(4), vel(4), accel(4);
+    sparse.ReadFrame(pos.data(), vel.data(), accel.data(), 4);
+    for (size_t i = 0; i < 4; i++) {
+        ASSERT_EQ(float3(10 * (i + 1)), pos[i]);
+    }
+
+    // particles 20 .. 29 at iterations 2 and 4
+    ASSERT_EQ(2 * 10, count_lines("trace_test_selection_box.trace"));
+
+    std::ifstream ids("trace_test_selection_box.trace.ids");
+    for (size_t frame = 1; frame <= 2; frame++) {
+        size_t iteration = 0, count = 0;
+        ids >> iteration >> count;
+        ASSERT_EQ(2 * frame, iteration);
+        ASSERT_EQ(10u, count);
+        for (size_t i = 0; i < count; i++) {
+            size_t id = 0;
+            ids >> id;
+            ASSERT_EQ(20 + i, id);
+        }
+    }
+
+    // sphere across periodic boundary
+    TraceSelectionConfig sphere_conf;
+    sphere_conf.region = std::string("sphere");
+    sphere_conf.sphere_radius = 2.0f;
+    sphere_conf.vel = false;
+
+    ParticleFrame frame, selected;
+    p_sys.snapshot(frame);
+    frame.iteration = 7;
+
+    TraceSelection sphere(sphere_conf);
+    sphere.setArea(float3(100), true);
+    sphere.apply(frame, selected);
+
+    ASSERT_EQ(7u, selected.iteration);
+    ASSERT_EQ(3u, selected.ids.size());
+    ASSERT_EQ(99u, selected.ids[2]);
+    ASSERT_EQ(3u, selected.pos.size());
+    ASSERT_TRUE(selected.vel.empty());
+    ASSERT_EQ(float3(99), selected.pos[2]);
+
+    sphere.setArea(float3(100), false);
+    sphere.apply(frame, selected);
+    ASSERT_EQ(2u, selected.ids.size());
+
+    std::istringstream binary_region("[TraceSelectionConfig]\n"
+                                     "filename \"trace_test_selection_invalid.trace\"\n"
+                                     "binary_file 1\n"
+                                     "region \"sphere\"\n"
+                                     "sphere_radius 1\n");
+    ASSERT_THROW(conf_man.loadFromStream(binary_region), ConfigError);
+}
+
+TEST(trace, frame_ring)
+{
+    NativeParticleSystem p_sys = make_trace_system(16);
+
+    FrameRingConfig conf;
+    conf.enabled = true;
+    conf.shm_name = std::string("/moldynam_trace_test_ring");
+    conf.slots = 2;
+    conf.iterations_threshold = 2;
+    conf.vel = true;
+
+    FrameRingPublisher publisher(conf);
+    publisher.attach(p_sys);
+
+    p_sys.invokeOnIteration(1);
+    p_sys.invokeOnIteration(2);
+    ASSERT_EQ(1u, publisher.published());
+
+    FrameRingReader reader(conf.shm_name);
+    ASSERT_EQ(16u, reader.capacity());
+    ASSERT_EQ(binary_trace_pos | binary_trace_vel, reader.fields());
+
+    ParticleFrame frame;
+    ASSERT_TRUE(reader.readLatest(frame));
+    ASSERT_EQ(2u, frame.iteration);
+    ASSERT_EQ(16u, frame.pos.size());
+    ASSERT_EQ(16u, frame.vel.size());
+    ASSERT_TRUE(frame.accel.empty());
+    ASSERT_EQ(float3(5), frame.pos[5]);
+
+    // nothing new
+    ASSERT_FALSE(reader.readLatest(frame));
+
+    // only the newest frame is read, older ones were overwritten
+    for (size_t i = 3; i <= 8; i++) {
+        p_sys.invokeOnIteration(i);
+    }
+    ASSERT_TRUE(reader.readLatest(frame));
+    ASSERT_EQ(8u, frame.iteration);
+
+    // stream repeats the last frame until a new one is published
+    FrameRingIStream is(conf.shm_name);
+    float3vec pos(16), vel(16), accel(16, float3(-1));
+    is.ReadFrame(pos.data(), vel.data(), accel.data(), 16);
+    ASSERT_TRUE(is.good());
+    ASSERT_EQ(float3(15), pos[15]);
+    ASSERT_EQ(float3(-1), accel[0]);
+
+    // readers never see a partially written frame
+    FrameRingWriter writer("/moldynam_trace_test_ring_concurrent", 2, 1000, binary_trace_pos, float3(1));
+    FrameRingReader concurrent("/moldynam_trace_test_ring_concurrent");
+
+    std::thread producer([&]() {
+        ParticleFrame published;
+        for (size_t i = 1; i <= 2000; i++) {
+            published.iteration = i;
+            published.pos.assign(1000, float3(i));
+            writer.publish(published);
+        }
+    });
+
+    size_t frames = 0;
+    while (frames == 0 || frame.iteration < 2000) {
+        if (!concurrent.readLatest(frame)) {
+            continue;
+        }
+
+        frames++;
+        ASSERT_EQ(1000u, frame.pos.size());
+        ASSERT_EQ(float3(frame.iteration), frame.pos.front());
+        ASSERT_EQ(float3(frame.iteration), frame.pos.back());
+    }
+    producer.join();
+
+    ASSERT_LE(1u, frames);
+    ASSERT_THROW(FrameRingReader("/moldynam_trace_test_ring_missing"), FrameRingError);
 }